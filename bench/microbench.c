@@ -0,0 +1,610 @@
+/**
+ * @file
+ * @brief Microbenchmarks de las primitivas del camino critico: sha256, el
+ * encuadre de los mensajes del protocolo y las consultas a versions.db
+ * @copyright MIT License
+ *
+ * Uso: microbench [-r REGISTROS,...] [-n ARCHIVOS] [-f FILTRO] [-b BASE | -w BASE] [-t UMBRAL]
+ *
+ * Cada caso se calibra para que una corrida dure al menos MIN_RUN_SECONDS y se
+ * repite REPEATS veces; se reporta la mejor corrida en ns por operacion (la
+ * menos afectada por interrupciones y otros procesos). Con -b se
+ * compara contra una linea base guardada y se termina con error si algun caso
+ * es mas lento que la base en mas de UMBRAL por ciento; -w guarda la linea base.
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../server/versions_server.h"
+#include "../common/sha256.h"
+
+#define REPEATS 5                   /**< Corridas por caso, se reporta la mejor */
+#define MIN_RUN_SECONDS 0.05        /**< Duracion minima de una corrida */
+#define MAX_CASES 64                /**< Casos que se pueden reportar */
+#define DB_CLIENTS 64               /**< Clientes entre los que se reparten los registros */
+#define DB_VERSIONS 4               /**< Versiones de cada archivo */
+#define DB_WRITE_RECORDS 256        /**< Registros por escritura al generar el .db */
+#define HASH_FILE_SIZE (64 << 20)   /**< Tamanio del archivo de sha256_hash_file_hex */
+#define MANY_MESSAGES 1024          /**< Mensajes por operacion de sha256_hash_many */
+#define SMALL_FILE_MIN 1024         /**< Tamanio minimo de los archivos pequenios */
+#define SMALL_FILE_MAX (16 << 10)   /**< Tamanio maximo de los archivos pequenios */
+
+struct thread_pool *workerPool = NULL; /**< Sin pool: las funciones del servidor trabajan en el hilo que llama */
+struct admission uploads;              /**< No se usa: no se miden subidas */
+
+/**
+ * @brief Resultado de un caso
+ */
+struct bench_case {
+	char name[64];   /**< Nombre, clave de la linea base */
+	double ns;       /**< ns por operacion de la mejor corrida */
+	double baseline; /**< ns por operacion de la linea base, 0 si no hay */
+};
+
+static struct bench_case cases[MAX_CASES];
+static int countCases = 0;
+static const char * filter = NULL;
+
+/**
+ * @brief Tiempo monotono en segundos
+ */
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compare_doubles(const void * a, const void * b) {
+	double x = *(const double *)a, y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Mide una funcion que hace iterations operaciones
+ * @param name nombre del caso
+ * @param run funcion a medir
+ * @param arg argumento de run
+ * @param bytes bytes procesados por operacion, 0 si no aplica
+ */
+static void measure(const char * name, void (*run)(void *, long), void * arg, size_t bytes) {
+	if(filter != NULL && strstr(name, filter) == NULL)
+		return;
+	//Calibracion: se duplican las iteraciones hasta que la corrida dure lo suficiente
+	long iterations = 1;
+	double elapsed;
+	while(1){
+		double start = now();
+		run(arg, iterations);
+		elapsed = now() - start;
+		if(elapsed >= MIN_RUN_SECONDS)
+			break;
+		iterations *= elapsed > 0 ? (MIN_RUN_SECONDS / elapsed > 2 ? 2 * MIN_RUN_SECONDS / elapsed : 2) : 2;
+	}
+	//Una operacion de mas de un segundo no se repite: la calibracion ya es la medida
+	double times[REPEATS];
+	int repeats = elapsed / iterations > 1.0 ? 1 : REPEATS;
+	times[0] = elapsed / iterations * 1e9;
+	for(int i = repeats > 1 ? 0 : 1; i < repeats; i++){
+		double start = now();
+		run(arg, iterations);
+		times[i] = (now() - start) / iterations * 1e9;
+	}
+	qsort(times, repeats, sizeof(double), compare_doubles);
+
+	struct bench_case * c = &cases[countCases < MAX_CASES ? countCases++ : MAX_CASES - 1];
+	snprintf(c->name, sizeof(c->name), "%s", name);
+	c->ns = times[0];
+	c->baseline = 0;
+	if(bytes > 0)
+		printf("%-32s %14.1f ns/op %10.3f GB/s\n", name, c->ns, bytes / c->ns);
+	else
+		printf("%-32s %14.1f ns/op\n", name, c->ns);
+	fflush(stdout);
+}
+
+/**
+ * @brief Sufijo de un caso segun una cantidad: 1000 es "1k", 1000000 es "1m"
+ */
+static void count_suffix(unsigned count, char * suffix, size_t size) {
+	if(count % 1000000 == 0)
+		snprintf(suffix, size, "%um", count / 1000000);
+	else if(count % 1000 == 0)
+		snprintf(suffix, size, "%uk", count / 1000);
+	else
+		snprintf(suffix, size, "%u", count);
+}
+
+/* ---------------------------------- sha256 --------------------------------- */
+
+/**
+ * @brief Datos de los casos de sha256
+ */
+struct sha_args {
+	char * data; /**< Buffer a resumir */
+	size_t size; /**< Bytes por operacion */
+	char path[PATH_MAX]; /**< Archivo de sha256_hash_file_hex */
+	const void * messages[MANY_MESSAGES]; /**< Mensajes de sha256_hash_many */
+	size_t sizes[MANY_MESSAGES];          /**< Tamanio de cada mensaje */
+	uint8_t * digests;                    /**< Resumenes de sha256_hash_many y de los archivos */
+	char ** paths;                        /**< Archivos pequenios */
+	char * hexes;                         /**< Resumen en hex de cada archivo pequenio */
+	unsigned files;                       /**< Archivos pequenios */
+};
+
+static void run_sha256_update(void * arg, long iterations) {
+	struct sha_args * args = arg;
+	struct sha256_buff buff;
+	sha256_init(&buff);
+	for(long i = 0; i < iterations; i++)
+		sha256_update(&buff, args->data, args->size);
+	sha256_finalize(&buff);
+}
+
+static void run_sha256_hash(void * arg, long iterations) {
+	struct sha_args * args = arg;
+	uint8_t hash[32];
+	for(long i = 0; i < iterations; i++)
+		sha256_hash(args->data, args->size, hash);
+}
+
+static void run_sha256_file(void * arg, long iterations) {
+	struct sha_args * args = arg;
+	char hex[HASH_SIZE];
+	for(long i = 0; i < iterations; i++)
+		sha256_hash_file_hex(args->path, hex);
+}
+
+static void run_sha256_many(void * arg, long iterations) {
+	struct sha_args * args = arg;
+	for(long i = 0; i < iterations; i++)
+		sha256_hash_many(args->messages, args->sizes, MANY_MESSAGES, args->digests);
+}
+
+static void run_sha256_files_serial(void * arg, long iterations) {
+	struct sha_args * args = arg;
+	for(long i = 0; i < iterations; i++)
+		for(unsigned f = 0; f < args->files; f++)
+			sha256_hash_file_hex(args->paths[f], args->hexes + f * 65);
+}
+
+static void run_sha256_files(void * arg, long iterations) {
+	struct sha_args * args = arg;
+	for(long i = 0; i < iterations; i++)
+		sha256_hash_files_hex(args->paths, args->files, args->hexes);
+}
+
+/**
+ * @brief Un add-dir de muchos archivos pequenios: uno por uno contra cada kernel
+ * multi-buffer. Los archivos quedan en la cache de paginas
+ */
+static void bench_sha256_files(struct sha_args * args, const char * dir, unsigned files) {
+	char suffix[32], name[64];
+	count_suffix(files, suffix, sizeof(suffix));
+	snprintf(name, sizeof(name), "_files_%s", suffix);
+	if(files == 0 || (filter != NULL && strstr("sha256_files", filter) == NULL && strstr(name, filter) == NULL))
+		return;
+	args->paths = calloc(files, sizeof(char *));
+	args->hexes = malloc((size_t)files * 65);
+	if(args->paths == NULL || args->hexes == NULL)
+		return;
+	size_t bytes = 0;
+	unsigned seed = files;
+	for(args->files = 0; args->files < files; args->files++){
+		char path[PATH_MAX];
+		size_t size = SMALL_FILE_MIN + rand_r(&seed) % (SMALL_FILE_MAX - SMALL_FILE_MIN + 1);
+		snprintf(path, sizeof(path), "%s/small-%u", dir, args->files);
+		FILE * fp = fopen(path, "wb");
+		if(fp == NULL || fwrite(args->data + args->files % 4096, 1, size, fp) != size || fclose(fp) != 0)
+			break;
+		args->paths[args->files] = strdup(path);
+		bytes += size;
+	}
+	if(args->files == files){
+		snprintf(name, sizeof(name), "sha256_files_serial_%s", suffix);
+		measure(name, run_sha256_files_serial, args, bytes);
+		for(int i = 0; sha256_multi_kernel_name(i) != NULL; i++){
+			if(sha256_set_multi_kernel(sha256_multi_kernel_name(i)) != 0)
+				continue;
+			snprintf(name, sizeof(name), "sha256_files_%s_%s", sha256_multi_kernel_name(i), suffix);
+			measure(name, run_sha256_files, args, bytes);
+		}
+		sha256_set_multi_kernel(NULL);
+	}
+	for(unsigned f = 0; f < args->files; f++){
+		unlink(args->paths[f]);
+		free(args->paths[f]);
+	}
+	free(args->paths);
+	free(args->hexes);
+}
+
+static void bench_sha256(const char * dir, unsigned files) {
+	struct sha_args args;
+	args.data = malloc(HASH_FILE_SIZE);
+	for(size_t i = 0; i < HASH_FILE_SIZE; i++)
+		args.data[i] = (char)(i * 2654435761u >> 13);
+
+	args.size = 1 << 20;
+	measure("sha256_update_1m", run_sha256_update, &args, args.size);
+	//Cada kernel que soporta este CPU; el por defecto es el que mide sha256_update_1m
+	char name[64];
+	for(int i = 0; sha256_kernel_name(i) != NULL; i++){
+		if(sha256_set_kernel(sha256_kernel_name(i)) != 0)
+			continue;
+		snprintf(name, sizeof(name), "sha256_kernel_%s_1m", sha256_kernel_name(i));
+		measure(name, run_sha256_update, &args, args.size);
+	}
+	sha256_set_kernel(NULL);
+	//Mensajes de 4k en los carriles de cada kernel multi-buffer
+	args.digests = malloc(MANY_MESSAGES * 32);
+	for(int i = 0; i < MANY_MESSAGES; i++){
+		args.messages[i] = args.data + (size_t)i * 4096;
+		args.sizes[i] = 4096;
+	}
+	for(int i = 0; args.digests != NULL && sha256_multi_kernel_name(i) != NULL; i++){
+		if(sha256_set_multi_kernel(sha256_multi_kernel_name(i)) != 0)
+			continue;
+		snprintf(name, sizeof(name), "sha256_many_%s_4k", sha256_multi_kernel_name(i));
+		measure(name, run_sha256_many, &args, (size_t)MANY_MESSAGES * 4096);
+	}
+	sha256_set_multi_kernel(NULL);
+	free(args.digests);
+	args.size = 64;
+	measure("sha256_hash_64", run_sha256_hash, &args, args.size);
+	args.size = 4096;
+	measure("sha256_hash_4k", run_sha256_hash, &args, args.size);
+
+	//El archivo queda en la cache de paginas: se mide la lectura y el resumen, no el disco
+	snprintf(args.path, sizeof(args.path), "%s/hash-file", dir);
+	FILE * fp = fopen(args.path, "wb");
+	if(fp != NULL && fwrite(args.data, 1, HASH_FILE_SIZE, fp) == HASH_FILE_SIZE && fclose(fp) == 0){
+		char hex[HASH_SIZE];
+		sha256_hash_file_hex(args.path, hex);
+		measure("sha256_hash_file_hex_64m", run_sha256_file, &args, HASH_FILE_SIZE);
+	}
+	unlink(args.path);
+	bench_sha256_files(&args, dir, files);
+	free(args.data);
+}
+
+/* --------------------------------- protocolo -------------------------------- */
+
+/**
+ * @brief Extremos de un socketpair: cada operacion envia por uno y recibe por el otro
+ */
+struct protocol_args {
+	int sender;   /**< Extremo que envia */
+	int receiver; /**< Extremo que recibe */
+};
+
+static void run_first_request(void * arg, long iterations) {
+	struct protocol_args * args = arg;
+	struct first_request request = { .request = GET, .idUser = 42 }, received;
+	for(long i = 0; i < iterations; i++){
+		send_first_request(args->sender, &request);
+		receive_first_request(args->receiver, &received);
+	}
+}
+
+static void run_file_request(void * arg, long iterations) {
+	struct protocol_args * args = arg;
+	struct file_request request, received;
+	memset(&request, 0, sizeof(request));
+	strcpy(request.nameFile, "src/module/file.c");
+	strcpy(request.hashFile, "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+	request.version = 3;
+	for(long i = 0; i < iterations; i++){
+		send_file_request(args->sender, &request);
+		receive_file_request(args->receiver, &received);
+	}
+}
+
+static void run_element_list(void * arg, long iterations) {
+	struct protocol_args * args = arg;
+	char element[SIZE_ELEMENT_LIST], received[SIZE_ELEMENT_LIST];
+	memset(element, 0, sizeof(element));
+	snprintf(element, sizeof(element), "3 src/module/file.c comentario  e3b0c");
+	for(long i = 0; i < iterations; i++){
+		send_element_list(args->sender, element);
+		receive_element_list(args->receiver, received);
+	}
+}
+
+static void run_status_code(void * arg, long iterations) {
+	struct protocol_args * args = arg;
+	return_code code;
+	for(long i = 0; i < iterations; i++){
+		send_status_code(args->sender, VERSION_ADDED);
+		receive_status_code(args->receiver, &code);
+	}
+}
+
+static void bench_protocol() {
+	int pair[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0){
+		perror("socketpair");
+		return;
+	}
+	struct protocol_args args = { pair[0], pair[1] };
+	measure("protocol_first_request", run_first_request, &args, 0);
+	measure("protocol_file_request", run_file_request, &args, 0);
+	measure("protocol_element_list", run_element_list, &args, 0);
+	measure("protocol_status_code", run_status_code, &args, 0);
+	close(pair[0]);
+	close(pair[1]);
+}
+
+/* -------------------------------- versions.db ------------------------------- */
+
+/**
+ * @brief Repositorio generado para las consultas
+ */
+struct db_args {
+	unsigned records;     /**< Registros del .db */
+	unsigned seed;        /**< Semilla de las consultas */
+	int client;           /**< Extremo del cliente para list */
+	int server;           /**< Extremo del servidor para list */
+};
+
+/**
+ * @brief Registro number del repositorio generado
+ */
+static void make_record(unsigned number, file_version * r) {
+	memset(r, 0, sizeof(file_version));
+	unsigned file = number / DB_VERSIONS;
+	snprintf(r->filename, sizeof(r->filename), "src/dir%03u/file%07u.c", file % 512, file);
+	snprintf(r->hash, sizeof(r->hash), "%064x", number);
+	snprintf(r->comment, sizeof(r->comment), "version %u", number % DB_VERSIONS + 1);
+	r->idCliente = file % DB_CLIENTS + 1;
+}
+
+/**
+ * @brief Escribe .versions/versions.db con records registros
+ */
+static int write_db(unsigned records) {
+	mkdir(VERSIONS_DIR, 0755);
+	FILE * fp = fopen(VERSIONS_DB_PATH, "wb");
+	if(fp == NULL)
+		return -1;
+	file_version * buffer = malloc(DB_WRITE_RECORDS * sizeof(file_version));
+	for(unsigned written = 0; written < records; ){
+		unsigned count = records - written < DB_WRITE_RECORDS ? records - written : DB_WRITE_RECORDS;
+		for(unsigned i = 0; i < count; i++)
+			make_record(written + i, &buffer[i]);
+		if(fwrite(buffer, sizeof(file_version), count, fp) != count)
+			break;
+		written += count;
+	}
+	free(buffer);
+	return fclose(fp);
+}
+
+static void run_version_exists(void * arg, long iterations) {
+	struct db_args * args = arg;
+	file_version r;
+	for(long i = 0; i < iterations; i++){
+		make_record(rand_r(&args->seed) % args->records, &r);
+		version_exists(r.filename, r.idCliente, r.hash);
+	}
+}
+
+static void run_version_missing(void * arg, long iterations) {
+	struct db_args * args = arg;
+	file_version r;
+	for(long i = 0; i < iterations; i++){
+		make_record(rand_r(&args->seed) % args->records, &r);
+		r.hash[0] = 'x';
+		version_exists(r.filename, r.idCliente, r.hash);
+	}
+}
+
+/**
+ * @brief Lee las respuestas de list hasta cerrar el socket, para que el servidor no bloquee
+ */
+static void * drain(void * arg) {
+	char element[SIZE_ELEMENT_LIST];
+	while(receive_element_list(*(int *)arg, element) == OK);
+	return NULL;
+}
+
+static void run_list(void * arg, long iterations) {
+	struct db_args * args = arg;
+	file_version r;
+	struct file_request request;
+	memset(&request, 0, sizeof(request));
+	for(long i = 0; i < iterations; i++){
+		make_record(rand_r(&args->seed) % args->records, &r);
+		strcpy(request.nameFile, r.filename);
+		send_file_request(args->client, &request);
+		list(args->server, r.idCliente);
+	}
+}
+
+static void bench_db(const char * recordsList) {
+	char * counts = strdup(recordsList);
+	for(char * item = strtok(counts, ","); item != NULL; item = strtok(NULL, ",")){
+		struct db_args args = { .records = strtoul(item, NULL, 10), .seed = 12345 };
+		if(args.records == 0)
+			continue;
+		char suffix[32], name[64];
+		count_suffix(args.records, suffix, sizeof(suffix));
+
+		snprintf(name, sizeof(name), "_%s", suffix);
+		if(filter != NULL && strstr("db_version_exists db_version_missing db_list", filter) == NULL && strstr(name, filter) == NULL)
+			continue;
+		double start = now();
+		if(write_db(args.records) != 0 || versions_db_open(0) != 0){
+			perror("versions.db");
+			break;
+		}
+		fprintf(stderr, "  (%u records generated and indexed in %.1f s)\n", args.records, now() - start);
+
+		snprintf(name, sizeof(name), "db_version_exists_%s", suffix);
+		measure(name, run_version_exists, &args, 0);
+		snprintf(name, sizeof(name), "db_version_missing_%s", suffix);
+		measure(name, run_version_missing, &args, 0);
+
+		int pair[2];
+		pthread_t reader;
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0){
+			args.client = pair[0];
+			args.server = pair[1];
+			pthread_create(&reader, NULL, drain, &pair[0]);
+			snprintf(name, sizeof(name), "db_list_%s", suffix);
+			measure(name, run_list, &args, 0);
+			shutdown(pair[1], SHUT_RDWR);
+			pthread_join(reader, NULL);
+			close(pair[0]);
+			close(pair[1]);
+		}
+		version_index_destroy(versionIndex);
+		versionIndex = NULL;
+		unlink(VERSIONS_DB_PATH);
+	}
+	rmdir(VERSIONS_DIR);
+	free(counts);
+}
+
+/* -------------------------------- linea base -------------------------------- */
+
+/**
+ * @brief Lee la linea base y la asocia a los casos medidos
+ * @return 0 si se leyo, -1 si no existe
+ */
+static int load_baseline(const char * path) {
+	FILE * fp = fopen(path, "r");
+	if(fp == NULL)
+		return -1;
+	char line[256], name[64];
+	double ns;
+	while(fgets(line, sizeof(line), fp) != NULL){
+		if(line[0] == '#' || sscanf(line, "%63s %lf", name, &ns) != 2)
+			continue;
+		for(int i = 0; i < countCases; i++)
+			if(strcmp(cases[i].name, name) == 0)
+				cases[i].baseline = ns;
+	}
+	fclose(fp);
+	return 0;
+}
+
+static int save_baseline(const char * path) {
+	FILE * fp = fopen(path, "w");
+	if(fp == NULL)
+		return -1;
+	fprintf(fp, "# caso ns_por_operacion (make bench-baseline)\n");
+	for(int i = 0; i < countCases; i++)
+		fprintf(fp, "%s %.1f\n", cases[i].name, cases[i].ns);
+	return fclose(fp);
+}
+
+static void usage() {
+	printf("Uso: microbench [-r REGISTROS,...] [-n ARCHIVOS] [-f FILTRO] [-b BASE | -w BASE] [-t UMBRAL]\n");
+	printf("  -r tamanios de versions.db a generar (por defecto 1000,100000,1000000)\n");
+	printf("  -n archivos de 1 a 16 KB para los casos sha256_files, 0 para omitirlos (por defecto 10000)\n");
+	printf("  -f solo los casos cuyo nombre contiene FILTRO\n");
+	printf("  -b compara contra la linea base BASE; falla si un caso es UMBRAL%% mas lento\n");
+	printf("  -w guarda los resultados como linea base en BASE\n");
+	printf("  -t umbral de regresion en por ciento (por defecto 10)\n");
+}
+
+int main(int argc, char * argv[]) {
+	const char * records = "1000,100000,1000000";
+	unsigned files = 10000;
+	const char * baselinePath = NULL;
+	const char * savePath = NULL;
+	double threshold = 10;
+	int opt;
+	while((opt = getopt(argc, argv, "r:n:f:b:w:t:")) != -1){
+		if(opt == 'r')
+			records = optarg;
+		else if(opt == 'n' && atoi(optarg) >= 0)
+			files = atoi(optarg);
+		else if(opt == 'f')
+			filter = optarg;
+		else if(opt == 'b')
+			baselinePath = optarg;
+		else if(opt == 'w')
+			savePath = optarg;
+		else if(opt == 't' && atof(optarg) > 0)
+			threshold = atof(optarg);
+		else{
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+
+	//Un solo CPU: el planificador no mueve el hilo entre corridas
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	if(sched_getaffinity(0, sizeof(cpus), &cpus) == 0){
+		for(int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+			if(CPU_ISSET(cpu, &cpus)){
+				CPU_ZERO(&cpus);
+				CPU_SET(cpu, &cpus);
+				sched_setaffinity(0, sizeof(cpus), &cpus);
+				break;
+			}
+		}
+	}
+	//Los mensajes del servidor no interesan
+	log_start(LOG_LEVEL_ERROR, STDERR_FILENO);
+
+	char dir[] = "/tmp/microbench.XXXXXX";
+	char cwd[PATH_MAX];
+	if(getcwd(cwd, sizeof(cwd)) == NULL || mkdtemp(dir) == NULL || chdir(dir) != 0){
+		perror("microbench");
+		return EXIT_FAILURE;
+	}
+	//Un kernel que no coincide con la referencia escalar invalida cualquier medicion
+	if(sha256_self_check() != 0){
+		printf("sha256: los kernels no coinciden con la referencia escalar\n");
+		return EXIT_FAILURE;
+	}
+	printf("sha256: kernel %s, multi-buffer %s\n", sha256_kernel(), sha256_multi_kernel());
+	bench_sha256(dir, files);
+	bench_protocol();
+	bench_db(records);
+	if(chdir(cwd) != 0 || rmdir(dir) != 0)
+		perror("microbench");
+	log_stop();
+
+	if(savePath != NULL){
+		if(save_baseline(savePath) != 0){
+			perror(savePath);
+			return EXIT_FAILURE;
+		}
+		printf("Linea base guardada en %s\n", savePath);
+	}
+	if(baselinePath == NULL)
+		return EXIT_SUCCESS;
+	if(load_baseline(baselinePath) != 0){
+		printf("No hay linea base en %s (make bench-baseline la crea)\n", baselinePath);
+		return EXIT_SUCCESS;
+	}
+	int regressions = 0;
+	printf("\n%-32s %12s %12s %8s\n", "caso", "base ns/op", "ns/op", "cambio");
+	for(int i = 0; i < countCases; i++){
+		if(cases[i].baseline <= 0)
+			continue;
+		double change = (cases[i].ns - cases[i].baseline) / cases[i].baseline * 100;
+		int regressed = change > threshold;
+		regressions += regressed;
+		printf("%-32s %12.1f %12.1f %+7.1f%%%s\n", cases[i].name, cases[i].baseline, cases[i].ns, change,
+				regressed ? "  REGRESION" : "");
+	}
+	if(regressions > 0){
+		printf("%d casos mas lentos que la linea base en mas de %.0f%%\n", regressions, threshold);
+		return EXIT_FAILURE;
+	}
+	printf("Sin regresiones mayores a %.0f%%\n", threshold);
+	return EXIT_SUCCESS;
+}
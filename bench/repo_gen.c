@@ -0,0 +1,377 @@
+/**
+ * @file
+ * @brief Generador de repositorios sinteticos: escribe directamente un
+ * .versions/ valido (versions.db y blobs) del tamanio que se necesite para
+ * las pruebas de escala, sin subir los archivos por el servidor
+ * @copyright MIT License
+ *
+ * Uso: repo_gen [-c CLIENTES] [-f ARCHIVOS] [-v VERSIONES] [-s TAMANIOS] [-d DEDUP] [-j HILOS] [-r SEMILLA] [DIRECTORIO]
+ *
+ * Cada cliente tiene ARCHIVOS archivos y cada archivo VERSIONES versiones; los
+ * registros quedan intercalados por rondas, como si todos los clientes
+ * trabajaran a la vez. TAMANIOS es una distribucion "tamanio:peso,..." (sufijos
+ * k y m). DEDUP es la fraccion de versiones cuyo contenido es el de una version
+ * de otro archivo, y que por lo tanto comparten blob.
+ *
+ * La generacion es determinista para una semilla y se hace en dos pasadas en
+ * paralelo: la primera crea los blobs unicos y guarda su hash, la segunda
+ * escribe versions.db por bloques en la posicion de cada registro.
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../server/versions_server.h"
+
+#define GEN_MAX_SIZES 16          /**< Tamanios en la distribucion */
+#define GEN_CHUNK_RECORDS 1024    /**< Registros que toma un hilo cada vez */
+#define GEN_WRITE_RECORDS 256     /**< Registros por escritura de versions.db */
+#define GEN_BUFFER_SIZE (1 << 20) /**< Bytes de contenido generados por bloque */
+#define GEN_MAX_THREADS 256       /**< Hilos como maximo */
+#define GEN_PROGRESS_SECONDS 5    /**< Segundos entre reportes de avance */
+#define GEN_SOURCE_TRIES 64       /**< Archivos en que se busca un contenido unico para repetir */
+
+/**
+ * @brief Distribucion de tamanios de archivo
+ */
+struct gen_sizes {
+	size_t sizes[GEN_MAX_SIZES]; /**< Tamanios en bytes */
+	int weights[GEN_MAX_SIZES];  /**< Peso de cada tamanio */
+	int count;                   /**< Tamanios en la distribucion */
+	int total;                   /**< Suma de los pesos */
+};
+
+static unsigned clients = 64;              /**< Clientes */
+static unsigned files = 16;                /**< Archivos por cliente */
+static unsigned versions = 4;              /**< Versiones por archivo */
+static double dedup = 0;                   /**< Fraccion de versiones con contenido repetido */
+static unsigned long long seed = 1;        /**< Semilla de la generacion */
+static struct gen_sizes sizes;             /**< Distribucion de tamanios */
+static unsigned long records;              /**< Registros a generar */
+static uint8_t (*hashes)[32];              /**< Hash del contenido de cada registro */
+static unsigned long nextChunk = 0;        /**< Siguiente bloque de registros sin asignar */
+static unsigned long done = 0;             /**< Registros terminados en la pasada actual */
+static unsigned long blobs = 0;            /**< Blobs escritos */
+static unsigned long long blobBytes = 0;   /**< Bytes de los blobs escritos */
+static int dbFile = -1;                    /**< Descriptor de versions.db */
+static int failed = 0;                     /**< 1 si un hilo no pudo escribir */
+
+/**
+ * @brief Tiempo monotono en segundos
+ */
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Mezcla de 64 bits (splitmix64): numeros pseudoaleatorios sin estado
+ */
+static unsigned long long mix(unsigned long long value) {
+	value += 0x9e3779b97f4a7c15ull;
+	value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+	value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+	return value ^ (value >> 31);
+}
+
+/**
+ * @brief Lee un tamanio con sufijo opcional k o m
+ */
+static size_t parse_size(const char * text) {
+	char * end;
+	size_t size = strtoull(text, &end, 10);
+	if(*end == 'k' || *end == 'K')
+		size *= 1024;
+	else if(*end == 'm' || *end == 'M')
+		size *= 1024 * 1024;
+	return size;
+}
+
+/**
+ * @brief Lee una distribucion "tamanio:peso,tamanio:peso"
+ * @return 0 si es valida, -1 si no
+ */
+static int parse_sizes(char * text, struct gen_sizes * result) {
+	memset(result, 0, sizeof(struct gen_sizes));
+	for(char * item = strtok(text, ","); item != NULL; item = strtok(NULL, ",")){
+		if(result->count == GEN_MAX_SIZES)
+			return -1;
+		char * weight = strchr(item, ':');
+		result->sizes[result->count] = parse_size(item);
+		result->weights[result->count] = weight != NULL ? atoi(weight + 1) : 1;
+		if(result->sizes[result->count] == 0 || result->weights[result->count] <= 0)
+			return -1;
+		result->total += result->weights[result->count++];
+	}
+	return result->count > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Archivo (cliente y archivo del cliente) al que pertenece un registro
+ */
+static unsigned long file_of(unsigned long record) {
+	return record % ((unsigned long)clients * files);
+}
+
+/**
+ * @brief Indica si el contenido de un registro repite el de otro registro
+ */
+static int is_duplicate(unsigned long record) {
+	return record > 0 && (mix(seed ^ (record << 1)) >> 11) * 0x1.0p-53 < dedup;
+}
+
+/**
+ * @brief Registro cuyo contenido usa un registro: el mismo si es unico, o uno
+ * unico de otro archivo en la misma ronda. Asi dos versiones de un archivo
+ * nunca tienen el mismo contenido (el servidor no aceptaria la segunda)
+ */
+static unsigned long source_of(unsigned long record) {
+	unsigned long total = (unsigned long)clients * files;
+	if(!is_duplicate(record) || total == 1)
+		return record;
+	unsigned long round = record / total, file = file_of(record);
+	unsigned long start = mix(seed ^ (record << 1 | 1)) % (total - 1);
+	for(unsigned long i = 0; i < GEN_SOURCE_TRIES && i < total - 1; i++){
+		unsigned long candidate = round * total + (file + 1 + (start + i) % (total - 1)) % total;
+		if(!is_duplicate(candidate))
+			return candidate;
+	}
+	return record;
+}
+
+/**
+ * @brief Tamanio del contenido de un registro unico
+ */
+static size_t size_of(unsigned long record) {
+	int pick = mix(seed ^ 0x5bd1e995ull ^ (record << 8)) % sizes.total;
+	for(int i = 0; i < sizes.count; i++){
+		if(pick < sizes.weights[i])
+			return sizes.sizes[i];
+		pick -= sizes.weights[i];
+	}
+	return sizes.sizes[0];
+}
+
+/**
+ * @brief Llena un bloque del contenido de un registro. Los primeros bytes son el
+ * numero de registro, asi dos registros unicos nunca tienen el mismo contenido
+ */
+static void fill(unsigned long record, size_t offset, unsigned long long * buffer, size_t words) {
+	unsigned long long state = mix(seed ^ record) ^ offset;
+	for(size_t i = 0; i < words; i++){
+		state ^= state << 13;
+		state ^= state >> 7;
+		state ^= state << 17;
+		buffer[i] = state;
+	}
+	if(offset == 0)
+		buffer[0] = record;
+}
+
+/**
+ * @brief Crea el blob de un registro unico y guarda su hash
+ * @return 0 si se escribio, -1 si no
+ */
+static int write_blob(unsigned long record, unsigned long long * buffer, int thread) {
+	char tmp[PATH_MAX], path[PATH_MAX], hex[HASH_SIZE];
+	snprintf(tmp, sizeof(tmp), "%s/.gen-%d", VERSIONS_DIR, thread);
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0)
+		return -1;
+	size_t size = size_of(record);
+	struct sha256_buff sha;
+	sha256_init(&sha);
+	for(size_t offset = 0; offset < size; offset += GEN_BUFFER_SIZE){
+		size_t chunk = size - offset < GEN_BUFFER_SIZE ? size - offset : GEN_BUFFER_SIZE;
+		fill(record, offset, buffer, (chunk + 7) / 8);
+		sha256_update(&sha, buffer, chunk);
+		if(write(fd, buffer, chunk) != (ssize_t)chunk){
+			close(fd);
+			return -1;
+		}
+	}
+	sha256_finalize(&sha);
+	sha256_read(&sha, hashes[record]);
+	sha256_read_hex(&sha, hex);
+	snprintf(path, sizeof(path), "%s/%s", VERSIONS_DIR, hex);
+	if(close(fd) != 0 || rename(tmp, path) != 0)
+		return -1;
+	__atomic_add_fetch(&blobs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&blobBytes, size, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/**
+ * @brief Primera pasada: crea los blobs de los registros unicos
+ */
+static void * generate_blobs(void * arg) {
+	int thread = (int)(long)arg;
+	unsigned long long * buffer = malloc(GEN_BUFFER_SIZE);
+	unsigned long start;
+	while(!failed && (start = __atomic_fetch_add(&nextChunk, GEN_CHUNK_RECORDS, __ATOMIC_RELAXED)) < records){
+		unsigned long end = start + GEN_CHUNK_RECORDS < records ? start + GEN_CHUNK_RECORDS : records;
+		for(unsigned long record = start; record < end; record++){
+			if(source_of(record) == record && write_blob(record, buffer, thread) != 0){
+				perror("blob");
+				failed = 1;
+				break;
+			}
+		}
+		__atomic_add_fetch(&done, end - start, __ATOMIC_RELAXED);
+	}
+	free(buffer);
+	return NULL;
+}
+
+/**
+ * @brief Llena el registro de versions.db numero record
+ */
+static void make_record(unsigned long record, file_version * r) {
+	static const char digits[] = "0123456789abcdef";
+	unsigned long file = file_of(record);
+	unsigned file_number = file % files;
+	memset(r, 0, sizeof(file_version));
+	snprintf(r->filename, sizeof(r->filename), "src/d%03u/file%06u.txt", file_number / 1000 % 1000, file_number);
+	snprintf(r->comment, sizeof(r->comment), "version %lu", record / ((unsigned long)clients * files) + 1);
+	const uint8_t * hash = hashes[source_of(record)];
+	for(int i = 0; i < 32; i++){
+		r->hash[2 * i] = digits[hash[i] >> 4];
+		r->hash[2 * i + 1] = digits[hash[i] & 15];
+	}
+	r->idCliente = file / files + 1;
+}
+
+/**
+ * @brief Segunda pasada: escribe versions.db; cada bloque va en su posicion
+ */
+static void * generate_records(void * arg) {
+	(void)arg;
+	file_version * buffer = malloc(GEN_WRITE_RECORDS * sizeof(file_version));
+	unsigned long start;
+	while(!failed && (start = __atomic_fetch_add(&nextChunk, GEN_WRITE_RECORDS, __ATOMIC_RELAXED)) < records){
+		unsigned long count = records - start < GEN_WRITE_RECORDS ? records - start : GEN_WRITE_RECORDS;
+		for(unsigned long i = 0; i < count; i++)
+			make_record(start + i, &buffer[i]);
+		size_t size = count * sizeof(file_version);
+		if(pwrite(dbFile, buffer, size, (off_t)start * sizeof(file_version)) != (ssize_t)size){
+			perror(VERSIONS_DB_PATH);
+			failed = 1;
+		}
+		__atomic_add_fetch(&done, count, __ATOMIC_RELAXED);
+	}
+	free(buffer);
+	return NULL;
+}
+
+/**
+ * @brief Ejecuta una pasada con threads hilos e informa el avance
+ */
+static void run_pass(const char * name, void * (*pass)(void *), int threads) {
+	pthread_t workers[GEN_MAX_THREADS];
+	double start = now();
+	nextChunk = 0;
+	done = 0;
+	for(int i = 0; i < threads; i++)
+		pthread_create(&workers[i], NULL, pass, (void *)(long)i);
+	double report = start + GEN_PROGRESS_SECONDS;
+	while(__atomic_load_n(&done, __ATOMIC_RELAXED) < records && !failed){
+		usleep(100000);
+		if(now() >= report){
+			fprintf(stderr, "  %s: %lu/%lu\n", name, __atomic_load_n(&done, __ATOMIC_RELAXED), records);
+			report += GEN_PROGRESS_SECONDS;
+		}
+	}
+	for(int i = 0; i < threads; i++)
+		pthread_join(workers[i], NULL);
+	printf("%-10s %lu registros en %.1f s\n", name, records, now() - start);
+}
+
+static void usage() {
+	printf("Uso: repo_gen [-c CLIENTES] [-f ARCHIVOS] [-v VERSIONES] [-s TAMANIOS] [-d DEDUP] [-j HILOS] [-r SEMILLA] [DIRECTORIO]\n");
+	printf("  -c clientes (por defecto 64)\n");
+	printf("  -f archivos por cliente (por defecto 16)\n");
+	printf("  -v versiones por archivo (por defecto 4)\n");
+	printf("  -s distribucion de tamanios tamanio:peso,... (por defecto 4k:70,64k:25,1m:5)\n");
+	printf("  -d fraccion de versiones que repiten contenido, entre 0 y 1 (por defecto 0)\n");
+	printf("  -j hilos (por defecto uno por CPU)\n");
+	printf("  -r semilla (por defecto 1)\n");
+	printf("Crea DIRECTORIO/%s, que no debe existir (por defecto en el directorio actual)\n", VERSIONS_DIR);
+}
+
+int main(int argc, char * argv[]) {
+	char defaultSizes[] = "4k:70,64k:25,1m:5";
+	char * sizesText = defaultSizes;
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+	while((opt = getopt(argc, argv, "c:f:v:s:d:j:r:")) != -1){
+		if(opt == 'c')
+			clients = strtoul(optarg, NULL, 10);
+		else if(opt == 'f')
+			files = strtoul(optarg, NULL, 10);
+		else if(opt == 'v')
+			versions = strtoul(optarg, NULL, 10);
+		else if(opt == 's')
+			sizesText = optarg;
+		else if(opt == 'd')
+			dedup = atof(optarg);
+		else if(opt == 'j')
+			threads = atoi(optarg);
+		else if(opt == 'r')
+			seed = strtoull(optarg, NULL, 10);
+		else{
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if(clients == 0 || files == 0 || versions == 0 || dedup < 0 || dedup > 1 || optind < argc - 1
+			|| parse_sizes(sizesText, &sizes) != 0){
+		usage();
+		return EXIT_FAILURE;
+	}
+	if(threads < 1)
+		threads = 1;
+	if(threads > GEN_MAX_THREADS)
+		threads = GEN_MAX_THREADS;
+	if(optind < argc && chdir(argv[optind]) != 0){
+		perror(argv[optind]);
+		return EXIT_FAILURE;
+	}
+	if(mkdir(VERSIONS_DIR, 0755) != 0){
+		perror(VERSIONS_DIR);
+		return EXIT_FAILURE;
+	}
+
+	records = (unsigned long)clients * files * versions;
+	hashes = malloc(records * sizeof(*hashes));
+	dbFile = open(VERSIONS_DB_PATH, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(hashes == NULL || dbFile < 0 || ftruncate(dbFile, (off_t)records * sizeof(file_version)) != 0){
+		perror("repo_gen");
+		return EXIT_FAILURE;
+	}
+	printf("%u clientes, %u archivos, %u versiones: %lu registros con %d hilos\n",
+			clients, files, versions, records, threads);
+
+	run_pass("blobs", generate_blobs, threads);
+	if(!failed)
+		run_pass("registros", generate_records, threads);
+	for(int i = 0; i < threads; i++){
+		char tmp[PATH_MAX];
+		snprintf(tmp, sizeof(tmp), "%s/.gen-%d", VERSIONS_DIR, i);
+		unlink(tmp);
+	}
+	if(close(dbFile) != 0)
+		failed = 1;
+	free(hashes);
+	if(failed){
+		fprintf(stderr, "No se pudo generar el repositorio\n");
+		return EXIT_FAILURE;
+	}
+	printf("%lu blobs (%.1f MB), %lu versiones con contenido repetido, versions.db de %.1f MB\n",
+			blobs, blobBytes / 1e6, records - blobs, (double)records * sizeof(file_version) / 1e6);
+	return EXIT_SUCCESS;
+}
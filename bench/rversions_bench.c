@@ -0,0 +1,378 @@
+/**
+ * @file
+ * @brief Generador de carga para rversionsd: N clientes concurrentes con una
+ * mezcla configurable de add/list/get
+ * @copyright MIT License
+ *
+ * Uso: rversions_bench [-c CLIENTES] [-d SEGUNDOS] [-m ADD:LIST:GET] [-s TAMANIOS] [-o SALIDA.json] IP PORT
+ *      rversions_bench [opciones] SOCKET
+ *
+ * Cada cliente tiene su propia conexion, su propio id y BENCH_FILES archivos.
+ * TAMANIOS es una distribucion "tamanio:peso,..." (sufijos k y m). Al terminar
+ * imprime el throughput y los percentiles de latencia de cada operacion y, con
+ * -o, los guarda en JSON para comparar corridas entre versiones.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../client/versions_client.h"
+#include "../server/stats.h"
+
+#define BENCH_FILES 8          /**< Archivos distintos por cliente */
+#define BENCH_MAX_SIZES 16     /**< Tamanios en la distribucion */
+#define BENCH_MAX_RETRIES 5    /**< Reintentos de una subida con el servidor ocupado */
+
+/**
+ * @brief Distribucion de tamanios de archivo
+ */
+struct bench_sizes {
+	size_t sizes[BENCH_MAX_SIZES]; /**< Tamanios en bytes */
+	int weights[BENCH_MAX_SIZES];  /**< Peso de cada tamanio */
+	int count;                     /**< Tamanios en la distribucion */
+	int total;                     /**< Suma de los pesos */
+};
+
+/**
+ * @brief Estado de un cliente simulado
+ */
+struct bench_client {
+	int id;                              /**< Numero del cliente */
+	int idClient;                        /**< Id con el que se presenta al servidor */
+	int socket;                          /**< Conexion con el servidor */
+	unsigned seed;                       /**< Semilla de sus decisiones */
+	int versions[BENCH_FILES];           /**< Versiones agregadas de cada archivo */
+	char paths[BENCH_FILES][PATH_MAX];   /**< Ruta de cada archivo */
+	unsigned long retries;               /**< Subidas repetidas por VERSION_RETRY_LATER */
+	unsigned long reconnects;            /**< Conexiones perdidas y recuperadas */
+	pthread_t thread;                    /**< Hilo del cliente */
+};
+
+static const char * address;              /**< IP o socket Unix del servidor */
+static int port = 0;                      /**< Puerto, 0 para el socket Unix */
+static int mix[3] = { 20, 10, 70 };       /**< Pesos de add, list y get */
+static struct bench_sizes sizes;          /**< Distribucion de tamanios */
+static double deadline;                   /**< Segundo (monotonico) en que se detienen los clientes */
+
+/**
+ * @brief Tiempo monotono en segundos
+ */
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Lee un tamanio con sufijo opcional k o m
+ */
+static size_t parse_size(const char * text) {
+	char * end;
+	size_t size = strtoull(text, &end, 10);
+	if(*end == 'k' || *end == 'K')
+		size *= 1024;
+	else if(*end == 'm' || *end == 'M')
+		size *= 1024 * 1024;
+	return size;
+}
+
+/**
+ * @brief Lee una distribucion "tamanio:peso,tamanio:peso"
+ * @return 0 si es valida, -1 si no
+ */
+static int parse_sizes(char * text, struct bench_sizes * result) {
+	memset(result, 0, sizeof(struct bench_sizes));
+	for(char * item = strtok(text, ","); item != NULL; item = strtok(NULL, ",")){
+		if(result->count == BENCH_MAX_SIZES)
+			return -1;
+		char * weight = strchr(item, ':');
+		result->sizes[result->count] = parse_size(item);
+		result->weights[result->count] = weight != NULL ? atoi(weight + 1) : 1;
+		if(result->sizes[result->count] == 0 || result->weights[result->count] <= 0)
+			return -1;
+		result->total += result->weights[result->count++];
+	}
+	return result->count > 0 ? 0 : -1;
+}
+
+/**
+ * @brief Escribe un archivo de size bytes con contenido que no se repite entre versiones
+ */
+static int write_file(const char * filename, size_t size, unsigned * seed) {
+	FILE * fp = fopen(filename, "wb");
+	if(fp == NULL)
+		return 0;
+	unsigned buffer[4096];
+	size_t written = 0;
+	while(written < size){
+		for(size_t i = 0; i < sizeof(buffer) / sizeof(unsigned); i++){
+			*seed = *seed * 1103515245u + 12345u;
+			buffer[i] = *seed;
+		}
+		size_t chunk = size - written < sizeof(buffer) ? size - written : sizeof(buffer);
+		if(fwrite(buffer, 1, chunk, fp) != chunk)
+			break;
+		written += chunk;
+	}
+	return fclose(fp) == 0 && written == size;
+}
+
+/**
+ * @brief Si el servidor cerro la conexion, abre otra
+ */
+static void check_connection(struct bench_client * client) {
+	char byte;
+	ssize_t peeked = recv(client->socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+	if(peeked > 0 || (peeked == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)))
+		return;
+	close(client->socket);
+	client->socket = connect_to_server(address, port);
+	client->reconnects++;
+}
+
+/**
+ * @brief Lista las versiones de un archivo sin imprimirlas
+ * @return 1 si llego el END
+ */
+static int bench_list(const char * filename, int socket) {
+	struct file_request request;
+	memset(&request, 0, sizeof(request));
+	strncpy(request.nameFile, filename, sizeof(request.nameFile) - 1);
+	if(send_file_request(socket, &request) != OK)
+		return 0;
+	char element[SIZE_ELEMENT_LIST];
+	while(receive_element_list(socket, element) == OK)
+		if(strcmp(element, "END") == 0)
+			return 1;
+	return 0;
+}
+
+/**
+ * @brief Hace una operacion de la mezcla y registra su latencia
+ */
+static void run_operation(struct bench_client * client) {
+	int choice = rand_r(&client->seed) % (mix[0] + mix[1] + mix[2]);
+	int file = rand_r(&client->seed) % BENCH_FILES;
+	type_request op = choice < mix[0] ? ADD : choice < mix[0] + mix[1] ? LIST : GET;
+	//Sin versiones todavia no hay nada que listar ni obtener
+	if(client->versions[file] == 0)
+		op = ADD;
+
+	size_t size = 0;
+	if(op == ADD){
+		int pick = rand_r(&client->seed) % sizes.total;
+		for(int i = 0; i < sizes.count; i++){
+			if(pick < sizes.weights[i]){
+				size = sizes.sizes[i];
+				break;
+			}
+			pick -= sizes.weights[i];
+		}
+		// El contenido se genera fuera de la medicion; el hash forma parte del add
+		if(!write_file(client->paths[file], size, &client->seed))
+			return;
+	}
+
+	struct first_request request = { .request = op, .idUser = client->idClient };
+	unsigned long long start = stats_now_ns();
+	int ok = 0;
+	unsigned long long bytesIn = 0, bytesOut = 0;
+	if(op == ADD){
+		//Como el cliente: con el servidor ocupado se espera lo que indica y se repite
+		return_code result = VERSION_ERROR;
+		for(int attempt = 0; attempt <= BENCH_MAX_RETRIES; attempt++){
+			if(send_first_request(client->socket, &request) != OK)
+				break;
+			result = add(client->paths[file], "bench", client->socket);
+			if(result != VERSION_RETRY_LATER)
+				break;
+			client->retries++;
+			sleep(retryAfter);
+		}
+		ok = result == VERSION_ADDED;
+		if(ok){
+			client->versions[file]++;
+			bytesOut = size;
+		}
+	}else if(op == LIST){
+		ok = send_first_request(client->socket, &request) == OK && bench_list(client->paths[file], client->socket);
+	}else{
+		int version = rand_r(&client->seed) % client->versions[file] + 1;
+		ok = send_first_request(client->socket, &request) == OK
+				&& get(client->paths[file], version, client->socket) == VERSION_ADDED;
+		struct stat st;
+		if(ok && stat(client->paths[file], &st) == 0)
+			bytesIn = st.st_size;
+	}
+	stats_record_request(op, (stats_now_ns() - start) / 1000, !ok, bytesIn, bytesOut);
+	if(!ok)
+		check_connection(client);
+}
+
+/**
+ * @brief Hilo de un cliente: operaciones hasta el final de la corrida
+ */
+static void * run_client(void * args) {
+	struct bench_client * client = (struct bench_client *)args;
+	while(now() < deadline && client->socket != -1)
+		run_operation(client);
+	return NULL;
+}
+
+/**
+ * @brief Imprime una operacion en la tabla y en el JSON
+ */
+static void report(FILE * out, FILE * json, const char * name, const struct stats_operation * op, double seconds, int last) {
+	const struct stats_histogram * latency = &op->latency;
+	double mb = (op->bytesIn + op->bytesOut) / seconds / (1024 * 1024);
+	fprintf(out, "%-5s %8lu ops %6lu err %10.1f ops/s %9.2f MB/s  p50 %8llu  p95 %8llu  p99 %8llu  p99.9 %8llu us\n",
+			name, latency->count, op->errors, latency->count / seconds, mb,
+			stats_percentile(latency, 50), stats_percentile(latency, 95), stats_percentile(latency, 99),
+			stats_percentile(latency, 99.9));
+	if(json == NULL)
+		return;
+	fprintf(json, "    \"%s\": {\"count\": %lu, \"errors\": %lu, \"ops_per_s\": %.2f, \"mb_per_s\": %.3f, "
+			"\"mean_us\": %.1f, \"p50_us\": %llu, \"p95_us\": %llu, \"p99_us\": %llu, \"p999_us\": %llu, \"max_us\": %llu}%s\n",
+			name, latency->count, op->errors, latency->count / seconds, mb,
+			latency->count > 0 ? (double)latency->sum / latency->count : 0.0,
+			stats_percentile(latency, 50), stats_percentile(latency, 95), stats_percentile(latency, 99),
+			stats_percentile(latency, 99.9), latency->max, last ? "" : ",");
+}
+
+/**
+ * @brief Imprime la ayuda
+ */
+static void usage() {
+	printf("Uso: rversions_bench [-c CLIENTES] [-d SEGUNDOS] [-m ADD:LIST:GET] [-s TAMANIOS] [-o SALIDA.json] IP PORT\n");
+	printf("     rversions_bench [opciones] SOCKET\n");
+	printf("  -c clientes concurrentes, cada uno con su conexion (por defecto 8)\n");
+	printf("  -d duracion de la corrida en segundos (por defecto 10)\n");
+	printf("  -m pesos de add, list y get (por defecto 20:10:70)\n");
+	printf("  -s distribucion de tamanios tamanio:peso,... con sufijos k y m (por defecto 4k:70,64k:25,1m:5)\n");
+	printf("  -o archivo donde guardar los resultados en JSON\n");
+}
+
+int main(int argc, char * argv[]) {
+	int clients = 8;
+	int duration = 10;
+	const char * jsonPath = NULL;
+	char defaultSizes[] = "4k:70,64k:25,1m:5";
+	char * sizesText = defaultSizes;
+	char mixText[64] = "20:10:70";
+	char sizesLabel[256];
+	int opt;
+	while((opt = getopt(argc, argv, "c:d:m:s:o:")) != -1){
+		if(opt == 'c' && atoi(optarg) > 0){
+			clients = atoi(optarg);
+		}else if(opt == 'd' && atoi(optarg) > 0){
+			duration = atoi(optarg);
+		}else if(opt == 'm'){
+			strncpy(mixText, optarg, sizeof(mixText) - 1);
+		}else if(opt == 's'){
+			sizesText = optarg;
+		}else if(opt == 'o'){
+			jsonPath = optarg;
+		}else{
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if(argc - optind != 1 && argc - optind != 2){
+		usage();
+		return EXIT_FAILURE;
+	}
+	strncpy(sizesLabel, sizesText, sizeof(sizesLabel) - 1);
+	sizesLabel[sizeof(sizesLabel) - 1] = '\0';
+	address = argv[optind];
+	port = argc - optind == 2 ? atoi(argv[optind + 1]) : 0;
+	if(sscanf(mixText, "%d:%d:%d", &mix[0], &mix[1], &mix[2]) != 3 || mix[0] < 0 || mix[1] < 0 || mix[2] < 0
+			|| mix[0] + mix[1] + mix[2] == 0 || parse_sizes(sizesText, &sizes) != 0){
+		printf("Mezcla o distribucion de tamanios invalida\n");
+		return EXIT_FAILURE;
+	}
+
+	struct bench_client * all = calloc(clients, sizeof(struct bench_client));
+	char dir[] = "/tmp/rversions_bench.XXXXXX";
+	if(all == NULL || mkdtemp(dir) == NULL){
+		perror("rversions_bench");
+		return EXIT_FAILURE;
+	}
+	// Ids distintos por corrida para no chocar con versiones previas
+	srand(time(NULL) ^ getpid());
+	int firstId = rand() % 1000000 + 1;
+	for(int i = 0; i < clients; i++){
+		all[i].id = i;
+		all[i].idClient = firstId + i;
+		all[i].seed = firstId * 31 + i;
+		all[i].socket = connect_to_server(address, port);
+		if(all[i].socket == -1)
+			return EXIT_FAILURE;
+		for(int f = 0; f < BENCH_FILES; f++)
+			snprintf(all[i].paths[f], PATH_MAX, "%s/c%d-f%d", dir, i, f);
+	}
+
+	// Los mensajes del cliente se descartan, los resultados van a la salida original
+	FILE * out = fdopen(dup(STDOUT_FILENO), "w");
+	if(out == NULL || freopen("/dev/null", "w", stdout) == NULL)
+		return EXIT_FAILURE;
+
+	double start = now();
+	deadline = start + duration;
+	for(int i = 0; i < clients; i++)
+		pthread_create(&all[i].thread, NULL, run_client, &all[i]);
+	unsigned long retries = 0, reconnects = 0;
+	for(int i = 0; i < clients; i++){
+		pthread_join(all[i].thread, NULL);
+		retries += all[i].retries;
+		reconnects += all[i].reconnects;
+	}
+	double seconds = now() - start;
+
+	struct stats_snapshot * snapshot = malloc(sizeof(struct stats_snapshot));
+	if(snapshot == NULL)
+		return EXIT_FAILURE;
+	stats_snapshot(snapshot);
+	unsigned long total = snapshot->operations[ADD].latency.count + snapshot->operations[LIST].latency.count
+			+ snapshot->operations[GET].latency.count;
+
+	FILE * json = NULL;
+	if(jsonPath != NULL && (json = fopen(jsonPath, "w")) == NULL)
+		fprintf(out, "No se pudo escribir %s\n", jsonPath);
+	fprintf(out, "%d clients, %.1f s, mix add:list:get %d:%d:%d, sizes %s\n", clients, seconds, mix[0], mix[1], mix[2], sizesLabel);
+	if(json != NULL){
+		fprintf(json, "{\n  \"clients\": %d,\n  \"seconds\": %.3f,\n  \"mix\": {\"add\": %d, \"list\": %d, \"get\": %d},\n",
+				clients, seconds, mix[0], mix[1], mix[2]);
+		fprintf(json, "  \"sizes\": [");
+		for(int i = 0; i < sizes.count; i++)
+			fprintf(json, "%s{\"bytes\": %zu, \"weight\": %d}", i > 0 ? ", " : "", sizes.sizes[i], sizes.weights[i]);
+		fprintf(json, "],\n  \"ops_per_s\": %.2f,\n  \"retries\": %lu,\n  \"reconnects\": %lu,\n  \"operations\": {\n",
+				total / seconds, retries, reconnects);
+	}
+	report(out, json, "add", &snapshot->operations[ADD], seconds, 0);
+	report(out, json, "list", &snapshot->operations[LIST], seconds, 0);
+	report(out, json, "get", &snapshot->operations[GET], seconds, 1);
+	fprintf(out, "total %8lu ops %10.1f ops/s, %lu retries, %lu reconnects\n", total, total / seconds, retries, reconnects);
+	if(json != NULL){
+		fprintf(json, "  }\n}\n");
+		fclose(json);
+	}
+
+	for(int i = 0; i < clients; i++){
+		for(int f = 0; f < BENCH_FILES; f++)
+			unlink(all[i].paths[f]);
+		if(all[i].socket != -1)
+			close(all[i].socket);
+	}
+	rmdir(dir);
+	free(all);
+	free(snapshot);
+	fclose(out);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,531 @@
+/**
+ * @file
+ * @brief Prueba de bloqueo en cabeza de cola para rversionsd: clientes lentos,
+ * conexiones detenidas y desconexiones a mitad de transferencia junto a
+ * clientes normales, con un SLO de latencia para los normales
+ * @copyright MIT License
+ *
+ * Uso: slow_clients [-c CLIENTES] [-d SEGUNDOS] [-r LECTORES] [-w ESCRITORES] [-s DETENIDAS]
+ *                   [-x DESCONEXIONES] [-b BYTES/S] [-z TAMANIO] [-p P99_MS] [-m MAX_MS] [-e ERRORES%] IP PORT
+ *
+ * Los clientes adversarios son:
+ *  - lectores lentos: piden un archivo grande y lo leen a BYTES/S con un buffer
+ *    de recepcion pequenio, asi el servidor queda bloqueado enviando
+ *  - escritores lentos: suben un archivo grande a BYTES/S
+ *  - conexiones detenidas: envian media solicitud y no envian el resto
+ *  - desconexiones: empiezan un get o un add grande y cierran a la mitad
+ * Los clientes normales hacen add/list/get de archivos pequenios. Al terminar se
+ * imprimen sus percentiles y el resultado de cada SLO; si alguno no se cumple
+ * el programa termina con 1.
+ *
+ * Cada solicitud en curso ocupa un worker del servidor: rversionsd debe tener
+ * mas workers (-w) que clientes adversarios, o los normales esperaran un worker
+ * libre aunque ningun candado los detenga.
+ */
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../client/versions_client.h"
+#include "../server/stats.h"
+
+#define SLOW_FILES 4               /**< Archivos distintos por cliente normal */
+#define SLOW_FILE_SIZE 4096        /**< Tamanio de los archivos de los clientes normales */
+#define SLOW_TIMEOUT 5             /**< Segundos de espera maxima de una operacion normal */
+#define SLOW_RECV_BUFFER 4096      /**< Buffer de recepcion de los lectores lentos */
+#define SLOW_TICK_MS 100           /**< Cada cuanto leen o escriben los clientes lentos */
+#define SLOW_WARMUP 1              /**< Segundos que los adversarios llevan antes de medir */
+#define SLOW_ABORT_BYTES 65536     /**< Bytes que transfiere una desconexion antes de cerrar */
+
+/**
+ * @brief Tipo de cliente adversario
+ */
+typedef enum {
+	SLOW_READER,   /**< Lee un get a la tasa lenta */
+	SLOW_WRITER,   /**< Sube un add a la tasa lenta */
+	STALLED,       /**< Envia media solicitud y se detiene */
+	DISCONNECTOR   /**< Cierra a mitad de un get o un add */
+} adversary_type;
+
+/**
+ * @brief Estado de un cliente normal
+ */
+struct normal_client {
+	int idClient;                      /**< Id con el que se presenta al servidor */
+	int socket;                        /**< Conexion con el servidor */
+	unsigned seed;                     /**< Semilla de sus decisiones */
+	int versions[SLOW_FILES];          /**< Versiones agregadas de cada archivo */
+	char paths[SLOW_FILES][PATH_MAX];  /**< Ruta de cada archivo */
+	unsigned long reconnects;          /**< Conexiones perdidas y recuperadas */
+	pthread_t thread;                  /**< Hilo del cliente */
+};
+
+/**
+ * @brief Estado de un cliente adversario
+ */
+struct adversary {
+	adversary_type type;       /**< Que hace */
+	int id;                    /**< Numero del adversario, distingue sus archivos */
+	unsigned long sessions;    /**< Conexiones que abrio */
+	unsigned long long bytes;  /**< Bytes que transfirio */
+	pthread_t thread;          /**< Hilo del adversario */
+};
+
+static const char * address;               /**< IP del servidor */
+static int port;                           /**< Puerto del servidor */
+static int rate = 10 * 1024;               /**< Bytes por segundo de los clientes lentos */
+static size_t bigSize = 32 * 1024 * 1024;  /**< Tamanio del archivo grande */
+static char bigPath[PATH_MAX];             /**< Archivo grande, ya agregado al servidor */
+static int bigOwner;                       /**< Id del cliente que agrego el archivo grande */
+static double deadline;                    /**< Segundo (monotonico) en que se detienen todos */
+static double measureStart;                /**< Segundo en que empiezan los clientes normales */
+
+/**
+ * @brief Tiempo monotono en segundos
+ */
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Duerme ms milisegundos
+ */
+static void sleep_ms(int ms) {
+	struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+	nanosleep(&ts, NULL);
+}
+
+/**
+ * @brief Lee un tamanio con sufijo opcional k o m
+ */
+static size_t parse_size(const char * text) {
+	char * end;
+	size_t size = strtoull(text, &end, 10);
+	if(*end == 'k' || *end == 'K')
+		size *= 1024;
+	else if(*end == 'm' || *end == 'M')
+		size *= 1024 * 1024;
+	return size;
+}
+
+/**
+ * @brief Escribe un archivo de size bytes con contenido que no se repite entre versiones
+ */
+static int write_file(const char * filename, size_t size, unsigned * seed) {
+	FILE * fp = fopen(filename, "wb");
+	if(fp == NULL)
+		return 0;
+	unsigned buffer[4096];
+	size_t written = 0;
+	while(written < size){
+		for(size_t i = 0; i < sizeof(buffer) / sizeof(unsigned); i++){
+			*seed = *seed * 1103515245u + 12345u;
+			buffer[i] = *seed;
+		}
+		size_t chunk = size - written < sizeof(buffer) ? size - written : sizeof(buffer);
+		if(fwrite(buffer, 1, chunk, fp) != chunk)
+			break;
+		written += chunk;
+	}
+	return fclose(fp) == 0 && written == size;
+}
+
+/**
+ * @brief Conecta con el servidor
+ * @param receiveBuffer tamanio del buffer de recepcion, 0 para el del sistema.
+ * Se fija antes de conectar para que la ventana anunciada tambien sea pequenia
+ * @param timeout segundos de espera maxima de cada envio o recepcion, 0 sin limite
+ * @return socket, -1 si falla
+ */
+static int connect_slow(int receiveBuffer, int timeout) {
+	struct sockaddr_in server;
+	memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_port = htons(port);
+	if(inet_pton(AF_INET, address, &server.sin_addr) <= 0)
+		return -1;
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(fd == -1)
+		return -1;
+	if(receiveBuffer > 0)
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+	if(timeout > 0){
+		struct timeval tv = { timeout, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	}
+	if(connect(fd, (struct sockaddr *)&server, sizeof(server)) != 0){
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * @brief Empieza un get del archivo grande: solicitud y respuesta con el tamanio
+ * @return 1 si el servidor empezo a enviar el contenido
+ */
+static int start_big_get(int fd) {
+	struct first_request request = { .request = GET, .idUser = bigOwner };
+	struct file_request file;
+	memset(&file, 0, sizeof(file));
+	if(snprintf(file.nameFile, sizeof(file.nameFile), "%s", bigPath) >= (int)sizeof(file.nameFile))
+		return 0;
+	file.version = 1;
+	struct file_transfer transfer;
+	return send_first_request(fd, &request) == OK && send_file_request(fd, &file) == OK
+			&& receive_file_transfer(fd, &transfer) == OK && transfer.filseSize > 0;
+}
+
+/**
+ * @brief Empieza un add grande con un hash que no existe: el servidor acepta la
+ * subida y espera el contenido
+ * @return 1 si el servidor espera el contenido
+ */
+static int start_big_add(int fd, struct adversary * self) {
+	struct first_request request = { .request = ADD, .idUser = bigOwner + 1 + self->id };
+	struct file_request file;
+	memset(&file, 0, sizeof(file));
+	if(snprintf(file.nameFile, sizeof(file.nameFile), "%s.upload%d", bigPath, self->id) >= (int)sizeof(file.nameFile))
+		return 0;
+	//Un hash distinto por sesion para que nunca sea una version existente
+	snprintf(file.hashFile, sizeof(file.hashFile), "%016lx%016lx%016lx%016lx", (unsigned long)getpid(),
+			(unsigned long)self->id, self->sessions, (unsigned long)time(NULL));
+	return_code status;
+	if(send_first_request(fd, &request) != OK || send_file_request(fd, &file) != OK
+			|| receive_status_code(fd, &status) != OK || status != VERSION_NOT_EXISTS)
+		return 0;
+	struct file_transfer transfer = { .filseSize = bigSize };
+	strcpy(transfer.comment, "slow");
+	off_t size = bigSize;
+	return send_file_transfer(fd, &transfer) == OK && write(fd, &size, sizeof(size)) == sizeof(size);
+}
+
+/**
+ * @brief Lee o escribe hasta el final de la corrida o hasta limit bytes
+ * @param paced 1 para ir a la tasa lenta, 0 tan rapido como se pueda
+ * @return bytes transferidos
+ */
+static unsigned long long trickle(int fd, int reading, unsigned long long limit, int paced) {
+	char buffer[SLOW_RECV_BUFFER];
+	memset(buffer, 'x', sizeof(buffer));
+	unsigned long long done = 0;
+	int chunk = rate * SLOW_TICK_MS / 1000;
+	if(chunk < 1)
+		chunk = 1;
+	if(chunk > (int)sizeof(buffer))
+		chunk = sizeof(buffer);
+	while(now() < deadline && done < limit){
+		int size = limit - done < (unsigned long long)chunk ? (int)(limit - done) : chunk;
+		ssize_t n = reading ? recv(fd, buffer, size, 0) : send(fd, buffer, size, MSG_NOSIGNAL);
+		if(n <= 0)
+			break;
+		done += n;
+		if(paced)
+			sleep_ms(SLOW_TICK_MS);
+	}
+	return done;
+}
+
+/**
+ * @brief Hilo de un adversario: repite su comportamiento hasta el final de la corrida
+ */
+static void * run_adversary(void * args) {
+	struct adversary * self = (struct adversary *)args;
+	while(now() < deadline){
+		int fd = connect_slow(self->type == SLOW_READER ? SLOW_RECV_BUFFER : 0, 0);
+		if(fd == -1){
+			sleep_ms(SLOW_TICK_MS);
+			continue;
+		}
+		self->sessions++;
+		if(self->type == SLOW_READER){
+			if(start_big_get(fd))
+				self->bytes += trickle(fd, 1, (unsigned long long)-1, 1);
+		}else if(self->type == SLOW_WRITER){
+			if(start_big_add(fd, self))
+				self->bytes += trickle(fd, 0, (unsigned long long)-1, 1);
+		}else if(self->type == STALLED){
+			//Media solicitud: el servidor espera el resto hasta su plazo de E/S
+			struct first_request request = { .request = GET, .idUser = bigOwner };
+			struct file_request file;
+			memset(&file, 0, sizeof(file));
+			if(send_first_request(fd, &request) == OK && send(fd, &file, sizeof(file) / 2, MSG_NOSIGNAL) > 0){
+				self->bytes += sizeof(file) / 2;
+				char byte;
+				while(now() < deadline && recv(fd, &byte, 1, MSG_DONTWAIT) != 0)
+					sleep_ms(SLOW_TICK_MS);
+			}
+		}else{
+			//Alterna un get y un add que se cortan despues de SLOW_ABORT_BYTES
+			if(self->sessions % 2 == 0 ? start_big_get(fd) : start_big_add(fd, self))
+				self->bytes += trickle(fd, self->sessions % 2 == 0, SLOW_ABORT_BYTES, 0);
+			sleep_ms(SLOW_TICK_MS);
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+/**
+ * @brief Lista las versiones de un archivo sin imprimirlas
+ * @return 1 si llego el END
+ */
+static int slow_list(const char * filename, int socket) {
+	struct file_request request;
+	memset(&request, 0, sizeof(request));
+	strncpy(request.nameFile, filename, sizeof(request.nameFile) - 1);
+	if(send_file_request(socket, &request) != OK)
+		return 0;
+	char element[SIZE_ELEMENT_LIST];
+	while(receive_element_list(socket, element) == OK)
+		if(strcmp(element, "END") == 0)
+			return 1;
+	return 0;
+}
+
+/**
+ * @brief Hace una operacion normal (20% add, 10% list, 70% get) y registra su latencia
+ */
+static void run_operation(struct normal_client * client) {
+	int choice = rand_r(&client->seed) % 100;
+	int file = rand_r(&client->seed) % SLOW_FILES;
+	type_request op = choice < 20 ? ADD : choice < 30 ? LIST : GET;
+	if(client->versions[file] == 0)
+		op = ADD;
+	if(op == ADD && !write_file(client->paths[file], SLOW_FILE_SIZE, &client->seed))
+		return;
+
+	struct first_request request = { .request = op, .idUser = client->idClient };
+	unsigned long long start = stats_now_ns();
+	int ok = send_first_request(client->socket, &request) == OK;
+	if(ok && op == ADD){
+		return_code result = add(client->paths[file], "normal", client->socket);
+		ok = result == VERSION_ADDED;
+		client->versions[file] += ok;
+	}else if(ok && op == LIST){
+		ok = slow_list(client->paths[file], client->socket);
+	}else if(ok){
+		int version = rand_r(&client->seed) % client->versions[file] + 1;
+		ok = get(client->paths[file], version, client->socket) == VERSION_ADDED;
+	}
+	stats_record_request(op, (stats_now_ns() - start) / 1000, !ok, ok && op == GET ? SLOW_FILE_SIZE : 0,
+			ok && op == ADD ? SLOW_FILE_SIZE : 0);
+	//Tras un error la conexion puede haber quedado a mitad de una respuesta
+	if(!ok){
+		close(client->socket);
+		client->socket = connect_slow(0, SLOW_TIMEOUT);
+		client->reconnects++;
+	}
+}
+
+/**
+ * @brief Hilo de un cliente normal: operaciones hasta el final de la corrida
+ */
+static void * run_client(void * args) {
+	struct normal_client * client = (struct normal_client *)args;
+	while(now() < deadline && client->socket != -1)
+		run_operation(client);
+	return NULL;
+}
+
+/**
+ * @brief Comprueba y reporta los SLO de una operacion
+ * @return 1 si se cumplen
+ */
+static int check_slo(FILE * out, const char * name, const struct stats_operation * op, double seconds,
+		double p99Ms, double maxMs, double errorPercent) {
+	const struct stats_histogram * latency = &op->latency;
+	double p99 = stats_percentile(latency, 99) / 1000.0;
+	double max = latency->max / 1000.0;
+	double errors = latency->count > 0 ? 100.0 * op->errors / latency->count : 0;
+	int ok = latency->count > 0 && p99 <= p99Ms && (maxMs <= 0 || max <= maxMs) && errors <= errorPercent;
+	fprintf(out, "%-5s %8lu ops %6lu err %8.1f ops/s  p50 %8.2f  p99 %8.2f  max %8.2f ms  %s\n",
+			name, latency->count, op->errors, latency->count / seconds, stats_percentile(latency, 50) / 1000.0,
+			p99, max, ok ? "OK" : "FALLA");
+	return ok;
+}
+
+/**
+ * @brief Imprime la ayuda
+ */
+static void usage() {
+	printf("Uso: slow_clients [-c CLIENTES] [-d SEGUNDOS] [-r LECTORES] [-w ESCRITORES] [-s DETENIDAS]\n");
+	printf("                  [-x DESCONEXIONES] [-b BYTES/S] [-z TAMANIO] [-p P99_MS] [-m MAX_MS] [-e ERRORES%%] IP PORT\n");
+	printf("  -c clientes normales (por defecto 4)\n");
+	printf("  -d duracion de la corrida en segundos (por defecto 10)\n");
+	printf("  -r lectores lentos (por defecto 2)\n");
+	printf("  -w escritores lentos (por defecto 1)\n");
+	printf("  -s conexiones que envian media solicitud y se detienen (por defecto 1)\n");
+	printf("  -x clientes que se desconectan a mitad de una transferencia (por defecto 1)\n");
+	printf("  -b bytes por segundo de los clientes lentos, sufijos k y m (por defecto 10k)\n");
+	printf("  -z tamanio del archivo grande que se lee y se sube despacio (por defecto 32m)\n");
+	printf("  -p SLO del p99 de cada operacion normal en ms (por defecto 250)\n");
+	printf("  -m SLO de la latencia maxima en ms, 0 sin limite (por defecto 0)\n");
+	printf("  -e porcentaje de errores permitido en las operaciones normales (por defecto 0)\n");
+}
+
+int main(int argc, char * argv[]) {
+	int clients = 4;
+	int duration = 10;
+	int counts[4] = { 2, 1, 1, 1 };
+	double p99Ms = 250, maxMs = 0, errorPercent = 0;
+	int opt;
+	while((opt = getopt(argc, argv, "c:d:r:w:s:x:b:z:p:m:e:")) != -1){
+		if(opt == 'c' && atoi(optarg) > 0){
+			clients = atoi(optarg);
+		}else if(opt == 'd' && atoi(optarg) > 0){
+			duration = atoi(optarg);
+		}else if(opt == 'r' && atoi(optarg) >= 0){
+			counts[SLOW_READER] = atoi(optarg);
+		}else if(opt == 'w' && atoi(optarg) >= 0){
+			counts[SLOW_WRITER] = atoi(optarg);
+		}else if(opt == 's' && atoi(optarg) >= 0){
+			counts[STALLED] = atoi(optarg);
+		}else if(opt == 'x' && atoi(optarg) >= 0){
+			counts[DISCONNECTOR] = atoi(optarg);
+		}else if(opt == 'b' && parse_size(optarg) > 0){
+			rate = parse_size(optarg);
+		}else if(opt == 'z' && parse_size(optarg) > 0){
+			bigSize = parse_size(optarg);
+		}else if(opt == 'p' && atof(optarg) > 0){
+			p99Ms = atof(optarg);
+		}else if(opt == 'm' && atof(optarg) >= 0){
+			maxMs = atof(optarg);
+		}else if(opt == 'e' && atof(optarg) >= 0){
+			errorPercent = atof(optarg);
+		}else{
+			usage();
+			return EXIT_FAILURE;
+		}
+	}
+	if(argc - optind != 2){
+		usage();
+		return EXIT_FAILURE;
+	}
+	address = argv[optind];
+	port = atoi(argv[optind + 1]);
+	signal(SIGPIPE, SIG_IGN);
+
+	char dir[] = "/tmp/slow_clients.XXXXXX";
+	if(mkdtemp(dir) == NULL){
+		perror("slow_clients");
+		return EXIT_FAILURE;
+	}
+	// Ids distintos por corrida para no chocar con versiones previas
+	srand(time(NULL) ^ getpid());
+	int firstId = rand() % 1000000 + 1;
+	unsigned seed = firstId;
+	bigOwner = firstId;
+	snprintf(bigPath, PATH_MAX, "%s/big", dir);
+
+	// Los mensajes del cliente se descartan, los resultados van a la salida original
+	FILE * out = fdopen(dup(STDOUT_FILENO), "w");
+	if(out == NULL || freopen("/dev/null", "w", stdout) == NULL)
+		return EXIT_FAILURE;
+
+	//El archivo grande se agrega antes de empezar, sin adversarios
+	int setup = connect_slow(0, 0);
+	struct first_request request = { .request = ADD, .idUser = bigOwner };
+	if(setup == -1 || !write_file(bigPath, bigSize, &seed) || send_first_request(setup, &request) != OK
+			|| add(bigPath, "big", setup) != VERSION_ADDED){
+		fprintf(out, "No se pudo agregar el archivo grande a %s:%d\n", address, port);
+		return EXIT_FAILURE;
+	}
+	close(setup);
+
+	int adversaries = counts[0] + counts[1] + counts[2] + counts[3];
+	struct adversary * bad = calloc(adversaries > 0 ? adversaries : 1, sizeof(struct adversary));
+	struct normal_client * all = calloc(clients, sizeof(struct normal_client));
+	if(bad == NULL || all == NULL)
+		return EXIT_FAILURE;
+	for(int i = 0; i < clients; i++){
+		all[i].idClient = firstId + adversaries + 1 + i;
+		all[i].seed = firstId * 31 + i;
+		for(int f = 0; f < SLOW_FILES; f++)
+			snprintf(all[i].paths[f], PATH_MAX, "%s/c%d-f%d", dir, i, f);
+	}
+
+	double start = now();
+	deadline = start + SLOW_WARMUP + duration;
+	for(int type = 0, n = 0; type < 4; type++){
+		for(int i = 0; i < counts[type]; i++, n++){
+			bad[n].type = type;
+			bad[n].id = n;
+			pthread_create(&bad[n].thread, NULL, run_adversary, &bad[n]);
+		}
+	}
+	//Los adversarios ya tienen al servidor ocupado cuando empiezan los normales
+	sleep(SLOW_WARMUP);
+	measureStart = now();
+	for(int i = 0; i < clients; i++){
+		all[i].socket = connect_slow(0, SLOW_TIMEOUT);
+		if(all[i].socket == -1){
+			fprintf(out, "No se pudo conectar con %s:%d\n", address, port);
+			return EXIT_FAILURE;
+		}
+		pthread_create(&all[i].thread, NULL, run_client, &all[i]);
+	}
+	unsigned long reconnects = 0;
+	for(int i = 0; i < clients; i++){
+		pthread_join(all[i].thread, NULL);
+		reconnects += all[i].reconnects;
+	}
+	double seconds = now() - measureStart;
+	for(int i = 0; i < adversaries; i++)
+		pthread_join(bad[i].thread, NULL);
+
+	struct stats_snapshot * snapshot = malloc(sizeof(struct stats_snapshot));
+	if(snapshot == NULL)
+		return EXIT_FAILURE;
+	stats_snapshot(snapshot);
+
+	const char * names[4] = { "lectores lentos", "escritores lentos", "conexiones detenidas", "desconexiones" };
+	fprintf(out, "%d clientes normales, %.1f s, clientes lentos a %d B/s, archivo grande de %zu bytes\n",
+			clients, seconds, rate, bigSize);
+	for(int type = 0; type < 4; type++){
+		unsigned long sessions = 0;
+		unsigned long long bytes = 0;
+		for(int i = 0; i < adversaries; i++){
+			if(bad[i].type == (adversary_type)type){
+				sessions += bad[i].sessions;
+				bytes += bad[i].bytes;
+			}
+		}
+		fprintf(out, "  %-21s %3d  %6lu conexiones %12llu bytes\n", names[type], counts[type], sessions, bytes);
+	}
+	fprintf(out, "SLO: p99 <= %.1f ms", p99Ms);
+	if(maxMs > 0)
+		fprintf(out, ", max <= %.1f ms", maxMs);
+	fprintf(out, ", errores <= %.1f%%\n", errorPercent);
+	int ok = check_slo(out, "add", &snapshot->operations[ADD], seconds, p99Ms, maxMs, errorPercent);
+	ok &= check_slo(out, "list", &snapshot->operations[LIST], seconds, p99Ms, maxMs, errorPercent);
+	ok &= check_slo(out, "get", &snapshot->operations[GET], seconds, p99Ms, maxMs, errorPercent);
+	fprintf(out, "%lu reconexiones. %s\n", reconnects, ok ? "Se cumplen los SLO" : "No se cumplen los SLO");
+
+	for(int i = 0; i < clients; i++){
+		for(int f = 0; f < SLOW_FILES; f++)
+			unlink(all[i].paths[f]);
+		if(all[i].socket != -1)
+			close(all[i].socket);
+	}
+	unlink(bigPath);
+	rmdir(dir);
+	free(all);
+	free(bad);
+	free(snapshot);
+	fclose(out);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,144 @@
+/**
+ * @file
+ * @brief Benchmark de add/get locales por TCP (loopback) y por socket Unix
+ * @copyright MIT License
+ *
+ * Uso: transport_bench PORT SOCKET [TAMANIO_BYTES] [ITERACIONES]
+ *
+ * Se conecta a un rversionsd que escucha en 127.0.0.1:PORT y en SOCKET,
+ * adiciona ITERACIONES versiones distintas de un archivo por cada transporte
+ * y luego las obtiene, reportando latencia promedio y throughput.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../client/versions_client.h"
+
+/**
+ * @brief Resultado de una serie de operaciones
+ */
+struct bench_result {
+	int    count;   /**< Operaciones exitosas */
+	double seconds; /**< Tiempo total de las operaciones */
+};
+
+/**
+ * @brief Tiempo monotono en segundos
+ */
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Escribe un archivo de size bytes cuyo contenido depende de seed
+ */
+static int write_file(const char * filename, size_t size, unsigned seed) {
+	FILE * fp = fopen(filename, "wb");
+	if(fp == NULL)
+		return 0;
+	unsigned x = seed * 2654435761u + 1;
+	for(size_t i = 0; i < size; i++){
+		x = x * 1103515245u + 12345u;
+		fputc(x >> 16, fp);
+	}
+	return fclose(fp) == 0;
+}
+
+/**
+ * @brief Adiciona iterations versiones y luego las obtiene por el socket dado
+ */
+static void run_transport(int socket, int idClient, const char * filename, size_t size, int iterations, struct bench_result * add_result, struct bench_result * get_result) {
+	struct first_request request;
+	request.idUser = idClient;
+
+	add_result->count = get_result->count = 0;
+	add_result->seconds = get_result->seconds = 0;
+
+	for(int i = 0; i < iterations; i++){
+		// El contenido se genera fuera de la medicion; el hash forma parte del add
+		write_file(filename, size, idClient + i);
+		double start = now();
+		request.request = ADD;
+		if(send_first_request(socket, &request) == OK && add((char *)filename, "bench", socket) == VERSION_ADDED)
+			add_result->count++;
+		add_result->seconds += now() - start;
+	}
+
+	for(int i = 1; i <= iterations; i++){
+		double start = now();
+		request.request = GET;
+		if(send_first_request(socket, &request) == OK && get((char *)filename, i, socket) == VERSION_ADDED)
+			get_result->count++;
+		get_result->seconds += now() - start;
+	}
+}
+
+/**
+ * @brief Imprime una fila de resultados
+ */
+static void report(FILE * out, const char * transport, const char * op, struct bench_result * result, size_t size) {
+	if(result->count == 0){
+		fprintf(out, "%-8s %-4s %6s\n", transport, op, "failed");
+		return;
+	}
+	double avg = result->seconds / result->count;
+	fprintf(out, "%-8s %-4s %6d ops %10.3f ms/op %10.2f MB/s\n", transport, op, result->count,
+			avg * 1e3, size * (double)result->count / result->seconds / (1024 * 1024));
+}
+
+int main(int argc, char * argv[]) {
+	if(argc < 3 || argc > 5){
+		printf("Uso: transport_bench PORT SOCKET [TAMANIO_BYTES] [ITERACIONES]\n");
+		return EXIT_FAILURE;
+	}
+	int port = atoi(argv[1]);
+	const char * localPath = argv[2];
+	size_t size = argc > 3 ? strtoull(argv[3], NULL, 10) : 1024 * 1024;
+	int iterations = argc > 4 ? atoi(argv[4]) : 50;
+	if(port <= 0 || size == 0 || iterations <= 0){
+		printf("Argumentos invalidos\n");
+		return EXIT_FAILURE;
+	}
+
+	int tcp = connect_to_server("127.0.0.1", port);
+	int local = connect_to_server(localPath, 0);
+	if(tcp == -1 || local == -1)
+		return EXIT_FAILURE;
+
+	// Los mensajes del cliente se descartan, los resultados van a la salida original
+	FILE * out = fdopen(dup(STDOUT_FILENO), "w");
+	if(out == NULL || freopen("/dev/null", "w", stdout) == NULL)
+		return EXIT_FAILURE;
+
+	char dir[] = "/tmp/transport_bench.XXXXXX";
+	if(mkdtemp(dir) == NULL || chdir(dir) != 0){
+		perror("mkdtemp");
+		return EXIT_FAILURE;
+	}
+
+	// Ids distintos por corrida para no chocar con versiones previas
+	srand(time(NULL) ^ getpid());
+	int idClient = rand() % 1000000 + 1;
+	struct bench_result tcpAdd, tcpGet, localAdd, localGet;
+	run_transport(tcp, idClient, "bench-tcp", size, iterations, &tcpAdd, &tcpGet);
+	run_transport(local, idClient, "bench-local", size, iterations, &localAdd, &localGet);
+
+	fprintf(out, "file size %zu bytes, %d iterations\n", size, iterations);
+	report(out, "tcp", "add", &tcpAdd, size);
+	report(out, "tcp", "get", &tcpGet, size);
+	report(out, "unix", "add", &localAdd, size);
+	report(out, "unix", "get", &localGet, size);
+
+	unlink("bench-tcp");
+	unlink("bench-local");
+	chdir("/");
+	rmdir(dir);
+	close(tcp);
+	close(local);
+	fclose(out);
+	return EXIT_SUCCESS;
+}
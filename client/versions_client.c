@@ -7,8 +7,16 @@
  * @copyright MIT License
 */
 
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+
 #include "versions_client.h"
 
+#define DELTA_MAX_LITERAL (1024 * 1024) /**< Maximo de contenido nuevo por instruccion */
+
 
 /**
  * @brief Crea una version en memoria del archivo
@@ -72,6 +80,90 @@ int retrieve_file(char * filename, char * hash, int socket, int sizeFile);
  */
 int getFileSize(char * filename);
 
+/**
+ * @brief Estado de la generacion de instrucciones de un add por diferencias.
+ */
+struct delta_state {
+	int socket;                         /**< socket de conexion */
+	const uint8_t * data;               /**< contenido del archivo */
+	size_t blockSize;                   /**< tamanio de bloque */
+	int copyBlock;                      /**< primer bloque de la copia pendiente */
+	size_t copyLength;                  /**< bytes de la copia pendiente */
+};
+
+/**
+ * @brief Envia las instrucciones para reconstruir un archivo a partir de las
+ * firmas de su version anterior.
+ *
+ * @param socket socket de conexion
+ * @param data contenido del archivo
+ * @param size tamanio del archivo
+ * @param header encabezado de las firmas
+ * @param signatures firmas de los bloques de la version anterior
+ * @return OK,ERROR_SOCKET,CLIENT_DISCONECT,INVALID_RESPONSE,ERROR,
+ */
+status_operation_socket send_delta(int socket, const uint8_t * data, size_t size, struct delta_signature_header * header, struct block_signature * signatures);
+
+/**
+ * @brief Crea los directorios padres de una ruta (como mkdir -p)
+ *
+ * @param path Ruta del archivo
+ */
+void make_parent_dirs(char * path);
+
+/**
+ * @brief Verifica que una ruta enviada por el servidor quede dentro del
+ * directorio actual: relativa y sin componentes "..".
+ *
+ * @param path Ruta del archivo
+ * @return 1 si la ruta es segura, 0 en caso contrario
+ */
+int safe_relative_path(const char * path);
+
+
+int connect_to_server(const char * address, int port) {
+	struct sockaddr_storage server_addr;
+	socklen_t len;
+	memset(&server_addr, 0, sizeof(server_addr));
+
+	if(port == 0){
+		struct sockaddr_un * local_addr = (struct sockaddr_un *)&server_addr;
+		if(strlen(address) >= sizeof(local_addr->sun_path)){
+			printf("Ruta del socket invalida\n");
+			return -1;
+		}
+		local_addr->sun_family = AF_UNIX;
+		strcpy(local_addr->sun_path, address);
+		len = sizeof(struct sockaddr_un);
+	}else{
+		struct sockaddr_in * inet_addr = (struct sockaddr_in *)&server_addr;
+		inet_addr->sin_family = AF_INET;
+		inet_addr->sin_port = htons(port);
+		//Convertimos la ip en el formato necesario
+		if(inet_pton(AF_INET, address, &inet_addr->sin_addr) <= 0){
+			printf("Direccion ip invalida\n");
+			return -1;
+		}
+		len = sizeof(struct sockaddr_in);
+	}
+
+	int client_socket = socket(server_addr.ss_family, SOCK_STREAM, 0);
+	if(client_socket == -1){
+		perror("Error al crear el socekt");
+		return -1;
+	}
+	if(connect(client_socket, (struct sockaddr *)&server_addr, len) == -1){
+		perror("Error al intentar conectarse con el servidor");
+		close(client_socket);
+		return -1;
+	}
+	//Los mensajes del protocolo son pequenos y de ida y vuelta: sin Nagle
+	if(port != 0){
+		int nodelay = 1;
+		setsockopt(client_socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+	}
+	return client_socket;
+}
 
 return_code create_version(char * filename, char * comment, file_version * result) {
 	file_version v;
@@ -101,6 +193,8 @@ return_code create_version(char * filename, char * comment, file_version * resul
 
 }
 
+int retryAfter = 0;
+
 return_code add(char * filename, char * comment, int client_socket) {
 	
 	file_version v;
@@ -111,7 +205,13 @@ return_code add(char * filename, char * comment, int client_socket) {
 
 	// 1. Crea la nueva version en memoria
 
-	create_version(filename, comment, &v);
+	if(create_version(filename, comment, &v) != VERSION_CREATED){
+		//La solicitud ya se anuncio y no se puede completar sin el hash: se cierra
+		//el envio para que el servidor la descarte, y la siguiente orden reconecta
+		printf("-----------No se pudo obtener el hash de %s------------\n", filename);
+		shutdown(client_socket, SHUT_WR);
+		return VERSION_ERROR;
+	}
 	strncpy(versionsSend.hashFile, v.hash, sizeof(versionsSend.hashFile) - 1);
     versionsSend.hashFile[sizeof(versionsSend.hashFile) - 1] = '\0'; 
 	
@@ -128,8 +228,8 @@ return_code add(char * filename, char * comment, int client_socket) {
 		return VERSION_ERROR;
 	}
 
-
-	
+	if(status == VERSION_RETRY_LATER)
+		return receive_retry_after(client_socket, &retryAfter) == OK ? VERSION_RETRY_LATER : VERSION_ERROR;
 	
 	if(status == VERSION_ALREADY_EXISTS){
 		printf("-----------la version ya existe en el servidor!-------------\n");
@@ -219,6 +319,51 @@ void list(char * filename, int socket) {
 	}
 }
 
+status_operation_socket stats(int socket) {
+	char elementList[SIZE_ELEMENT_LIST];
+	while(1){
+		status_operation_socket status = receive_element_list(socket, elementList);
+		if(status != OK)
+			return status;
+		elementList[SIZE_ELEMENT_LIST - 1] = '\0';
+		if(strcmp(elementList, "END") == 0)
+			return OK;
+		printf("%s\n", elementList);
+	}
+}
+
+status_operation_socket trace(int socket, int rate, char * destination) {
+	struct file_request request;
+	memset(&request, 0, sizeof(request));
+	request.version = rate;
+	if(destination != NULL){
+		strncpy(request.nameFile, destination, PATH_MAX - 1);
+		request.sizeNameFile = strlen(request.nameFile);
+	}
+	status_operation_socket status = send_file_request(socket, &request);
+	struct file_transfer transfer;
+	if(status == OK)
+		status = receive_file_transfer(socket, &transfer);
+	if(status != OK)
+		return status;
+	transfer.comment[COMMENT_SIZE - 1] = '\0';
+	printf("%s\n", transfer.comment);
+	if(transfer.filseSize == 0)
+		return OK;
+
+	//Siempre se recibe el contenido, aunque no se pueda guardar, para no desfasar el socket
+	int file = open(destination, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(file < 0){
+		perror(destination);
+		file = open("/dev/null", O_WRONLY);
+	}
+	status = receive_file_data(socket, file, transfer.filseSize);
+	close(file);
+	if(status == OK)
+		printf("Trazas guardadas en %s (%zu bytes)\n", destination, transfer.filseSize);
+	return status;
+}
+
 char *get_file_hash(char * filename, char * hash) {
 	char *comando;
 	FILE * fp;
@@ -230,8 +375,11 @@ char *get_file_hash(char * filename, char * hash) {
 		return NULL;
 	}
 
-	//Generar el comando para obtener el hash
-	sha256_hash_file_hex(filename, hash);
+	//Calcular el hash; un error de lectura no debe dejar un hash vacio
+	if (sha256_hash_file_hex(filename, hash) != 0) {
+		perror("sha256");
+		return NULL;
+	}
 
 	return hash;
 
@@ -298,7 +446,17 @@ int get(char * filename, int version, int socket) {
 		return VERSION_NOT_EXISTS;
 	}
 	
-	if(receive_file(socket, filename) != 0){
+	status_operation_socket received;
+	if(pass_file_descriptor(socket_is_local(socket), info_file.filseSize)){
+		// Servidor local: envia el descriptor del archivo en lugar de su contenido
+		int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		received = receive_file_descriptor(socket, fd, info_file.filseSize);
+		if(fd >= 0)
+			close(fd);
+	}else{
+		received = receive_file(socket, filename);
+	}
+	if(received != OK){
 		printf("------Error al recibir el archivo---------- \n");
 		return VERSION_ERROR;
 	}
@@ -329,4 +487,382 @@ int getFileSize(char * filename){
 	return st.st_size;
 }
 
+return_code add_batch(char ** filenames, int count, char * comment, int socket) {
+	struct batch_header header;
+	header.count = count;
+	if(send_batch_header(socket, &header) != OK){
+		printf("--------------Falla escritura----------- \n");
+		return VERSION_ERROR;
+	}
+
+	// 1. Enviar el manifiesto: nombre, hash, tamanio y comentario de cada archivo.
+	//    Los hashes se calculan todos juntos: los archivos pequenios van en paralelo
+	//    por los carriles SIMD en lugar de uno tras otro
+	char * hashes = malloc((count > 0 ? count : 1) * 65);
+	if(hashes == NULL)
+		return VERSION_ERROR;
+	sha256_hash_files_hex(filenames, count, hashes);
+	for(int i = 0; i < count; i++){
+		struct batch_add_entry entry;
+		memset(&entry, 0, sizeof(entry));
+		if(hashes[i * 65] == '\0'){
+			printf("-----------No se pudo obtener el hash de %s------------\n", filenames[i]);
+			free(hashes);
+			return VERSION_ERROR;
+		}
+		strcpy(entry.hashFile, &hashes[i * 65]);
+		entry.fileSize = getFileSize(filenames[i]);
+		strncpy(entry.comment, comment, sizeof(entry.comment) - 1);
+		if(send_batch_add_entry(socket, &entry, filenames[i]) != OK){
+			printf("--------------Falla escritura----------- \n");
+			free(hashes);
+			return VERSION_ERROR;
+		}
+	}
+	free(hashes);
+
+	// 2. Recibir los indices de los archivos que necesita el servidor
+	int * needed = malloc((count > 0 ? count : 1) * sizeof(int));
+	int countNeeded;
+	if(needed == NULL)
+		return VERSION_ERROR;
+	if(receive_batch_indexes(socket, needed, count, &countNeeded) != OK){
+		printf("-----------------¡Falla al recibir del servidor!-----------------\n");
+		free(needed);
+		return VERSION_ERROR;
+	}
+	if(countNeeded == BATCH_RETRY_LATER){
+		retryAfter = needed[0];
+		free(needed);
+		return VERSION_RETRY_LATER;
+	}
+
+	// 3. Enviar los contenidos uno tras otro
+	for(int i = 0; i < countNeeded; i++){
+		if(send_file(socket, filenames[needed[i]]) != OK){
+			printf("-------------Error al mandar el archivo %s---------\n", filenames[needed[i]]);
+			free(needed);
+			return VERSION_ERROR;
+		}
+	}
+	free(needed);
+
+	return_code status;
+	if(receive_status_code(socket, &status) != OK){
+		printf("--------Error de conexion------------  \n");
+		return VERSION_ERROR;
+	}
+	if(status == VERSION_ALREADY_EXISTS){
+		printf("-----------las versiones ya existen en el servidor!-------------\n");
+		return status;
+	}
+	if(status != VERSION_ADDED){
+		printf("-------------Error al agregar el lote-------- \n");
+		return VERSION_ERROR;
+	}
+	printf("--------Se agregaron %d archivos al servidor (%d enviados) ------- \n", count, countNeeded);
+	return VERSION_ADDED;
+}
+
+return_code get_batch(char ** filenames, int * versions, int count, int socket) {
+	struct batch_header header;
+	header.count = count;
+	if(send_batch_header(socket, &header) != OK){
+		printf("--------------Falla escritura----------- \n");
+		return VERSION_ERROR;
+	}
+	for(int i = 0; i < count; i++){
+		struct batch_get_entry entry;
+		entry.version = versions[i];
+		if(send_batch_get_entry(socket, &entry, filenames[i]) != OK){
+			printf("--------------Falla escritura----------- \n");
+			return VERSION_ERROR;
+		}
+	}
+
+	// Escribir cada archivo a medida que llega, hasta el encabezado vacio.
+	// Un servidor local envia descriptores de archivo en lugar del contenido
+	int local = socket_is_local(socket);
+	int received = 0;
+	int missing = 0;
+	int rejected = 0;
+	int entry = 0;
+	while(1){
+		struct batch_file_header fileHeader;
+		char filename[PATH_MAX];
+		if(receive_batch_file_header(socket, &fileHeader, filename) != OK){
+			printf("--------Error de conexion------------  \n");
+			return VERSION_ERROR;
+		}
+		if(fileHeader.sizeNameFile == 0)
+			break;
+		// Con una lista solo se aceptan los archivos pedidos, en el mismo orden;
+		// sin lista, solo rutas relativas que no salgan del directorio actual
+		int accepted = count > 0
+			? entry < count && strcmp(filename, filenames[entry]) == 0 && fileHeader.version == versions[entry]
+			: safe_relative_path(filename);
+		entry++;
+		if(!accepted){
+			printf("------------- %s version %d no fue pedido o es una ruta insegura, se descarta-------------\n", filename, fileHeader.version);
+			rejected++;
+		}
+		if(fileHeader.status != VERSION_ADDED){
+			if(accepted){
+				printf("------------- %s version %d no se encuentra en el repositorio-------------\n", filename, fileHeader.version);
+				missing++;
+			}
+			continue;
+		}
+
+		// El contenido de un archivo descartado se consume igual, para no
+		// desincronizar el flujo
+		if(accepted)
+			make_parent_dirs(filename);
+		int fd = accepted ? open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644) : open("/dev/null", O_WRONLY);
+		if(fd < 0){
+			perror("------Error al crear el archivo----------");
+			return VERSION_ERROR;
+		}
+		status_operation_socket status = pass_file_descriptor(local, fileHeader.fileSize) ? receive_file_descriptor(socket, fd, fileHeader.fileSize) : receive_file_data(socket, fd, fileHeader.fileSize);
+		close(fd);
+		if(status != OK){
+			printf("------Error al recibir el archivo %s---------- \n", filename);
+			return VERSION_ERROR;
+		}
+		if(accepted)
+			received++;
+	}
+	printf("----------------%d versiones recuperadas, %d no encontradas --------\n", received, missing);
+	if(rejected > 0){
+		printf("----------------%d archivos descartados --------\n", rejected);
+		return VERSION_ERROR;
+	}
+	return received > 0 ? VERSION_ADDED : VERSION_NOT_EXISTS;
+}
+
+int safe_relative_path(const char * path) {
+	if(path[0] == '\0' || path[0] == '/')
+		return 0;
+	for(const char * c = path; *c; ){
+		size_t length = strcspn(c, "/");
+		if(length == 2 && c[0] == '.' && c[1] == '.')
+			return 0;
+		c += length;
+		if(*c == '/')
+			c++;
+	}
+	return 1;
+}
+
+void make_parent_dirs(char * path) {
+	char dir[PATH_MAX];
+	strncpy(dir, path, PATH_MAX - 1);
+	dir[PATH_MAX - 1] = '\0';
+	for(char * c = dir + 1; *c; c++){
+		if(*c != '/')
+			continue;
+		*c = '\0';
+		mkdir(dir, 0755);
+		*c = '/';
+	}
+}
+
+return_code add_delta(char * filename, char * comment, int socket) {
+	file_version v;
+	return_code status;
+	struct file_request versionsSend;
+	memset(&versionsSend, 0, sizeof(versionsSend));
+	strncpy(versionsSend.nameFile, filename, sizeof(versionsSend.nameFile) - 1);
+
+	// 1. Enviar nombre y hash, el servidor responde si la version ya existe
+	if(create_version(filename, comment, &v) != VERSION_CREATED)
+		return VERSION_ERROR;
+	strncpy(versionsSend.hashFile, v.hash, sizeof(versionsSend.hashFile) - 1);
+	if(send_file_request(socket, &versionsSend) != OK || receive_status_code(socket, &status) != OK){
+		printf("-----------------¡Falla al comunicarse con el servidor!-----------------\n");
+		return VERSION_ERROR;
+	}
+	if(status == VERSION_RETRY_LATER)
+		return receive_retry_after(socket, &retryAfter) == OK ? VERSION_RETRY_LATER : VERSION_ERROR;
+	if(status == VERSION_ALREADY_EXISTS){
+		printf("-----------la version ya existe en el servidor!-------------\n");
+		return status;
+	}
+
+	// 2. Enviar tamanio y comentario, recibir las firmas de la ultima version
+	int fd = open(filename, O_RDONLY);
+	struct stat st;
+	if(fd < 0 || fstat(fd, &st) != 0){
+		perror("--------------!error al abrir el archivo");
+		if(fd >= 0)
+			close(fd);
+		return VERSION_ERROR;
+	}
+	struct file_transfer sendVersionsTransfer;
+	memset(&sendVersionsTransfer, 0, sizeof(sendVersionsTransfer));
+	sendVersionsTransfer.filseSize = st.st_size;
+	strncpy(sendVersionsTransfer.comment, comment, sizeof(sendVersionsTransfer.comment) - 1);
+
+	struct delta_signature_header header;
+	struct block_signature * signatures;
+	if(send_file_transfer(socket, &sendVersionsTransfer) != OK || receive_delta_signatures(socket, &header, &signatures) != OK){
+		printf("-----------------¡Falla al comunicarse con el servidor!-----------------\n");
+		close(fd);
+		return VERSION_ERROR;
+	}
+
+	// 3. Enviar las instrucciones para reconstruir el archivo
+	const uint8_t * data = NULL;
+	if(st.st_size > 0){
+		data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if(data == MAP_FAILED){
+			perror("--------------!error al leer el archivo");
+			close(fd);
+			free(signatures);
+			return VERSION_ERROR;
+		}
+		madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+	}
+	close(fd);
+	status_operation_socket result = send_delta(socket, data, st.st_size, &header, signatures);
+	if(data != NULL)
+		munmap((void *)data, st.st_size);
+	free(signatures);
+	if(result != OK){
+		printf("-------------Error al mandar el archivo---------\n");
+		return VERSION_ERROR;
+	}
+
+	if(receive_status_code(socket, &status) != OK || status != VERSION_ADDED){
+		printf("-------------Error al agregar-------- \n");
+		return VERSION_ERROR;
+	}
+	printf("--------Se agrego el archivo al servidor ------- \n");
+	return VERSION_ADDED;
+}
+
+/**
+ * @brief Envia la copia pendiente, si hay una.
+ */
+static status_operation_socket flush_copy(struct delta_state * state) {
+	if(state->copyLength == 0)
+		return OK;
+	struct delta_op op = { DELTA_COPY, state->copyBlock, state->copyLength };
+	state->copyLength = 0;
+	return send_delta_op(state->socket, &op, NULL);
+}
+
+/**
+ * @brief Envia el contenido nuevo entre from y to, despues de la copia pendiente.
+ */
+static status_operation_socket flush_literal(struct delta_state * state, size_t from, size_t to) {
+	if(to <= from)
+		return OK;
+	status_operation_socket status = flush_copy(state);
+	if(status != OK)
+		return status;
+	struct delta_op op = { DELTA_LITERAL, 0, to - from };
+	return send_delta_op(state->socket, &op, state->data + from);
+}
+
+/**
+ * @brief Busca un bloque de la version anterior igual a la ventana actual.
+ * Prefiere el bloque que continua la copia pendiente para poder unirlas.
+ * @return indice del bloque, -1 si no hay coincidencia
+ */
+static int find_block(struct delta_state * state, const uint8_t * window, uint32_t weak, int * heads, int * next, size_t mask, struct block_signature * signatures, int count) {
+	struct block_signature signature;
+	int strong = 0;
+	int expected = state->copyLength > 0 ? state->copyBlock + (int)(state->copyLength / state->blockSize) : -1;
+
+	if(heads[weak & mask] == 0)
+		return -1;
+	for(int i = heads[weak & mask] - 1; i >= 0; i = next[i]){
+		if(signatures[i].weak != weak)
+			continue;
+		if(!strong){
+			delta_block_signature(window, state->blockSize, &signature);
+			strong = 1;
+		}
+		if(memcmp(signature.strong, signatures[i].strong, DELTA_STRONG_SIZE) != 0)
+			continue;
+		if(expected >= 0 && expected < count && expected != i
+				&& signatures[expected].weak == weak
+				&& memcmp(signature.strong, signatures[expected].strong, DELTA_STRONG_SIZE) == 0)
+			return expected;
+		return i;
+	}
+	return -1;
+}
+
+status_operation_socket send_delta(int socket, const uint8_t * data, size_t size, struct delta_signature_header * header, struct block_signature * signatures) {
+	struct delta_state state = { socket, data, header->blockSize, 0, 0 };
+	size_t blockSize = header->blockSize;
+	int count = header->blockCount;
+	status_operation_socket status = OK;
+	size_t literal = 0;
+	size_t pos = 0;
+
+	// Tabla hash de los checksums debiles, encadenando los bloques que colisionan
+	size_t tableSize = 1;
+	while(tableSize < (size_t)count * 2)
+		tableSize <<= 1;
+	int * heads = calloc(tableSize, sizeof(int));
+	int * next = malloc((count > 0 ? count : 1) * sizeof(int));
+	if(heads == NULL || next == NULL){
+		free(heads);
+		free(next);
+		return ERROR;
+	}
+	for(int i = count - 1; i >= 0; i--){
+		next[i] = heads[signatures[i].weak & (tableSize - 1)] - 1;
+		heads[signatures[i].weak & (tableSize - 1)] = i + 1;
+	}
 
+	struct delta_rolling rolling;
+	int rollingValid = 0;
+	while(count > 0 && pos + blockSize <= size && status == OK){
+		if(!rollingValid){
+			delta_rolling_init(&rolling, data + pos, blockSize);
+			rollingValid = 1;
+		}
+
+		int block = find_block(&state, data + pos, delta_rolling_value(&rolling), heads, next, tableSize - 1, signatures, count);
+		if(block >= 0){
+			status = flush_literal(&state, literal, pos);
+			if(status == OK && state.copyLength > 0 && block != state.copyBlock + (int)(state.copyLength / blockSize))
+				status = flush_copy(&state);
+			if(state.copyLength == 0)
+				state.copyBlock = block;
+			state.copyLength += blockSize;
+			pos += blockSize;
+			literal = pos;
+			rollingValid = 0;
+			continue;
+		}
+
+		if(pos + blockSize < size)
+			delta_rolling_roll(&rolling, data[pos], data[pos + blockSize]);
+		pos++;
+		if(pos - literal >= DELTA_MAX_LITERAL){
+			status = flush_literal(&state, literal, pos);
+			literal = pos;
+		}
+	}
+	free(heads);
+	free(next);
+
+	// El resto del archivo se envia como contenido nuevo
+	while(status == OK && literal < size){
+		size_t to = size - literal > DELTA_MAX_LITERAL ? literal + DELTA_MAX_LITERAL : size;
+		status = flush_literal(&state, literal, to);
+		literal = to;
+	}
+	if(status == OK)
+		status = flush_copy(&state);
+	if(status != OK)
+		return status;
+
+	struct delta_op end = { DELTA_END, 0, 0 };
+	return send_delta_op(socket, &end, NULL);
+}
@@ -20,6 +20,8 @@
 
 #include "../common/sha256.h"
 #include "../common/protocol.h"
+#include "../common/delta.h"
+#include "../common/trace.h"
 
 #define VERSIONS_DB "versions.db" /**< Nombre de la base de datos de versiones. */
 #define VERSIONS_DIR ".versions" /**< Directorio del repositorio. */
@@ -27,6 +29,8 @@
 
 #define EQUALS(s1, s2) (strcmp(s1, s2) == 0) /**< Verdadero si dos cadenas son iguales.*/
 
+extern int retryAfter; /**< Segundos a esperar cuando una subida devuelve VERSION_RETRY_LATER. */
+
 /**
  * @brief Version de un archivo.
  * Para cada version de un archivo se almacena el nombre original,
@@ -41,13 +45,23 @@ typedef  struct __attribute__((aligned(512))) {
 }file_version;
 
 
+/**
+ * @brief Se conecta al servidor por TCP, o por un socket Unix si port es 0.
+ *
+ * @param address IP del servidor, o ruta del socket Unix
+ * @param port Puerto del servidor, 0 para usar el socket Unix
+ * @return socket conectado, -1 si ocurre un error
+ */
+int connect_to_server(const char * address, int port);
+
 /**
  * @brief Adiciona un archivo al repositorio.
  *
  * @param filename Nombre del archivo a adicionar
  * @param comment Comentario de la version actual
  * @param socket socket to write 
- * @return Codigo de la operacion
+ * @return Codigo de la operacion, VERSION_RETRY_LATER si el servidor esta
+ *         ocupado (hay que esperar retryAfter segundos y repetir la solicitud)
  */
 return_code add(char * filename, char * comment, int socket);
 
@@ -58,6 +72,26 @@ return_code add(char * filename, char * comment, int socket);
  */
 void list(char * filename, int socket);
 
+/**
+ * @brief Muestra las estadisticas del servidor, una linea por contador o
+ * histograma hasta el END.
+ *
+ * @param socket socket de conexion
+ * @return OK,ERROR_SOCKET,CLIENT_DISCONECT,INVALID_RESPONSE,ERROR,
+ */
+status_operation_socket stats(int socket);
+
+/**
+ * @brief Cambia la tasa de muestreo de las trazas del servidor y, si se indica
+ * un destino, descarga las trazas en formato Chrome trace (JSON).
+ *
+ * @param socket socket de conexion
+ * @param rate solicitudes trazadas por millon, TRACE_KEEP_RATE para no cambiarla
+ * @param destination archivo donde guardar las trazas, NULL para no pedirlas
+ * @return OK,ERROR_SOCKET,CLIENT_DISCONECT,INVALID_RESPONSE,ERROR,
+ */
+status_operation_socket trace(int socket, int rate, char * destination);
+
 /**
  * @brief Obtiene una version del un archivo.
  * Sobreescribe la version existente.
@@ -67,4 +101,47 @@ void list(char * filename, int socket);
  */
 int get(char * filename, int version, int socket);
 
+/**
+ * @brief Adiciona varios archivos al repositorio en una sola solicitud.
+ * Envia el manifiesto de los archivos, recibe los indices de los archivos
+ * cuyo contenido necesita el servidor y los envia uno tras otro.
+ *
+ * @param filenames Nombres de los archivos a adicionar
+ * @param count Cantidad de archivos
+ * @param comment Comentario de la version de todos los archivos
+ * @param socket socket to write
+ * @return Codigo de la operacion, VERSION_RETRY_LATER si el servidor esta
+ *         ocupado (hay que esperar retryAfter segundos y repetir la solicitud)
+ */
+return_code add_batch(char ** filenames, int count, char * comment, int socket);
+
+/**
+ * @brief Obtiene varias versiones en un solo flujo.
+ * Cada archivo se escribe a medida que llega, creando sus directorios.
+ * Con una lista solo se escriben los archivos y versiones pedidos, en orden;
+ * sin lista solo rutas relativas sin "..". El resto se descarta.
+ *
+ * @param filenames Nombres de los archivos, NULL (con count 0) para obtener
+ *        la ultima version de todos los archivos del cliente
+ * @param versions Numero secuencial de la version de cada archivo
+ * @param count Cantidad de archivos
+ * @param socket socket de conexion
+ * @return Codigo de la operacion, VERSION_ERROR si se descarto algun archivo
+ */
+return_code get_batch(char ** filenames, int * versions, int count, int socket);
+
+/**
+ * @brief Adiciona un archivo enviando solo sus cambios respecto a la ultima version.
+ * Recibe las firmas de los bloques de la ultima version guardada, busca esos
+ * bloques en el archivo con un checksum rodante y envia instrucciones de copia
+ * para los que coinciden y el contenido nuevo para el resto.
+ *
+ * @param filename Nombre del archivo a adicionar
+ * @param comment Comentario de la version actual
+ * @param socket socket to write
+ * @return Codigo de la operacion, VERSION_RETRY_LATER si el servidor esta
+ *         ocupado (hay que esperar retryAfter segundos y repetir la solicitud)
+ */
+return_code add_delta(char * filename, char * comment, int socket);
+
 #endif
@@ -0,0 +1,48 @@
+/**
+ * @file
+ * @brief Implementacion de las firmas de bloques y el checksum rodante
+ * @copyright MIT License
+ */
+
+#include "delta.h"
+#include "sha256.h"
+
+size_t delta_block_size(size_t fileSize) {
+	size_t size = 1024;
+	while (size * size < fileSize)
+		size += 1024;
+	if (size < DELTA_MIN_BLOCK)
+		return DELTA_MIN_BLOCK;
+	if (size > DELTA_MAX_BLOCK)
+		return DELTA_MAX_BLOCK;
+	return size;
+}
+
+void delta_rolling_init(struct delta_rolling *rolling, const uint8_t *data, size_t size) {
+	rolling->a = 0;
+	rolling->b = 0;
+	rolling->size = size;
+	for (size_t i = 0; i < size; i++) {
+		rolling->a += data[i];
+		rolling->b += (uint32_t)(size - i) * data[i];
+	}
+}
+
+void delta_rolling_roll(struct delta_rolling *rolling, uint8_t out, uint8_t in) {
+	rolling->a += in - out;
+	rolling->b += rolling->a - (uint32_t)rolling->size * out;
+}
+
+uint32_t delta_rolling_value(const struct delta_rolling *rolling) {
+	return (rolling->a & 0xffff) | (rolling->b << 16);
+}
+
+void delta_block_signature(const uint8_t *data, size_t size, struct block_signature *signature) {
+	struct delta_rolling rolling;
+	uint8_t hash[32];
+
+	delta_rolling_init(&rolling, data, size);
+	signature->weak = delta_rolling_value(&rolling);
+	sha256_hash(data, size, hash);
+	memcpy(signature->strong, hash, DELTA_STRONG_SIZE);
+}
@@ -0,0 +1,66 @@
+/**
+ * @file
+ * @brief Firmas de bloques y checksum rodante para enviar solo los cambios de un archivo
+ * @copyright MIT License
+ */
+
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "protocol.h"
+
+#define DELTA_MIN_BLOCK 2048   /**< Tamanio minimo de bloque */
+#define DELTA_MAX_BLOCK 131072 /**< Tamanio maximo de bloque */
+
+/**
+ * @brief Checksum rodante (estilo rsync) de una ventana de bytes
+ */
+struct delta_rolling {
+    uint32_t a;    /**< Suma de los bytes de la ventana */
+    uint32_t b;    /**< Suma ponderada por la posicion */
+    size_t   size; /**< Tamanio de la ventana */
+};
+
+/**
+ * @brief Elige el tamanio de bloque para un archivo (raiz cuadrada del tamanio,
+ * redondeada a 1KB y limitada entre DELTA_MIN_BLOCK y DELTA_MAX_BLOCK)
+ * @param fileSize tamanio del archivo
+ * @return tamanio de bloque
+ */
+size_t delta_block_size(size_t fileSize);
+
+/**
+ * @brief Calcula el checksum rodante de una ventana
+ * @param rolling estado a inicializar
+ * @param data inicio de la ventana
+ * @param size tamanio de la ventana
+ */
+void delta_rolling_init(struct delta_rolling *rolling, const uint8_t *data, size_t size);
+
+/**
+ * @brief Desplaza la ventana un byte
+ * @param rolling estado del checksum
+ * @param out byte que sale de la ventana
+ * @param in byte que entra a la ventana
+ */
+void delta_rolling_roll(struct delta_rolling *rolling, uint8_t out, uint8_t in);
+
+/**
+ * @brief Valor del checksum rodante
+ * @param rolling estado del checksum
+ * @return checksum de 32 bits
+ */
+uint32_t delta_rolling_value(const struct delta_rolling *rolling);
+
+/**
+ * @brief Calcula la firma de un bloque
+ * @param data contenido del bloque
+ * @param size tamanio del bloque
+ * @param signature firma calculada
+ */
+void delta_block_signature(const uint8_t *data, size_t size, struct block_signature *signature);
+
+#endif
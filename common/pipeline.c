@@ -0,0 +1,321 @@
+/**
+ * @file
+ * @brief Recepcion de archivos por etapas: red, hash y disco en hilos
+ * distintos, unidas por colas acotadas y un pool de buffers
+ * @copyright MIT License
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "pipeline.h"
+#include "uring.h"
+
+/**
+ * @brief Cola acotada de buffers entre dos etapas. Nunca se llena: caben todos
+ * los buffers del pool, y la etapa de red espera un buffer libre antes de encolar
+ */
+struct pipeline_queue {
+    struct pipeline_chunk **items; /**< Buffers encolados (anillo) */
+    int head;                      /**< Siguiente a sacar */
+    int count;                     /**< Buffers encolados */
+    pthread_cond_t ready;          /**< Se senala al encolar */
+};
+
+/**
+ * @brief Archivo que se esta recibiendo por etapas
+ */
+struct pipeline_upload {
+    int file;                         /**< Archivo destino */
+    off_t start;                      /**< Posicion del archivo donde empieza el contenido */
+    struct sha256_buff *sha;          /**< Hash a actualizar, NULL si no se calcula */
+    struct pipeline_queue *hashQueue; /**< Cola del hilo de hash que atiende este archivo */
+    int pending;                      /**< Buffers encolados que el disco no ha terminado */
+    int error;                        /**< errno del primer fallo de escritura, 0 si no hubo */
+    pthread_cond_t done;              /**< Se senala cuando pending llega a 0 */
+};
+
+/**
+ * @brief Buffer del pool con el trozo de archivo que lleva
+ */
+struct pipeline_chunk {
+    struct pipeline_upload *upload; /**< Archivo al que pertenece */
+    char *data;                     /**< PIPELINE_CHUNK_SIZE bytes */
+    size_t length;                  /**< Bytes validos */
+    off_t offset;                   /**< Posicion dentro del archivo */
+};
+
+static int buffers = 0;                        /**< Buffers del pool, 0 si no se inicio */
+static struct pipeline_chunk *chunks = NULL;   /**< Todos los buffers */
+static struct pipeline_chunk **freeChunks;     /**< Pila de buffers libres */
+static int freeCount = 0;                      /**< Buffers libres */
+static struct pipeline_queue *hashQueues;      /**< De la red al hash, una por hilo de hash */
+static int hashers = 0;                        /**< Hilos de hash */
+static unsigned long nextHasher = 0;           /**< Reparte los archivos entre los hilos de hash */
+static struct pipeline_queue diskQueue;        /**< Del hash al disco */
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;  /**< Protege pool, colas, cargas y contadores */
+static pthread_cond_t chunkFree = PTHREAD_COND_INITIALIZER; /**< Se senala al liberar un buffer */
+static struct pipeline_stage_stats stats[PIPELINE_STAGES];  /**< Contadores por etapa */
+static struct timespec started;                /**< Momento en que se iniciaron las etapas */
+
+static unsigned long long elapsed_ns(const struct timespec *from) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - from->tv_sec) * 1000000000ULL + now.tv_nsec - from->tv_nsec;
+}
+
+/**
+ * @brief Encola un buffer para la etapa stage, con el mutex tomado
+ */
+static void queue_push(struct pipeline_queue *queue, enum pipeline_stage stage, struct pipeline_chunk *chunk) {
+    queue->items[(queue->head + queue->count) % buffers] = chunk;
+    queue->count++;
+    stats[stage].depth++;
+    stats[stage].depthSum += stats[stage].depth;
+    if (stats[stage].depth > stats[stage].maxDepth)
+        stats[stage].maxDepth = stats[stage].depth;
+    pthread_cond_signal(&queue->ready);
+}
+
+/**
+ * @brief Saca el siguiente buffer para la etapa stage, esperando si no hay, con el mutex tomado
+ */
+static struct pipeline_chunk *queue_pop(struct pipeline_queue *queue, enum pipeline_stage stage) {
+    while (queue->count == 0)
+        pthread_cond_wait(&queue->ready, &mutex);
+    struct pipeline_chunk *chunk = queue->items[queue->head];
+    queue->head = (queue->head + 1) % buffers;
+    queue->count--;
+    stats[stage].depth--;
+    return chunk;
+}
+
+/**
+ * @brief Etapa de hash: los buffers de un archivo llegan en orden porque los
+ * encola un solo hilo de red y los atiende siempre el mismo hilo de hash
+ * @param arg cola del hilo
+ */
+static void *pipeline_hasher(void *arg) {
+    struct pipeline_queue *queue = arg;
+    while (1) {
+        pthread_mutex_lock(&mutex);
+        struct pipeline_chunk *chunk = queue_pop(queue, PIPELINE_HASH);
+        pthread_mutex_unlock(&mutex);
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (chunk->upload->sha != NULL)
+            sha256_update(chunk->upload->sha, chunk->data, chunk->length);
+        unsigned long long busy = elapsed_ns(&start);
+
+        pthread_mutex_lock(&mutex);
+        stats[PIPELINE_HASH].chunks++;
+        stats[PIPELINE_HASH].bytes += chunk->length;
+        stats[PIPELINE_HASH].busyNs += busy;
+        queue_push(&diskQueue, PIPELINE_DISK, chunk);
+        pthread_mutex_unlock(&mutex);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Etapa de disco: escribe cada buffer en su posicion y lo devuelve al pool
+ */
+static void *pipeline_writer(void *arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&mutex);
+        struct pipeline_chunk *chunk = queue_pop(&diskQueue, PIPELINE_DISK);
+        pthread_mutex_unlock(&mutex);
+
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        struct pipeline_upload *upload = chunk->upload;
+        int error = 0;
+        size_t written = 0;
+        while (written < chunk->length && upload->error == 0) {
+            __atomic_fetch_add(&transferCounters.syscalls, 1, __ATOMIC_RELAXED);
+            ssize_t bytes = pwrite(upload->file, chunk->data + written, chunk->length - written,
+                    upload->start + chunk->offset + written);
+            if (bytes < 0) {
+                if (errno == EINTR)
+                    continue;
+                error = errno;
+                break;
+            }
+            written += bytes;
+        }
+        unsigned long long busy = elapsed_ns(&start);
+
+        pthread_mutex_lock(&mutex);
+        stats[PIPELINE_DISK].chunks++;
+        stats[PIPELINE_DISK].bytes += chunk->length;
+        stats[PIPELINE_DISK].busyNs += busy;
+        if (error != 0 && upload->error == 0)
+            upload->error = error;
+        freeChunks[freeCount++] = chunk;
+        pthread_cond_signal(&chunkFree);
+        if (--upload->pending == 0)
+            pthread_cond_signal(&upload->done);
+        pthread_mutex_unlock(&mutex);
+    }
+    return NULL;
+}
+
+int pipeline_start(int count) {
+    if (count <= 0)
+        return -1;
+    //El hash es la etapa mas cara: un hilo por CPU, cada archivo siempre en el mismo
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = cpus > 0 ? cpus : 1;
+    chunks = calloc(count, sizeof(struct pipeline_chunk));
+    freeChunks = malloc(count * sizeof(struct pipeline_chunk *));
+    hashQueues = calloc(threads, sizeof(struct pipeline_queue));
+    diskQueue.items = malloc(count * sizeof(struct pipeline_chunk *));
+    char *memory = malloc((size_t)count * PIPELINE_CHUNK_SIZE);
+    int failed = chunks == NULL || freeChunks == NULL || hashQueues == NULL || diskQueue.items == NULL || memory == NULL;
+    for (int i = 0; !failed && i < threads; i++) {
+        hashQueues[i].items = malloc(count * sizeof(struct pipeline_chunk *));
+        failed = hashQueues[i].items == NULL;
+    }
+    if (failed) {
+        for (int i = 0; hashQueues != NULL && i < threads; i++)
+            free(hashQueues[i].items);
+        free(chunks);
+        free(freeChunks);
+        free(hashQueues);
+        free(diskQueue.items);
+        free(memory);
+        return -1;
+    }
+    for (int i = 0; i < count; i++) {
+        chunks[i].data = memory + (size_t)i * PIPELINE_CHUNK_SIZE;
+        freeChunks[i] = &chunks[i];
+    }
+    freeCount = count;
+    pthread_cond_init(&diskQueue.ready, NULL);
+    buffers = count;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    //Los hilos de las etapas viven lo que el proceso
+    pthread_t thread;
+    for (int i = 0; i < threads; i++) {
+        pthread_cond_init(&hashQueues[i].ready, NULL);
+        if (pthread_create(&thread, NULL, pipeline_hasher, &hashQueues[i]) != 0)
+            break;
+        pthread_detach(thread);
+        hashers++;
+    }
+    if (hashers == 0 || pthread_create(&thread, NULL, pipeline_writer, NULL) != 0)
+        return buffers = 0, -1;
+    pthread_detach(thread);
+    return 0;
+}
+
+int pipeline_available(off_t fileSize) {
+    //Un archivo de un solo buffer no tiene nada que solapar
+    return buffers > 0 && fileSize > PIPELINE_CHUNK_SIZE;
+}
+
+status_operation_socket pipeline_receive_file(int socket, int file, off_t fileSize, struct sha256_buff *sha) {
+    __atomic_fetch_add(&transferCounters.transfers, 1, __ATOMIC_RELAXED);
+    struct pipeline_upload upload = { .file = file, .sha = sha };
+    pthread_cond_init(&upload.done, NULL);
+    upload.start = lseek(file, 0, SEEK_CUR);
+    if (upload.start < 0)
+        upload.start = 0;
+
+    pthread_mutex_lock(&mutex);
+    upload.hashQueue = &hashQueues[nextHasher++ % hashers];
+    pthread_mutex_unlock(&mutex);
+
+    status_operation_socket status = OK;
+    off_t queued = 0;
+    while (queued < fileSize) {
+        //Sin buffers libres el disco o el hash van atrasados: la red espera (contrapresion)
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        pthread_mutex_lock(&mutex);
+        while (freeCount == 0)
+            pthread_cond_wait(&chunkFree, &mutex);
+        struct pipeline_chunk *chunk = freeChunks[--freeCount];
+        stats[PIPELINE_NETWORK].stallNs += elapsed_ns(&start);
+        pthread_mutex_unlock(&mutex);
+
+        // Nunca se lee mas alla del archivo para no consumir el siguiente mensaje del socket
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        size_t length = fileSize - queued < PIPELINE_CHUNK_SIZE ? fileSize - queued : PIPELINE_CHUNK_SIZE;
+        size_t received = 0;
+        while (received < length) {
+            __atomic_fetch_add(&transferCounters.syscalls, 1, __ATOMIC_RELAXED);
+            ssize_t bytes = recv(socket, chunk->data + received, length - received, MSG_WAITALL);
+            if (bytes < 0 && errno == EINTR)
+                continue;
+            if (bytes <= 0) {
+                if (bytes < 0)
+                    note_socket_error();
+                perror("Error reading from socket");
+                status = ERROR_SOCKET;
+                break;
+            }
+            received += bytes;
+        }
+        unsigned long long busy = elapsed_ns(&start);
+
+        pthread_mutex_lock(&mutex);
+        stats[PIPELINE_NETWORK].busyNs += busy;
+        if (status != OK) {
+            freeChunks[freeCount++] = chunk;
+            pthread_cond_signal(&chunkFree);
+            pthread_mutex_unlock(&mutex);
+            break;
+        }
+        stats[PIPELINE_NETWORK].chunks++;
+        stats[PIPELINE_NETWORK].bytes += length;
+        chunk->upload = &upload;
+        chunk->length = length;
+        chunk->offset = queued;
+        upload.pending++;
+        queue_push(upload.hashQueue, PIPELINE_HASH, chunk);
+        pthread_mutex_unlock(&mutex);
+        queued += length;
+    }
+
+    //Los buffers apuntan a upload: hay que esperar a que el disco termine con todos
+    pthread_mutex_lock(&mutex);
+    while (upload.pending > 0)
+        pthread_cond_wait(&upload.done, &mutex);
+    pthread_mutex_unlock(&mutex);
+    pthread_cond_destroy(&upload.done);
+
+    if (status == OK && upload.error != 0) {
+        errno = upload.error;
+        perror("Error writing to file");
+        return ERROR;
+    }
+    if (status == OK) {
+        lseek(file, upload.start + fileSize, SEEK_SET);
+        threadTransferBytes += fileSize;
+    }
+    return status;
+}
+
+void pipeline_get_stats(struct pipeline_stats *result) {
+    memset(result, 0, sizeof(struct pipeline_stats));
+    if (buffers == 0)
+        return;
+    pthread_mutex_lock(&mutex);
+    memcpy(result->stages, stats, sizeof(stats));
+    result->freeBuffers = freeCount;
+    pthread_mutex_unlock(&mutex);
+    result->buffers = buffers;
+    result->hashers = hashers;
+    result->seconds = elapsed_ns(&started) / 1e9;
+}
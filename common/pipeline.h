@@ -0,0 +1,87 @@
+/**
+ * @file
+ * @brief Recepcion de archivos por etapas: red, hash y disco en hilos
+ * distintos, unidas por colas acotadas y un pool de buffers, para que la red
+ * y el disco trabajen al mismo tiempo
+ * @copyright MIT License
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <sys/types.h>
+
+#include "protocol.h"
+#include "sha256.h"
+
+#define PIPELINE_CHUNK_SIZE (256 * 1024) /**< Tamanio de cada buffer del pool */
+#define PIPELINE_DEFAULT_BUFFERS 32      /**< Buffers del pool si no se indica otro numero */
+
+/**
+ * @brief Etapas de la recepcion
+ */
+enum pipeline_stage {
+    PIPELINE_NETWORK, /**< Llena buffers desde el socket (el hilo de la solicitud) */
+    PIPELINE_HASH,    /**< Actualiza el hash del archivo con cada buffer */
+    PIPELINE_DISK,    /**< Escribe cada buffer en su posicion del archivo */
+    PIPELINE_STAGES,  /**< Numero de etapas */
+};
+
+/**
+ * @brief Contadores de una etapa
+ */
+struct pipeline_stage_stats {
+    unsigned long chunks;       /**< Buffers procesados */
+    unsigned long long bytes;   /**< Bytes procesados */
+    unsigned long long busyNs;  /**< Tiempo trabajando (sumado entre los hilos de la etapa) */
+    unsigned long long stallNs; /**< Red: tiempo esperando un buffer libre del pool */
+    unsigned long depthSum;     /**< Suma de la profundidad de la cola de entrada al encolar */
+    int depth;                  /**< Buffers en la cola de entrada */
+    int maxDepth;               /**< Maxima profundidad de la cola de entrada */
+};
+
+/**
+ * @brief Estado de la recepcion por etapas para reportar
+ */
+struct pipeline_stats {
+    struct pipeline_stage_stats stages[PIPELINE_STAGES]; /**< Contadores por etapa */
+    int buffers;                                         /**< Buffers del pool */
+    int freeBuffers;                                     /**< Buffers libres */
+    int hashers;                                         /**< Hilos de la etapa de hash */
+    double seconds;                                      /**< Segundos desde que se inicio */
+};
+
+/**
+ * @brief Inicia los hilos de hash y disco con un pool de buffers. Desde aqui
+ * los archivos de mas de un buffer se reciben por etapas
+ * @param buffers buffers del pool (memoria: buffers * PIPELINE_CHUNK_SIZE)
+ * @return 0 si se inicio, -1 si no hay memoria o no se pudieron crear los hilos
+ */
+int pipeline_start(int buffers);
+
+/**
+ * @brief Indica si conviene recibir un archivo por etapas
+ * @param fileSize bytes del archivo
+ * @return 1 si las etapas estan activas y el archivo ocupa mas de un buffer
+ */
+int pipeline_available(off_t fileSize);
+
+/**
+ * @brief Recibe fileSize bytes de un socket y los escribe en un archivo desde su
+ * posicion actual. El hilo que llama es la etapa de red: llena buffers del pool y
+ * los encola al hash, que los pasa al disco; retorna cuando el disco escribio todo
+ * @param socket socket origen
+ * @param file descriptor del archivo
+ * @param fileSize bytes a recibir
+ * @param sha hash a actualizar con el contenido, NULL para no calcularlo
+ * @return OK, ERROR_SOCKET si fallo el socket, ERROR si fallo el disco
+ */
+status_operation_socket pipeline_receive_file(int socket, int file, off_t fileSize, struct sha256_buff *sha);
+
+/**
+ * @brief Copia los contadores de las etapas
+ * @param stats donde dejar los contadores
+ */
+void pipeline_get_stats(struct pipeline_stats *stats);
+
+#endif
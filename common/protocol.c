@@ -1,13 +1,23 @@
+#define _GNU_SOURCE
 #include "protocol.h"
+#include "sha256.h"
+#include "uring.h"
+#include "pipeline.h"
+#include "trace.h"
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
 
 #define BUFFER_SIZE 1024
 
+__thread int socketTimedOut = 0;
+__thread int socketDesynced = 0;
+
 /**
  * @brief Validate the bytes of a message by socket
  * @param bytes_int bytes of response of a write or read
@@ -16,6 +26,35 @@
  */
 status_operation_socket validate_message(int bytes_int, int bytes_expected);
 
+/**
+ * @brief Receive fileSize bytes into an open file, updating a hash with them
+ * @param socket socket to receive the content
+ * @param file descriptor of the file to write
+ * @param fileSize bytes to receive
+ * @param sha hash to update with the content, NULL to not hash it
+ * @return OK,ERROR_SOCKET,CLIENT_DISCONECT,INVALID_RESPONSE,ERROR,
+ */
+static status_operation_socket receive_file_data_hashed(int socket, int file, off_t fileSize, struct sha256_buff *sha);
+
+/**
+ * @brief Send fileSize bytes of an open file, without tracing
+ * @param socket socket to send the content
+ * @param file descriptor of the file to read
+ * @param fileSize bytes to send
+ * @return OK,ERROR_SOCKET,CLIENT_DISCONECT,INVALID_RESPONSE,ERROR,
+ */
+static status_operation_socket send_file_content(int socket, int file, off_t fileSize);
+
+/**
+ * @brief Receive fileSize bytes into an open file, without tracing
+ * @param socket socket to receive the content
+ * @param file descriptor of the file to write
+ * @param fileSize bytes to receive
+ * @param sha hash to update with the content, NULL to not hash it
+ * @return OK,ERROR_SOCKET,CLIENT_DISCONECT,INVALID_RESPONSE,ERROR,
+ */
+static status_operation_socket receive_file_content(int socket, int file, off_t fileSize, struct sha256_buff *sha);
+
 status_operation_socket send_file(int socket, const char *pathFile) {
     // 1. Abrir el archivo en modo solo lectura
     int file = open(pathFile, O_RDONLY);
@@ -41,16 +80,42 @@ status_operation_socket send_file(int socket, const char *pathFile) {
     }
 
     // 4. Leer el archivo y enviar su contenido
+    status_operation_socket status = send_file_data(socket, file, fileSize);
+
+    // 5. Cerrar el archivo
+    close(file);
+    return status;
+}
+
+status_operation_socket send_file_data(int socket, int file, off_t fileSize) {
+    unsigned long long span = trace_begin();
+    status_operation_socket status = send_file_content(socket, file, fileSize);
+    trace_end("socket.send_file", span);
+    return status;
+}
+
+static status_operation_socket send_file_content(int socket, int file, off_t fileSize) {
+    if (fileSize > 0 && uring_available())
+        return uring_send_file(socket, file, fileSize);
+    __atomic_fetch_add(&transferCounters.transfers, 1, __ATOMIC_RELAXED);
+
     char buffer[BUFFER_SIZE];
-    ssize_t bytesRead;
+    ssize_t bytesRead = 0;
     off_t totalBytesSent = 0;
-    while ((bytesRead = read(file, buffer, sizeof(buffer))) > 0) {
+    while (totalBytesSent < fileSize) {
+        size_t toRead = sizeof(buffer);
+        if (fileSize - totalBytesSent < (off_t)toRead)
+            toRead = fileSize - totalBytesSent;
+        __atomic_fetch_add(&transferCounters.syscalls, 1, __ATOMIC_RELAXED);
+        if ((bytesRead = read(file, buffer, toRead)) <= 0)
+            break;
         ssize_t totalBytesWritten = 0;
         while (totalBytesWritten < bytesRead) {
+            __atomic_fetch_add(&transferCounters.syscalls, 1, __ATOMIC_RELAXED);
             ssize_t bytesWritten = write(socket, buffer + totalBytesWritten, bytesRead - totalBytesWritten);
             if (bytesWritten < 0) {
+                note_socket_error();
                 perror("Error sending file");
-                close(file);
                 return ERROR;
             }
             totalBytesWritten += bytesWritten;
@@ -58,14 +123,12 @@ status_operation_socket send_file(int socket, const char *pathFile) {
         totalBytesSent += bytesRead;
     }
 
-    if (bytesRead < 0) {
+    if (bytesRead < 0 || totalBytesSent < fileSize) {
         perror("Error reading file");
-        close(file);
         return ERROR;
     }
-
-    // 5. Cerrar el archivo
-    close(file);
+    threadTransferBytes += fileSize;
+    threadSentBytes += fileSize;
     return OK;
 }
 
@@ -79,23 +142,113 @@ status_operation_socket receive_file(int socket, const char *pathFile) {
 
     // 2. Recibir el tamaño del archivo
     off_t fileSize;
-    if (read(socket, &fileSize, sizeof(fileSize)) <= 0) {
+    if (receive_all(socket, &fileSize, sizeof(fileSize)) != OK) {
         perror("Error receiving file size");
         close(file);
         return ERROR;
     }
 
     // 3. Recibir y escribir los datos del archivo
+    status_operation_socket status = receive_file_data(socket, file, fileSize);
+
+    // 4. Cerrar el archivo
+    close(file);
+    return status;
+}
+
+status_operation_socket receive_file_data(int socket, int file, off_t fileSize) {
+    return receive_file_data_hashed(socket, file, fileSize, NULL);
+}
+
+status_operation_socket receive_file_verified(int socket, const char *pathFile, const char *hash, off_t announcedSize) {
+    // 1. Recibir el tamaño del archivo: uno distinto del anunciado se rechaza
+    //    antes de reservar espacio o leer el contenido
+    off_t fileSize;
+    if (receive_all(socket, &fileSize, sizeof(fileSize)) != OK) {
+        perror("Error receiving file size");
+        return ERROR;
+    }
+    if (fileSize < 0 || (announcedSize > 0 && fileSize != announcedSize)) {
+        fprintf(stderr, "Size of %s does not match the announced size\n", pathFile);
+        return INVALID_RESPONSE;
+    }
+
+    // 2. Crear un archivo temporal junto al destino, para que el rename sea
+    //    atomico, y reservar solo el tamaño anunciado por adelantado: el que
+    //    envia el otro extremo no se reserva sin haberlo recibido
+    char tmpPath[PATH_MAX];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.XXXXXX", pathFile);
+    int file = mkstemp(tmpPath);
+    if (file < 0) {
+        perror("Error creating temporary file");
+        return ERROR;
+    }
+    fchmod(file, 0644);
+    if (announcedSize > 0 && fallocate(file, 0, 0, announcedSize) != 0 && errno != EOPNOTSUPP) {
+        perror("Error reserving space for file");
+        close(file);
+        unlink(tmpPath);
+        return ERROR;
+    }
+
+    // 3. Recibir el contenido calculando su hash en la misma pasada
+    struct sha256_buff sha;
+    sha256_init(&sha);
+    status_operation_socket status = receive_file_data_hashed(socket, file, fileSize, &sha);
+    if (close(file) != 0 && status == OK)
+        status = ERROR;
+
+    // 4. Dejar el archivo en su lugar solo si el contenido es el anunciado
+    char hex[65];
+    sha256_finalize(&sha);
+    sha256_read_hex(&sha, hex);
+    hex[64] = '\0';
+    if (status == OK && strcmp(hex, hash) != 0) {
+        fprintf(stderr, "Content of %s does not match its hash\n", pathFile);
+        status = INVALID_RESPONSE;
+    }
+    if (status == OK && rename(tmpPath, pathFile) != 0) {
+        perror("Error renaming temporary file");
+        status = ERROR;
+    }
+    if (status != OK)
+        unlink(tmpPath);
+    return status;
+}
+
+static status_operation_socket receive_file_data_hashed(int socket, int file, off_t fileSize, struct sha256_buff *sha) {
+    unsigned long long span = trace_begin();
+    status_operation_socket status = receive_file_content(socket, file, fileSize, sha);
+    trace_end("socket.receive_file", span);
+    return status;
+}
+
+static status_operation_socket receive_file_content(int socket, int file, off_t fileSize, struct sha256_buff *sha) {
+    if (pipeline_available(fileSize))
+        return pipeline_receive_file(socket, file, fileSize, sha);
+    if (fileSize > 0 && uring_available())
+        return uring_receive_file(socket, file, fileSize, sha);
+    __atomic_fetch_add(&transferCounters.transfers, 1, __ATOMIC_RELAXED);
+
+    // Nunca se lee mas alla del archivo para no consumir el siguiente mensaje del socket
     char buffer[BUFFER_SIZE];
-    ssize_t bytesReceived;
+    ssize_t bytesReceived = 0;
     off_t totalBytesReceived = 0;
-    while (totalBytesReceived < fileSize && (bytesReceived = read(socket, buffer, sizeof(buffer))) > 0) {
+    while (totalBytesReceived < fileSize) {
+        size_t toRead = sizeof(buffer);
+        if (fileSize - totalBytesReceived < (off_t)toRead)
+            toRead = fileSize - totalBytesReceived;
+        __atomic_fetch_add(&transferCounters.syscalls, 1, __ATOMIC_RELAXED);
+        if ((bytesReceived = read(socket, buffer, toRead)) <= 0)
+            break;
+        if (sha != NULL)
+            sha256_update(sha, buffer, bytesReceived);
         ssize_t totalBytesWritten = 0;
         while (totalBytesWritten < bytesReceived) {
+            __atomic_fetch_add(&transferCounters.syscalls, 1, __ATOMIC_RELAXED);
             ssize_t bytesWritten = write(file, buffer + totalBytesWritten, bytesReceived - totalBytesWritten);
             if (bytesWritten < 0) {
                 perror("Error writing to file");
-                close(file);
                 return ERROR;
             }
             totalBytesWritten += bytesWritten;
@@ -103,14 +256,12 @@ status_operation_socket receive_file(int socket, const char *pathFile) {
         totalBytesReceived += bytesReceived;
     }
 
-    if (bytesReceived < 0) {
+    if (bytesReceived < 0 || totalBytesReceived < fileSize) {
+        note_socket_error();
         perror("Error reading from socket");
-        close(file);
         return ERROR;
     }
-
-    // 4. Cerrar el archivo
-    close(file);
+    threadTransferBytes += fileSize;
     return OK;
 }
 
@@ -121,6 +272,7 @@ status_operation_socket receive_first_request(int socket, struct first_request *
     while (totalBytesRead < bytes_expected) {
         ssize_t bytes_read = read(socket, (void*)first_request_param + totalBytesRead, bytes_expected - totalBytesRead);
         if (bytes_read < 0) {
+            note_socket_error();
             perror("Error reading from socket");
             return ERROR_SOCKET;
         } else if (bytes_read == 0) {
@@ -144,6 +296,7 @@ status_operation_socket receive_file_request(int socket, struct file_request *fi
     while (totalBytesRead < bytes_expected) {
         ssize_t bytes_read = read(socket, (void*)file_request_param + totalBytesRead, bytes_expected - totalBytesRead);
         if (bytes_read < 0) {
+            note_socket_error();
             perror("Error reading from socket");
             return ERROR_SOCKET;
         } else if (bytes_read == 0) {
@@ -169,6 +322,7 @@ status_operation_socket receive_file_transfer(int socket, struct file_transfer *
     while (totalBytesRead < bytes_expected) {
         ssize_t bytes_read = read(socket, (void*)file_transfer_param + totalBytesRead, bytes_expected - totalBytesRead);
         if (bytes_read < 0) {
+            note_socket_error();
             perror("Error reading from socket");
             return ERROR_SOCKET;
         } else if (bytes_read == 0) {
@@ -192,6 +346,7 @@ status_operation_socket receive_status_code(int socket, return_code *status_oper
     while (totalBytesRead < bytes_expected) {
         ssize_t bytes_read = read(socket, (void*)status_operation + totalBytesRead, bytes_expected - totalBytesRead);
         if (bytes_read < 0) {
+            note_socket_error();
             perror("Error reading from socket");
             return ERROR_SOCKET;
         } else if (bytes_read == 0) {
@@ -214,6 +369,7 @@ status_operation_socket receive_element_list(int socket, char elementList[SIZE_E
     while (totalBytesRead < size_struct) {
         ssize_t bytes_read = read(socket, elementList + totalBytesRead, size_struct - totalBytesRead);
         if (bytes_read < 0) {
+            note_socket_error();
             perror("Error reading from socket");
             return ERROR_SOCKET;
         } else if (bytes_read == 0) {
@@ -240,6 +396,7 @@ status_operation_socket send_first_request(int socket, struct first_request *fir
     while (totalBytesWritten < size_struct) {
         ssize_t bytes_written = write(socket, (char *)first_request_param + totalBytesWritten, size_struct - totalBytesWritten);
         if (bytes_written < 0) {
+            note_socket_error();
             perror("Error writing to socket");
             return ERROR_SOCKET;
         }
@@ -263,6 +420,7 @@ status_operation_socket send_file_request(int socket, struct file_request *file_
     while (totalBytesWritten < size_struct) {
         ssize_t bytes_written = write(socket, (char *)file_request_param + totalBytesWritten, size_struct - totalBytesWritten);
         if (bytes_written < 0) {
+            note_socket_error();
             perror("Error writing to socket");
             return ERROR_SOCKET;
         }
@@ -287,6 +445,7 @@ status_operation_socket send_file_transfer(int socket, struct file_transfer *fil
     while (totalBytesWritten < size_struct) {
         ssize_t bytes_written = write(socket, (char *)file_transfer_param + totalBytesWritten, size_struct - totalBytesWritten);
         if (bytes_written < 0) {
+            note_socket_error();
             perror("Error writing to socket");
             return ERROR_SOCKET;
         }
@@ -309,6 +468,7 @@ status_operation_socket send_status_code(int socket, return_code code) {
     while (totalBytesWritten < size_struct) {
         ssize_t bytes_written = write(socket, (void *)&code + totalBytesWritten, size_struct - totalBytesWritten);
         if (bytes_written < 0) {
+            note_socket_error();
             perror("Error writing to socket");
             return ERROR_SOCKET;
         }
@@ -328,6 +488,7 @@ status_operation_socket send_element_list(int socket, char elementList[SIZE_ELEM
     while (totalBytesWritten < size_struct) {
         ssize_t bytes_written = write(socket, elementList + totalBytesWritten, size_struct - totalBytesWritten);
         if (bytes_written < 0) {
+            note_socket_error();
             perror("Error writing to socket");
             return ERROR_SOCKET;
         }
@@ -337,6 +498,302 @@ status_operation_socket send_element_list(int socket, char elementList[SIZE_ELEM
     return validate_message(totalBytesWritten, size_struct);
 }
 
+status_operation_socket send_batch_header(int socket, struct batch_header *batch_header_param) {
+    return send_all(socket, batch_header_param, sizeof(struct batch_header));
+}
+
+status_operation_socket receive_batch_header(int socket, struct batch_header *batch_header_param) {
+    status_operation_socket status = receive_all(socket, batch_header_param, sizeof(struct batch_header));
+    if (status != OK)
+        return status;
+    if (batch_header_param->count < 0 || batch_header_param->count > MAX_BATCH_ENTRIES)
+        return INVALID_RESPONSE;
+    return OK;
+}
+
+status_operation_socket send_batch_add_entry(int socket, struct batch_add_entry *entry, const char *nameFile) {
+    entry->sizeNameFile = strlen(nameFile);
+    status_operation_socket status = send_all(socket, entry, sizeof(struct batch_add_entry));
+    if (status != OK)
+        return status;
+    return send_all(socket, nameFile, entry->sizeNameFile);
+}
+
+status_operation_socket receive_batch_add_entry(int socket, struct batch_add_entry *entry, char nameFile[PATH_MAX]) {
+    status_operation_socket status = receive_all(socket, entry, sizeof(struct batch_add_entry));
+    if (status != OK)
+        return status;
+    if (entry->sizeNameFile <= 0 || entry->sizeNameFile >= PATH_MAX)
+        return INVALID_RESPONSE;
+    status = receive_all(socket, nameFile, entry->sizeNameFile);
+    if (status != OK)
+        return status;
+    nameFile[entry->sizeNameFile] = '\0';
+    entry->hashFile[HASH_SIZE - 1] = '\0';
+    entry->comment[COMMENT_SIZE - 1] = '\0';
+    return OK;
+}
+
+status_operation_socket send_batch_indexes(int socket, const int *indexes, int count) {
+    status_operation_socket status = send_all(socket, &count, sizeof(int));
+    if (status != OK || count == 0)
+        return status;
+    return send_all(socket, indexes, count * sizeof(int));
+}
+
+status_operation_socket receive_batch_indexes(int socket, int *indexes, int maxCount, int *count) {
+    status_operation_socket status = receive_all(socket, count, sizeof(int));
+    if (status != OK)
+        return status;
+    if (*count == BATCH_RETRY_LATER)
+        return receive_retry_after(socket, &indexes[0]);
+    if (*count < 0 || *count > maxCount)
+        return INVALID_RESPONSE;
+    if (*count == 0)
+        return OK;
+    status = receive_all(socket, indexes, *count * sizeof(int));
+    if (status != OK)
+        return status;
+    for (int i = 0; i < *count; i++)
+        if (indexes[i] < 0 || indexes[i] >= maxCount)
+            return INVALID_RESPONSE;
+    return OK;
+}
+
+status_operation_socket send_retry_after(int socket, int seconds) {
+    status_operation_socket status = send_status_code(socket, VERSION_RETRY_LATER);
+    if (status != OK)
+        return status;
+    return send_all(socket, &seconds, sizeof(int));
+}
+
+status_operation_socket receive_retry_after(int socket, int *seconds) {
+    status_operation_socket status = receive_all(socket, seconds, sizeof(int));
+    if (status == OK && *seconds <= 0)
+        return INVALID_RESPONSE;
+    return status;
+}
+
+status_operation_socket send_batch_retry_after(int socket, int seconds) {
+    int count = BATCH_RETRY_LATER;
+    status_operation_socket status = send_all(socket, &count, sizeof(int));
+    if (status != OK)
+        return status;
+    return send_all(socket, &seconds, sizeof(int));
+}
+
+status_operation_socket send_batch_get_entry(int socket, struct batch_get_entry *entry, const char *nameFile) {
+    entry->sizeNameFile = strlen(nameFile);
+    status_operation_socket status = send_all(socket, entry, sizeof(struct batch_get_entry));
+    if (status != OK)
+        return status;
+    return send_all(socket, nameFile, entry->sizeNameFile);
+}
+
+status_operation_socket receive_batch_get_entry(int socket, struct batch_get_entry *entry, char nameFile[PATH_MAX]) {
+    status_operation_socket status = receive_all(socket, entry, sizeof(struct batch_get_entry));
+    if (status != OK)
+        return status;
+    if (entry->sizeNameFile <= 0 || entry->sizeNameFile >= PATH_MAX)
+        return INVALID_RESPONSE;
+    status = receive_all(socket, nameFile, entry->sizeNameFile);
+    if (status != OK)
+        return status;
+    nameFile[entry->sizeNameFile] = '\0';
+    return OK;
+}
+
+status_operation_socket send_batch_file_header(int socket, struct batch_file_header *header, const char *nameFile) {
+    header->sizeNameFile = nameFile == NULL ? 0 : strlen(nameFile);
+    status_operation_socket status = send_all(socket, header, sizeof(struct batch_file_header));
+    if (status != OK || header->sizeNameFile == 0)
+        return status;
+    return send_all(socket, nameFile, header->sizeNameFile);
+}
+
+status_operation_socket receive_batch_file_header(int socket, struct batch_file_header *header, char nameFile[PATH_MAX]) {
+    status_operation_socket status = receive_all(socket, header, sizeof(struct batch_file_header));
+    if (status != OK)
+        return status;
+    if (header->sizeNameFile < 0 || header->sizeNameFile >= PATH_MAX)
+        return INVALID_RESPONSE;
+    status = receive_all(socket, nameFile, header->sizeNameFile);
+    if (status != OK)
+        return status;
+    nameFile[header->sizeNameFile] = '\0';
+    return OK;
+}
+
+status_operation_socket send_delta_signatures(int socket, struct delta_signature_header *header, const struct block_signature *signatures) {
+    status_operation_socket status = send_all(socket, header, sizeof(struct delta_signature_header));
+    if (status != OK || header->blockCount == 0)
+        return status;
+    return send_all(socket, signatures, header->blockCount * sizeof(struct block_signature));
+}
+
+status_operation_socket receive_delta_signatures(int socket, struct delta_signature_header *header, struct block_signature **signatures) {
+    *signatures = NULL;
+    status_operation_socket status = receive_all(socket, header, sizeof(struct delta_signature_header));
+    if (status != OK)
+        return status;
+    if (header->blockCount < 0 || header->blockCount > MAX_DELTA_BLOCKS || (header->blockCount > 0 && header->blockSize == 0))
+        return INVALID_RESPONSE;
+    if (header->blockCount == 0)
+        return OK;
+    *signatures = malloc(header->blockCount * sizeof(struct block_signature));
+    if (*signatures == NULL)
+        return ERROR;
+    status = receive_all(socket, *signatures, header->blockCount * sizeof(struct block_signature));
+    if (status != OK) {
+        free(*signatures);
+        *signatures = NULL;
+    }
+    return status;
+}
+
+status_operation_socket send_delta_op(int socket, struct delta_op *op, const void *literal) {
+    status_operation_socket status = send_all(socket, op, sizeof(struct delta_op));
+    if (status != OK || op->type != DELTA_LITERAL)
+        return status;
+    return send_all(socket, literal, op->length);
+}
+
+status_operation_socket receive_delta_op(int socket, struct delta_op *op) {
+    status_operation_socket status = receive_all(socket, op, sizeof(struct delta_op));
+    if (status != OK)
+        return status;
+    if (op->type != DELTA_COPY && op->type != DELTA_LITERAL && op->type != DELTA_END)
+        return INVALID_RESPONSE;
+    return OK;
+}
+
+int socket_is_local(int socket) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+    if (getsockname(socket, (struct sockaddr *)&addr, &len) != 0)
+        return 0;
+    return addr.ss_family == AF_UNIX;
+}
+
+int pass_file_descriptor(int local, off_t fileSize) {
+    return local && fileSize >= LOCAL_FD_MIN_SIZE;
+}
+
+status_operation_socket send_file_descriptor(int socket, int file) {
+    char byte = 0;
+    struct iovec iov = { &byte, 1 };
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &file, sizeof(int));
+
+    if (sendmsg(socket, &msg, 0) != 1) {
+        note_socket_error();
+        perror("Error sending file descriptor");
+        return ERROR_SOCKET;
+    }
+    return OK;
+}
+
+status_operation_socket receive_file_descriptor(int socket, int file, off_t fileSize) {
+    char byte;
+    struct iovec iov = { &byte, 1 };
+    union {
+        char buffer[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = sizeof(control.buffer);
+
+    ssize_t received = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+    if (received < 0) {
+        note_socket_error();
+        perror("Error receiving file descriptor");
+        return ERROR_SOCKET;
+    }
+    if (received == 0)
+        return CLIENT_DISCONECT;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+        return INVALID_RESPONSE;
+    int source;
+    memcpy(&source, CMSG_DATA(cmsg), sizeof(int));
+
+    // Copiar dentro del kernel, sin pasar el contenido por el socket
+    status_operation_socket status = file < 0 ? ERROR : OK;
+    off_t offset = 0;
+    while (status == OK && offset < fileSize) {
+        ssize_t copied = copy_file_range(source, &offset, file, NULL, fileSize - offset, 0);
+        if (copied < 0 && (errno == EXDEV || errno == ENOSYS || errno == EINVAL) && offset == 0) {
+            // Sistemas de archivos distintos: copia normal desde el descriptor
+            status = send_file_data(file, source, fileSize);
+            break;
+        }
+        if (copied <= 0) {
+            perror("Error copying file");
+            status = ERROR;
+            break;
+        }
+    }
+    close(source);
+    return status;
+}
+
+status_operation_socket send_all(int socket, const void *data, size_t size) {
+    size_t totalBytesWritten = 0;
+
+    while (totalBytesWritten < size) {
+        ssize_t bytes_written = write(socket, (const char *)data + totalBytesWritten, size - totalBytesWritten);
+        if (bytes_written < 0) {
+            note_socket_error();
+            perror("Error writing to socket");
+            return ERROR_SOCKET;
+        }
+        totalBytesWritten += bytes_written;
+    }
+    return OK;
+}
+
+status_operation_socket receive_all(int socket, void *data, size_t size) {
+    size_t totalBytesRead = 0;
+
+    while (totalBytesRead < size) {
+        ssize_t bytes_read = read(socket, (char *)data + totalBytesRead, size - totalBytesRead);
+        if (bytes_read < 0) {
+            note_socket_error();
+            perror("Error reading from socket");
+            return ERROR_SOCKET;
+        } else if (bytes_read == 0) {
+            return CLIENT_DISCONECT;
+        }
+        totalBytesRead += bytes_read;
+    }
+    return OK;
+}
+
+void note_socket_error() {
+    //Un socket bloqueante solo devuelve EAGAIN si vencio SO_RCVTIMEO o SO_SNDTIMEO
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ETIMEDOUT)
+        socketTimedOut = 1;
+}
+
 status_operation_socket validate_message(int bytes_int, int bytes_expected) {
     if (bytes_int == -1)
         return ERROR_SOCKET;
@@ -6,17 +6,26 @@
  * @copyright MIT License
  */
 
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <fcntl.h>
+#include <stdint.h>
 
 #define BUFFER_SIZE 1024 /* Default buffer size */
 #define COMMENT_SIZE 80 /** < Longitud del comentario */
 #define HASH_SIZE 256 /**< Longitud del hash incluyendo NULL*/
 #define PATH_MAX 4096 /**< Longitud maxima de una ruta de archivo. */
 #define SIZE_ELEMENT_LIST sizeof(int) + PATH_MAX + COMMENT_SIZE + HASH_SIZE
+#define MAX_BATCH_ENTRIES 100000 /**< Maximo de archivos en una solicitud por lotes */
+#define BATCH_RETRY_LATER -1 /**< Cuenta de indices de un lote rechazado: siguen los segundos a esperar */
+#define MAX_DELTA_BLOCKS (1 << 22) /**< Maximo de firmas de bloque en un add por diferencias */
+#define DELTA_STRONG_SIZE 16 /**< Bytes del hash fuerte de cada bloque */
+#define LOCAL_FD_MIN_SIZE 65536 /**< Desde este tamanio un get local pasa el descriptor en lugar del contenido */
 
 /**
  * @brief type of request of user
@@ -25,6 +34,11 @@ typedef enum {
     LIST,/*!< Request to list versions*/
     ADD, /*!<Request to add a file*/
     GET, /*< Request to get a version of a file*/
+    ADD_BATCH, /*!< Request to add many files with a single manifest*/
+    GET_BATCH, /*!< Request to get many versions in a single stream*/
+    ADD_DELTA, /*!< Request to add a file sending only the changes against its last version*/
+    STATS, /*!< Request the counters and latency histograms of the server*/
+    TRACE, /*!< Request the spans of the sampled requests or change the sampling rate*/
 }type_request;
 
 /**
@@ -65,6 +79,80 @@ struct file_transfer{
     char   comment[COMMENT_SIZE]; /*!< Comment of the file (optional)*/
 };
 
+/**
+ * @brief header of a batch, tells how many entries follow
+ */
+struct batch_header{
+    int count; /*!< number of entries of the batch*/
+};
+
+/**
+ * @brief entry of the manifest of a batch add, the name of the file
+ * (sizeNameFile bytes, without NULL) is sent right after the struct
+ */
+struct batch_add_entry{
+    size_t fileSize;              /*!< Size of the file*/
+    int    sizeNameFile;          /*!< size of the name*/
+    char   hashFile[HASH_SIZE];   /*!< Hash of the file*/
+    char   comment[COMMENT_SIZE]; /*!< Comment of the file*/
+};
+
+/**
+ * @brief entry of a batch get, the name of the file (sizeNameFile bytes,
+ * without NULL) is sent right after the struct
+ */
+struct batch_get_entry{
+    int version;      /*!< version of the file*/
+    int sizeNameFile; /*!< size of the name*/
+};
+
+/**
+ * @brief header of each file of the stream of a batch get, followed by the
+ * name (sizeNameFile bytes) and fileSize bytes of content. A header with
+ * sizeNameFile 0 ends the stream
+ */
+struct batch_file_header{
+    int         sizeNameFile; /*!< size of the name, 0 at the end of the stream*/
+    int         version;      /*!< version of the file*/
+    size_t      fileSize;     /*!< size of the content that follows*/
+    int         status;       /*!< VERSION_ADDED or VERSION_NOT_EXISTS (return_code)*/
+};
+
+/**
+ * @brief header of the block signatures of the last version of a file,
+ * followed by blockCount block_signature structs
+ */
+struct delta_signature_header{
+    size_t blockSize;  /*!< size of each block (the last one can be shorter)*/
+    int    blockCount; /*!< number of signatures, 0 if there is no previous version*/
+};
+
+/**
+ * @brief signature of one block of the previous version of a file
+ */
+struct block_signature{
+    uint32_t weak;                      /*!< rolling checksum of the block*/
+    uint8_t  strong[DELTA_STRONG_SIZE]; /*!< first bytes of the SHA-256 of the block*/
+};
+
+/**
+ * @brief type of an instruction to rebuild a file from its previous version
+ */
+typedef enum{
+    DELTA_END,     /*!< the file is complete*/
+    DELTA_COPY,    /*!< copy length bytes of the previous version from block*/
+    DELTA_LITERAL, /*!< length bytes of new content follow the instruction*/
+}delta_op_type;
+
+/**
+ * @brief instruction to rebuild a file from its previous version
+ */
+struct delta_op{
+    int    type;   /*!< delta_op_type*/
+    int    block;  /*!< first block to copy (DELTA_COPY)*/
+    size_t length; /*!< bytes to copy or bytes of literal content*/
+};
+
 typedef enum {
 	VERSION_ERROR,          /*!< Error no especificado */
 	VERSION_CREATED,        /*!< Version creada */
@@ -72,6 +160,7 @@ typedef enum {
 	VERSION_ALREADY_EXISTS, /*!< Version ya existe */
     VERSION_NOT_EXISTS,     /*!< Versions not exist*/
 	FILE_ADDED,             /*<! Archivo adicionado  */
+	VERSION_RETRY_LATER,    /*!< Servidor ocupado: siguen los segundos a esperar antes de reintentar */
 }return_code;
 
 /**
@@ -92,6 +181,101 @@ status_operation_socket send_file(int socket,const  char * pathFile);
  */
 status_operation_socket receive_file(int socket,const  char *pathFile);
 
+/**
+ * @brief Tell if the socket is a Unix domain socket, where open files can be
+ * passed with SCM_RIGHTS instead of copying their content
+ * @param socket socket to check
+ * @return 1 if the socket is AF_UNIX, 0 otherwise
+ */
+int socket_is_local(int socket);
+
+/**
+ * @brief Tell if a file of fileSize bytes is sent as a file descriptor instead
+ * of its content: only through a local socket and for files of at least
+ * LOCAL_FD_MIN_SIZE bytes, where it is cheaper than copying
+ * @param local 1 if the socket is local (socket_is_local)
+ * @param fileSize size of the file
+ * @return 1 if the file descriptor is passed, 0 otherwise
+ */
+int pass_file_descriptor(int local, off_t fileSize);
+
+/**
+ * @brief Pass an open file descriptor through a Unix domain socket (SCM_RIGHTS)
+ * @param socket AF_UNIX socket to comunicate
+ * @param file descriptor to pass, the receiver gets its own copy
+ * @return OK,ERROR_SOCKET
+ */
+status_operation_socket send_file_descriptor(int socket, int file);
+
+/**
+ * @brief Receive a file descriptor passed with send_file_descriptor and copy
+ * fileSize bytes of it into an open file inside the kernel (copy_file_range)
+ * @param socket AF_UNIX socket to comunicate
+ * @param file descriptor of the file to write, -1 to only consume the descriptor
+ * @param fileSize bytes to copy
+ * @return OK,ERROR_SOCKET,CLIENT_DISCONECT,INVALID_RESPONSE,ERROR,
+ */
+status_operation_socket receive_file_descriptor(int socket, int file, off_t fileSize);
+
+/**
+ * @brief Receive a file hashing it while it is written to a temporary file
+ * preallocated to the announced size. A size that differs from the announced
+ * one is rejected before the content is read. The file is renamed to pathFile
+ * only when its SHA-256 matches hash, otherwise it is discarded
+ * @param socket socket to recieve a file
+ * @param pathFile final path of the file
+ * @param hash expected SHA-256 of the content (64 hex chars)
+ * @param announcedSize size announced by the sender, 0 if unknown
+ * @return OK,ERROR_SOCKET,CLIENT_DISCONECT,INVALID_RESPONSE (hash or size mismatch),ERROR,
+ */
+status_operation_socket receive_file_verified(int socket, const char *pathFile, const char *hash, off_t announcedSize);
+
+/**
+ * @brief Send fileSize bytes of an open file, without the size header
+ * @param socket socket to send the content
+ * @param file descriptor of the file to read
+ * @param fileSize bytes to send
+ * @return OK,ERROR_SOCKET,CLIENT_DISCONECT,INVALID_RESPONSE,ERROR,
+ */
+status_operation_socket send_file_data(int socket, int file, off_t fileSize);
+
+/**
+ * @brief Receive fileSize bytes into an open file, without the size header.
+ * Never reads past the content, so the next message stays in the socket
+ * @param socket socket to receive the content
+ * @param file descriptor of the file to write
+ * @param fileSize bytes to receive
+ * @return OK,ERROR_SOCKET,CLIENT_DISCONECT,INVALID_RESPONSE,ERROR,
+ */
+status_operation_socket receive_file_data(int socket, int file, off_t fileSize);
+
+/**
+ * @brief Write all the bytes of a buffer in the socket
+ * @param socket socket to comunicate
+ * @param data buffer to send
+ * @param size bytes to send
+ * @return OK,ERROR_SOCKET
+ */
+status_operation_socket send_all(int socket, const void *data, size_t size);
+
+/**
+ * @brief Read exactly size bytes from the socket
+ * @param socket socket to comunicate
+ * @param data buffer to fill
+ * @param size bytes to read
+ * @return OK,ERROR_SOCKET,CLIENT_DISCONECT
+ */
+status_operation_socket receive_all(int socket, void *data, size_t size);
+
+extern __thread int socketTimedOut; /**< 1 si una lectura o escritura del hilo vencio su plazo */
+extern __thread int socketDesynced; /**< 1 si el hilo dejo el flujo a mitad de un mensaje y no se puede seguir */
+
+/**
+ * @brief Check the errno of a failed read or write on a socket and mark
+ * socketTimedOut if it was a timeout (SO_RCVTIMEO, SO_SNDTIMEO or keepalive)
+ */
+void note_socket_error();
+
 /**
  * @brief Receive the structure first_request whit a code of status
  * @param socket socket to recieve a file
@@ -170,3 +354,155 @@ status_operation_socket send_status_code(int socket, return_code code);
  * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
  */
 status_operation_socket send_element_list(int socket, char elementList[SIZE_ELEMENT_LIST]);
+
+/**
+ * @brief Send the batch_header structure in the socket
+ * @param socket socket to comunicate
+ * @param batch_header_param struct to send
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
+ */
+status_operation_socket send_batch_header(int socket, struct batch_header *batch_header_param);
+
+/**
+ * @brief Receive the structure batch_header whit a code of status
+ * @param socket socket to comunicate
+ * @param batch_header_param batch header to receive
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
+ */
+status_operation_socket receive_batch_header(int socket, struct batch_header *batch_header_param);
+
+/**
+ * @brief Send one entry of the manifest of a batch add followed by the name of the file
+ * @param socket socket to comunicate
+ * @param entry entry to send, sizeNameFile is filled from nameFile
+ * @param nameFile name of the file
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
+ */
+status_operation_socket send_batch_add_entry(int socket, struct batch_add_entry *entry, const char *nameFile);
+
+/**
+ * @brief Receive one entry of the manifest of a batch add and the name of the file
+ * @param socket socket to comunicate
+ * @param entry entry to receive
+ * @param nameFile buffer for the name of the file, NULL terminated
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
+ */
+status_operation_socket receive_batch_add_entry(int socket, struct batch_add_entry *entry, char nameFile[PATH_MAX]);
+
+/**
+ * @brief Send a list of indexes of a batch (count followed by the indexes)
+ * @param socket socket to comunicate
+ * @param indexes indexes to send
+ * @param count number of indexes
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
+ */
+status_operation_socket send_batch_indexes(int socket, const int *indexes, int count);
+
+/**
+ * @brief Receive a list of indexes of a batch
+ * @param socket socket to comunicate
+ * @param indexes buffer of maxCount elements for the indexes
+ * @param maxCount max number of indexes expected
+ * @param count number of indexes received, BATCH_RETRY_LATER if the server is busy
+ * (then indexes[0] has the seconds to wait)
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
+ */
+status_operation_socket receive_batch_indexes(int socket, int *indexes, int maxCount, int *count);
+
+/**
+ * @brief Send the VERSION_RETRY_LATER status followed by the seconds to wait
+ * @param socket socket to comunicate
+ * @param seconds seconds that the client must wait before retrying
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
+ */
+status_operation_socket send_retry_after(int socket, int seconds);
+
+/**
+ * @brief Receive the seconds to wait after a VERSION_RETRY_LATER status
+ * @param socket socket to comunicate
+ * @param seconds seconds that the client must wait before retrying
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
+ */
+status_operation_socket receive_retry_after(int socket, int *seconds);
+
+/**
+ * @brief Reject a batch because the server is busy (count BATCH_RETRY_LATER
+ * instead of the indexes, followed by the seconds to wait)
+ * @param socket socket to comunicate
+ * @param seconds seconds that the client must wait before retrying
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
+ */
+status_operation_socket send_batch_retry_after(int socket, int seconds);
+
+/**
+ * @brief Send one entry of a batch get followed by the name of the file
+ * @param socket socket to comunicate
+ * @param entry entry to send, sizeNameFile is filled from nameFile
+ * @param nameFile name of the file
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
+ */
+status_operation_socket send_batch_get_entry(int socket, struct batch_get_entry *entry, const char *nameFile);
+
+/**
+ * @brief Receive one entry of a batch get and the name of the file
+ * @param socket socket to comunicate
+ * @param entry entry to receive
+ * @param nameFile buffer for the name of the file, NULL terminated
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
+ */
+status_operation_socket receive_batch_get_entry(int socket, struct batch_get_entry *entry, char nameFile[PATH_MAX]);
+
+/**
+ * @brief Send the header of a file of the stream of a batch get followed by its name
+ * @param socket socket to comunicate
+ * @param header header to send, sizeNameFile is filled from nameFile
+ * @param nameFile name of the file, NULL to end the stream
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
+ */
+status_operation_socket send_batch_file_header(int socket, struct batch_file_header *header, const char *nameFile);
+
+/**
+ * @brief Receive the header of a file of the stream of a batch get and its name
+ * @param socket socket to comunicate
+ * @param header header to receive, sizeNameFile 0 is the end of the stream
+ * @param nameFile buffer for the name of the file, NULL terminated
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
+ */
+status_operation_socket receive_batch_file_header(int socket, struct batch_file_header *header, char nameFile[PATH_MAX]);
+
+/**
+ * @brief Send the signatures of the blocks of the previous version of a file
+ * @param socket socket to comunicate
+ * @param header header with the block size and the number of signatures
+ * @param signatures blockCount signatures to send
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
+ */
+status_operation_socket send_delta_signatures(int socket, struct delta_signature_header *header, const struct block_signature *signatures);
+
+/**
+ * @brief Receive the signatures of the blocks of the previous version of a file
+ * @param socket socket to comunicate
+ * @param header header to receive
+ * @param signatures allocated array of signatures (free it), NULL if there are none
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE, ERROR
+ */
+status_operation_socket receive_delta_signatures(int socket, struct delta_signature_header *header, struct block_signature **signatures);
+
+/**
+ * @brief Send an instruction to rebuild a file, followed by its content if it is a literal
+ * @param socket socket to comunicate
+ * @param op instruction to send
+ * @param literal op->length bytes of content for DELTA_LITERAL, NULL otherwise
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
+ */
+status_operation_socket send_delta_op(int socket, struct delta_op *op, const void *literal);
+
+/**
+ * @brief Receive an instruction to rebuild a file, the content of a literal stays in the socket
+ * @param socket socket to comunicate
+ * @param op instruction to receive
+ * @return status of operation, posibles returns: OK,ERROR_SCOKET,CLIENT_DISCONECT, INVALID_RESONSE
+ */
+status_operation_socket receive_delta_op(int socket, struct delta_op *op);
+
+#endif
@@ -25,10 +25,25 @@
 /* Details of the implementation, etc can be found here: https://en.wikipedia.org/wiki/SHA-2
 	 See sha256.h for short documentation on library usage */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "sha256.h"
 
+#define SHA256_BATCH_BYTES (8 << 20)      /* Arena for the small files of one sha256_hash_files_hex round */
+#define SHA256_BATCH_FILES 1024           /* Files per round */
+#define SHA256_BATCH_MAX_FILE (1 << 20)   /* Bigger files are hashed one at a time, streaming */
+#define SHA256_MMAP_MIN (1 << 20)         /* Smaller regular files are read, mapping them costs more */
+#define SHA256_MMAP_WINDOW (64 << 20)     /* Bytes of a big file mapped at a time */
+#define SHA256_READ_BUFFER (1 << 20)      /* Read size for pipes and special files */
+
 void sha256_init(struct sha256_buff* buff) {
 	buff->h[0] = 0x6a09e667;
 	buff->h[1] = 0xbb67ae85;
@@ -55,45 +70,623 @@ const static uint32_t k[64] = {
 
 #define rotate_r(val, bits) (val >> bits | val << (32 - bits))
 
-static void sha256_calc_chunk(struct sha256_buff* buff, const uint8_t* chunk) {
+/* Compression function: processes 'blocks' consecutive 64-byte chunks into h.
+   The portable version below is the reference; the hardware kernels are
+   selected at runtime (see sha256_set_kernel) and cross-checked against it */
+typedef void (*sha256_blocks_fn)(uint32_t* h, const uint8_t* data, size_t blocks);
+
+static inline __attribute__((always_inline)) void sha256_blocks_generic(uint32_t* h, const uint8_t* chunk, size_t blocks) {
 	uint32_t w[64];
 	uint32_t tv[8];
 	uint32_t i;
 
-	for (i=0; i<16; ++i){
-		w[i] = (uint32_t) chunk[0] << 24 | (uint32_t) chunk[1] << 16 | (uint32_t) chunk[2] << 8 | (uint32_t) chunk[3];
-		chunk += 4;
+	while (blocks--) {
+		for (i=0; i<16; ++i){
+			w[i] = (uint32_t) chunk[0] << 24 | (uint32_t) chunk[1] << 16 | (uint32_t) chunk[2] << 8 | (uint32_t) chunk[3];
+			chunk += 4;
+		}
+
+		for (i=16; i<64; ++i){
+			uint32_t s0 = rotate_r(w[i-15], 7) ^ rotate_r(w[i-15], 18) ^ (w[i-15] >> 3);
+			uint32_t s1 = rotate_r(w[i-2], 17) ^ rotate_r(w[i-2], 19) ^ (w[i-2] >> 10);
+			w[i] = w[i-16] + s0 + w[i-7] + s1;
+		}
+
+		for (i = 0; i < 8; ++i)
+			tv[i] = h[i];
+
+		for (i=0; i<64; ++i){
+			uint32_t S1 = rotate_r(tv[4], 6) ^ rotate_r(tv[4], 11) ^ rotate_r(tv[4], 25);
+			uint32_t ch = (tv[4] & tv[5]) ^ (~tv[4] & tv[6]);
+			uint32_t temp1 = tv[7] + S1 + ch + k[i] + w[i];
+			uint32_t S0 = rotate_r(tv[0], 2) ^ rotate_r(tv[0], 13) ^ rotate_r(tv[0], 22);
+			uint32_t maj = (tv[0] & tv[1]) ^ (tv[0] & tv[2]) ^ (tv[1] & tv[2]);
+			uint32_t temp2 = S0 + maj;
+
+			tv[7] = tv[6];
+			tv[6] = tv[5];
+			tv[5] = tv[4];
+			tv[4] = tv[3] + temp1;
+			tv[3] = tv[2];
+			tv[2] = tv[1];
+			tv[1] = tv[0];
+			tv[0] = temp1 + temp2;
+		}
+
+		for (i = 0; i < 8; ++i)
+			h[i] += tv[i];
 	}
+}
+
+static void sha256_blocks_scalar(uint32_t* h, const uint8_t* data, size_t blocks) {
+	sha256_blocks_generic(h, data, blocks);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
 
-	for (i=16; i<64; ++i){
-		uint32_t s0 = rotate_r(w[i-15], 7) ^ rotate_r(w[i-15], 18) ^ (w[i-15] >> 3);
-		uint32_t s1 = rotate_r(w[i-2], 17) ^ rotate_r(w[i-2], 19) ^ (w[i-2] >> 10);
-		w[i] = w[i-16] + s0 + w[i-7] + s1;
+/* Same code built for AVX2/BMI2 CPUs: rotations become rorx and ~e & g becomes andn */
+__attribute__((target("avx2,bmi,bmi2")))
+static void sha256_blocks_avx2(uint32_t* h, const uint8_t* data, size_t blocks) {
+	sha256_blocks_generic(h, data, blocks);
+}
+
+/* SHA extensions: two rounds per sha256rnds2, message schedule with sha256msg1/msg2.
+   The state is kept as ABEF/CDGH, the layout the instructions expect */
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_blocks_shani(uint32_t* h, const uint8_t* data, size_t blocks) {
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&h[0]), 0xB1);   /* CDAB */
+	__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&h[4]), 0x1B); /* EFGH */
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);    /* ABEF */
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);         /* CDGH */
+	__m128i w[16];
+	int i;
+
+	while (blocks--) {
+		__m128i abef = state0;
+		__m128i cdgh = state1;
+		for (i = 0; i < 16; ++i) {
+			if (i < 4) {
+				w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * i)), mask);
+			} else {
+				w[i] = _mm_sha256msg1_epu32(w[i-4], w[i-3]);
+				w[i] = _mm_add_epi32(w[i], _mm_alignr_epi8(w[i-1], w[i-2], 4));
+				w[i] = _mm_sha256msg2_epu32(w[i], w[i-1]);
+			}
+			__m128i msg = _mm_add_epi32(w[i], _mm_loadu_si128((const __m128i*)&k[4 * i]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0E));
+		}
+		state0 = _mm_add_epi32(state0, abef);
+		state1 = _mm_add_epi32(state1, cdgh);
+		data += 64;
 	}
 
+	tmp = _mm_shuffle_epi32(state0, 0x1B);       /* FEBA */
+	state1 = _mm_shuffle_epi32(state1, 0xB1);    /* DCHG */
+	_mm_storeu_si128((__m128i*)&h[0], _mm_blend_epi16(tmp, state1, 0xF0)); /* DCBA */
+	_mm_storeu_si128((__m128i*)&h[4], _mm_alignr_epi8(state1, tmp, 8));    /* HGFE */
+}
+
+static int cpu_has_avx2(void) {
+	unsigned int a, b, c, d;
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d))
+		return 0;
+	/* AVX2 also needs the OS to save the YMM registers (OSXSAVE + XCR0) */
+	unsigned int a1, b1, c1, d1;
+	if (!__get_cpuid(1, &a1, &b1, &c1, &d1) || !(c1 & bit_OSXSAVE))
+		return 0;
+	unsigned int xcr0_lo, xcr0_hi;
+	__asm__ ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+	return (b & bit_AVX2) && (b & bit_BMI) && (b & bit_BMI2) && (xcr0_lo & 6) == 6;
+}
+
+static int cpu_has_shani(void) {
+	unsigned int a, b, c, d;
+	if (!__get_cpuid_count(7, 0, &a, &b, &c, &d) || !(b & (1u << 29)))  /* CPUID.7.0:EBX.SHA */
+		return 0;
+	return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSE4_1) && (c & bit_SSSE3);
+}
+#endif
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA2
+#define HWCAP_SHA2 (1 << 6)
+#endif
+
+/* ARMv8 crypto extensions: four rounds per sha256h/sha256h2 pair */
+__attribute__((target("+crypto")))
+static void sha256_blocks_armv8(uint32_t* h, const uint8_t* data, size_t blocks) {
+	uint32x4_t state0 = vld1q_u32(&h[0]);
+	uint32x4_t state1 = vld1q_u32(&h[4]);
+	uint32x4_t w[16];
+	int i;
+
+	while (blocks--) {
+		uint32x4_t abcd = state0;
+		uint32x4_t efgh = state1;
+		for (i = 0; i < 16; ++i) {
+			if (i < 4)
+				w[i] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16 * i)));
+			else
+				w[i] = vsha256su1q_u32(vsha256su0q_u32(w[i-4], w[i-3]), w[i-2], w[i-1]);
+			uint32x4_t msg = vaddq_u32(w[i], vld1q_u32(&k[4 * i]));
+			uint32x4_t prev = state0;
+			state0 = vsha256hq_u32(state0, state1, msg);
+			state1 = vsha256h2q_u32(state1, prev, msg);
+		}
+		state0 = vaddq_u32(state0, abcd);
+		state1 = vaddq_u32(state1, efgh);
+		data += 64;
+	}
+
+	vst1q_u32(&h[0], state0);
+	vst1q_u32(&h[4], state1);
+}
+
+static int cpu_has_armv8(void) {
+	return (getauxval(AT_HWCAP) & HWCAP_SHA2) != 0;
+}
+#endif
+
+static int cpu_has_scalar(void) {
+	return 1;
+}
+
+struct sha256_kernel_entry {
+	const char* name;
+	sha256_blocks_fn blocks;
+	int (*supported)(void);
+};
+
+/* In order of preference */
+static const struct sha256_kernel_entry kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	{ "sha-ni", sha256_blocks_shani, cpu_has_shani },
+#endif
+#if defined(__aarch64__)
+	{ "armv8", sha256_blocks_armv8, cpu_has_armv8 },
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+	{ "avx2", sha256_blocks_avx2, cpu_has_avx2 },
+#endif
+	{ "scalar", sha256_blocks_scalar, cpu_has_scalar },
+};
+
+#define KERNEL_COUNT (sizeof(kernels) / sizeof(kernels[0]))
+#define SELF_CHECK_BLOCKS 17
+
+static void sha256_blocks_resolve(uint32_t* h, const uint8_t* data, size_t blocks);
+
+static sha256_blocks_fn sha256_blocks = sha256_blocks_resolve;
+static const char* kernel_name = NULL;
+
+/* Runs a kernel and the scalar reference over the same data from several
+   starting states and block counts; returns 1 if every result matches */
+static int kernel_matches_scalar(const struct sha256_kernel_entry* kernel) {
+	uint8_t data[SELF_CHECK_BLOCKS * 64];
+	uint32_t seed = 0x2545f491;
+	size_t i, blocks;
+	for (i = 0; i < sizeof(data); ++i) {
+		seed = seed * 1103515245u + 12345u;
+		data[i] = seed >> 24;
+	}
+	for (blocks = 1; blocks <= SELF_CHECK_BLOCKS; blocks += 4) {
+		uint32_t expected[8], actual[8];
+		for (i = 0; i < 8; ++i)
+			expected[i] = actual[i] = k[(i * 7 + blocks) % 64];
+		sha256_blocks_scalar(expected, data, blocks);
+		kernel->blocks(actual, data, blocks);
+		if (memcmp(expected, actual, sizeof(expected)) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+/* Scalar reference against the FIPS 180-2 "abc" test vector */
+static int scalar_matches_vector(void) {
+	static const uint32_t abc[8] = {
+		0xba7816bf, 0x8f01cfea, 0x414140de, 0x5dae2223, 0xb00361a3, 0x96177a9c, 0xb410ff61, 0xf20015ad
+	};
+	uint8_t chunk[64] = { 'a', 'b', 'c', 0x80 };
+	chunk[63] = 24;
+	uint32_t h[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	sha256_blocks_scalar(h, chunk, 1);
+	return memcmp(h, abc, sizeof(abc)) == 0;
+}
+
+static void select_kernel(const struct sha256_kernel_entry* kernel) {
+	__atomic_store_n(&kernel_name, kernel->name, __ATOMIC_RELAXED);
+	__atomic_store_n(&sha256_blocks, kernel->blocks, __ATOMIC_RELEASE);
+}
+
+int sha256_set_kernel(const char* name) {
+	size_t i;
+	for (i = 0; i < KERNEL_COUNT; ++i) {
+		if (name != NULL && strcmp(name, kernels[i].name) != 0)
+			continue;
+		if (!kernels[i].supported() || !kernel_matches_scalar(&kernels[i])) {
+			if (name != NULL)
+				return -1;
+			continue;
+		}
+		select_kernel(&kernels[i]);
+		return 0;
+	}
+	return -1;
+}
+
+const char* sha256_kernel(void) {
+	if (__atomic_load_n(&kernel_name, __ATOMIC_RELAXED) == NULL)
+		sha256_blocks_resolve(NULL, NULL, 0);
+	return kernel_name;
+}
+
+const char* sha256_kernel_name(int index) {
+	return index >= 0 && (size_t)index < KERNEL_COUNT ? kernels[index].name : NULL;
+}
+
+/* First call: SHA256_KERNEL in the environment forces a kernel, otherwise the
+   fastest one this CPU supports that agrees with the scalar reference */
+static void sha256_blocks_resolve(uint32_t* h, const uint8_t* data, size_t blocks) {
+	const char* forced = getenv("SHA256_KERNEL");
+	if (forced == NULL || sha256_set_kernel(forced) != 0)
+		sha256_set_kernel(NULL);
+	if (blocks > 0)
+		__atomic_load_n(&sha256_blocks, __ATOMIC_ACQUIRE)(h, data, blocks);
+}
+
+/* ------------------------------------------------------------------------
+   Multi-buffer: independent messages hashed side by side, one per SIMD lane.
+   The state is transposed (word i of lane l at state[i * lanes + l]) and every
+   lane reads its own 64-byte block per step */
+
+typedef void (*sha256_lanes_fn)(uint32_t* state, const uint8_t** ptrs, size_t blocks);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define AVX2_INLINE static inline __attribute__((always_inline, target("avx2")))
+
+AVX2_INLINE __m256i ror_x8(__m256i x, int bits) {
+	return _mm256_or_si256(_mm256_srli_epi32(x, bits), _mm256_slli_epi32(x, 32 - bits));
+}
+
+/* Loads 8 big-endian words at offset from each of 8 lanes: out[i] holds word i of every lane */
+AVX2_INLINE void load_words_x8(const uint8_t* const* ptrs, size_t offset, __m256i* out) {
+	const __m256i bswap = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3,
+			12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+	__m256i r[8], t[8], u[8];
+	int i;
 	for (i = 0; i < 8; ++i)
-		tv[i] = buff->h[i];
-
-	for (i=0; i<64; ++i){
-		uint32_t S1 = rotate_r(tv[4], 6) ^ rotate_r(tv[4], 11) ^ rotate_r(tv[4], 25);
-		uint32_t ch = (tv[4] & tv[5]) ^ (~tv[4] & tv[6]);
-		uint32_t temp1 = tv[7] + S1 + ch + k[i] + w[i];
-		uint32_t S0 = rotate_r(tv[0], 2) ^ rotate_r(tv[0], 13) ^ rotate_r(tv[0], 22);
-		uint32_t maj = (tv[0] & tv[1]) ^ (tv[0] & tv[2]) ^ (tv[1] & tv[2]);
-		uint32_t temp2 = S0 + maj;
-
-		tv[7] = tv[6];
-		tv[6] = tv[5];
-		tv[5] = tv[4];
-		tv[4] = tv[3] + temp1;
-		tv[3] = tv[2];
-		tv[2] = tv[1];
-		tv[1] = tv[0];
-		tv[0] = temp1 + temp2;
+		r[i] = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i*)(ptrs[i] + offset)), bswap);
+	for (i = 0; i < 8; i += 2) {
+		t[i] = _mm256_unpacklo_epi32(r[i], r[i + 1]);
+		t[i + 1] = _mm256_unpackhi_epi32(r[i], r[i + 1]);
+	}
+	for (i = 0; i < 8; i += 4) {
+		u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+		u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+		u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+		u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
 	}
+	for (i = 0; i < 4; ++i) {
+		out[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+		out[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+	}
+}
 
+__attribute__((target("avx2")))
+static void sha256_lanes_avx2(uint32_t* state, const uint8_t** ptrs, size_t blocks) {
+	__m256i s[8], v[8], w[16];
+	const uint8_t* p[8];
+	int i;
+	for (i = 0; i < 8; ++i) {
+		s[i] = _mm256_loadu_si256((const __m256i*)&state[i * 8]);
+		p[i] = ptrs[i];
+	}
+	while (blocks--) {
+		load_words_x8(p, 0, w);
+		load_words_x8(p, 32, w + 8);
+		for (i = 0; i < 8; ++i)
+			v[i] = s[i];
+		for (i = 0; i < 64; ++i) {
+			if (i >= 16) {
+				__m256i w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+				__m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ror_x8(w15, 7), ror_x8(w15, 18)), _mm256_srli_epi32(w15, 3));
+				__m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ror_x8(w2, 17), ror_x8(w2, 19)), _mm256_srli_epi32(w2, 10));
+				w[i & 15] = _mm256_add_epi32(_mm256_add_epi32(w[i & 15], s0), _mm256_add_epi32(w[(i - 7) & 15], s1));
+			}
+			__m256i S1 = _mm256_xor_si256(_mm256_xor_si256(ror_x8(v[4], 6), ror_x8(v[4], 11)), ror_x8(v[4], 25));
+			__m256i ch = _mm256_xor_si256(_mm256_and_si256(v[4], v[5]), _mm256_andnot_si256(v[4], v[6]));
+			__m256i temp1 = _mm256_add_epi32(_mm256_add_epi32(v[7], S1), _mm256_add_epi32(ch, w[i & 15]));
+			temp1 = _mm256_add_epi32(temp1, _mm256_set1_epi32(k[i]));
+			__m256i S0 = _mm256_xor_si256(_mm256_xor_si256(ror_x8(v[0], 2), ror_x8(v[0], 13)), ror_x8(v[0], 22));
+			__m256i maj = _mm256_or_si256(_mm256_and_si256(v[0], v[1]), _mm256_and_si256(v[2], _mm256_or_si256(v[0], v[1])));
+			v[7] = v[6];
+			v[6] = v[5];
+			v[5] = v[4];
+			v[4] = _mm256_add_epi32(v[3], temp1);
+			v[3] = v[2];
+			v[2] = v[1];
+			v[1] = v[0];
+			v[0] = _mm256_add_epi32(temp1, _mm256_add_epi32(S0, maj));
+		}
+		for (i = 0; i < 8; ++i) {
+			s[i] = _mm256_add_epi32(s[i], v[i]);
+			p[i] += 64;
+		}
+	}
 	for (i = 0; i < 8; ++i)
-		buff->h[i] += tv[i];
+		_mm256_storeu_si256((__m256i*)&state[i * 8], s[i]);
+}
+
+/* AVX-512: native rotations, and ch/maj as a single ternary logic instruction */
+__attribute__((target("avx512f")))
+static void sha256_lanes_avx512(uint32_t* state, const uint8_t** ptrs, size_t blocks) {
+	__m512i s[8], v[8], w[16];
+	__m256i lo[16], hi[16];
+	const uint8_t* p[16];
+	int i;
+	for (i = 0; i < 8; ++i)
+		s[i] = _mm512_loadu_si512(&state[i * 16]);
+	for (i = 0; i < 16; ++i)
+		p[i] = ptrs[i];
+	while (blocks--) {
+		load_words_x8(p, 0, lo);
+		load_words_x8(p, 32, lo + 8);
+		load_words_x8(p + 8, 0, hi);
+		load_words_x8(p + 8, 32, hi + 8);
+		for (i = 0; i < 16; ++i)
+			w[i] = _mm512_inserti64x4(_mm512_castsi256_si512(lo[i]), hi[i], 1);
+		for (i = 0; i < 8; ++i)
+			v[i] = s[i];
+		for (i = 0; i < 64; ++i) {
+			if (i >= 16) {
+				__m512i w15 = w[(i - 15) & 15], w2 = w[(i - 2) & 15];
+				__m512i s0 = _mm512_ternarylogic_epi32(_mm512_ror_epi32(w15, 7), _mm512_ror_epi32(w15, 18), _mm512_srli_epi32(w15, 3), 0x96);
+				__m512i s1 = _mm512_ternarylogic_epi32(_mm512_ror_epi32(w2, 17), _mm512_ror_epi32(w2, 19), _mm512_srli_epi32(w2, 10), 0x96);
+				w[i & 15] = _mm512_add_epi32(_mm512_add_epi32(w[i & 15], s0), _mm512_add_epi32(w[(i - 7) & 15], s1));
+			}
+			__m512i S1 = _mm512_ternarylogic_epi32(_mm512_ror_epi32(v[4], 6), _mm512_ror_epi32(v[4], 11), _mm512_ror_epi32(v[4], 25), 0x96);
+			__m512i ch = _mm512_ternarylogic_epi32(v[4], v[5], v[6], 0xCA);
+			__m512i temp1 = _mm512_add_epi32(_mm512_add_epi32(v[7], S1), _mm512_add_epi32(ch, w[i & 15]));
+			temp1 = _mm512_add_epi32(temp1, _mm512_set1_epi32(k[i]));
+			__m512i S0 = _mm512_ternarylogic_epi32(_mm512_ror_epi32(v[0], 2), _mm512_ror_epi32(v[0], 13), _mm512_ror_epi32(v[0], 22), 0x96);
+			__m512i maj = _mm512_ternarylogic_epi32(v[0], v[1], v[2], 0xE8);
+			v[7] = v[6];
+			v[6] = v[5];
+			v[5] = v[4];
+			v[4] = _mm512_add_epi32(v[3], temp1);
+			v[3] = v[2];
+			v[2] = v[1];
+			v[1] = v[0];
+			v[0] = _mm512_add_epi32(temp1, _mm512_add_epi32(S0, maj));
+		}
+		for (i = 0; i < 8; ++i)
+			s[i] = _mm512_add_epi32(s[i], v[i]);
+		for (i = 0; i < 16; ++i)
+			p[i] += 64;
+	}
+	for (i = 0; i < 8; ++i)
+		_mm512_storeu_si512(&state[i * 16], s[i]);
+}
+
+static int cpu_has_avx512(void) {
+	unsigned int a, b, c, d;
+	if (!cpu_has_avx2() || !__get_cpuid_count(7, 0, &a, &b, &c, &d) || !(b & bit_AVX512F))
+		return 0;
+	/* The OS must also save the opmask and ZMM registers */
+	unsigned int xcr0_lo, xcr0_hi;
+	__asm__ ("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+	return (xcr0_lo & 0xe6) == 0xe6;
+}
+#endif
+
+struct sha256_lanes_entry {
+	const char* name;
+	int lanes;                  /* 1: each message goes through the single-stream kernel */
+	int beats_sha_extensions;   /* Faster than sha-ni/armv8 one message at a time */
+	sha256_lanes_fn blocks;
+	int (*supported)(void);
+};
+
+/* In order of preference */
+static const struct sha256_lanes_entry lanes_kernels[] = {
+#if defined(__x86_64__) || defined(__i386__)
+	{ "avx512", 16, 1, sha256_lanes_avx512, cpu_has_avx512 },
+	{ "avx2", 8, 0, sha256_lanes_avx2, cpu_has_avx2 },
+#endif
+	{ "single", 1, 1, NULL, cpu_has_scalar },
+};
+
+#define LANES_KERNEL_COUNT (sizeof(lanes_kernels) / sizeof(lanes_kernels[0]))
+#define SELF_CHECK_MESSAGES 37
+
+static const struct sha256_lanes_entry* lanes_kernel = NULL;
+
+/* A message in a lane: its whole blocks straight from the caller's buffer,
+   then one or two padded blocks with the tail and the length */
+struct sha256_lane {
+	const uint8_t* ptr;
+	size_t blocks;
+	size_t message;
+	int tail;
+	uint8_t pad[128];
+	size_t pad_blocks;
+};
+
+static void lane_start(struct sha256_lane* lane, uint32_t* state, int lanes, int index,
+		const uint8_t* data, size_t size, size_t message) {
+	static const uint32_t iv[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+	size_t full = size / 64, rest = size % 64, i;
+	uint64_t bits = (uint64_t)size * 8;
+	for (i = 0; i < 8; ++i)
+		state[i * lanes + index] = iv[i];
+	lane->message = message;
+	lane->pad_blocks = rest < 56 ? 1 : 2;
+	memset(lane->pad, 0, sizeof(lane->pad));
+	memcpy(lane->pad, data + full * 64, rest);
+	lane->pad[rest] = 0x80;
+	for (i = 0; i < 8; ++i)
+		lane->pad[lane->pad_blocks * 64 - 1 - i] = bits >> (8 * i);
+	lane->tail = full == 0;
+	lane->ptr = full > 0 ? data : lane->pad;
+	lane->blocks = full > 0 ? full : lane->pad_blocks;
+}
+
+static void lanes_hash(const struct sha256_lanes_entry* kernel, const void* const* data, const size_t* sizes,
+		size_t count, uint8_t* digests) {
+	struct sha256_lane lane[SHA256_MAX_LANES];
+	int busy[SHA256_MAX_LANES];
+	uint32_t state[8 * SHA256_MAX_LANES];
+	const uint8_t* ptrs[SHA256_MAX_LANES];
+	int lanes = kernel->lanes, active = 0, l, i;
+	size_t next = 0;
+
+	for (l = 0; l < lanes; ++l) {
+		busy[l] = next < count;
+		if (busy[l]) {
+			lane_start(&lane[l], state, lanes, l, data[next], sizes[next], next);
+			next++;
+			active++;
+		}
+	}
+	while (active > 0) {
+		/* All lanes advance together as far as the shortest segment; idle
+		   lanes reread a busy lane's blocks and their result is ignored */
+		size_t steps = (size_t)-1;
+		const uint8_t* any = NULL;
+		for (l = 0; l < lanes; ++l) {
+			if (busy[l] && lane[l].blocks < steps)
+				steps = lane[l].blocks;
+			if (busy[l])
+				any = lane[l].ptr;
+		}
+		for (l = 0; l < lanes; ++l)
+			ptrs[l] = busy[l] ? lane[l].ptr : any;
+		kernel->blocks(state, ptrs, steps);
+
+		for (l = 0; l < lanes; ++l) {
+			if (!busy[l])
+				continue;
+			lane[l].ptr += steps * 64;
+			lane[l].blocks -= steps;
+			if (lane[l].blocks > 0)
+				continue;
+			if (!lane[l].tail) {
+				lane[l].tail = 1;
+				lane[l].ptr = lane[l].pad;
+				lane[l].blocks = lane[l].pad_blocks;
+				continue;
+			}
+			uint8_t* digest = digests + lane[l].message * 32;
+			for (i = 0; i < 8; ++i) {
+				uint32_t word = state[i * lanes + l];
+				digest[i * 4] = word >> 24;
+				digest[i * 4 + 1] = word >> 16;
+				digest[i * 4 + 2] = word >> 8;
+				digest[i * 4 + 3] = word;
+			}
+			busy[l] = next < count;
+			if (busy[l]) {
+				lane_start(&lane[l], state, lanes, l, data[next], sizes[next], next);
+				next++;
+			} else {
+				active--;
+			}
+		}
+	}
+}
+
+static void hash_messages(const struct sha256_lanes_entry* kernel, const void* const* data, const size_t* sizes,
+		size_t count, uint8_t* digests) {
+	size_t i;
+	if (kernel->lanes == 1 || count == 1) {
+		for (i = 0; i < count; ++i)
+			sha256_hash(data[i], sizes[i], digests + i * 32);
+		return;
+	}
+	lanes_hash(kernel, data, sizes, count, digests);
+}
+
+/* Hashes messages of every length up to a few blocks, more messages than
+   lanes, with the kernel and one by one; returns 1 if they all match */
+static int lanes_kernel_matches(const struct sha256_lanes_entry* kernel) {
+	static uint8_t data[SELF_CHECK_MESSAGES * 71];
+	const void* messages[SELF_CHECK_MESSAGES];
+	size_t sizes[SELF_CHECK_MESSAGES], i;
+	uint8_t expected[SELF_CHECK_MESSAGES][32], actual[SELF_CHECK_MESSAGES][32];
+	uint32_t seed = 0x9e3779b9;
+	for (i = 0; i < sizeof(data); ++i) {
+		seed = seed * 1103515245u + 12345u;
+		data[i] = seed >> 24;
+	}
+	/* Both sides of the one and two padding block boundaries, then longer ones */
+	static const size_t edges[] = { 0, 1, 55, 56, 63, 64, 119, 120 };
+	for (i = 0; i < SELF_CHECK_MESSAGES; ++i) {
+		sizes[i] = i < sizeof(edges) / sizeof(edges[0]) ? edges[i] : i * 67 % (sizeof(data) - i);
+		messages[i] = data + i;
+		sha256_hash(messages[i], sizes[i], expected[i]);
+	}
+	hash_messages(kernel, messages, sizes, SELF_CHECK_MESSAGES, &actual[0][0]);
+	return memcmp(expected, actual, sizeof(expected)) == 0;
+}
+
+int sha256_set_multi_kernel(const char* name) {
+	int sha_extensions = strcmp(sha256_kernel(), "sha-ni") == 0 || strcmp(sha256_kernel(), "armv8") == 0;
+	size_t i;
+	for (i = 0; i < LANES_KERNEL_COUNT; ++i) {
+		if (name != NULL && strcmp(name, lanes_kernels[i].name) != 0)
+			continue;
+		if (name == NULL && sha_extensions && !lanes_kernels[i].beats_sha_extensions)
+			continue;
+		if (!lanes_kernels[i].supported() || !lanes_kernel_matches(&lanes_kernels[i])) {
+			if (name != NULL)
+				return -1;
+			continue;
+		}
+		__atomic_store_n(&lanes_kernel, &lanes_kernels[i], __ATOMIC_RELEASE);
+		return 0;
+	}
+	return -1;
+}
+
+/* First use: SHA256_MULTI_KERNEL in the environment forces a kernel */
+static const struct sha256_lanes_entry* current_lanes_kernel(void) {
+	const struct sha256_lanes_entry* kernel = __atomic_load_n(&lanes_kernel, __ATOMIC_ACQUIRE);
+	if (kernel != NULL)
+		return kernel;
+	const char* forced = getenv("SHA256_MULTI_KERNEL");
+	if (forced == NULL || sha256_set_multi_kernel(forced) != 0)
+		sha256_set_multi_kernel(NULL);
+	return __atomic_load_n(&lanes_kernel, __ATOMIC_ACQUIRE);
+}
+
+const char* sha256_multi_kernel(void) {
+	return current_lanes_kernel()->name;
+}
+
+const char* sha256_multi_kernel_name(int index) {
+	return index >= 0 && (size_t)index < LANES_KERNEL_COUNT ? lanes_kernels[index].name : NULL;
+}
+
+void sha256_hash_many(const void* const* data, const size_t* sizes, size_t count, uint8_t* digests) {
+	hash_messages(current_lanes_kernel(), data, sizes, count, digests);
+}
+
+int sha256_self_check(void) {
+	int failures = !scalar_matches_vector();
+	size_t i;
+	for (i = 0; i < KERNEL_COUNT; ++i)
+		if (kernels[i].supported() && !kernel_matches_scalar(&kernels[i]))
+			failures++;
+	for (i = 0; i < LANES_KERNEL_COUNT; ++i)
+		if (lanes_kernels[i].supported() && !lanes_kernel_matches(&lanes_kernels[i]))
+			failures++;
+	return failures;
 }
 
 void sha256_update(struct sha256_buff* buff, const void* data, size_t size) {
@@ -107,13 +700,13 @@ void sha256_update(struct sha256_buff* buff, const void* data, size_t size) {
 		ptr += (64 - buff->chunk_size);
 		size -= (64 - buff->chunk_size);
 		buff->chunk_size = 0;
-		sha256_calc_chunk(buff, tmp_chunk);
+		sha256_blocks(buff->h, tmp_chunk, 1);
 	}
-	/* Run over data chunks */
-	while (size  >= 64) {
-		sha256_calc_chunk(buff, ptr);
-		ptr += 64;
-		size -= 64; 
+	/* Run over all the whole data chunks in one call */
+	if (size >= 64) {
+		sha256_blocks(buff->h, ptr, size / 64);
+		ptr += size / 64 * 64;
+		size %= 64;
 	}
 
 	/* Save remaining data in buff, will be reused on next call or finalize */
@@ -128,7 +721,7 @@ void sha256_finalize(struct sha256_buff* buff) {
 
 	/* If there isn't enough space to fit int64, pad chunk with zeroes and prepare next chunk */
 	if (buff->chunk_size > 56) {
-		sha256_calc_chunk(buff, buff->last_chunk);
+		sha256_blocks(buff->h, buff->last_chunk, 1);
 		memset(buff->last_chunk, 0, 64);
 	}
 
@@ -140,7 +733,7 @@ void sha256_finalize(struct sha256_buff* buff) {
 		size >>= 8;
 	}
 
-	sha256_calc_chunk(buff, buff->last_chunk);
+	sha256_blocks(buff->h, buff->last_chunk, 1);
 }
 
 void sha256_read(const struct sha256_buff* buff, uint8_t* hash) {
@@ -183,23 +776,196 @@ void sha256_hash_hex(const void* data, size_t size, char* hex) {
 	bin_to_hex(hash, 32, hex);
 }
 
-void sha256_hash_file_hex(char * path, char * hex) {
-	FILE* file = fopen(path, "rb");
-	if (!file){
-		return;
+static pthread_once_t sigbusOnce = PTHREAD_ONCE_INIT;
+static int sigbusInstalled = 0;                  /* The SIGBUS handler below is in place */
+static struct sigaction sigbusPrevious;          /* Handler for the SIGBUS that are not ours */
+static __thread sigjmp_buf* volatile sigbusJump; /* Set while this thread reads a mapping */
+
+/* A file truncated while it is mapped raises SIGBUS on the pages past its new
+   end. While a thread hashes a mapping the handler jumps back to it; any other
+   SIGBUS goes to the previous handler, or kills the process as before */
+static void hash_file_sigbus(int sig, siginfo_t* info, void* context) {
+	if (sigbusJump != NULL)
+		siglongjmp(*sigbusJump, 1);
+	if (sigbusPrevious.sa_flags & SA_SIGINFO) {
+		sigbusPrevious.sa_sigaction(sig, info, context);
+	} else if (sigbusPrevious.sa_handler != SIG_DFL && sigbusPrevious.sa_handler != SIG_IGN) {
+		sigbusPrevious.sa_handler(sig);
+	} else {
+		signal(SIGBUS, SIG_DFL);
+		raise(SIGBUS);
+	}
+}
+
+static void hash_file_install_sigbus(void) {
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = hash_file_sigbus;
+	action.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&action.sa_mask);
+	sigbusInstalled = sigaction(SIGBUS, &action, &sigbusPrevious) == 0;
+}
+
+/* Hashes a regular file through windows of a read-only mapping: no copy into
+   user space, and MADV_SEQUENTIAL lets the kernel read ahead and drop the
+   pages behind. If the file shrinks meanwhile the hash starts over and the
+   caller reads the file instead. Returns 0, 1 if the file can't be mapped
+   (buff and the file position are as they were), -1 on error */
+static int hash_file_mapped(int fd, off_t size, struct sha256_buff* buff) {
+	sigjmp_buf jump;
+	void* volatile map = MAP_FAILED;
+	volatile size_t length = 0;
+	pthread_once(&sigbusOnce, hash_file_install_sigbus);
+	if (!sigbusInstalled)
+		return 1;
+	if (sigsetjmp(jump, 1) != 0) {
+		sigbusJump = NULL;
+		munmap(map, length);
+		sha256_init(buff);
+		return lseek(fd, 0, SEEK_SET) == 0 ? 1 : -1;
+	}
+	sigbusJump = &jump;
+	for (off_t offset = 0; offset < size; offset += SHA256_MMAP_WINDOW) {
+		length = size - offset < SHA256_MMAP_WINDOW ? (size_t)(size - offset) : SHA256_MMAP_WINDOW;
+		map = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, offset);
+		if (map == MAP_FAILED) {
+			sigbusJump = NULL;
+			return offset == 0 ? 1 : -1;
+		}
+		madvise(map, length, MADV_SEQUENTIAL);
+		madvise(map, length, MADV_WILLNEED);
+		sha256_update(buff, map, length);
+		munmap(map, length);
 	}
-	char buffer[1024];
-	size_t size;
+	sigbusJump = NULL;
+	return 0;
+}
+
+/* Hashes whatever read returns until end of file, in large page-aligned reads.
+   Used for pipes and special files, small files, and files that can't be mapped */
+static int hash_file_read(int fd, size_t buffer_size, struct sha256_buff* buff) {
+	void* buffer;
+	if (posix_memalign(&buffer, 4096, buffer_size) != 0)
+		return -1;
+	int result = 0;
+	while (1) {
+		ssize_t n = read(fd, buffer, buffer_size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			result = -1;
+		if (n <= 0)
+			break;
+		sha256_update(buff, buffer, n);
+	}
+	free(buffer);
+	return result;
+}
+
+int sha256_hash_file_hex(char * path, char * hex) {
 	struct sha256_buff buff;
+	struct stat st;
+	int result = -1;
+	hex[0] = '\0';
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
 	sha256_init(&buff);
-	while (!feof(file)){
-		/* Hash file by 1kb chunks, instead of loading into RAM at once */
-		size = fread(buffer, 1, 1024, file);
-		sha256_update(&buff, buffer, size);
+	if (fstat(fd, &st) == 0) {
+		result = 1;
+		if (S_ISREG(st.st_mode) && st.st_size >= SHA256_MMAP_MIN)
+			result = hash_file_mapped(fd, st.st_size, &buff);
+		/* Small regular files need just one read of their size */
+		if (result == 1) {
+			size_t buffer_size = SHA256_READ_BUFFER;
+			if (S_ISREG(st.st_mode) && st.st_size < SHA256_READ_BUFFER)
+				buffer_size = (st.st_size + 1 + 4095) / 4096 * 4096;
+			result = hash_file_read(fd, buffer_size, &buff);
+		}
 	}
-	char hash[65] = {0}; /* hash[64] is null-byte */
-	sha256_finalize(&buff);
+	int saved = errno;
+	close(fd);
+	errno = saved;
+	if (result != 0)
+		return -1;
 
-	hex[64] = 0;
+	sha256_finalize(&buff);
 	sha256_read_hex(&buff, hex);
+	hex[64] = '\0';
+	return 0;
+}
+
+static ssize_t read_full(int fd, uint8_t* buffer, size_t size) {
+	size_t done = 0;
+	while (done < size) {
+		ssize_t n = read(fd, buffer + done, size - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		done += n;
+	}
+	return done;
+}
+
+int sha256_hash_files_hex(char** paths, size_t count, char* hexes) {
+	uint8_t* arena = malloc(SHA256_BATCH_BYTES);
+	const void** data = malloc(SHA256_BATCH_FILES * sizeof(void*));
+	size_t* sizes = malloc(SHA256_BATCH_FILES * sizeof(size_t));
+	size_t* which = malloc(SHA256_BATCH_FILES * sizeof(size_t));
+	uint8_t* digests = malloc(SHA256_BATCH_FILES * 32);
+	int failures = 0;
+	size_t i = 0, j;
+
+	while (i < count) {
+		size_t used = 0, n = 0;
+		/* Small files are read whole into the arena and hashed together in SIMD
+		   lanes; big files, special files, or all of them if there is no memory
+		   for the arena, are hashed one at a time while reading */
+		for (; i < count && n < SHA256_BATCH_FILES; ++i) {
+			char* hex = hexes + i * 65;
+			struct stat st;
+			hex[0] = '\0';
+			int fd = open(paths[i], O_RDONLY);
+			if (fd < 0 || fstat(fd, &st) != 0) {
+				if (fd >= 0)
+					close(fd);
+				failures++;
+				continue;
+			}
+			if (arena == NULL || data == NULL || sizes == NULL || which == NULL || digests == NULL
+					|| !S_ISREG(st.st_mode) || st.st_size > SHA256_BATCH_MAX_FILE) {
+				close(fd);
+				failures += sha256_hash_file_hex(paths[i], hex) != 0;
+				continue;
+			}
+			if (used + st.st_size > SHA256_BATCH_BYTES) {
+				close(fd);
+				break;
+			}
+			ssize_t got = read_full(fd, arena + used, st.st_size);
+			close(fd);
+			if (got != st.st_size) {
+				failures++;
+				continue;
+			}
+			data[n] = arena + used;
+			sizes[n] = got;
+			which[n++] = i;
+			used += got;
+		}
+		if (n == 0)
+			continue;
+		sha256_hash_many(data, sizes, n, digests);
+		for (j = 0; j < n; ++j) {
+			bin_to_hex(digests + j * 32, 32, hexes + which[j] * 65);
+			hexes[which[j] * 65 + 64] = '\0';
+		}
+	}
+	free(arena);
+	free(data);
+	free(sizes);
+	free(which);
+	free(digests);
+	return failures;
 }
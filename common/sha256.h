@@ -62,8 +62,49 @@ void sha256_hash(const void* data, size_t size, uint8_t* hash);
 /* Hashes single contiguous block of data and reads digest into 64-char string (without null-byte) */
 void sha256_hash_hex(const void* data, size_t size, char* hex);
 
-/* Hashes a file */
-void sha256_hash_file_hex(char * path, char * hex);
+/* Name of the compression kernel in use: "sha-ni", "armv8", "avx2" or "scalar".
+   The first use picks the fastest one the CPU supports (SHA256_KERNEL in the
+   environment forces one) after checking it against the scalar reference */
+const char* sha256_kernel(void);
+
+/* Selects a kernel by name, NULL for the fastest available.
+   Returns 0, or -1 if the CPU lacks it or it disagrees with the scalar reference */
+int sha256_set_kernel(const char* name);
+
+/* Name of the index-th kernel built in, NULL past the last one */
+const char* sha256_kernel_name(int index);
+
+/* Checks the scalar kernel against a known vector, every kernel this CPU
+   supports against the scalar one and every multi-buffer kernel against
+   sha256_hash; returns the number of failures */
+int sha256_self_check(void);
+
+/* Hashes a file into a 64-char string plus null-byte. Big regular files are
+   mapped, anything else (pipes, devices, small files) is read in large chunks.
+   Returns 0, or -1 with errno set and an empty hex if the file can't be read */
+int sha256_hash_file_hex(char * path, char * hex);
+
+#define SHA256_MAX_LANES 16
+
+/* Hashes count independent buffers at once, one per SIMD lane (16 with AVX-512,
+   8 with AVX2, otherwise one after the other). digests receives 32 bytes per buffer */
+void sha256_hash_many(const void* const* data, const size_t* sizes, size_t count, uint8_t* digests);
+
+/* Name of the multi-buffer kernel in use: "avx512", "avx2" or "single".
+   SHA256_MULTI_KERNEL in the environment forces one */
+const char* sha256_multi_kernel(void);
+
+/* Selects a multi-buffer kernel by name, NULL for the default.
+   Returns 0, or -1 if the CPU lacks it or it disagrees with sha256_hash */
+int sha256_set_multi_kernel(const char* name);
+
+/* Name of the index-th multi-buffer kernel built in, NULL past the last one */
+const char* sha256_multi_kernel_name(int index);
+
+/* Hashes many files, small ones together through sha256_hash_many.
+   hexes receives 65 bytes per file (64 hex chars and a null-byte), an empty
+   string for a file that could not be read. Returns the number of such files */
+int sha256_hash_files_hex(char** paths, size_t count, char* hexes);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,140 @@
+/**
+ * @file
+ * @brief Trazas por solicitud en buffers circulares por hilo
+ * @copyright MIT License
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/**
+ * @brief Intervalo terminado
+ */
+struct trace_span {
+    const char *name;         /**< Nombre (cadena constante) */
+    unsigned long long start; /**< Inicio en nanosegundos (reloj monotonico) */
+    unsigned long long nanos; /**< Duracion */
+    unsigned long request;    /**< Solicitud del hilo a la que pertenece */
+};
+
+/**
+ * @brief Buffer de intervalos de un hilo. Solo su hilo escribe en el; el
+ * candado es para que un volcado no lea un intervalo a medio escribir
+ */
+struct trace_buffer {
+    pthread_mutex_t mutex;                  /**< Protege spans y count */
+    pid_t tid;                              /**< Hilo dueno, la fila del trace */
+    unsigned long count;                    /**< Intervalos guardados desde el inicio */
+    struct trace_buffer *next;              /**< Siguiente buffer de la lista global */
+    struct trace_span spans[TRACE_BUFFER_SPANS]; /**< Anillo de intervalos */
+};
+
+static int traceRate = 0;                                    /* Partes por millon de las solicitudes que se trazan*/
+static struct trace_buffer *buffers = NULL;                  /* Buffers de todos los hilos que han trazado*/
+static pthread_mutex_t buffersMutex = PTHREAD_MUTEX_INITIALIZER; /* Protege la lista de buffers*/
+static __thread struct trace_buffer *threadBuffer = NULL;    /* Buffer del hilo, se crea al primer intervalo*/
+static __thread int threadSampled = 0;                       /* La solicitud actual del hilo se traza*/
+static __thread unsigned long threadRequest = 0;             /* Solicitudes trazadas por el hilo*/
+static __thread unsigned threadSeed = 0;                     /* Estado del generador del muestreo*/
+
+static unsigned long long trace_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void trace_set_rate(int rate) {
+    if (rate < 0)
+        rate = 0;
+    if (rate > TRACE_RATE_SCALE)
+        rate = TRACE_RATE_SCALE;
+    __atomic_store_n(&traceRate, rate, __ATOMIC_RELAXED);
+}
+
+int trace_get_rate() {
+    return __atomic_load_n(&traceRate, __ATOMIC_RELAXED);
+}
+
+int trace_request_begin() {
+    int rate = trace_get_rate();
+    if (rate == 0) {
+        threadSampled = 0;
+        return 0;
+    }
+    //xorshift32: sin estado compartido entre hilos
+    if (threadSeed == 0)
+        threadSeed = ((unsigned)gettid() * 2654435761u ^ (unsigned)trace_now_ns()) | 1;
+    threadSeed ^= threadSeed << 13;
+    threadSeed ^= threadSeed >> 17;
+    threadSeed ^= threadSeed << 5;
+    threadSampled = threadSeed % TRACE_RATE_SCALE < (unsigned)rate;
+    threadRequest += threadSampled;
+    return threadSampled;
+}
+
+void trace_request_end() {
+    threadSampled = 0;
+}
+
+unsigned long long trace_begin() {
+    return threadSampled ? trace_now_ns() : 0;
+}
+
+/**
+ * @brief Crea el buffer del hilo y lo agrega a la lista global
+ * @return buffer, NULL si no hay memoria
+ */
+static struct trace_buffer *trace_thread_buffer() {
+    struct trace_buffer *buffer = calloc(1, sizeof(struct trace_buffer));
+    if (buffer == NULL)
+        return NULL;
+    pthread_mutex_init(&buffer->mutex, NULL);
+    buffer->tid = gettid();
+    pthread_mutex_lock(&buffersMutex);
+    buffer->next = buffers;
+    buffers = buffer;
+    pthread_mutex_unlock(&buffersMutex);
+    return buffer;
+}
+
+void trace_end(const char *name, unsigned long long start) {
+    if (start == 0)
+        return;
+    unsigned long long end = trace_now_ns();
+    if (threadBuffer == NULL && (threadBuffer = trace_thread_buffer()) == NULL)
+        return;
+    pthread_mutex_lock(&threadBuffer->mutex);
+    struct trace_span *span = &threadBuffer->spans[threadBuffer->count++ % TRACE_BUFFER_SPANS];
+    span->name = name;
+    span->start = start;
+    span->nanos = end - start;
+    span->request = threadRequest;
+    pthread_mutex_unlock(&threadBuffer->mutex);
+}
+
+long trace_write_json(FILE *fp) {
+    long written = 0;
+    pid_t pid = getpid();
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    pthread_mutex_lock(&buffersMutex);
+    for (struct trace_buffer *buffer = buffers; buffer != NULL; buffer = buffer->next) {
+        pthread_mutex_lock(&buffer->mutex);
+        unsigned long first = buffer->count > TRACE_BUFFER_SPANS ? buffer->count - TRACE_BUFFER_SPANS : 0;
+        for (unsigned long i = first; i < buffer->count; i++) {
+            struct trace_span *span = &buffer->spans[i % TRACE_BUFFER_SPANS];
+            fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"rversionsd\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                    "\"pid\":%d,\"tid\":%d,\"args\":{\"request\":%lu}}", written > 0 ? "," : "", span->name,
+                    span->start / 1e3, span->nanos / 1e3, pid, buffer->tid, span->request);
+            written++;
+        }
+        pthread_mutex_unlock(&buffer->mutex);
+    }
+    pthread_mutex_unlock(&buffersMutex);
+    fprintf(fp, "\n]}\n");
+    return ferror(fp) ? -1 : written;
+}
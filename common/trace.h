@@ -0,0 +1,63 @@
+/**
+ * @file
+ * @brief Trazas por solicitud: intervalos (spans) de cada fase de una
+ * solicitud muestreada, guardados en un buffer circular por hilo y exportables
+ * en el formato JSON de Chrome trace / Perfetto
+ * @copyright MIT License
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+#define TRACE_BUFFER_SPANS 16384   /**< Intervalos por hilo; al llenarse se pisan los mas antiguos */
+#define TRACE_RATE_SCALE 1000000   /**< La tasa de muestreo se expresa en partes por millon */
+#define TRACE_KEEP_RATE -1         /**< En una solicitud TRACE: no cambiar la tasa */
+
+/**
+ * @brief Cambia la tasa de muestreo. Se puede llamar en cualquier momento:
+ * aplica desde la siguiente solicitud
+ * @param rate solicitudes trazadas por cada TRACE_RATE_SCALE, 0 para no trazar
+ */
+void trace_set_rate(int rate);
+
+/**
+ * @brief Tasa de muestreo actual
+ * @return solicitudes trazadas por cada TRACE_RATE_SCALE
+ */
+int trace_get_rate();
+
+/**
+ * @brief Empieza una solicitud en el hilo: decide si se traza segun la tasa
+ * @return 1 si la solicitud se traza
+ */
+int trace_request_begin();
+
+/**
+ * @brief Termina la solicitud del hilo; sus intervalos ya no se registran
+ */
+void trace_request_end();
+
+/**
+ * @brief Empieza un intervalo
+ * @return instante de inicio en nanosegundos, 0 si la solicitud no se traza
+ */
+unsigned long long trace_begin();
+
+/**
+ * @brief Termina un intervalo y lo guarda en el buffer del hilo
+ * @param name nombre del intervalo, debe ser una cadena constante
+ * @param start valor de trace_begin; si es 0 no se guarda nada
+ */
+void trace_end(const char *name, unsigned long long start);
+
+/**
+ * @brief Escribe los intervalos de todos los hilos como JSON de Chrome trace
+ * (eventos completos "X", una fila por hilo); se abre en chrome://tracing o Perfetto
+ * @param fp archivo destino
+ * @return intervalos escritos, -1 si fallo la escritura
+ */
+long trace_write_json(FILE *fp);
+
+#endif
@@ -0,0 +1,399 @@
+/**
+ * @file
+ * @brief Backend opcional de io_uring para transferir archivos por socket
+ * sin una llamada al sistema por cada bloque
+ * @copyright MIT License
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+
+#include "uring.h"
+
+#define URING_ENTRIES (3 * URING_BUFFERS) /**< Cada bloque usa hasta tres operaciones enlazadas */
+#define FIXED_SOCKET 0                    /**< Posicion del socket en los archivos registrados */
+#define FIXED_FILE 1                      /**< Posicion del archivo en los archivos registrados */
+
+struct transfer_counters transferCounters;
+__thread unsigned long long threadTransferBytes = 0;
+__thread unsigned long long threadSentBytes = 0;
+
+/**
+ * @brief Anillo de io_uring de un hilo con sus buffers registrados
+ */
+struct uring {
+    int fd;                      /**< Descriptor del anillo */
+    unsigned *sqTail;            /**< Cola de envio: siguiente posicion libre */
+    unsigned *sqMask;            /**< Mascara de la cola de envio */
+    unsigned *sqArray;           /**< Indices de las SQE en la cola de envio */
+    unsigned *cqHead;            /**< Cola de completados: siguiente a leer */
+    unsigned *cqTail;            /**< Cola de completados: ultimo escrito por el kernel */
+    unsigned *cqMask;            /**< Mascara de la cola de completados */
+    struct io_uring_sqe *sqes;   /**< Operaciones */
+    struct io_uring_cqe *cqes;   /**< Resultados */
+    char *buffers;               /**< URING_BUFFERS buffers registrados contiguos */
+    struct __kernel_timespec timeout; /**< Plazo de cada operacion del socket */
+};
+
+static int uringEnabled = 0;                      /**< io_uring activado y soportado */
+static int uringTimeout = 0;                      /**< Segundos de plazo por operacion del socket, 0 sin plazo */
+static __thread struct uring *threadRing = NULL;  /**< Anillo del hilo actual */
+static __thread int threadRingFailed = 0;         /**< El hilo no pudo crear su anillo */
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *params) {
+    return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int sys_io_uring_enter(int fd, unsigned submit, unsigned complete, unsigned flags) {
+    __atomic_fetch_add(&transferCounters.syscalls, 1, __ATOMIC_RELAXED);
+    return syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, void *arg, unsigned count) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+/**
+ * @brief Crea el anillo del hilo: mapea las colas, registra los buffers y dos
+ * archivos fijos vacios (socket y archivo de cada transferencia)
+ * @return anillo, NULL si hubo error
+ */
+static struct uring *uring_create(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = sys_io_uring_setup(URING_ENTRIES, &params);
+    if (fd < 0)
+        return NULL;
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP)) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t ringSize = sqSize > cqSize ? sqSize : cqSize;
+    char *ring = mmap(NULL, ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    struct io_uring_sqe *sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    char *buffers = mmap(NULL, URING_BUFFERS * URING_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    struct uring *uring = malloc(sizeof(struct uring));
+    if (ring == MAP_FAILED || sqes == MAP_FAILED || buffers == MAP_FAILED || uring == NULL)
+        goto error;
+
+    struct iovec iovecs[URING_BUFFERS];
+    for (int i = 0; i < URING_BUFFERS; i++) {
+        iovecs[i].iov_base = buffers + (size_t)i * URING_BUFFER_SIZE;
+        iovecs[i].iov_len = URING_BUFFER_SIZE;
+    }
+    int files[2] = { -1, -1 };
+    if (sys_io_uring_register(fd, IORING_REGISTER_BUFFERS, iovecs, URING_BUFFERS) < 0
+            || sys_io_uring_register(fd, IORING_REGISTER_FILES, files, 2) < 0)
+        goto error;
+
+    uring->fd = fd;
+    uring->sqTail = (unsigned *)(ring + params.sq_off.tail);
+    uring->sqMask = (unsigned *)(ring + params.sq_off.ring_mask);
+    uring->sqArray = (unsigned *)(ring + params.sq_off.array);
+    uring->cqHead = (unsigned *)(ring + params.cq_off.head);
+    uring->cqTail = (unsigned *)(ring + params.cq_off.tail);
+    uring->cqMask = (unsigned *)(ring + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)(ring + params.cq_off.cqes);
+    uring->sqes = sqes;
+    uring->buffers = buffers;
+    uring->timeout.tv_sec = uringTimeout;
+    uring->timeout.tv_nsec = 0;
+    return uring;
+
+error:
+    free(uring);
+    if (buffers != MAP_FAILED)
+        munmap(buffers, URING_BUFFERS * URING_BUFFER_SIZE);
+    if (sqes != MAP_FAILED)
+        munmap(sqes, params.sq_entries * sizeof(struct io_uring_sqe));
+    if (ring != MAP_FAILED)
+        munmap(ring, ringSize);
+    close(fd);
+    return NULL;
+}
+
+int uring_enable(int timeout) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = sys_io_uring_setup(1, &params);
+    if (fd < 0)
+        return -1;
+    close(fd);
+    uringTimeout = timeout;
+    uringEnabled = 1;
+    return 0;
+}
+
+int uring_available(void) {
+    if (!uringEnabled || threadRingFailed)
+        return 0;
+    if (threadRing == NULL) {
+        threadRing = uring_create();
+        if (threadRing == NULL) {
+            perror("Error creating the io_uring of the thread, using read/write");
+            threadRingFailed = 1;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Prepara una operacion en la siguiente posicion de la cola de envio
+ * (el kernel no la ve hasta publicar sqTail)
+ */
+static struct io_uring_sqe *uring_sqe(struct uring *uring, unsigned index, int opcode, int fixedFd, unsigned flags) {
+    unsigned tail = *uring->sqTail + index;
+    unsigned slot = tail & *uring->sqMask;
+    struct io_uring_sqe *sqe = &uring->sqes[slot];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->fd = fixedFd;
+    sqe->flags = IOSQE_FIXED_FILE | flags;
+    sqe->off = (__u64)-1; /* posicion actual del archivo, como read/write */
+    sqe->user_data = index;
+    uring->sqArray[slot] = slot;
+    return sqe;
+}
+
+/**
+ * @brief Enlaza un plazo a la operacion anterior de la cadena, que debe llevar
+ * IOSQE_IO_LINK. Si vence, la operacion termina con -ECANCELED y el plazo con
+ * -ETIME; si la operacion termina antes, el plazo termina con -ECANCELED
+ */
+static void uring_link_timeout(struct uring *uring, unsigned index, unsigned flags) {
+    struct io_uring_sqe *sqe = uring_sqe(uring, index, IORING_OP_LINK_TIMEOUT, -1, 0);
+    sqe->flags = flags;
+    sqe->off = 0;
+    sqe->addr = (unsigned long)&uring->timeout;
+    sqe->len = 1;
+}
+
+/**
+ * @brief Deja en errno la causa de un envio o recepcion fallido. Un plazo
+ * vencido queda como ETIMEDOUT para que note_socket_error marque socketTimedOut.
+ * Al vencer, el kernel cancela la operacion: termina con -ECANCELED, o con los
+ * bytes que alcanzo a mover, y el plazo con -ETIME o -ECANCELED. Una operacion
+ * cortada con el socket todavia abierto (sin EOF ni error) solo puede ser el plazo
+ * @param socket socket de la transferencia
+ * @param expected bytes del bloque
+ * @param socketResult resultado de la operacion del socket
+ * @param timeoutResult resultado del plazo enlazado, 0 si no hay plazo
+ */
+static void uring_note_error(int socket, int expected, int socketResult, int timeoutResult) {
+    int timedOut = timeoutResult == -ETIME;
+    if (!timedOut && timeoutResult == -ECANCELED && (socketResult == -ECANCELED || (socketResult >= 0 && socketResult < expected))) {
+        char byte;
+        ssize_t peeked = recv(socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        timedOut = peeked > 0 || (peeked < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+    }
+    errno = timedOut ? ETIMEDOUT : socketResult < 0 ? -socketResult : EIO;
+    note_socket_error();
+}
+
+/**
+ * @brief Registra el socket y el archivo de una transferencia como archivos fijos
+ * @return 0 si se registraron, -1 si hubo error
+ */
+static int uring_set_files(struct uring *uring, int socket, int file) {
+    int files[2] = { socket, file };
+    struct io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = FIXED_SOCKET;
+    update.fds = (unsigned long)files;
+    __atomic_fetch_add(&transferCounters.syscalls, 1, __ATOMIC_RELAXED);
+    return sys_io_uring_register(uring->fd, IORING_REGISTER_FILES_UPDATE, &update, 2) == 2 ? 0 : -1;
+}
+
+/**
+ * @brief Vacia los archivos fijos al terminar una transferencia: el anillo
+ * tiene su propia referencia y un close() del socket no lo cerraria
+ */
+static void uring_clear_files(struct uring *uring) {
+    if (uring_set_files(uring, -1, -1) != 0)
+        perror("Error clearing the io_uring files");
+}
+
+/**
+ * @brief Publica count operaciones (una cadena enlazada) y espera todos sus
+ * resultados en una sola llamada al sistema
+ * @param uring anillo
+ * @param count operaciones preparadas
+ * @param results resultado de cada operacion, en orden
+ * @return 0 si se completaron, -1 si fallo io_uring_enter
+ */
+static int uring_run(struct uring *uring, unsigned count, int *results) {
+    __atomic_store_n(uring->sqTail, *uring->sqTail + count, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&transferCounters.sqes, count, __ATOMIC_RELAXED);
+
+    unsigned completed = 0;
+    unsigned toSubmit = count;
+    while (completed < count) {
+        int ret = sys_io_uring_enter(uring->fd, toSubmit, count - completed, IORING_ENTER_GETEVENTS);
+        if (ret < 0 && errno != EINTR)
+            return -1;
+        if (ret > 0)
+            toSubmit -= (unsigned)ret < toSubmit ? (unsigned)ret : toSubmit;
+        unsigned head = *uring->cqHead;
+        unsigned tail = __atomic_load_n(uring->cqTail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &uring->cqes[head & *uring->cqMask];
+            if (cqe->user_data < count)
+                results[cqe->user_data] = cqe->res;
+            completed++;
+        }
+        __atomic_store_n(uring->cqHead, head, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+/**
+ * @brief Cadenas de lectura del archivo fijo y envio por el socket fijo
+ * hasta completar el archivo
+ * @return OK, ERROR
+ */
+static status_operation_socket uring_send_chains(struct uring *uring, int socket, off_t fileSize) {
+    // Los envios van en una sola cadena: io_uring no ordena operaciones independientes.
+    // SO_SNDTIMEO no se aplica a io_uring: cada envio lleva enlazado su plazo
+    unsigned step = uringTimeout > 0 ? 3 : 2;
+    int results[URING_ENTRIES];
+    off_t sent = 0;
+    while (sent < fileSize) {
+        unsigned count = 0;
+        off_t queued = sent;
+        for (int i = 0; i < URING_BUFFERS && queued < fileSize; i++) {
+            size_t length = fileSize - queued < URING_BUFFER_SIZE ? fileSize - queued : URING_BUFFER_SIZE;
+            char *buffer = uring->buffers + (size_t)i * URING_BUFFER_SIZE;
+            queued += length;
+
+            struct io_uring_sqe *sqe = uring_sqe(uring, count++, IORING_OP_READ_FIXED, FIXED_FILE, IOSQE_IO_LINK);
+            sqe->addr = (unsigned long)buffer;
+            sqe->len = length;
+            sqe->buf_index = i;
+
+            sqe = uring_sqe(uring, count++, IORING_OP_SEND, FIXED_SOCKET, queued < fileSize || step == 3 ? IOSQE_IO_LINK : 0);
+            sqe->addr = (unsigned long)buffer;
+            sqe->len = length;
+            sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+            sqe->off = 0;
+            if (step == 3)
+                uring_link_timeout(uring, count++, queued < fileSize ? IOSQE_IO_LINK : 0);
+        }
+        if (uring_run(uring, count, results) != 0)
+            return ERROR;
+
+        // Una lectura o envio corto rompe la cadena: el resto llega cancelado
+        for (unsigned i = 0; i < count; i += step) {
+            size_t expected = fileSize - sent < URING_BUFFER_SIZE ? fileSize - sent : URING_BUFFER_SIZE;
+            if (results[i] != (int)expected) {
+                errno = results[i] < 0 ? -results[i] : EIO;
+                perror("Error reading file");
+                return ERROR;
+            }
+            if (results[i + 1] != (int)expected) {
+                uring_note_error(socket, expected, results[i + 1], step == 3 ? results[i + 2] : 0);
+                perror("Error sending file");
+                return ERROR;
+            }
+            sent += expected;
+        }
+    }
+    threadTransferBytes += fileSize;
+    threadSentBytes += fileSize;
+    return OK;
+}
+
+status_operation_socket uring_send_file(int socket, int file, off_t fileSize) {
+    struct uring *uring = threadRing;
+    if (uring_set_files(uring, socket, file) != 0) {
+        uring_clear_files(uring);
+        return ERROR;
+    }
+    __atomic_fetch_add(&transferCounters.transfers, 1, __ATOMIC_RELAXED);
+    status_operation_socket status = uring_send_chains(uring, socket, fileSize);
+    uring_clear_files(uring);
+    return status;
+}
+
+/**
+ * @brief Cadenas de recepcion del socket fijo y escritura en el archivo fijo
+ * hasta completar el archivo
+ * @return OK, ERROR
+ */
+static status_operation_socket uring_receive_chains(struct uring *uring, int socket, off_t fileSize, struct sha256_buff *sha) {
+    // Como en el envio, cada recepcion lleva enlazado su plazo (SO_RCVTIMEO)
+    unsigned step = uringTimeout > 0 ? 3 : 2;
+    int results[URING_ENTRIES];
+    off_t received = 0;
+    while (received < fileSize) {
+        unsigned count = 0;
+        off_t queued = received;
+        for (int i = 0; i < URING_BUFFERS && queued < fileSize; i++) {
+            size_t length = fileSize - queued < URING_BUFFER_SIZE ? fileSize - queued : URING_BUFFER_SIZE;
+            char *buffer = uring->buffers + (size_t)i * URING_BUFFER_SIZE;
+            queued += length;
+
+            // MSG_WAITALL: nunca se recibe mas alla del archivo ni menos que el bloque
+            struct io_uring_sqe *sqe = uring_sqe(uring, count++, IORING_OP_RECV, FIXED_SOCKET, IOSQE_IO_LINK);
+            sqe->addr = (unsigned long)buffer;
+            sqe->len = length;
+            sqe->msg_flags = MSG_WAITALL;
+            sqe->off = 0;
+            if (step == 3)
+                uring_link_timeout(uring, count++, IOSQE_IO_LINK);
+
+            sqe = uring_sqe(uring, count++, IORING_OP_WRITE_FIXED, FIXED_FILE, queued < fileSize ? IOSQE_IO_LINK : 0);
+            sqe->addr = (unsigned long)buffer;
+            sqe->len = length;
+            sqe->buf_index = i;
+        }
+        if (uring_run(uring, count, results) != 0)
+            return ERROR;
+
+        // El hash se calcula de los buffers, todavia en cache, antes de reutilizarlos
+        for (unsigned i = 0; i < count; i += step) {
+            size_t expected = fileSize - received < URING_BUFFER_SIZE ? fileSize - received : URING_BUFFER_SIZE;
+            if (results[i] != (int)expected) {
+                uring_note_error(socket, expected, results[i], step == 3 ? results[i + 1] : 0);
+                perror("Error receiving file");
+                return ERROR;
+            }
+            if (results[i + step - 1] != (int)expected) {
+                errno = results[i + step - 1] < 0 ? -results[i + step - 1] : EIO;
+                perror("Error writing file");
+                return ERROR;
+            }
+            if (sha != NULL)
+                sha256_update(sha, uring->buffers + (size_t)(i / step) * URING_BUFFER_SIZE, expected);
+            received += expected;
+        }
+    }
+    threadTransferBytes += fileSize;
+    return OK;
+}
+
+status_operation_socket uring_receive_file(int socket, int file, off_t fileSize, struct sha256_buff *sha) {
+    struct uring *uring = threadRing;
+    if (uring_set_files(uring, socket, file) != 0) {
+        uring_clear_files(uring);
+        return ERROR;
+    }
+    __atomic_fetch_add(&transferCounters.transfers, 1, __ATOMIC_RELAXED);
+    status_operation_socket status = uring_receive_chains(uring, socket, fileSize, sha);
+    uring_clear_files(uring);
+    return status;
+}
@@ -0,0 +1,68 @@
+/**
+ * @file
+ * @brief Backend opcional de io_uring para transferir archivos por socket
+ * sin una llamada al sistema por cada bloque
+ * @copyright MIT License
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <sys/types.h>
+
+#include "protocol.h"
+#include "sha256.h"
+
+#define URING_BUFFERS 8             /**< Buffers registrados por anillo (bloques por envio al kernel) */
+#define URING_BUFFER_SIZE 65536     /**< Tamanio de cada buffer registrado */
+
+/**
+ * @brief Contadores de las transferencias de archivos (con y sin io_uring)
+ */
+struct transfer_counters {
+    unsigned long transfers;  /**< Archivos enviados o recibidos */
+    unsigned long syscalls;   /**< Llamadas al sistema de E/S usadas en las transferencias */
+    unsigned long sqes;       /**< Operaciones enviadas a io_uring */
+};
+
+extern struct transfer_counters transferCounters; /**< Contadores globales del proceso */
+extern __thread unsigned long long threadTransferBytes; /**< Bytes de archivos transferidos por el hilo actual */
+extern __thread unsigned long long threadSentBytes; /**< De esos, bytes enviados */
+
+/**
+ * @brief Activa io_uring si el kernel lo soporta. Cada hilo crea su propio
+ * anillo la primera vez que transfiere; si no puede, usa read/write
+ * @param timeout segundos que puede esperar cada envio o recepcion del socket
+ *        (io_uring no respeta SO_RCVTIMEO ni SO_SNDTIMEO), 0 sin plazo
+ * @return 0 si quedo activo, -1 si el kernel no lo soporta
+ */
+int uring_enable(int timeout);
+
+/**
+ * @brief Indica si el hilo actual puede transferir con io_uring
+ * @return 1 si puede, 0 si debe usar read/write
+ */
+int uring_available(void);
+
+/**
+ * @brief Envia fileSize bytes de un archivo (desde su posicion actual) a un socket.
+ * Cada bloque es una lectura a un buffer registrado enlazada con su envio
+ * @param socket socket destino
+ * @param file descriptor del archivo
+ * @param fileSize bytes a enviar
+ * @return OK o ERROR
+ */
+status_operation_socket uring_send_file(int socket, int file, off_t fileSize);
+
+/**
+ * @brief Recibe fileSize bytes de un socket y los escribe en un archivo (en su
+ * posicion actual). Cada bloque es una recepcion enlazada con su escritura
+ * @param socket socket origen
+ * @param file descriptor del archivo
+ * @param fileSize bytes a recibir
+ * @param sha hash a actualizar con el contenido, NULL para no calcularlo
+ * @return OK o ERROR
+ */
+status_operation_socket uring_receive_file(int socket, int file, off_t fileSize, struct sha256_buff *sha);
+
+#endif
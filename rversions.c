@@ -6,6 +6,8 @@
  * @author Santiago Escandon
  * Sistema de Control de Versiones
  */
+#define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -15,11 +17,15 @@
 #include <sys/socket.h>
 #include <netinet/ip.h>
 #include <signal.h>
+#include <errno.h>
 #include <pthread.h>
 #include <linux/stat.h>
+#include <ftw.h>
 
 #include "./client/versions_client.h"
 
+#define MAX_RETRIES 5 /**< Reintentos de una subida cuando el servidor esta ocupado */
+
 /**
 * @brief Imprime la ayuda
 */
@@ -47,12 +53,48 @@ void handle_terminate(int sig);
  */
  status_operation_socket actionList(char * argument2, int idClient, int client_socket);
 
+ /**
+*@brief do the action to get many versions in a single stream, line has pairs "numver archivo"
+ or is empty to get the last version of all the files
+ */
+ status_operation_socket actionGetBatch(char * line, int idClient, int client_socket);
+ /**
+*@brief do the action to add a file sending only its changes against the last version
+ */
+ status_operation_socket actionAddDelta(char * argument2, char * argument3, int idClient, int client_socket);
+ /**
+*@brief do the action to add all the files of a directory in a single batch
+ */
+ status_operation_socket actionAddBatch(char * argument2, char * argument3, int idClient, int client_socket);
+ /**
+*@brief do the action to show the counters and latencies of the server
+ */
+ status_operation_socket actionStats(int idClient, int client_socket);
+ /**
+*@brief do the action to change the sampling rate of the traces of the server and download them
+ */
+ status_operation_socket actionTrace(int rate, char * destination, int idClient, int client_socket);
+
+/**
+ * @brief collect a regular file found by nftw in the list of files of the batch
+ */
+int collect_file(const char *path, const struct stat *s, int type, struct FTW *ftwbuf);
+
 /**	
  * @param filename nombre/ ruta del archivo 
  * @return return code 
  */
  return_code validate_exist(char * filename);
 
+/**
+ * @brief check before a command that the server did not close the connection
+ * (idle timeout or restart) and connect again if it did
+ * @param address ip or path of the unix socket of the server
+ * @param port port of the server, 0 for the unix socket
+ * @return 0 if the connection is usable, -1 if the server is not available
+ */
+int ensure_connection(const char * address, int port);
+
 /**
  * @brief setup the id client in a file or generate a new one
  * @return int id of the client
@@ -61,6 +103,10 @@ int setup_idClient();
 
 int client_socket; /* socket of the conexion with the server */
 
+char **batchFiles = NULL; /* files collected for a batch add */
+int countBatchFiles = 0;  /* number of files collected */
+int capacityBatchFiles = 0; /* capacity of batchFiles */
+
 int main(int argc, char *argv[]) {
 	signal(SIGINT, handle_terminate);
 	signal(SIGTERM, handle_terminate);
@@ -69,48 +115,35 @@ int main(int argc, char *argv[]) {
 	
  
 	// Validar argumentos de linea de comandos
-	if(argc != 3){
+	if(argc != 2 && argc != 3){
 		printf("Invalid argumetns\n");
 		usage();
 		exit(EXIT_FAILURE);
 	}
-    //Extraemos y validamos ip y puerto
-    int server_port = atoi(argv[2]);
-	if(server_port == 0){
-		printf("Invalid port\n");
-		usage();
-		exit(EXIT_FAILURE);
+    //Extraemos y validamos ip y puerto, o la ruta del socket Unix
+    int server_port = 0;
+	if(argc == 3){
+		server_port = atoi(argv[2]);
+		if(server_port == 0){
+			printf("Invalid port\n");
+			usage();
+			exit(EXIT_FAILURE);
+		}
 	}
 	const char *server_ip = argv[1];
 
-    //Creamos las estructuras para crear la conexion
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(server_port);
-
-    //Convertimos la ip en el formato necesario
-    if (inet_pton(AF_INET, server_ip, &server_addr.sin_addr) <= 0) {
-        printf("Direccion ip invalida\n");
-		usage();
-        exit(EXIT_FAILURE);
-    }
-
-	//Creamos el socket
-	client_socket = socket(AF_INET, SOCK_STREAM, 0);
+	//Creamos el socket y nos conectamos
+	client_socket = connect_to_server(server_ip, server_port);
 	if(client_socket == -1){
-		perror("Error al crear el socekt");
+		usage();
 		exit(EXIT_FAILURE);
 	}
-
-	if(connect(client_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)) == -1) {
-        perror("Error al intentar conectarse con el servidor");
-        close(client_socket);
-        exit(EXIT_FAILURE);
-    }
 	
 	system("clear");
-    printf("Conectado al servidor %s en el puerto %d\n", server_ip, server_port);
+	if(server_port == 0)
+		printf("Conectado al servidor local en %s\n", server_ip);
+	else
+		printf("Conectado al servidor %s en el puerto %d\n", server_ip, server_port);
 
 	//Cargamos o generamos el id del cliente
 	int idClient = setup_idClient();
@@ -122,10 +155,25 @@ int main(int argc, char *argv[]) {
 		type_request peticionRequest;
 		printf("Ingrese la orden \n");
 		printf("->  ");
-		fgets(line, LINESIZE, stdin);
-		line[strlen(line) - 1] = '\0';
+		if (fgets(line, LINESIZE, stdin) == NULL)
+			handle_terminate(0);
+		line[strcspn(line, "\n")] = '\0';
+		if (ensure_connection(server_ip, server_port) != 0) {
+			printf("Servidor desconectado \n");
+			handle_terminate(0);
+		}
 
-		if (sscanf(line, "add %s \"%[^\"]\"", argument2, argument3) == 2) {
+		if (sscanf(line, "add-dir %s \"%[^\"]\"", argument2, argument3) == 2) {
+			if (actionAddBatch(argument2, argument3, idClient, client_socket) == CLIENT_DISCONECT) {
+				printf("Servidor desconectado \n");
+				handle_terminate(0);
+			}
+		} else if (sscanf(line, "add-delta %s \"%[^\"]\"", argument2, argument3) == 2) {
+			if (actionAddDelta(argument2, argument3, idClient, client_socket) == CLIENT_DISCONECT) {
+				printf("Servidor desconectado \n");
+				handle_terminate(0);
+			}
+		} else if (sscanf(line, "add %s \"%[^\"]\"", argument2, argument3) == 2) {
 			status_operation_socket messageActionAdd = actionAdd(argument2, argument3, idClient, client_socket);
 			if (messageActionAdd != OK) {
 				if (messageActionAdd == CLIENT_DISCONECT) {
@@ -139,10 +187,34 @@ int main(int argc, char *argv[]) {
 				continue;
 			}
 			printf("_______________________ \n");
+		} else if (strcmp(line, "get-all") == 0 || strncmp(line, "get-batch ", 10) == 0) {
+			if (actionGetBatch(line[4] == 'a' ? "" : line + 10, idClient, client_socket) == CLIENT_DISCONECT) {
+				printf("Servidor desconectado \n");
+				handle_terminate(0);
+			}
 		} else if (sscanf(line, "get %s %s", argument2, argument3) == 2) {
 			if (actionGet(argument2, argument3, idClient, client_socket) != OK) {
 				continue;
 			}	
+		} else if (sscanf(line, "trace-dump %s", argument2) == 1) {
+			if (actionTrace(TRACE_KEEP_RATE, argument2, idClient, client_socket) == CLIENT_DISCONECT) {
+				printf("Servidor desconectado \n");
+				handle_terminate(0);
+			}
+		} else if (sscanf(line, "trace %s", argument2) == 1) {
+			if (atof(argument2) < 0 || atof(argument2) > 1) {
+				printf("La tasa de muestreo debe estar entre 0 y 1\n");
+				continue;
+			}
+			if (actionTrace(atof(argument2) * TRACE_RATE_SCALE, NULL, idClient, client_socket) == CLIENT_DISCONECT) {
+				printf("Servidor desconectado \n");
+				handle_terminate(0);
+			}
+		} else if (strcmp(line, "stats") == 0) {
+			if (actionStats(idClient, client_socket) == CLIENT_DISCONECT) {
+				printf("Servidor desconectado \n");
+				handle_terminate(0);
+			}
 		} else if (strcmp(line, "list") == 0) {
 			if (actionList("", idClient, client_socket) != OK) {
 
@@ -159,6 +231,20 @@ int main(int argc, char *argv[]) {
 
 }
 
+int ensure_connection(const char * address, int port){
+	//Entre comandos el servidor no envia nada: si hay algo para leer es el cierre
+	char byte;
+	ssize_t peeked = recv(client_socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+	if(peeked > 0 || (peeked == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)))
+		return 0;
+	close(client_socket);
+	client_socket = connect_to_server(address, port);
+	if(client_socket == -1)
+		return -1;
+	printf("Reconectado al servidor\n");
+	return 0;
+}
+
 status_operation_socket actionAdd(char * argument2, char * argument3, int idClient, int client_socket){
 	
 	type_request peticionRequest = ADD;
@@ -175,12 +261,131 @@ status_operation_socket actionAdd(char * argument2, char * argument3, int idClie
 		printf("--------Error first Request  rvs-------\n");
 		return ERROR;
 	}
-	if(add(argument2, argument3, client_socket)!= VERSION_ADDED){
+	//Si el servidor esta ocupado esperamos lo que indica y repetimos la solicitud
+	return_code result;
+	int attempts = 0;
+	while((result = add(argument2, argument3, client_socket)) == VERSION_RETRY_LATER && attempts++ < MAX_RETRIES){
+		printf("-----------Servidor ocupado, reintentando en %d segundos-----------\n", retryAfter);
+		sleep(retryAfter);
+		if(send_first_request(client_socket, &peticion) != OK)
+			return ERROR;
+	}
+	if(result != VERSION_ADDED){
 		return ERROR;
 	}	
 	return OK;
 }
 
+status_operation_socket actionAddBatch(char * argument2, char * argument3, int idClient, int client_socket){
+	struct first_request peticion;
+	peticion.request = ADD_BATCH;
+	peticion.idUser = idClient;
+
+	//Recolectamos los archivos regulares del directorio
+	countBatchFiles = 0;
+	if(nftw(argument2, collect_file, 16, FTW_PHYS) != 0){
+		printf("---------------el directorio no existe o es inaccesible------------------- \n ");
+		return ERROR;
+	}
+	if(countBatchFiles == 0){
+		printf("---------------el directorio no tiene archivos------------------- \n ");
+		return ERROR;
+	}
+	if(countBatchFiles > MAX_BATCH_ENTRIES){
+		printf("---------------el directorio tiene mas de %d archivos------------------- \n ", MAX_BATCH_ENTRIES);
+		return ERROR;
+	}
+
+	status_operation_socket result = send_first_request(client_socket, &peticion);
+	return_code added = VERSION_ERROR;
+	int attempts = 0;
+	while(result == OK && (added = add_batch(batchFiles, countBatchFiles, argument3, client_socket)) == VERSION_RETRY_LATER
+			&& attempts++ < MAX_RETRIES){
+		printf("-----------Servidor ocupado, reintentando en %d segundos-----------\n", retryAfter);
+		sleep(retryAfter);
+		result = send_first_request(client_socket, &peticion);
+	}
+	if(result == OK && (added == VERSION_ERROR || added == VERSION_RETRY_LATER))
+		result = ERROR;
+
+	for(int i = 0; i < countBatchFiles; i++)
+		free(batchFiles[i]);
+	countBatchFiles = 0;
+	return result;
+}
+
+status_operation_socket actionAddDelta(char * argument2, char * argument3, int idClient, int client_socket){
+	struct first_request peticion;
+	peticion.request = ADD_DELTA;
+	peticion.idUser = idClient;
+
+	if(validate_exist(argument2) == VERSION_ERROR){
+		printf("---------------el documento no existe o es inaccesible------------------- \n ");
+		return ERROR;
+	}
+	status_operation_socket result = send_first_request(client_socket, &peticion);
+	if(result != OK)
+		return result;
+	return_code added;
+	int attempts = 0;
+	while((added = add_delta(argument2, argument3, client_socket)) == VERSION_RETRY_LATER && attempts++ < MAX_RETRIES){
+		printf("-----------Servidor ocupado, reintentando en %d segundos-----------\n", retryAfter);
+		sleep(retryAfter);
+		if(send_first_request(client_socket, &peticion) != OK)
+			return ERROR;
+	}
+	if(added == VERSION_ERROR || added == VERSION_RETRY_LATER)
+		return ERROR;
+	return OK;
+}
+
+status_operation_socket actionGetBatch(char * line, int idClient, int client_socket){
+	struct first_request peticion;
+	peticion.request = GET_BATCH;
+	peticion.idUser = idClient;
+
+	//Separamos los pares "numver archivo" de la linea
+	char *filenames[256];
+	int versions[256];
+	int count = 0;
+	char *save;
+	char *token = strtok_r(line, " ", &save);
+	while(token != NULL && count < 256){
+		versions[count] = atoi(token);
+		filenames[count] = strtok_r(NULL, " ", &save);
+		if(versions[count] <= 0 || filenames[count] == NULL){
+			printf("----------------Escriba pares: numver archivo -----------------------\n");
+			return ERROR;
+		}
+		count++;
+		token = strtok_r(NULL, " ", &save);
+	}
+
+	status_operation_socket result = send_first_request(client_socket, &peticion);
+	if(result != OK)
+		return result;
+	if(get_batch(filenames, versions, count, client_socket) == VERSION_ERROR)
+		return ERROR;
+	return OK;
+}
+
+int collect_file(const char *path, const struct stat *s, int type, struct FTW *ftwbuf){
+	if(type != FTW_F || !S_ISREG(s->st_mode))
+		return 0;
+	if(countBatchFiles == capacityBatchFiles){
+		capacityBatchFiles = capacityBatchFiles ? capacityBatchFiles * 2 : 64;
+		char **files = realloc(batchFiles, capacityBatchFiles * sizeof(char *));
+		if(files == NULL)
+			return -1;
+		batchFiles = files;
+	}
+	batchFiles[countBatchFiles] = strdup(path);
+	if(batchFiles[countBatchFiles] == NULL)
+		return -1;
+	countBatchFiles++;
+	return 0;
+}
+
 status_operation_socket actionGet(char * argument2, char * argument3, int idClient, int client_socket){
 	
 	type_request peticionRequest = GET;
@@ -204,6 +409,30 @@ status_operation_socket actionGet(char * argument2, char * argument3, int idClie
 	return restult_first_request;
 }
 
+status_operation_socket actionStats(int idClient, int client_socket){
+	struct first_request peticion;
+	peticion.request = STATS;
+	peticion.idUser = idClient;
+	if(send_first_request(client_socket, &peticion) != OK)
+		return ERROR;
+	status_operation_socket status = stats(client_socket);
+	if(status != OK)
+		printf("------Error recibiendo las estadisticas: %d--------\n", status);
+	return status;
+}
+
+status_operation_socket actionTrace(int rate, char * destination, int idClient, int client_socket){
+	struct first_request peticion;
+	peticion.request = TRACE;
+	peticion.idUser = idClient;
+	if(send_first_request(client_socket, &peticion) != OK)
+		return ERROR;
+	status_operation_socket status = trace(client_socket, rate, destination);
+	if(status != OK)
+		printf("------Error con las trazas: %d--------\n", status);
+	return status;
+}
+
 status_operation_socket actionList(char * argument2, int idClient, int client_socket){
 	
 	type_request peticionRequest = LIST;
@@ -220,11 +449,19 @@ status_operation_socket actionList(char * argument2, int idClient, int client_so
 }
 void usage() {
 	printf("Uso: rversions IP PORT Conecta el cliente a un servidor en la IP y puerto especificados.\n");
+	printf("     rversions SOCKET  Conecta el cliente a un servidor local por el socket Unix especificado.\n");
 	printf("Los comandos, una vez que el cliente se ha conectado al servidor, son los siguientes:\n");
 	printf("add ARCHIVO \"Comentario\" : Adiciona una version del archivo al repositorio\n");
+	printf("add-delta ARCHIVO \"Comentario\" : Adiciona una version enviando solo los cambios\n");
+	printf("add-dir DIRECTORIO \"Comentario\" : Adiciona todos los archivos del directorio en un solo lote\n");
 	printf("list ARCHIVO               : Lista las versiones del archivo existentes\n");
 	printf("list                       : Lista todas las versiones de los archivos existentes\n");
 	printf("get numver ARCHIVO         : Obtiene una version del archivo del repositorio\n");
+	printf("get-batch numver ARCHIVO [numver ARCHIVO ...] : Obtiene varias versiones en un solo flujo\n");
+	printf("get-all                    : Obtiene la ultima version de todos los archivos\n");
+	printf("stats                      : Muestra los contadores y latencias del servidor\n");
+	printf("trace TASA                 : Traza esa fraccion (0 a 1) de las solicitudes del servidor\n");
+	printf("trace-dump ARCHIVO         : Guarda las trazas del servidor en ARCHIVO (Chrome trace / Perfetto)\n");
 }
 
 void handle_terminate(int sig){
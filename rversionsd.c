@@ -11,20 +11,53 @@
  *      versions list                     : Lista todos los archivos almacenados en el repositorio
  *      versions get NUMVER ARCHIVO       : Obtiene una version del archivo del repositorio
  */
+#define _GNU_SOURCE
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
 #include <signal.h>
 #include <pthread.h>
 
 #include "./server/versions_server.h"
+#include "./server/thread_pool.h"
+#include "./server/connections.h"
+#include "./server/log.h"
+#include "./server/stats.h"
+#include "./server/lock_profile.h"
+#include "./common/uring.h"
+#include "./common/pipeline.h"
+#include "./common/trace.h"
 
-#define MAX_USERS 100
+#define RESERVED_FDS 64		/* Descriptores que no se usan para conexiones (blobs, .db, anillos)*/
+#define MAX_EVENTS 64		/* Eventos que se atienden por cada epoll_wait*/
+#define WORKERS_PER_CPU 2	/* Hilos trabajadores por CPU si no se indica -w*/
+#define DEFAULT_TRANSFERS 4	/* Subidas simultaneas si no se indica -t*/
+#define DEFAULT_IDLE_TIMEOUT 300	/* Segundos sin solicitudes antes de cerrar una conexion si no se indica -i*/
+#define DEFAULT_IO_TIMEOUT 60	/* Segundos que puede bloquear una lectura o escritura si no se indica -o*/
+#define KEEPALIVE_IDLE 30		/* Segundos de silencio antes de sondear un cliente TCP*/
+#define KEEPALIVE_INTERVAL 10	/* Segundos entre sondeos*/
+#define KEEPALIVE_PROBES 3		/* Sondeos sin respuesta para dar el cliente por muerto*/
+#define IDLE_WHEEL_SLOTS 512	/* Ranuras (segundos) de la rueda de inactividad*/
+#define RESPAWN_DELAY 1			/* Segundos antes de reemplazar un proceso que murio*/
+#define RELOAD_LISTENERS_ENV "RVERSIONSD_LISTENERS"	/* Listeners heredados en un reinicio: "tcp,unix"*/
+#define RELOAD_SOCKET_ENV "RVERSIONSD_RELOAD_SOCKET"	/* Socket con el proceso anterior en un reinicio*/
+#define RELOAD_READY_TIMEOUT 30	/* Segundos que se espera al proceso nuevo antes de cancelar el reinicio*/
+#define TRACE_FILE "trace-%d.json"	/* Archivo donde SIGUSR1 vuelca las trazas (con el pid del proceso)*/
 /**
 * @brief Imprime la ayuda
 */
@@ -37,59 +70,247 @@ void usage();
 void handle_terminate(int sig);
 
 /**
- * @brief infinite loop to receive new users in the server
+ * @brief Ask the reactor to restart the server (SIGHUP)
+ * @param sig number of the signal sended
+ */
+void handle_reload(int sig);
+
+/**
+ * @brief Ask the reactor to dump the traces of the process (SIGUSR1)
+ * @param sig number of the signal sended
+ */
+void handle_trace_dump(int sig);
+
+/**
+ * @brief Write the spans of the sampled requests to TRACE_FILE in the
+ * working directory, in the Chrome trace format
+ */
+void dump_trace();
+
+/**
+ * @brief Master of the multiprocess mode: forward SIGUSR1 to the workers,
+ * each one dumps its own traces
+ * @param sig number of the signal sended
+ */
+void handle_trace_processes(int sig);
+
+/**
+ * @brief Start a new server process with the same arguments that inherits the
+ * listeners. When it is ready this process stops accepting users, closes the idle
+ * ones and ends when its requests in course finish
+ */
+void start_reload();
+
+/**
+ * @brief Take the listeners and the reload socket inherited from the previous
+ * process in a restart
+ * @return 1 if the process was started by a restart, 0 if not
+ */
+int inherit_listeners();
+
+/**
+ * @brief The previous process of a restart ended: index the versions it added
+ * while finishing its requests
+ */
+void previous_process_ended();
+
+/**
+ * @brief Terminate the master process in the multiprocess mode: stop the
+ * workers, then the writer, and remove the unix socket
+ * @param sig number of the signal sended
+ */
+void handle_terminate_processes(int sig);
+
+/**
+ * @brief Fork the writer process and the worker processes and supervise them,
+ * replacing the ones that die. Only returns in the worker processes
+ * @param count number of worker processes
+ */
+void start_processes(int count);
+
+/**
+ * @brief Fork a process. The child restores the signals of a server
+ * @param role name of the process for the log
+ * @return pid in the parent, 0 in the child, -1 on error
+ */
+pid_t fork_process(const char *role);
+
+/**
+ * @brief Open the TCP listening socket of the server
+ * @param port port to listen
+ * @param reusePort 1 to share the port with the other processes (SO_REUSEPORT)
+ * @return listening socket, exits if it cant listen
+ */
+int open_listener(int port, int reusePort);
+
+/**
+ * @brief infinite loop (reactor) that accepts new users and reads their requests
+ * without blocking, dispatching the complete ones to the worker pool
  */
 void loop_listening();
 
 /**
- * @brief Handle user thread to listen the querys of user
- * @param args its a *void
+ * @brief Accept all the pending users of a listener and register them in the epoll
+ * @param listener listening socket (TCP or unix)
  */
-void *handler_user_thread(void *args);
+void accept_users(int listener);
 
 /**
- * @brief delete the user with the socket given
- * @param socket socket of the user to delete
+ * @brief Set the timeouts and the keepalive of the socket of a new user
+ * @param socket socket of the user
+ * @param local 1 if it is a unix socket
  */
-void delete_user(int socket);
+void configure_socket(int socket, int local);
+
+/**
+ * @brief Close the connections that have been idle more than the idle timeout
+ */
+void reap_idle_connections();
+
+/**
+ * @brief Decide the new deadline of a connection whose idle timer expired
+ * @param node timer of the connection
+ * @param arg current second
+ * @return new deadline, not after the current second if the connection must be closed
+ */
+long check_idle_connection(struct timer_node *node, void *arg);
+
+/**
+ * @brief Read without blocking the available bytes of the next request of the user
+ * @param conn connection of the user
+ */
+void read_request(struct connection *conn);
+
+/**
+ * @brief Handle a complete request in a worker of the pool and rearm the connection
+ * @param args its a struct connection *
+ */
+void handle_request(void *args);
+
+/**
+ * @brief Close the connection of a user and release it
+ * @param conn connection of the user
+ */
+void close_connection(struct connection *conn);
+
+/**
+ * @brief Close the socket of a connection at the end of the server
+ * @param conn connection of the user
+ * @param arg not used
+ */
+void close_socket(struct connection *conn, void *arg);
 
 /**
  * @brief Handle the add request of the user
  * @param socket socket of the user
  * @param idUser id of the user
+ * @return result of the request
  */
-void handle_add(int socket, int idUser);
+return_code handle_add(int socket, int idUser);
 
 /**
  * @brief Handle the get request of the user
  * @param socket socket of the user
  * @param idUser id of the user
+ * @return result of the request
  */
-void handle_get(int socket, int idUser);
+return_code handle_get(int socket, int idUser);
 
 /**
  * @brief Handle the list request of the user
  * @param socket socket of the user
  * @param idUser id of the user
+ * @return result of the request
+ */
+return_code handle_list(int socket, int idUser);
+
+/**
+ * @brief Handle the batch add request of the user
+ * @param socket socket of the user
+ * @param idUser id of the user
+ * @return result of the request
+ */
+return_code handle_add_batch(int socket, int idUser);
+
+/**
+ * @brief Handle the batch get request of the user
+ * @param socket socket of the user
+ * @param idUser id of the user
+ * @return result of the request
+ */
+return_code handle_get_batch(int socket, int idUser);
+
+/**
+ * @brief Handle the delta add request of the user
+ * @param socket socket of the user
+ * @param idUser id of the user
+ * @return result of the request
+ */
+return_code handle_add_delta(int socket, int idUser);
+
+/**
+ * @brief Handle the stats request: send a line per counter and histogram, ending with END
+ * @param socket socket of the user
+ * @param idUser id of the user
+ * @return result of the request
+ */
+return_code handle_stats(int socket, int idUser);
+
+/**
+ * @brief Send a line of the stats report
+ * @param socket socket of the user
+ * @param message buffer of the line (SIZE_ELEMENT_LIST), the rest stays in zero
+ * @param format format of the line
+ * @return result of the send
+ */
+status_operation_socket send_stats_line(int socket, char *message, const char *format, ...);
+
+/**
+ * @brief Send the lines of the lock profile: first the total of each mutex, then
+ * each site where it is taken
+ * @param socket socket of the user
+ * @param message buffer of the line (SIZE_ELEMENT_LIST)
+ * @return result of the send
  */
-void handle_list(int socket, int idUser);
+status_operation_socket send_lock_profile(int socket, char *message);
 
 /**
- * @brief Structure to save the actives users
+ * @brief Handle the trace request: change the sampling rate and, if the user
+ * asks for them, send the spans of the sampled requests as Chrome trace JSON
+ * @param socket socket of the user
+ * @param idUser id of the user
+ * @return result of the request
  */
-struct Server{
-	int countUsers;
-	int *socketsUsers;
-};
+return_code handle_trace(int socket, int idUser);
 
-struct Server *myServer = NULL;  /* Global variable to manage multiples users*/
+struct connection_table connections; /* Active users, the most of them idle in the epoll*/
+int processIndex = -1;			 /* Worker process number in the multiprocess mode, -1 in the single process mode*/
+int processCount = 1;			 /* Worker processes (-p)*/
+pid_t *workerPids = NULL;		 /* Master: pid of each worker process*/
+pid_t writerPid = -1;			 /* Master: pid of the writer process*/
+int (*writerPairs)[2] = NULL;	 /* Master: socket pair of each worker with the writer (0 writer, 1 worker)*/
 int serverSocket;				 /* Server socket*/
-pthread_mutex_t mutexServer; 	/* Mutex for sync myServer variable*/
-pthread_mutex_t mutexDB;		/**< Mutex para proteger el acceso a la base de datos. */
+int localSocket = -1;			 /* Unix domain socket for clients in the same host, -1 if not used*/
+char localPath[sizeof(((struct sockaddr_un *)0)->sun_path)]; /* Path of the unix domain socket*/
+int epollFd = -1;				 /* Epoll of the listeners and the idle users*/
+struct thread_pool *workerPool = NULL; /* Fixed pool of workers that handle the requests and their subtasks*/
+struct admission uploads;		/* Admission control of the uploads*/
+struct timer_wheel idleTimers;	/* Deadlines of the connections, only the reactor advances it*/
+int idleTimeout = DEFAULT_IDLE_TIMEOUT;	/* Seconds without requests before closing a connection*/
+int ioTimeout = DEFAULT_IO_TIMEOUT;		/* Seconds that a read or write on a user socket can block*/
+char **serverArgv = NULL;		/* Arguments of the server, to start the new process in a restart*/
+volatile sig_atomic_t reloadRequested = 0;	/* SIGHUP received, the reactor starts the restart*/
+int draining = 0;				/* The listeners were handed to a new process, ending when the requests finish*/
+int reloadSocket = -1;			/* Socket with the other process of a restart: its end shows when the previous process ended*/
+struct timespec reloadStarted;	/* When the restart started, to measure it*/
+time_t serverStarted;			/* When the server started, for the stats*/
+volatile sig_atomic_t traceDumpRequested = 0;	/* SIGUSR1 received, the reactor dumps the traces*/
+const char *requestNames[STATS_OPERATIONS] = { "list", "add", "get", "add_batch", "get_batch", "add_delta", "stats", "trace" }; /* Name of each request, for the stats and the traces*/
 int main(int argc, char *argv[]) {
 	//Config the handlers of signals
     signal(SIGINT, handle_terminate);
     signal(SIGTERM, handle_terminate);
+	serverArgv = argv;
 	
 	struct stat s;
 
@@ -105,7 +326,48 @@ int main(int argc, char *argv[]) {
 		creat(VERSIONS_DB_PATH, 0755);
 	}
 	// Validar argumentos de linea de comandos
-	if(argc != 2){
+	int workers = WORKERS_PER_CPU * sysconf(_SC_NPROCESSORS_ONLN);
+	int useUring = 0;
+	//Por defecto tantas conexiones como descriptores permita el proceso
+	struct rlimit files;
+	getrlimit(RLIMIT_NOFILE, &files);
+	int maxConnections = files.rlim_cur > 2 * RESERVED_FDS ? files.rlim_cur - RESERVED_FDS : RESERVED_FDS;
+	int transfers = DEFAULT_TRANSFERS;
+	int queue = -1;
+	int level = LOG_LEVEL_INFO;
+	int pipelineBuffers = PIPELINE_DEFAULT_BUFFERS;
+	int opt;
+	while((opt = getopt(argc, argv, "w:uc:t:q:l:i:o:b:p:s:")) != -1){
+		if(opt == 'w' && atoi(optarg) > 0){
+			workers = atoi(optarg);
+		}else if(opt == 't' && atoi(optarg) > 0){
+			transfers = atoi(optarg);
+		}else if(opt == 'q' && atoi(optarg) >= 0){
+			queue = atoi(optarg);
+		}else if(opt == 'l' && log_parse_level(optarg) != -1){
+			level = log_parse_level(optarg);
+		}else if(opt == 'p' && atoi(optarg) > 0){
+			processCount = atoi(optarg);
+		}else if(opt == 'b' && atoi(optarg) >= 0){
+			pipelineBuffers = atoi(optarg);
+		}else if(opt == 'i' && atoi(optarg) > 0){
+			idleTimeout = atoi(optarg);
+		}else if(opt == 'o' && atoi(optarg) > 0){
+			ioTimeout = atoi(optarg);
+		}else if(opt == 'c' && atoi(optarg) > 0){
+			maxConnections = atoi(optarg);
+		}else if(opt == 's' && atof(optarg) >= 0 && atof(optarg) <= 1){
+			trace_set_rate(atof(optarg) * TRACE_RATE_SCALE);
+		}else if(opt == 'u'){
+			useUring = 1;
+		}else{
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+	argc -= optind - 1;
+	argv += optind - 1;
+	if(argc != 2 && argc != 3){
 		usage();
 		exit(EXIT_FAILURE);
 	}
@@ -114,40 +376,120 @@ int main(int argc, char *argv[]) {
 		printf("Invalid port, it mus be numeric\n");
 		exit(EXIT_FAILURE);
 	}
-	system("clear");
+	//En un reinicio los listeners vienen del proceso anterior, que sigue en la terminal
+	int inherited = inherit_listeners();
+	if(!inherited)
+		system("clear");
+
+	//Indice de versions.db: en modo multiproceso en memoria compartida por todos los procesos
+	if(versions_db_open(processCount > 1) != 0){
+		perror("Error loading the index of versions.db");
+		exit(EXIT_FAILURE);
+	}
+
+	//Socket Unix para los clientes del mismo host, compartido por todos los procesos
+	if(argc == 3 && inherited){
+		strncpy(localPath, argv[2], sizeof(localPath) - 1);
+	}else if(argc == 3){
+		struct sockaddr_un local_addr;
+		memset(&local_addr, 0, sizeof(struct sockaddr_un));
+		local_addr.sun_family = AF_UNIX;
+		if(strlen(argv[2]) >= sizeof(local_addr.sun_path)){
+			printf("Invalid socket path, it is too long\n");
+			exit(EXIT_FAILURE);
+		}
+		strcpy(local_addr.sun_path, argv[2]);
+		strcpy(localPath, argv[2]);
+		unlink(localPath);
+
+		localSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		if (localSocket == -1 || bind(localSocket, (struct sockaddr *)&local_addr, sizeof(struct sockaddr_un)) == -1
+				|| listen(localSocket, SOMAXCONN) == -1) {
+			perror("Sorry, we cant listen on the unix socket");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	//El proceso maestro se queda supervisando; cada trabajador sigue como un servidor completo
+	//Los reinicios con SIGHUP son del modo de un solo proceso: con -p cada trabajador tiene su listener
+	signal(SIGUSR1, handle_trace_dump);
+	if(processCount > 1){
+		signal(SIGHUP, SIG_IGN);
+		start_processes(processCount);
+	}else{
+		signal(SIGHUP, handle_reload);
+	}
+
+	//Desde aqui los mensajes pasan por la bitacora asincrona
+	if(log_start(level, STDOUT_FILENO) != 0){
+		perror("Error starting the log");
+		exit(EXIT_FAILURE);
+	}
+	atexit(log_stop);
 	//Empezamos a inicializar el servidor
-	printf("> Starting server\n");
+	serverStarted = time(NULL);
+	if(processIndex == -1)
+		log_write(LOG_LEVEL_INFO, "> Starting server\n");
+	else
+		log_write(LOG_LEVEL_INFO, "> Starting worker process %d (pid %d)\n", processIndex, getpid());
 
-	//Initializate myServer structure
-	myServer = malloc(sizeof(struct Server));
-	myServer->socketsUsers = calloc(MAX_USERS, sizeof(int));
-	myServer->countUsers = 0;
+	//Initializate the registry of users
+	connections_init(&connections, maxConnections);
+	if(timer_wheel_init(&idleTimers, IDLE_WHEEL_SLOTS) != 0){
+		perror("Error creating the idle timers");
+		exit(EXIT_FAILURE);
+	}
+	log_write(LOG_LEVEL_INFO, "> Closing connections idle for %d s, reads and writes time out after %d s\n", idleTimeout, ioTimeout);
 
-	//Initializate the mutex
-	pthread_mutex_init(&mutexServer,NULL);
-	pthread_mutex_init(&mutexDB,NULL);
+	//Las subidas que esperan turno ocupan un trabajador: por defecto la cola
+	//deja libre al menos la mitad de los trabajadores para las demas solicitudes
+	if(queue == -1)
+		queue = workers / 2;
+	if(admission_init(&uploads, transfers, queue) != 0){
+		perror("Error initializing the admission control");
+		exit(EXIT_FAILURE);
+	}
+	log_write(LOG_LEVEL_INFO, "> %d concurrent uploads, %d waiting\n", transfers, queue);
 
-	//Obtain the server socket
-	serverSocket = socket(AF_INET, SOCK_STREAM,0);
+	//Start the workers, the count of threads doesnt depend on the count of users
+	workerPool = thread_pool_create(workers);
+	if(workerPool == NULL){
+		perror("Error creating the worker pool");
+		exit(EXIT_FAILURE);
+	}
+	log_write(LOG_LEVEL_INFO, "> Started %d workers\n", workerPool->countThreads);
 
-	//Initializate bind config
-	struct sockaddr_in addr;    
-    memset(&addr, 0, sizeof(struct sockaddr_in)); //rellenamos la estructura de ceros
-    addr.sin_family = AF_INET; //Config of socket
-    addr.sin_port = htons(PORT); //Config port
-    addr.sin_addr.s_addr = INADDR_ANY; //0.0.0.0
+	//Transferencias de archivos por io_uring si el kernel lo soporta, con el
+	//mismo plazo por operacion que SO_RCVTIMEO y SO_SNDTIMEO
+	if(useUring){
+		if(uring_enable(ioTimeout) == 0)
+			log_write(LOG_LEVEL_INFO, "> Transfering files with io_uring\n");
+		else
+			log_write(LOG_LEVEL_WARN, "io_uring is not available, transfering files with read/write: %m\n");
+	}
 
-	if (bind(serverSocket, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) == -1) {
-        perror("Sorry, we cant run the bind");
-        exit(EXIT_FAILURE);
-    }  
+	//Recepcion por etapas: la red, el hash y el disco de una subida trabajan a la vez
+	if(pipelineBuffers > 0){
+		if(pipeline_start(pipelineBuffers) == 0)
+			log_write(LOG_LEVEL_INFO, "> Receiving files in stages with %d buffers of %d KB\n", pipelineBuffers, PIPELINE_CHUNK_SIZE / 1024);
+		else
+			log_write(LOG_LEVEL_WARN, "Could not start the upload stages, receiving files in the request thread\n");
+	}
 
-	if (listen(serverSocket, MAX_USERS) == -1) {
-        perror("Error tring listen");
-        exit(EXIT_FAILURE);
-    }
+	//Obtain the server socket
+	if(!inherited)
+		serverSocket = open_listener(PORT, processCount > 1);
+	log_write(LOG_LEVEL_INFO, "> Server listening on port:%d\n", PORT);
+	if(localSocket != -1)
+		log_write(LOG_LEVEL_INFO, "> Server listening on unix socket:%s\n", localPath);
 
-	printf("> Server listening on port:%d\n", PORT);
+	//El proceso anterior deja de aceptar usuarios cuando este ya puede atenderlos
+	if(inherited && reloadSocket != -1){
+		char ready = 1;
+		if(write(reloadSocket, &ready, 1) != 1)
+			log_write(LOG_LEVEL_WARN, "Error notifying the previous process: %m\n");
+		log_write(LOG_LEVEL_INFO, "> Took the listeners of the previous process\n");
+	}
 	
 	loop_listening();
 	
@@ -157,153 +499,916 @@ int main(int argc, char *argv[]) {
 
 void usage() {
 	printf("Uso: \n");
-	printf("rversionsd PORT:   Escucha por conexiones del cliente en el puerto especificado.\n");
+	printf("rversionsd [-w WORKERS] [-u] [-c CONEXIONES] [-t SUBIDAS] [-q COLA] [-l NIVEL] [-i INACTIVO] [-o ESPERA] [-b BUFFERS] [-p PROCESOS] [-s TASA] PORT [SOCKET]: Escucha por conexiones del cliente en el puerto especificado.\n");
+	printf("                            Con SOCKET escucha tambien en ese socket Unix para clientes locales.\n");
+	printf("                            WORKERS hilos atienden las solicitudes (por defecto %d por CPU).\n", WORKERS_PER_CPU);
+	printf("                            Con -u transfiere los archivos con io_uring si el kernel lo soporta.\n");
+	printf("                            CONEXIONES es el maximo de usuarios simultaneos (por defecto el limite de descriptores).\n");
+	printf("                            SUBIDAS es el maximo de archivos recibiendose a la vez (por defecto %d) y COLA\n", DEFAULT_TRANSFERS);
+	printf("                            cuantas subidas pueden esperar turno (por defecto WORKERS / 2); si la cola esta llena\n");
+	printf("                            el cliente recibe cuantos segundos esperar antes de reintentar.\n");
+	printf("                            NIVEL (-l) es el nivel minimo de la bitacora: debug, info, warn o error (por defecto info).\n");
+	printf("                            Una conexion sin solicitudes por INACTIVO segundos se cierra (por defecto %d) y una\n", DEFAULT_IDLE_TIMEOUT);
+	printf("                            lectura o escritura bloqueada por ESPERA segundos aborta la solicitud (por defecto %d).\n", DEFAULT_IO_TIMEOUT);
+	printf("                            Los archivos se reciben por etapas (red, hash, disco) con BUFFERS buffers de %d KB\n", PIPELINE_CHUNK_SIZE / 1024);
+	printf("                            (por defecto %d, 0 para recibirlos en el hilo de la solicitud).\n", PIPELINE_DEFAULT_BUFFERS);
+	printf("                            Con PROCESOS > 1 atienden PROCESOS procesos con WORKERS hilos cada uno, que comparten\n");
+	printf("                            el puerto (SO_REUSEPORT) y el indice de versiones; un proceso escritor agrega al .db.\n");
+	printf("                            Con SIGHUP (sin -p) se reinicia sin cortar el servicio: un proceso nuevo hereda los\n");
+	printf("                            listeners y este termina cuando acaban las solicitudes en curso.\n");
+	printf("                            TASA (-s) es la fraccion de solicitudes que se trazan (por defecto 0); con SIGUSR1\n");
+	printf("                            cada proceso escribe sus trazas en %s (formato Chrome trace).\n", TRACE_FILE);
 }
 
 void handle_terminate(int sig){
-	printf("--Ending the Server--\n");
-	
-	//Liberamos memoria de myServer de manera segura
-	pthread_mutex_lock(&mutexServer);
-	size_t j = 0;
-	for(int i = 0; j<myServer->countUsers;i++){
-		if(myServer->socketsUsers[i]>0){
-			close(myServer->socketsUsers[i]);
-			j++;
+	log_write(LOG_LEVEL_INFO, "--Ending the Server--\n");
+	if(transferCounters.transfers > 0)
+		log_write(LOG_LEVEL_INFO, "> %lu files transfered with %lu I/O syscalls (%.1f per file, %lu io_uring operations)\n",
+				transferCounters.transfers, transferCounters.syscalls,
+				(double)transferCounters.syscalls / transferCounters.transfers, transferCounters.sqes);
+	struct pipeline_stats stages;
+	pipeline_get_stats(&stages);
+	if(stages.stages[PIPELINE_NETWORK].chunks > 0){
+		static const char *names[] = { "network", "hash", "disk" };
+		for(int i = 0; i < PIPELINE_STAGES; i++){
+			struct pipeline_stage_stats *stage = &stages.stages[i];
+			int threads = i == PIPELINE_HASH ? stages.hashers : 1;
+			log_write(LOG_LEVEL_INFO, "> Stage %-7s %lu chunks, %llu MB, busy %.1f%%, stalled %.1f%%, queue avg %.1f max %d\n",
+					names[i], stage->chunks, stage->bytes >> 20, stage->busyNs / 1e7 / stages.seconds / threads,
+					stage->stallNs / 1e7 / stages.seconds,
+					stage->chunks > 0 ? (double)stage->depthSum / stage->chunks : 0.0, stage->maxDepth);
 		}
 	}
+	struct log_stats logStats;
+	log_get_stats(&logStats);
+	if(logStats.sampled + logStats.dropped > 0)
+		log_write(LOG_LEVEL_WARN, "> Log: %lu records sampled out, %lu dropped\n", logStats.sampled, logStats.dropped);
+	if(connections.reaped + connections.timedOut > 0)
+		log_write(LOG_LEVEL_INFO, "> %lu idle connections reaped, %lu closed by a read or write timeout\n",
+				(unsigned long)connections.reaped, (unsigned long)connections.timedOut);
+	
+	//Cerramos los sockets de los usuarios y liberamos el registro
+	connections_foreach(&connections, close_socket, NULL);
+	connections_destroy(&connections);
+	if(localSocket != -1){
+		close(localSocket);
+		//En modo multiproceso el socket Unix es de todos: lo quita el maestro
+		if(processIndex == -1)
+			unlink(localPath);
+	}
+	exit(EXIT_SUCCESS);
+}
+
+void handle_reload(int sig){
+	reloadRequested = 1;
+}
+
+void handle_trace_dump(int sig){
+	traceDumpRequested = 1;
+}
+
+void dump_trace(){
+	traceDumpRequested = 0;
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), TRACE_FILE, getpid());
+	FILE *fp = fopen(path, "w");
+	long spans = fp != NULL ? trace_write_json(fp) : -1;
+	if(fp != NULL && fclose(fp) != 0)
+		spans = -1;
+	if(spans < 0)
+		log_write(LOG_LEVEL_ERROR, "> Error writing the traces to %s: %m\n", path);
+	else
+		log_write(LOG_LEVEL_INFO, "> %ld spans written to %s\n", spans, path);
+}
+
+void handle_trace_processes(int sig){
+	for(int i = 0; i < processCount; i++)
+		if(workerPids[i] > 0)
+			kill(workerPids[i], SIGUSR1);
+}
+
+void start_reload(){
+	reloadRequested = 0;
+	if(draining){
+		log_write(LOG_LEVEL_WARN, "> Restart already in course, ignoring SIGHUP\n");
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &reloadStarted);
+	log_write(LOG_LEVEL_INFO, "> Restarting: starting a new process with the listeners\n");
+
+	int pair[2];
+	if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, pair) == -1){
+		log_write(LOG_LEVEL_ERROR, "Error restarting the server: %m\n");
+		return;
+	}
+	//El entorno se arma antes del fork: el hijo de un proceso con hilos no debe pedir memoria
+	char listeners[32], reload[32];
+	snprintf(listeners, sizeof(listeners), RELOAD_LISTENERS_ENV "=%d,%d", serverSocket, localSocket);
+	snprintf(reload, sizeof(reload), RELOAD_SOCKET_ENV "=%d", pair[1]);
+	int countEnv = 0;
+	while(environ[countEnv] != NULL)
+		countEnv++;
+	char **env = malloc((countEnv + 3) * sizeof(char *));
+	if(env == NULL){
+		close(pair[0]);
+		close(pair[1]);
+		log_write(LOG_LEVEL_ERROR, "Error restarting the server: %m\n");
+		return;
+	}
+	int countNew = 0;
+	for(int i = 0; i < countEnv; i++)
+		if(strncmp(environ[i], RELOAD_LISTENERS_ENV "=", sizeof(RELOAD_LISTENERS_ENV)) != 0
+				&& strncmp(environ[i], RELOAD_SOCKET_ENV "=", sizeof(RELOAD_SOCKET_ENV)) != 0)
+			env[countNew++] = environ[i];
+	env[countNew++] = listeners;
+	env[countNew++] = reload;
+	env[countNew] = NULL;
+
+	pid_t pid = fork();
+	if(pid == 0){
+		//Solo pasan al proceso nuevo los listeners y su extremo del socket
+		close_range(3, ~0U, CLOSE_RANGE_CLOEXEC);
+		fcntl(serverSocket, F_SETFD, 0);
+		if(localSocket != -1)
+			fcntl(localSocket, F_SETFD, 0);
+		fcntl(pair[1], F_SETFD, 0);
+		execve("/proc/self/exe", serverArgv, env);
+		_exit(127);
+	}
+	free(env);
+	close(pair[1]);
+	if(pid == -1){
+		close(pair[0]);
+		log_write(LOG_LEVEL_ERROR, "Error restarting the server: %m\n");
+		return;
+	}
+
+	//Mientras el proceso nuevo arranca los usuarios nuevos esperan en la cola de listen
+	struct pollfd ready = { .fd = pair[0], .events = POLLIN };
+	char byte;
+	int polled;
+	while((polled = poll(&ready, 1, RELOAD_READY_TIMEOUT * 1000)) == -1 && errno == EINTR);
+	if(polled != 1 || read(pair[0], &byte, 1) != 1){
+		log_write(LOG_LEVEL_ERROR, "> Restart failed: the new process %d did not start, keep serving\n", pid);
+		close(pair[0]);
+		kill(pid, SIGKILL);
+		waitpid(pid, NULL, 0);
+		return;
+	}
+	//El socket queda abierto hasta que este proceso termine: su cierre avisa al proceso nuevo
+	reloadSocket = pair[0];
+
+	//Dejamos de aceptar: lo que llegue a los listeners ya es del proceso nuevo
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, serverSocket, NULL);
+	close(serverSocket);
+	serverSocket = -1;
+	if(localSocket != -1){
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, localSocket, NULL);
+		close(localSocket);
+		localSocket = -1;
+	}
+	draining = 1;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	log_write(LOG_LEVEL_INFO, "> Restart: process %d took the listeners in %.1f ms, finishing %d users\n", pid,
+			(now.tv_sec - reloadStarted.tv_sec) * 1e3 + (now.tv_nsec - reloadStarted.tv_nsec) / 1e6, connections.count);
+	//Las conexiones inactivas vencen en el proximo segundo; las ocupadas al terminar su solicitud
+	timer_wheel_shorten(&idleTimers, timer_wheel_now() + 1);
+}
+
+int inherit_listeners(){
+	const char *listeners = getenv(RELOAD_LISTENERS_ENV);
+	if(listeners == NULL || sscanf(listeners, "%d,%d", &serverSocket, &localSocket) != 2)
+		return 0;
+	const char *reload = getenv(RELOAD_SOCKET_ENV);
+	if(reload != NULL){
+		reloadSocket = atoi(reload);
+		fcntl(reloadSocket, F_SETFD, FD_CLOEXEC);
+	}
+	if(localSocket != -1)
+		fcntl(localSocket, F_SETFD, FD_CLOEXEC);
+	fcntl(serverSocket, F_SETFD, FD_CLOEXEC);
+	unsetenv(RELOAD_LISTENERS_ENV);
+	unsetenv(RELOAD_SOCKET_ENV);
+	return 1;
+}
 
-	free(myServer->socketsUsers);
-	free(myServer);
-	pthread_mutex_unlock(&mutexServer);
-	pthread_mutex_destroy(&mutexServer);
-	pthread_mutex_destroy(&mutexDB);
+void previous_process_ended(){
+	//El proceso anterior cerro su extremo al terminar: lo que agrego mientras terminaba pasa al indice
+	char byte;
+	ssize_t received = recv(reloadSocket, &byte, 1, MSG_DONTWAIT);
+	if(received > 0 || (received == -1 && (errno == EAGAIN || errno == EINTR)))
+		return;
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, reloadSocket, NULL);
+	close(reloadSocket);
+	reloadSocket = -1;
+	int added = versions_db_sync();
+	log_write(LOG_LEVEL_INFO, "> The previous process ended, %d versions added while it finished\n", added);
+}
+
+void handle_terminate_processes(int sig){
+	log_write(LOG_LEVEL_INFO, "--Ending the Server: stopping %d processes--\n", processCount);
+	signal(SIGCHLD, SIG_DFL);
+	for(int i = 0; i < processCount; i++)
+		if(workerPids[i] > 0)
+			kill(workerPids[i], SIGTERM);
+	for(int i = 0; i < processCount; i++)
+		if(workerPids[i] > 0)
+			waitpid(workerPids[i], NULL, 0);
+	//Sin trabajadores no hay agregados en curso: el escritor puede terminar en cualquier punto
+	if(writerPid > 0){
+		kill(writerPid, SIGKILL);
+		waitpid(writerPid, NULL, 0);
+	}
+	if(localSocket != -1)
+		unlink(localPath);
 	exit(EXIT_SUCCESS);
 }
 
+pid_t fork_process(const char *role){
+	pid_t pid = fork();
+	if(pid == -1)
+		log_write(LOG_LEVEL_ERROR, "Error starting the %s process: %m\n", role);
+	if(pid == 0){
+		signal(SIGINT, handle_terminate);
+		signal(SIGTERM, handle_terminate);
+		signal(SIGUSR1, handle_trace_dump);
+	}
+	return pid;
+}
+
+void start_processes(int count){
+	workerPids = calloc(count, sizeof(pid_t));
+	writerPairs = calloc(count, sizeof(*writerPairs));
+	if(workerPids == NULL || writerPairs == NULL){
+		perror("Error starting the processes");
+		exit(EXIT_FAILURE);
+	}
+	//El maestro no inicia la bitacora asincrona: escribe por linea para no heredar texto sin vaciar a los hijos
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	//El maestro conserva los dos extremos de cada par para poder reemplazar cualquier proceso
+	for(int i = 0; i < count; i++){
+		if(socketpair(AF_UNIX, SOCK_SEQPACKET, 0, writerPairs[i]) == -1){
+			perror("Error creating the writer sockets");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	//Los trabajadores pasan a los de abajo; el maestro los atiende solo con las senales
+	signal(SIGINT, handle_terminate_processes);
+	signal(SIGTERM, handle_terminate_processes);
+	signal(SIGUSR1, handle_trace_processes);
+	log_write(LOG_LEVEL_INFO, "> Starting %d worker processes and the writer process\n", count);
+	int started = 0;
+	while(1){
+		if(writerPid <= 0){
+			writerPid = fork_process("writer");
+			if(writerPid == 0){
+				//El escritor no se interrumpe a mitad de un registro: lo detiene el maestro al final
+				signal(SIGINT, SIG_IGN);
+				signal(SIGTERM, SIG_IGN);
+				signal(SIGUSR1, SIG_IGN);
+				int *sockets = malloc(count * sizeof(int));
+				for(int i = 0; i < count; i++){
+					sockets[i] = writerPairs[i][0];
+					close(writerPairs[i][1]);
+				}
+				versions_db_serve(sockets, count);
+			}
+		}
+		for(int i = 0; i < count; i++){
+			if(workerPids[i] > 0)
+				continue;
+			workerPids[i] = fork_process("worker");
+			if(workerPids[i] == 0){
+				processIndex = i;
+				for(int j = 0; j < count; j++){
+					close(writerPairs[j][0]);
+					if(j != i)
+						close(writerPairs[j][1]);
+				}
+				versions_db_set_writer(writerPairs[i][1]);
+				free(workerPids);
+				free(writerPairs);
+				return;
+			}
+		}
+		if(!started)
+			log_write(LOG_LEVEL_INFO, "> Master process %d supervising\n", getpid());
+		started = 1;
+
+		//Un proceso que muere no tumba a los demas: se reemplaza
+		int status;
+		pid_t pid = wait(&status);
+		if(pid == -1){
+			if(errno != EINTR)
+				sleep(RESPAWN_DELAY);
+			continue;
+		}
+		const char *role = pid == writerPid ? "writer" : "worker";
+		if(WIFSIGNALED(status))
+			log_write(LOG_LEVEL_ERROR, "> The %s process %d died by the signal %d, replacing it\n", role, pid, WTERMSIG(status));
+		else
+			log_write(LOG_LEVEL_WARN, "> The %s process %d exited with %d, replacing it\n", role, pid, WEXITSTATUS(status));
+		//Lo que el proceso tenia del candado de versions.db no debe detener a los demas
+		version_index_release_process(versionIndex, pid);
+		if(pid == writerPid)
+			writerPid = -1;
+		for(int i = 0; i < count; i++)
+			if(workerPids[i] == pid)
+				workerPids[i] = -1;
+		sleep(RESPAWN_DELAY);
+	}
+}
+
+int open_listener(int port, int reusePort){
+	int listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if(listener == -1){
+		perror("Error creating the server socket");
+		exit(EXIT_FAILURE);
+	}
+	//Cada proceso tiene su propio socket en el mismo puerto y el kernel reparte las conexiones
+	int enable = 1;
+	if(reusePort && setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1){
+		perror("Error sharing the port");
+		exit(EXIT_FAILURE);
+	}
+
+	//Initializate bind config
+	struct sockaddr_in addr;    
+    memset(&addr, 0, sizeof(struct sockaddr_in)); //rellenamos la estructura de ceros
+    addr.sin_family = AF_INET; //Config of socket
+    addr.sin_port = htons(port); //Config port
+    addr.sin_addr.s_addr = INADDR_ANY; //0.0.0.0
+
+	if (bind(listener, (struct sockaddr *)&addr, sizeof(struct sockaddr_in)) == -1) {
+        perror("Sorry, we cant run the bind");
+        exit(EXIT_FAILURE);
+    }  
+
+	if (listen(listener, SOMAXCONN) == -1) {
+        perror("Error tring listen");
+        exit(EXIT_FAILURE);
+    }
+	return listener;
+}
+
 void loop_listening(){
-	//TODO logica para conectar a un usuario y asignarle un hilo
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if(epollFd == -1){
+		perror("Error creating the epoll");
+		exit(EXIT_FAILURE);
+	}
+	//Los listeners se identifican por la direccion de su variable, las conexiones por su struct connection
+	struct epoll_event event = { .events = EPOLLIN, .data.ptr = &serverSocket };
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, serverSocket, &event);
+	if(localSocket != -1){
+		//El socket Unix lo comparten todos los procesos: solo se despierta a uno por conexion
+		event.events = processIndex == -1 ? EPOLLIN : EPOLLIN | EPOLLEXCLUSIVE;
+		event.data.ptr = &localSocket;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, localSocket, &event);
+	}
+	if(reloadSocket != -1){
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.ptr = &reloadSocket;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, reloadSocket, &event);
+	}
+
+	struct epoll_event events[MAX_EVENTS];
+	while(1){
+		//Bloqueamos esperando nuevos usuarios o solicitudes de los usuarios inactivos,
+		//despertando cada segundo para avanzar la rueda de inactividad
+		int count = epoll_wait(epollFd, events, MAX_EVENTS, idleTimers.count > 0 || draining ? 1000 : -1);
+		if(count == -1 && errno != EINTR)
+			log_write(LOG_LEVEL_ERROR, "Error waiting new users: %m\n");
+		for(int i = 0; i < count; i++){
+			if(events[i].data.ptr == &serverSocket)
+				accept_users(serverSocket);
+			else if(events[i].data.ptr == &localSocket)
+				accept_users(localSocket);
+			else if(events[i].data.ptr == &reloadSocket)
+				previous_process_ended();
+			else
+				read_request(events[i].data.ptr);
+		}
+		if(reloadRequested)
+			start_reload();
+		if(traceDumpRequested)
+			dump_trace();
+		if(timer_wheel_now() > idleTimers.current)
+			reap_idle_connections();
+		if(draining && connections.count == 0){
+			struct timespec now;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			log_write(LOG_LEVEL_INFO, "> Restart: requests in course finished %.1f ms after SIGHUP\n",
+					(now.tv_sec - reloadStarted.tv_sec) * 1e3 + (now.tv_nsec - reloadStarted.tv_nsec) / 1e6);
+			handle_terminate(SIGHUP);
+		}
+	}
+}
+
+void reap_idle_connections(){
+	long now = timer_wheel_now();
+	struct timer_node *expired;
+	timer_wheel_advance(&idleTimers, now, check_idle_connection, &now, &expired);
+	//Las vencidas estan inactivas en el epoll: solo el reactor las toca, se cierran sin el bloqueo de la rueda
+	while(expired != NULL){
+		struct connection *conn = (struct connection *)((char *)expired - offsetof(struct connection, timer));
+		expired = expired->prev;
+		log_write(LOG_LEVEL_INFO, "> Cliente con id %d inactivo por %ld s\n", conn->request.idUser, now - conn->lastActive);
+		connections.reaped++;
+		close_connection(conn);
+	}
+}
+
+long check_idle_connection(struct timer_node *node, void *arg){
+	struct connection *conn = (struct connection *)((char *)node - offsetof(struct connection, timer));
+	long now = *(long *)arg;
+	//Una solicitud en curso la vigilan los plazos del socket, volvemos a mirar en un periodo
+	if(conn->op != CONNECTION_IDLE)
+		return now + idleTimeout;
+	//En un reinicio la conexion inactiva se cierra y el cliente se conecta al proceso nuevo
+	if(draining)
+		return conn->lastActive;
+	return conn->lastActive + idleTimeout;
+}
+
+void accept_users(int listener){
 	while(1){
 		//Donde vamos a guardar info de la conexion
 		struct sockaddr_in client_addr;
 		socklen_t client_len = sizeof(client_addr);
-
-		//Bloqueamos esperando conexiond e nuevo usuario
-		int new_client_socket = accept(serverSocket, (struct sockaddr *)&client_addr, &client_len);
+		int new_client_socket = accept4(listener, (struct sockaddr *)&client_addr, &client_len, SOCK_CLOEXEC);
 		if(new_client_socket == -1){
-			perror("Error conecting the new user");
+			if(errno != EAGAIN && errno != EWOULDBLOCK)
+				log_write(LOG_LEVEL_ERROR, "Error conecting the new user: %m\n");
+			return;
+		}
+
+		//Registramos el nuevo usuario, mientras no se supere el limite
+		struct connection *conn = connections_add(&connections, new_client_socket, listener == localSocket);
+		if(conn == NULL){
+			log_write(LOG_LEVEL_WARN, "Rejecting new user, there are %d users connected\n", connections.count);
+			close(new_client_socket);
 			continue;
 		}
+
 		//Sacamos la ip del usuario
-		char *client_ip = inet_ntoa(client_addr.sin_addr);
-		printf("Reciving new user with ip %s\n", client_ip);
-
-		//Creamos el hilo que maneja el usuario
-		int *socket_ptr = malloc(sizeof(int));
-		*socket_ptr = new_client_socket;
-		
-		pthread_t thread_id;
-		if(pthread_create(&thread_id, NULL, handler_user_thread, (void*)socket_ptr) != 0){
-			free(socket_ptr);
-			perror("Error creating the thread to the user");
+		if(listener == localSocket){
+			log_write(LOG_LEVEL_INFO, "Reciving new local user on %s\n", localPath);
+		}else{
+			log_write(LOG_LEVEL_INFO, "Reciving new user with ip %s\n", inet_ntoa(client_addr.sin_addr));
 		}
-		pthread_detach(thread_id);
+		configure_socket(new_client_socket, listener == localSocket);
+		timer_wheel_add(&idleTimers, &conn->timer, conn->lastActive + idleTimeout);
 
-		//Agregamos de manera segura el socket del nuevo usuario a nuestra estructura
-		pthread_mutex_lock(&mutexServer);
-		size_t i = 0;
-		while ( myServer->socketsUsers[i]>0)
-			i++;
-		myServer->socketsUsers[i] = new_client_socket;
-		myServer->countUsers++;
-		pthread_mutex_unlock(&mutexServer);
-		
+		//El usuario queda en el epoll hasta que envie una solicitud, sin ocupar un hilo
+		struct epoll_event event = { .events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, .data.ptr = conn };
+		if(epoll_ctl(epollFd, EPOLL_CTL_ADD, new_client_socket, &event) == -1){
+			log_write(LOG_LEVEL_ERROR, "Error registering the new user: %m\n");
+			close_connection(conn);
+		}
 	}
-	
 }
 
-void *handler_user_thread(void *args){
-	int clientSocket = *(int *)args;
+void configure_socket(int socket, int local){
+	//Los trabajadores bloquean en el socket: un cliente que desaparece no los retiene mas de ioTimeout
+	struct timeval timeout = { .tv_sec = ioTimeout, .tv_usec = 0 };
+	setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	if(local)
+		return;
 
-	size_t size_struct = sizeof(struct first_request); 
-	struct first_request *request = malloc(size_struct);
+	//Los mensajes del protocolo son pequenos y de ida y vuelta: sin Nagle
+	int nodelay = 1;
+	setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
 
-	while (1) {
-		int result = receive_first_request(clientSocket, request);
-		if (result == ERROR_SOCKET || result == CLIENT_DISCONECT) {
-			break;
-		}
+	//Keepalive detecta el cliente que se fue sin FIN mientras la conexion espera en el
+	//epoll. Las transferencias por io_uring no respetan SO_RCVTIMEO ni SO_SNDTIMEO:
+	//cada envio o recepcion lleva su propio plazo enlazado (ver uring_enable)
+	int keepalive = 1, idle = KEEPALIVE_IDLE, interval = KEEPALIVE_INTERVAL, probes = KEEPALIVE_PROBES;
+	setsockopt(socket, SOL_SOCKET, SO_KEEPALIVE, &keepalive, sizeof(keepalive));
+	setsockopt(socket, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+	setsockopt(socket, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+	setsockopt(socket, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
+	//Datos enviados sin confirmar por mas de ioTimeout tambien cierran la conexion
+	unsigned int userTimeout = ioTimeout * 1000;
+	setsockopt(socket, IPPROTO_TCP, TCP_USER_TIMEOUT, &userTimeout, sizeof(userTimeout));
+}
 
-		if (request->request == ADD) 
-			handle_add(clientSocket, request->idUser);
-		else if (request->request == LIST)
-			handle_list(clientSocket, request->idUser);
-		else if (request->request == GET)
-			handle_get(clientSocket, request->idUser);
-		else
-			printf("Solicitud desconocida del usuario %d\n", request->idUser);
+void read_request(struct connection *conn){
+	//EPOLLONESHOT: mientras la conexion no se rearme ningun otro hilo la toca
+	ssize_t bytes_read = recv(conn->socket, (char *)&conn->request + conn->received,
+			sizeof(struct first_request) - conn->received, MSG_DONTWAIT);
+	if(bytes_read == 0 || (bytes_read == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)){
+		close_connection(conn);
+		return;
 	}
+	if(bytes_read > 0)
+		conn->received += bytes_read;
 
-	printf("> Cliente con id %d se ha desconectado\n", request->idUser);
-	close(clientSocket);
-	delete_user(clientSocket);
-	free(request);
+	if(conn->received < sizeof(struct first_request)){
+		//Solicitud incompleta, esperamos el resto sin bloquear
+		struct epoll_event event = { .events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, .data.ptr = conn };
+		epoll_ctl(epollFd, EPOLL_CTL_MOD, conn->socket, &event);
+		return;
+	}
+	//Desde aqui la conexion es del trabajador: la rueda no la cierra
+	conn->op = conn->request.request;
+	if(thread_pool_submit(workerPool, handle_request, conn) == -1){
+		log_write(LOG_LEVEL_ERROR, "Error dispatching the request: %m\n");
+		close_connection(conn);
+	}
 }
 
-void delete_user(int socket){
-	pthread_mutex_lock(&mutexServer);
-	size_t i = 0;
-	while(myServer->socketsUsers[i] != socket)
-		i++;
-	myServer->socketsUsers[i] = -1;
-	myServer->countUsers--;
-	pthread_mutex_unlock(&mutexServer);
+void handle_request(void *args){
+	struct connection *conn = (struct connection *)args;
+	int clientSocket = conn->socket;
+	struct first_request *request = &conn->request;
+
+	//El resto de la operacion es bloqueante, como antes, con los plazos del socket
+	conn->opStarted = time(NULL);
+	threadTransferBytes = 0;
+	threadSentBytes = 0;
+	socketTimedOut = 0;
+	socketDesynced = 0;
+	unsigned long long started = stats_now_ns();
+	trace_request_begin();
+	unsigned long long span = trace_begin();
+	return_code result = VERSION_ERROR;
+	if (request->request == ADD) 
+		result = handle_add(clientSocket, request->idUser);
+	else if (request->request == LIST)
+		result = handle_list(clientSocket, request->idUser);
+	else if (request->request == GET)
+		result = handle_get(clientSocket, request->idUser);
+	else if (request->request == ADD_BATCH)
+		result = handle_add_batch(clientSocket, request->idUser);
+	else if (request->request == GET_BATCH)
+		result = handle_get_batch(clientSocket, request->idUser);
+	else if (request->request == ADD_DELTA)
+		result = handle_add_delta(clientSocket, request->idUser);
+	else if (request->request == STATS)
+		result = handle_stats(clientSocket, request->idUser);
+	else if (request->request == TRACE)
+		result = handle_trace(clientSocket, request->idUser);
+	else{
+		//Sin conocer la solicitud no se sabe donde empieza la siguiente
+		log_write(LOG_LEVEL_WARN, "Solicitud desconocida del usuario %d\n", request->idUser);
+		socketDesynced = 1;
+	}
+	if((unsigned)request->request < STATS_OPERATIONS)
+		trace_end(requestNames[request->request], span);
+	trace_request_end();
+	stats_record_request(request->request, (stats_now_ns() - started) / 1000, result == VERSION_ERROR || socketTimedOut,
+			threadTransferBytes - threadSentBytes, threadSentBytes);
+
+	conn->bytes += threadTransferBytes;
+	conn->requests++;
+
+	//Si vencio un plazo el cliente quedo a mitad de la solicitud y no se puede seguir
+	if(socketTimedOut){
+		log_write(LOG_LEVEL_WARN, "> Cliente con id %d no respondio en %d s\n", request->idUser, ioTimeout);
+		connections.timedOut++;
+		close_connection(conn);
+		return;
+	}
+	//Un manejador que dejo el flujo a mitad de un mensaje: lo que queda en el
+	//socket se leeria como la siguiente solicitud
+	if(socketDesynced){
+		log_write(LOG_LEVEL_WARN, "> Cliente con id %d quedo a mitad de una solicitud, se cierra la conexion\n", request->idUser);
+		close_connection(conn);
+		return;
+	}
+	//En un reinicio la conexion se cierra al terminar su solicitud, no vuelve al epoll
+	if(draining){
+		close_connection(conn);
+		return;
+	}
+	conn->lastActive = timer_wheel_now();
+	conn->op = CONNECTION_IDLE;
+
+	//Devolvemos la conexion al epoll para la siguiente solicitud
+	conn->received = 0;
+	struct epoll_event event = { .events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, .data.ptr = conn };
+	if(epoll_ctl(epollFd, EPOLL_CTL_MOD, clientSocket, &event) == -1){
+		log_write(LOG_LEVEL_ERROR, "Error rearming the user: %m\n");
+		close_connection(conn);
+	}
+}
+
+void close_connection(struct connection *conn){
+	log_write(LOG_LEVEL_INFO, "> Cliente con id %d se ha desconectado (%lu solicitudes, %llu bytes en %ld s)\n", conn->request.idUser,
+			conn->requests, conn->bytes, (long)(time(NULL) - conn->started));
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->socket, NULL);
+	timer_wheel_remove(&idleTimers, &conn->timer);
+	//Se borra antes de cerrar: al cerrar, accept puede reutilizar el mismo numero de socket
+	int socket = conn->socket;
+	connections_remove(&connections, conn);
+	close(socket);
+}
+
+void close_socket(struct connection *conn, void *arg){
+	close(conn->socket);
 }
 
-void handle_add(int socket, int idUser){
-	printf(" -- El usuario %d ha solicitado un add --\n", idUser);
+return_code handle_add(int socket, int idUser){
+	log_write(LOG_LEVEL_DEBUG, " -- El usuario %d ha solicitado un add --\n", idUser);
 
-	switch (add(socket, idUser))
+	return_code result = add(socket, idUser);
+	switch (result)
 	{
 	case VERSION_ERROR:
-		printf("> Error adding the new version of the user %d\n", idUser);
+		log_write(LOG_LEVEL_ERROR, "> Error adding the new version of the user %d\n", idUser);
 		break;
 	case VERSION_ALREADY_EXISTS:
-		printf("> The version already exists for the user %d\n", idUser);
+		log_write(LOG_LEVEL_INFO, "> The version already exists for the user %d\n", idUser);
 		break;
 	case VERSION_ADDED:
-		printf("> The version has been added for the user %d\n", idUser);
+		log_write(LOG_LEVEL_INFO, "> The version has been added for the user %d\n", idUser);
+		break;
+	case VERSION_RETRY_LATER:
+		log_write(LOG_LEVEL_WARN, "> Too many uploads, the user %d must retry later\n", idUser);
 		break;
 	default:
 		break;
 	}
+	return result;
 }
 
-void handle_get(int socket, int idUser){
-	printf("--El usuario %d ha solicitado un get--\n", idUser);
-	switch (get(socket, idUser))
+return_code handle_get(int socket, int idUser){
+	log_write(LOG_LEVEL_DEBUG, "--El usuario %d ha solicitado un get--\n", idUser);
+	return_code result = get(socket, idUser);
+	switch (result)
 	{
 	case VERSION_ADDED:
-		printf("> The versions has been geted for the user %d\n", idUser);
+		log_write(LOG_LEVEL_INFO, "> The versions has been geted for the user %d\n", idUser);
 		break;
 	case VERSION_ERROR:
-		printf("> Error listing the versions of the user %d\n", idUser);
+		log_write(LOG_LEVEL_ERROR, "> Error listing the versions of the user %d\n", idUser);
 		break;
 	case VERSION_NOT_EXISTS:
-		printf("> The version not exists for the user %d\n", idUser);
+		log_write(LOG_LEVEL_INFO, "> The version not exists for the user %d\n", idUser);
+		break;
+	}
+	return result;
+}
+
+return_code handle_list(int socket, int idUser){
+	log_write(LOG_LEVEL_DEBUG, "-- El usuario %d ha solicitado un list --\n", idUser);
+	return_code result = list(socket, idUser);
+	switch (result)
+	{
+	case VERSION_ADDED:
+		log_write(LOG_LEVEL_INFO, "> The versions has been listed for the user %d\n", idUser);
+		break;
+	case VERSION_ERROR:
+		log_write(LOG_LEVEL_ERROR, "> Error geting the versions of the user %d\n", idUser);
+		break;
+	}
+	return result;
+}
+
+return_code handle_add_batch(int socket, int idUser){
+	log_write(LOG_LEVEL_DEBUG, "-- El usuario %d ha solicitado un add por lotes --\n", idUser);
+
+	return_code result = add_batch(socket, idUser);
+	switch (result)
+	{
+	case VERSION_ERROR:
+		log_write(LOG_LEVEL_ERROR, "> Error adding the batch of the user %d\n", idUser);
+		break;
+	case VERSION_ALREADY_EXISTS:
+		log_write(LOG_LEVEL_INFO, "> All the versions of the batch already exist for the user %d\n", idUser);
+		break;
+	case VERSION_ADDED:
+		log_write(LOG_LEVEL_INFO, "> The batch has been added for the user %d\n", idUser);
+		break;
+	case VERSION_RETRY_LATER:
+		log_write(LOG_LEVEL_WARN, "> Too many uploads, the user %d must retry the batch later\n", idUser);
+		break;
+	default:
 		break;
 	}
+	return result;
 }
 
-void handle_list(int socket, int idUser){
-	printf("-- El usuario %d ha solicitado un list --\n", idUser);
-	switch (list(socket, idUser))
+return_code handle_get_batch(int socket, int idUser){
+	log_write(LOG_LEVEL_DEBUG, "-- El usuario %d ha solicitado un get por lotes --\n", idUser);
+
+	return_code result = get_batch(socket, idUser);
+	switch (result)
 	{
 	case VERSION_ADDED:
-		printf("> The versions has been listed for the user %d\n", idUser);
+		log_write(LOG_LEVEL_INFO, "> The batch has been sent to the user %d\n", idUser);
+		break;
+	case VERSION_ERROR:
+		log_write(LOG_LEVEL_ERROR, "> Error sending the batch of the user %d\n", idUser);
+		break;
+	case VERSION_NOT_EXISTS:
+		log_write(LOG_LEVEL_INFO, "> No versions of the batch exist for the user %d\n", idUser);
 		break;
+	default:
+		break;
+	}
+	return result;
+}
+
+return_code handle_add_delta(int socket, int idUser){
+	log_write(LOG_LEVEL_DEBUG, "-- El usuario %d ha solicitado un add por diferencias --\n", idUser);
+
+	return_code result = add_delta(socket, idUser);
+	switch (result)
+	{
 	case VERSION_ERROR:
-		printf("> Error geting the versions of the user %d\n", idUser);
+		log_write(LOG_LEVEL_ERROR, "> Error adding the delta of the user %d\n", idUser);
+		break;
+	case VERSION_ALREADY_EXISTS:
+		log_write(LOG_LEVEL_INFO, "> The version already exists for the user %d\n", idUser);
+		break;
+	case VERSION_ADDED:
+		log_write(LOG_LEVEL_INFO, "> The version has been rebuilt from the delta for the user %d\n", idUser);
+		break;
+	case VERSION_RETRY_LATER:
+		log_write(LOG_LEVEL_WARN, "> Too many uploads, the user %d must retry later\n", idUser);
+		break;
+	default:
 		break;
 	}
+	return result;
+}
+
+status_operation_socket send_stats_line(int socket, char *message, const char *format, ...){
+	va_list args;
+	va_start(args, format);
+	vsnprintf(message, STATS_LINE_SIZE, format, args);
+	va_end(args);
+	return send_element_list(socket, message);
+}
+
+return_code handle_stats(int socket, int idUser){
+	log_write(LOG_LEVEL_DEBUG, "-- El usuario %d ha solicitado las estadisticas --\n", idUser);
+	static const char *locks[STATS_LOCKS] = { "read", "write" };
+	static const char *stages[PIPELINE_STAGES] = { "network", "hash", "disk" };
+	char *message = calloc(1, SIZE_ELEMENT_LIST);
+	struct stats_snapshot *snapshot = malloc(sizeof(struct stats_snapshot));
+	if(message == NULL || snapshot == NULL){
+		free(message);
+		free(snapshot);
+		socketDesynced = 1;
+		return VERSION_ERROR;
+	}
+	stats_snapshot(snapshot);
+	char name[STATS_LINE_SIZE], line[STATS_LINE_SIZE];
+	status_operation_socket status = send_stats_line(socket, message, "server pid=%d process=%d uptime_s=%ld workers=%d",
+			getpid(), processIndex, (long)(time(NULL) - serverStarted), workerPool->countThreads);
+
+	//Solicitudes: contadores y latencia
+	for(int i = 0; i < STATS_OPERATIONS && status == OK; i++){
+		struct stats_operation *operation = &snapshot->operations[i];
+		snprintf(name, sizeof(name), "op %s errors=%lu bytes_in=%llu bytes_out=%llu", requestNames[i],
+				operation->errors, operation->bytesIn, operation->bytesOut);
+		stats_format_histogram(line, name, &operation->latency);
+		status = send_stats_line(socket, message, "%s", line);
+	}
+	//Bloqueo del indice de versions.db (antes mutexDB)
+	for(int i = 0; i < STATS_LOCKS && status == OK; i++){
+		snprintf(name, sizeof(name), "db_lock %s wait", locks[i]);
+		stats_format_histogram(line, name, &snapshot->lockWait[i]);
+		status = send_stats_line(socket, message, "%s", line);
+		snprintf(name, sizeof(name), "db_lock %s hold", locks[i]);
+		stats_format_histogram(line, name, &snapshot->lockHold[i]);
+		if(status == OK)
+			status = send_stats_line(socket, message, "%s", line);
+	}
+	if(status == OK)
+		status = send_stats_line(socket, message, "connections active=%d limit=%d reaped=%lu timed_out=%lu",
+				connections.count, connections.limit, (unsigned long)connections.reaped, (unsigned long)connections.timedOut);
+	if(status == OK)
+		status = send_stats_line(socket, message, "uploads active=%d limit=%d waiting=%d queue=%d rejected=%lu",
+				uploads.active, uploads.limit, uploads.waiting, uploads.queueLimit, uploads.rejected);
+	if(status == OK)
+		status = send_stats_line(socket, message, "transfers files=%lu syscalls=%lu io_uring_ops=%lu",
+				transferCounters.transfers, transferCounters.syscalls, transferCounters.sqes);
+
+	struct pipeline_stats pipeline;
+	pipeline_get_stats(&pipeline);
+	for(int i = 0; i < PIPELINE_STAGES && status == OK && pipeline.buffers > 0; i++){
+		struct pipeline_stage_stats *stage = &pipeline.stages[i];
+		int threads = i == PIPELINE_HASH ? pipeline.hashers : 1;
+		double seconds = pipeline.seconds > 0 ? pipeline.seconds : 1;
+		status = send_stats_line(socket, message, "pipeline %s chunks=%lu bytes=%llu busy_pct=%.1f stall_pct=%.1f queue_avg=%.1f queue_max=%d",
+				stages[i], stage->chunks, stage->bytes, stage->busyNs / 1e7 / seconds / threads, stage->stallNs / 1e7 / seconds,
+				stage->chunks > 0 ? (double)stage->depthSum / stage->chunks : 0.0, stage->maxDepth);
+	}
+
+	struct log_stats logStats;
+	log_get_stats(&logStats);
+	if(status == OK)
+		status = send_stats_line(socket, message, "log written=%lu sampled=%lu dropped=%lu",
+				logStats.written, logStats.sampled, logStats.dropped);
+	unsigned long blobs;
+	unsigned long long blobBytes;
+	blob_store_usage(&blobs, &blobBytes);
+	if(status == OK)
+		status = send_stats_line(socket, message, "store versions=%u blobs=%lu bytes=%llu", versionIndex->count, blobs, blobBytes);
+	if(status == OK)
+		status = send_lock_profile(socket, message);
+	if(status == OK)
+		status = send_stats_line(socket, message, "END");
+	free(message);
+	free(snapshot);
+	if(status != OK){
+		log_write(LOG_LEVEL_ERROR, "> Error sending the stats to the user %d\n", idUser);
+		socketDesynced = 1;
+		return VERSION_ERROR;
+	}
+	log_write(LOG_LEVEL_INFO, "> The stats have been sent to the user %d\n", idUser);
+	return VERSION_ADDED;
+}
+
+status_operation_socket send_lock_profile(int socket, char *message){
+	struct lock_site *totals = calloc(LOCK_PROFILE_NAMES, sizeof(struct lock_site));
+	if(totals == NULL)
+		return ERROR;
+	int count = 0;
+	for(struct lock_site *site = lock_profile_sites(); site != NULL; site = site->next){
+		int i = 0;
+		while(i < count && strcmp(totals[i].lock, site->lock) != 0)
+			i++;
+		if(i == LOCK_PROFILE_NAMES)
+			continue;
+		if(i == count)
+			totals[count++].lock = site->lock;
+		totals[i].acquisitions += site->acquisitions;
+		totals[i].contended += site->contended;
+		stats_histogram_add(&totals[i].wait, &site->wait);
+		stats_histogram_add(&totals[i].hold, &site->hold);
+	}
+
+	char name[STATS_LINE_SIZE], line[STATS_LINE_SIZE];
+	status_operation_socket status = OK;
+	for(int i = 0; i < count && status == OK; i++){
+		snprintf(name, sizeof(name), "lock %s wait", totals[i].lock);
+		lock_profile_format(line, name, totals[i].acquisitions, totals[i].contended, &totals[i].wait);
+		status = send_stats_line(socket, message, "%s", line);
+		snprintf(name, sizeof(name), "lock %s hold", totals[i].lock);
+		lock_profile_format(line, name, totals[i].acquisitions, totals[i].contended, &totals[i].hold);
+		if(status == OK)
+			status = send_stats_line(socket, message, "%s", line);
+	}
+	for(struct lock_site *site = lock_profile_sites(); site != NULL && status == OK; site = site->next){
+		snprintf(name, sizeof(name), "lock_site %s %s:%d wait", site->lock, site->file, site->line);
+		lock_profile_format(line, name, site->acquisitions, site->contended, &site->wait);
+		status = send_stats_line(socket, message, "%s", line);
+		snprintf(name, sizeof(name), "lock_site %s %s:%d hold", site->lock, site->file, site->line);
+		lock_profile_format(line, name, site->acquisitions, site->contended, &site->hold);
+		if(status == OK)
+			status = send_stats_line(socket, message, "%s", line);
+	}
+	free(totals);
+	return status;
+}
+
+return_code handle_trace(int socket, int idUser){
+	struct file_request request;
+	if(receive_file_request(socket, &request) != OK){
+		socketDesynced = 1;
+		return VERSION_ERROR;
+	}
+	if(request.version != TRACE_KEEP_RATE){
+		trace_set_rate(request.version);
+		log_write(LOG_LEVEL_INFO, "> The user %d set the trace rate to %d per million\n", idUser, trace_get_rate());
+	}
+
+	//Las trazas pasan por un archivo temporal: se envian como un archivo con su tamanio
+	struct file_transfer transfer;
+	memset(&transfer, 0, sizeof(transfer));
+	FILE *fp = NULL;
+	long spans = 0;
+	if(request.sizeNameFile > 0){
+		fp = tmpfile();
+		spans = fp != NULL ? trace_write_json(fp) : -1;
+		if(spans < 0 || fflush(fp) != 0){
+			log_write(LOG_LEVEL_ERROR, "> Error writing the traces for the user %d: %m\n", idUser);
+			spans = -1;
+		}else{
+			transfer.filseSize = ftell(fp);
+		}
+	}
+	snprintf(transfer.comment, COMMENT_SIZE, "rate=%d spans=%ld", trace_get_rate(), spans);
+	status_operation_socket status = send_file_transfer(socket, &transfer);
+	if(status == OK && transfer.filseSize > 0 && lseek(fileno(fp), 0, SEEK_SET) == 0)
+		status = send_file_data(socket, fileno(fp), transfer.filseSize);
+	if(fp != NULL)
+		fclose(fp);
+	if(status != OK){
+		log_write(LOG_LEVEL_ERROR, "> Error sending the traces to the user %d\n", idUser);
+		socketDesynced = 1;
+		return VERSION_ERROR;
+	}
+	if(transfer.filseSize > 0)
+		log_write(LOG_LEVEL_INFO, "> %ld spans have been sent to the user %d\n", spans, idUser);
+	return spans < 0 ? VERSION_ERROR : VERSION_ADDED;
 }
@@ -0,0 +1,130 @@
+/**
+ * @file
+ * @brief Control de admision de las subidas de archivos: limita las
+ * transferencias simultaneas con una cola de espera acotada y reparte los
+ * turnos de forma justa entre clientes
+ * @copyright MIT License
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "admission.h"
+#include "lock_profile.h"
+
+#define FREE_TURN -1        /**< Turno sin cliente en holders */
+#define AVERAGE_WEIGHT 0.2  /**< Peso de la ultima duracion en el promedio movil */
+
+int admission_init(struct admission *admission, int limit, int queueLimit) {
+    memset(admission, 0, sizeof(struct admission));
+    admission->holders = malloc(limit * sizeof(int));
+    if (admission->holders == NULL)
+        return -1;
+    for (int i = 0; i < limit; i++)
+        admission->holders[i] = FREE_TURN;
+    admission->limit = limit;
+    admission->queueLimit = queueLimit;
+    pthread_mutex_init(&admission->mutex, NULL);
+    return 0;
+}
+
+/**
+ * @brief Cuenta los turnos que tiene un cliente (holders es pequenio)
+ */
+static int turns_of(struct admission *admission, int idClient) {
+    int turns = 0;
+    for (int i = 0; i < admission->limit; i++)
+        turns += admission->holders[i] == idClient;
+    return turns;
+}
+
+/**
+ * @brief Ocupa un turno libre para el cliente
+ */
+static void take_turn(struct admission *admission, int idClient) {
+    int i = 0;
+    while (admission->holders[i] != FREE_TURN)
+        i++;
+    admission->holders[i] = idClient;
+    admission->active++;
+}
+
+int admission_enter(struct admission *admission, int idClient, int mayReject) {
+    profiled_lock(&admission->mutex, "admission");
+    //Sin adelantarse: si hay cola, la solicitud nueva tambien espera
+    if (admission->active < admission->limit && admission->head == NULL) {
+        take_turn(admission, idClient);
+        profiled_unlock(&admission->mutex);
+        return 0;
+    }
+    if (mayReject && admission->waiting >= admission->queueLimit) {
+        admission->rejected++;
+        profiled_unlock(&admission->mutex);
+        return -1;
+    }
+
+    struct admission_waiter waiter;
+    waiter.idClient = idClient;
+    waiter.granted = 0;
+    waiter.next = NULL;
+    pthread_cond_init(&waiter.cond, NULL);
+    struct admission_waiter **last = &admission->head;
+    while (*last != NULL)
+        last = &(*last)->next;
+    *last = &waiter;
+    admission->waiting++;
+
+    //admission_exit toma el turno a nombre de quien despierta
+    while (!waiter.granted)
+        profiled_cond_wait(&waiter.cond, &admission->mutex);
+    profiled_unlock(&admission->mutex);
+    pthread_cond_destroy(&waiter.cond);
+    return 0;
+}
+
+void admission_exit(struct admission *admission, int idClient, double elapsedMs) {
+    profiled_lock(&admission->mutex, "admission");
+    for (int i = 0; i < admission->limit; i++) {
+        if (admission->holders[i] == idClient) {
+            admission->holders[i] = FREE_TURN;
+            admission->active--;
+            break;
+        }
+    }
+    admission->averageMs = admission->averageMs == 0 ? elapsedMs
+            : (1 - AVERAGE_WEIGHT) * admission->averageMs + AVERAGE_WEIGHT * elapsedMs;
+
+    //Justicia entre clientes: el turno es del que espera con menos turnos
+    //ocupados; entre iguales, del que llego primero. Un lote grande que pide
+    //turno por cada archivo no deja sin turno a los demas
+    if (admission->head != NULL) {
+        struct admission_waiter **best = NULL;
+        int bestTurns = 0;
+        for (struct admission_waiter **w = &admission->head; *w != NULL; w = &(*w)->next) {
+            int turns = turns_of(admission, (*w)->idClient);
+            if (best == NULL || turns < bestTurns) {
+                best = w;
+                bestTurns = turns;
+            }
+        }
+        struct admission_waiter *chosen = *best;
+        *best = chosen->next;
+        admission->waiting--;
+        take_turn(admission, chosen->idClient);
+        chosen->granted = 1;
+        pthread_cond_signal(&chosen->cond);
+    }
+    profiled_unlock(&admission->mutex);
+}
+
+int admission_retry_after(struct admission *admission) {
+    profiled_lock(&admission->mutex, "admission");
+    //Tiempo para que se vacie la cola actual con todos los turnos trabajando
+    double seconds = admission->averageMs * (admission->waiting + 1) / admission->limit / 1000;
+    profiled_unlock(&admission->mutex);
+    if (seconds < 1)
+        return 1;
+    if (seconds > ADMISSION_MAX_RETRY)
+        return ADMISSION_MAX_RETRY;
+    return (int)seconds + 1;
+}
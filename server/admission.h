@@ -0,0 +1,75 @@
+/**
+ * @file
+ * @brief Control de admision de las subidas de archivos: limita las
+ * transferencias simultaneas con una cola de espera acotada y reparte los
+ * turnos de forma justa entre clientes
+ * @copyright MIT License
+ */
+
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <pthread.h>
+
+#define ADMISSION_MAX_RETRY 60 /**< Maximo de segundos que se pide esperar antes de reintentar */
+
+/**
+ * @brief Solicitud esperando turno para subir un archivo
+ */
+struct admission_waiter {
+    int idClient;                  /**< Cliente que espera */
+    int granted;                   /**< 1 cuando ya tiene turno */
+    pthread_cond_t cond;           /**< Se senala al darle el turno */
+    struct admission_waiter *next; /**< Siguiente en la cola (orden de llegada) */
+};
+
+/**
+ * @brief Estado del control de admision
+ */
+struct admission {
+    int limit;                       /**< Transferencias simultaneas permitidas */
+    int queueLimit;                  /**< Solicitudes que pueden esperar turno */
+    int *holders;                    /**< Cliente de cada turno ocupado (limit posiciones) */
+    int active;                      /**< Turnos ocupados */
+    int waiting;                     /**< Solicitudes en la cola */
+    struct admission_waiter *head;   /**< Cola de espera */
+    double averageMs;                /**< Promedio movil de la duracion de un turno */
+    unsigned long rejected;          /**< Solicitudes rechazadas con cola llena */
+    pthread_mutex_t mutex;           /**< Protege el estado */
+};
+
+/**
+ * @brief Inicializa el control de admision
+ * @param admission estado a inicializar
+ * @param limit transferencias simultaneas permitidas
+ * @param queueLimit solicitudes que pueden esperar turno
+ * @return 0 si se inicializo, -1 si no hay memoria
+ */
+int admission_init(struct admission *admission, int limit, int queueLimit);
+
+/**
+ * @brief Pide un turno para transferir. Si no hay turno libre espera en la
+ * cola; los turnos se dan primero al cliente que menos turnos tenga
+ * @param admission control de admision
+ * @param idClient cliente que pide el turno
+ * @param mayReject 1 para no esperar si la cola esta llena
+ * @return 0 con el turno tomado, -1 si la cola estaba llena
+ */
+int admission_enter(struct admission *admission, int idClient, int mayReject);
+
+/**
+ * @brief Libera un turno y se lo da a la siguiente solicitud que corresponda
+ * @param admission control de admision
+ * @param idClient cliente que tenia el turno
+ * @param elapsedMs duracion del turno en milisegundos, para estimar la espera
+ */
+void admission_exit(struct admission *admission, int idClient, double elapsedMs);
+
+/**
+ * @brief Estima en cuantos segundos conviene reintentar una solicitud rechazada
+ * @param admission control de admision
+ * @return segundos, entre 1 y ADMISSION_MAX_RETRY
+ */
+int admission_retry_after(struct admission *admission);
+
+#endif
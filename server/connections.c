@@ -0,0 +1,99 @@
+/**
+ * @file
+ * @brief Registro de las conexiones activas del servidor
+ * @copyright MIT License
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "connections.h"
+#include "lock_profile.h"
+
+#define CONNECTIONS_INITIAL_CAPACITY 64 /**< Capacidad inicial de los arreglos */
+
+void connections_init(struct connection_table *table, int limit) {
+    memset(table, 0, sizeof(struct connection_table));
+    table->limit = limit;
+    pthread_mutex_init(&table->mutex, NULL);
+}
+
+/**
+ * @brief Crece un arreglo de punteros al doble (o lo necesario) llenando con NULL
+ * @return 0 si crecio, -1 si no hay memoria
+ */
+static int grow(struct connection ***array, int *capacity, int needed) {
+    int size = *capacity > 0 ? *capacity : CONNECTIONS_INITIAL_CAPACITY;
+    while (size <= needed)
+        size *= 2;
+    struct connection **grown = realloc(*array, size * sizeof(struct connection *));
+    if (grown == NULL)
+        return -1;
+    memset(grown + *capacity, 0, (size - *capacity) * sizeof(struct connection *));
+    *array = grown;
+    *capacity = size;
+    return 0;
+}
+
+struct connection *connections_add(struct connection_table *table, int socket, int local) {
+    struct connection *conn = calloc(1, sizeof(struct connection));
+    if (conn == NULL)
+        return NULL;
+    conn->socket = socket;
+    conn->local = local;
+    conn->op = CONNECTION_IDLE;
+    conn->started = time(NULL);
+    conn->lastActive = timer_wheel_now();
+
+    profiled_lock(&table->mutex, "connections");
+    //Los sockets son los descriptores mas bajos libres: bySocket crece poco a poco
+    if (table->count == table->limit
+            || (socket >= table->capacity && grow(&table->bySocket, &table->capacity, socket) != 0)
+            || (table->count == table->activeCapacity && grow(&table->active, &table->activeCapacity, table->count) != 0)) {
+        profiled_unlock(&table->mutex);
+        free(conn);
+        return NULL;
+    }
+    conn->index = table->count;
+    table->active[table->count++] = conn;
+    table->bySocket[socket] = conn;
+    profiled_unlock(&table->mutex);
+    return conn;
+}
+
+void connections_remove(struct connection_table *table, struct connection *conn) {
+    profiled_lock(&table->mutex, "connections");
+    //La ultima conexion ocupa el hueco de la que se quita
+    struct connection *last = table->active[--table->count];
+    table->active[conn->index] = last;
+    last->index = conn->index;
+    if (table->bySocket[conn->socket] == conn)
+        table->bySocket[conn->socket] = NULL;
+    profiled_unlock(&table->mutex);
+    free(conn);
+}
+
+struct connection *connections_find(struct connection_table *table, int socket) {
+    struct connection *conn = NULL;
+    profiled_lock(&table->mutex, "connections");
+    if (socket >= 0 && socket < table->capacity)
+        conn = table->bySocket[socket];
+    profiled_unlock(&table->mutex);
+    return conn;
+}
+
+void connections_foreach(struct connection_table *table, void (*function)(struct connection *, void *), void *arg) {
+    profiled_lock(&table->mutex, "connections");
+    for (int i = 0; i < table->count; i++)
+        function(table->active[i], arg);
+    profiled_unlock(&table->mutex);
+}
+
+void connections_destroy(struct connection_table *table) {
+    for (int i = 0; i < table->count; i++)
+        free(table->active[i]);
+    free(table->active);
+    free(table->bySocket);
+    pthread_mutex_destroy(&table->mutex);
+    memset(table, 0, sizeof(struct connection_table));
+}
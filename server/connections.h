@@ -0,0 +1,99 @@
+/**
+ * @file
+ * @brief Registro de las conexiones activas del servidor
+ * @copyright MIT License
+ */
+
+#ifndef CONNECTIONS_H
+#define CONNECTIONS_H
+
+#include <pthread.h>
+#include <time.h>
+#include <stdatomic.h>
+
+#include "../common/protocol.h"
+#include "timer_wheel.h"
+
+#define CONNECTION_IDLE -1 /**< Operacion actual de una conexion sin solicitud en curso */
+
+/**
+ * @brief Conexion de un usuario. Queda registrada en el epoll mientras espera
+ * una solicitud y la atiende un trabajador mientras la ejecuta
+ */
+struct connection {
+    int socket;                   /**< Socket del usuario */
+    int local;                    /**< 1 si llego por el socket Unix */
+    struct first_request request; /**< Solicitud que se lee sin bloquear */
+    size_t received;              /**< Bytes ya leidos de la solicitud */
+    int index;                    /**< Posicion en el arreglo de conexiones activas */
+    atomic_int op;                /**< Solicitud en curso (type_request), CONNECTION_IDLE si no hay */
+    time_t started;               /**< Momento en que se conecto */
+    time_t opStarted;             /**< Momento en que empezo la solicitud en curso */
+    unsigned long requests;       /**< Solicitudes atendidas */
+    unsigned long long bytes;     /**< Bytes de archivos transferidos */
+    atomic_long lastActive;       /**< Segundo (monotonico) en que termino su ultima solicitud */
+    struct timer_node timer;      /**< Vencimiento por inactividad en la rueda del reactor */
+};
+
+/**
+ * @brief Tabla de conexiones: un arreglo indexado por socket para buscar y uno
+ * denso de las activas para recorrerlas. Insertar y borrar son O(1)
+ */
+struct connection_table {
+    struct connection **bySocket; /**< Conexion de cada socket, NULL si no hay */
+    int capacity;                 /**< Tamanio de bySocket */
+    struct connection **active;   /**< Conexiones activas, sin huecos */
+    int activeCapacity;           /**< Tamanio de active */
+    int count;                    /**< Numero de conexiones activas */
+    int limit;                    /**< Maximo de conexiones simultaneas */
+    atomic_ulong reaped;          /**< Conexiones cerradas por inactividad */
+    atomic_ulong timedOut;        /**< Conexiones cerradas por vencer una lectura o escritura */
+    pthread_mutex_t mutex;        /**< Protege la tabla */
+};
+
+/**
+ * @brief Inicializa una tabla vacia
+ * @param table tabla a inicializar
+ * @param limit maximo de conexiones simultaneas
+ */
+void connections_init(struct connection_table *table, int limit);
+
+/**
+ * @brief Registra una conexion nueva
+ * @param table tabla de conexiones
+ * @param socket socket del usuario
+ * @param local 1 si llego por el socket Unix
+ * @return conexion creada, NULL si se alcanzo el limite o no hay memoria
+ */
+struct connection *connections_add(struct connection_table *table, int socket, int local);
+
+/**
+ * @brief Quita una conexion de la tabla y la libera (no cierra el socket)
+ * @param table tabla de conexiones
+ * @param conn conexion a quitar
+ */
+void connections_remove(struct connection_table *table, struct connection *conn);
+
+/**
+ * @brief Busca la conexion de un socket
+ * @param table tabla de conexiones
+ * @param socket socket del usuario
+ * @return conexion, NULL si el socket no esta registrado
+ */
+struct connection *connections_find(struct connection_table *table, int socket);
+
+/**
+ * @brief Recorre las conexiones activas con la tabla bloqueada
+ * @param table tabla de conexiones
+ * @param function funcion que se llama con cada conexion
+ * @param arg argumento adicional de la funcion
+ */
+void connections_foreach(struct connection_table *table, void (*function)(struct connection *, void *), void *arg);
+
+/**
+ * @brief Libera la tabla y las conexiones que queden (no cierra los sockets)
+ * @param table tabla de conexiones
+ */
+void connections_destroy(struct connection_table *table);
+
+#endif
@@ -0,0 +1,111 @@
+/**
+ * @file
+ * @brief Perfil de contencion de los mutex del servidor
+ * @copyright MIT License
+ */
+
+#include <errno.h>
+#include <stdio.h>
+
+#include "lock_profile.h"
+
+/**
+ * @brief Mutex que el hilo tiene tomado
+ */
+struct lock_held {
+    pthread_mutex_t *mutex;     /**< Mutex */
+    struct lock_site *site;     /**< Sitio donde se tomo */
+    unsigned long long since;   /**< Cuando se tomo (nanosegundos) */
+};
+
+static struct lock_site *sites = NULL;                        /* Sitios registrados*/
+static pthread_mutex_t sitesMutex = PTHREAD_MUTEX_INITIALIZER; /* Protege el registro de sitios*/
+static __thread struct lock_held held[LOCK_PROFILE_DEPTH];    /* Mutex tomados por el hilo*/
+static __thread int countHeld = 0;                            /* Entradas usadas de held*/
+
+/**
+ * @brief Agrega un sitio a la lista la primera vez que se usa
+ */
+static void register_site(struct lock_site *site) {
+    pthread_mutex_lock(&sitesMutex);
+    if (!site->registered) {
+        site->next = sites;
+        __atomic_store_n(&sites, site, __ATOMIC_RELEASE);
+        site->registered = 1;
+    }
+    pthread_mutex_unlock(&sitesMutex);
+}
+
+void lock_profile_record_acquire(struct lock_site *site, int contended, unsigned long long waitNs) {
+    if (!__atomic_load_n(&site->registered, __ATOMIC_ACQUIRE))
+        register_site(site);
+    if (contended) {
+        __atomic_fetch_add(&site->contended, 1, __ATOMIC_RELAXED);
+        stats_histogram_record(&site->wait, waitNs);
+    }
+    __atomic_fetch_add(&site->acquisitions, 1, __ATOMIC_RELAXED);
+}
+
+void lock_profile_record_hold(struct lock_site *site, unsigned long long holdNs) {
+    stats_histogram_record(&site->hold, holdNs);
+}
+
+void lock_profile_acquire(pthread_mutex_t *mutex, struct lock_site *site) {
+    //Sin contencion basta el trylock: solo se mide la espera cuando la hay
+    if (pthread_mutex_trylock(mutex) == EBUSY) {
+        unsigned long long start = stats_now_ns();
+        pthread_mutex_lock(mutex);
+        lock_profile_record_acquire(site, 1, stats_now_ns() - start);
+    } else {
+        lock_profile_record_acquire(site, 0, 0);
+    }
+    if (countHeld < LOCK_PROFILE_DEPTH)
+        held[countHeld++] = (struct lock_held){ mutex, site, stats_now_ns() };
+}
+
+/**
+ * @brief Registra el tiempo con un mutex y lo quita de los tomados por el hilo
+ * @return entrada que tenia, -1 si no se tomo con perfil
+ */
+static int release_held(pthread_mutex_t *mutex) {
+    for (int i = countHeld - 1; i >= 0; i--) {
+        if (held[i].mutex != mutex)
+            continue;
+        lock_profile_record_hold(held[i].site, stats_now_ns() - held[i].since);
+        return i;
+    }
+    return -1;
+}
+
+void profiled_unlock(pthread_mutex_t *mutex) {
+    int entry = release_held(mutex);
+    if (entry != -1) {
+        for (int i = entry; i < countHeld - 1; i++)
+            held[i] = held[i + 1];
+        countHeld--;
+    }
+    pthread_mutex_unlock(mutex);
+}
+
+void profiled_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+    int entry = release_held(mutex);
+    pthread_cond_wait(cond, mutex);
+    //Al volver se tomo el mutex otra vez: es otra adquisicion, asi cada tiempo
+    //con el mutex tiene la suya. Su espera no se distingue de la de la condicion
+    if (entry != -1) {
+        lock_profile_record_acquire(held[entry].site, 0, 0);
+        held[entry].since = stats_now_ns();
+    }
+}
+
+struct lock_site *lock_profile_sites() {
+    return __atomic_load_n(&sites, __ATOMIC_ACQUIRE);
+}
+
+void lock_profile_format(char *line, const char *name, unsigned long acquisitions, unsigned long contended,
+        const struct stats_histogram *histogram) {
+    snprintf(line, STATS_LINE_SIZE, "%s acquisitions=%lu contended=%lu (%.2f%%) count=%lu mean_ns=%.0f p50_ns=%llu p99_ns=%llu p999_ns=%llu max_ns=%llu",
+            name, acquisitions, contended, acquisitions > 0 ? 100.0 * contended / acquisitions : 0.0, histogram->count,
+            histogram->count > 0 ? (double)histogram->sum / histogram->count : 0.0, stats_percentile(histogram, 50),
+            stats_percentile(histogram, 99), stats_percentile(histogram, 99.9), histogram->max);
+}
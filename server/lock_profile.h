@@ -0,0 +1,103 @@
+/**
+ * @file
+ * @brief Perfil de contencion de los mutex del servidor: cada sitio donde se
+ * toma un mutex cuenta sus adquisiciones, las que tuvieron que esperar, y la
+ * distribucion de la espera y del tiempo con el mutex tomado
+ * @copyright MIT License
+ */
+
+#ifndef LOCK_PROFILE_H
+#define LOCK_PROFILE_H
+
+#include <pthread.h>
+
+#include "stats.h"
+
+#define LOCK_PROFILE_DEPTH 8  /**< Mutex que un hilo puede tener tomados a la vez con perfil */
+#define LOCK_PROFILE_NAMES 32 /**< Mutex distintos que se suman por nombre en el reporte */
+
+/**
+ * @brief Sitio (archivo y linea) donde se toma un mutex. Se declara estatico en
+ * el sitio con LOCK_SITE y se registra la primera vez que se usa
+ */
+struct lock_site {
+    const char *lock;              /**< Nombre del mutex; los sitios del mismo mutex se suman por nombre */
+    const char *file;              /**< Archivo del sitio */
+    int line;                      /**< Linea del sitio */
+    int registered;                /**< 1 si ya esta en la lista de sitios */
+    struct lock_site *next;        /**< Siguiente sitio registrado */
+    unsigned long acquisitions;    /**< Veces que se tomo el mutex aqui */
+    unsigned long contended;       /**< Veces que estaba tomado y hubo que esperar */
+    struct stats_histogram wait;   /**< Espera de las adquisiciones con contencion (nanosegundos) */
+    struct stats_histogram hold;   /**< Tiempo con el mutex tomado (nanosegundos) */
+};
+
+/**
+ * @brief Sitio estatico de la linea donde se usa
+ * @param name nombre del mutex
+ */
+#define LOCK_SITE(name) ({ static struct lock_site site_ = { .lock = (name), .file = __FILE__, .line = __LINE__ }; &site_; })
+
+/**
+ * @brief Toma un mutex midiendo la espera en el sitio de la llamada
+ * @param mutex mutex
+ * @param name nombre del mutex en el reporte
+ */
+#define profiled_lock(mutex, name) lock_profile_acquire((mutex), LOCK_SITE(name))
+
+/**
+ * @brief Toma un mutex y registra la adquisicion en un sitio
+ * @param mutex mutex
+ * @param site sitio de la llamada
+ */
+void lock_profile_acquire(pthread_mutex_t *mutex, struct lock_site *site);
+
+/**
+ * @brief Registra una adquisicion en un sitio, para candados que no son un
+ * pthread_mutex_t (como el del indice de versions.db)
+ * @param site sitio de la llamada
+ * @param contended 1 si hubo que esperar
+ * @param waitNs espera en nanosegundos, si contended
+ */
+void lock_profile_record_acquire(struct lock_site *site, int contended, unsigned long long waitNs);
+
+/**
+ * @brief Registra en un sitio el tiempo que se tuvo el candado
+ * @param site sitio donde se tomo
+ * @param holdNs tiempo con el candado tomado en nanosegundos
+ */
+void lock_profile_record_hold(struct lock_site *site, unsigned long long holdNs);
+
+/**
+ * @brief Suelta un mutex tomado con profiled_lock y registra el tiempo que se tuvo
+ * @param mutex mutex
+ */
+void profiled_unlock(pthread_mutex_t *mutex);
+
+/**
+ * @brief pthread_cond_wait de un mutex tomado con profiled_lock: el tiempo
+ * esperando la condicion no cuenta como tiempo con el mutex, y al volver se
+ * cuenta una adquisicion nueva en el mismo sitio
+ * @param cond condicion
+ * @param mutex mutex tomado
+ */
+void profiled_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+
+/**
+ * @brief Primer sitio registrado; los demas siguen por next
+ * @return sitio, NULL si aun no se ha tomado ningun mutex con perfil
+ */
+struct lock_site *lock_profile_sites();
+
+/**
+ * @brief Escribe una linea con las adquisiciones y la espera o el tiempo tomado de un sitio
+ * @param line donde dejar el texto (STATS_LINE_SIZE)
+ * @param name nombre de la linea
+ * @param acquisitions adquisiciones
+ * @param contended adquisiciones con contencion
+ * @param histogram espera o tiempo con el mutex (nanosegundos)
+ */
+void lock_profile_format(char *line, const char *name, unsigned long acquisitions, unsigned long contended,
+        const struct stats_histogram *histogram);
+
+#endif
@@ -0,0 +1,396 @@
+/**
+ * @file
+ * @brief Bitacora asincrona del servidor: los hilos dejan registros en un anillo
+ * propio sin bloquearse ni hacer llamadas al sistema, y un hilo de fondo les da
+ * formato y los escribe
+ * @copyright MIT License
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define LOG_OUTPUT_SIZE 65536   /**< Buffer de salida del hilo de fondo */
+#define LOG_LINE_MAX 4096       /**< Longitud maxima de una linea */
+#define LOG_IDLE_NS 1000000     /**< Espera del hilo de fondo cuando no hay registros */
+#define LOG_REPORT_SECONDS 1    /**< Cada cuanto se informan los registros perdidos */
+
+static const char *levelNames[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+static const char *levelOptions[] = { "debug", "info", "warn", "error" };
+
+static int minimumLevel = LOG_LEVEL_INFO;             /**< Nivel minimo registrado */
+static int outputFd = STDOUT_FILENO;                  /**< Destino de la bitacora */
+static atomic_int running = 0;                        /**< El hilo de fondo esta activo */
+static atomic_int stopping = 0;                       /**< El hilo de fondo debe terminar */
+static pthread_t writer;                              /**< Hilo de fondo */
+static _Atomic(struct log_ring *) rings = NULL;       /**< Anillos de todos los hilos */
+static pthread_mutex_t ringsMutex = PTHREAD_MUTEX_INITIALIZER; /**< Protege el alta de anillos */
+static atomic_ulong written = 0;                      /**< Registros escritos */
+static __thread struct log_ring *threadRing = NULL;   /**< Anillo del hilo actual */
+
+/**
+ * @brief Crea y registra el anillo del hilo actual (solo la primera vez)
+ */
+static struct log_ring *ring_of_thread(void) {
+    if (threadRing != NULL)
+        return threadRing;
+    struct log_ring *ring = calloc(1, sizeof(struct log_ring));
+    if (ring == NULL)
+        return NULL;
+    pthread_mutex_lock(&ringsMutex);
+    ring->next = atomic_load(&rings);
+    atomic_store_explicit(&rings, ring, memory_order_release);
+    pthread_mutex_unlock(&ringsMutex);
+    threadRing = ring;
+    return ring;
+}
+
+/**
+ * @brief Salta banderas, ancho, precision y modificadores de una conversion
+ * @param p primer caracter despues de '%'
+ * @param stars cuantos '*' tiene (cada uno consume un int)
+ * @param length 'l' por cada l, 'z', 'j', 't', 'h' o 'L' (el ultimo que aparezca)
+ * @param longs cuantas 'l' tiene
+ * @return caracter de conversion
+ */
+static const char *parse_spec(const char *p, int *stars, char *length, int *longs) {
+    *stars = 0;
+    *length = 0;
+    *longs = 0;
+    while (*p != '\0' && strchr("-+ #0'", *p) != NULL)
+        p++;
+    if (*p == '*') {
+        (*stars)++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9')
+        p++;
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            (*stars)++;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+    while (*p != '\0' && strchr("hlzjtL", *p) != NULL) {
+        if (*p == 'l')
+            (*longs)++;
+        *length = *p;
+        p++;
+    }
+    return p;
+}
+
+/**
+ * @brief Copia los argumentos de un registro segun su formato
+ */
+static void capture_args(struct log_record *record, const char *format, va_list ap) {
+    int count = 0;
+    size_t used = 0;
+    for (const char *p = format; *p != '\0'; p++) {
+        if (*p != '%')
+            continue;
+        if (*++p == '%')
+            continue;
+        int stars, longs;
+        char length;
+        p = parse_spec(p, &stars, &length, &longs);
+        for (int i = 0; i < stars; i++) {
+            int value = va_arg(ap, int);
+            if (count < LOG_MAX_ARGS)
+                record->args[count++] = value;
+        }
+
+        long long value = 0;
+        switch (*p) {
+        case 'd': case 'i':
+            value = longs >= 2 ? va_arg(ap, long long) : (longs == 1 || length == 'z' || length == 'j' || length == 't')
+                    ? va_arg(ap, long) : va_arg(ap, int);
+            break;
+        case 'u': case 'x': case 'X': case 'o': case 'c':
+            value = longs >= 2 ? (long long)va_arg(ap, unsigned long long) : (longs == 1 || length == 'z' || length == 'j' || length == 't')
+                    ? (long long)va_arg(ap, unsigned long) : (long long)va_arg(ap, unsigned int);
+            break;
+        case 'p':
+            value = (long long)(uintptr_t)va_arg(ap, void *);
+            break;
+        case 'f': case 'F': case 'g': case 'G': case 'e': case 'E': {
+            double real = length == 'L' ? (double)va_arg(ap, long double) : va_arg(ap, double);
+            memcpy(&value, &real, sizeof(double));
+            break;
+        }
+        case 's': {
+            //Las cadenas se copian: el hilo de fondo las lee mas tarde
+            const char *string = va_arg(ap, const char *);
+            if (string == NULL)
+                string = "(null)";
+            if (used < LOG_STRINGS_SIZE) {
+                size_t size = strnlen(string, LOG_STRINGS_SIZE - used - 1);
+                memcpy(record->strings + used, string, size);
+                record->strings[used + size] = '\0';
+                used += size + 1;
+            }
+            continue;
+        }
+        default:
+            //%m y conversiones desconocidas no consumen argumentos
+            if (*p == '\0')
+                return;
+            continue;
+        }
+        if (count < LOG_MAX_ARGS)
+            record->args[count++] = value;
+    }
+}
+
+void log_write(log_level level, const char *format, ...) {
+    if ((int)level < minimumLevel)
+        return;
+    int error = errno;
+    va_list ap;
+    va_start(ap, format);
+    struct log_ring *ring = atomic_load_explicit(&running, memory_order_acquire) ? ring_of_thread() : NULL;
+    if (ring == NULL) {
+        //Antes de arrancar (o despues de detener) la bitacora se escribe directamente
+        vprintf(format, ap);
+        va_end(ap);
+        errno = error;
+        return;
+    }
+
+    unsigned long tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned long used = tail - atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (used >= LOG_RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+    } else if (used >= LOG_RING_SIZE * 3 / 4 && level < LOG_LEVEL_WARN && ring->pressure++ % LOG_SAMPLE_RATE != 0) {
+        //Bajo presion se muestrean los niveles bajos para dejar lugar a los errores
+        atomic_fetch_add_explicit(&ring->sampled, 1, memory_order_relaxed);
+    } else {
+        struct log_record *record = &ring->records[tail & (LOG_RING_SIZE - 1)];
+        record->format = format;
+        record->level = level;
+        record->error = error;
+        clock_gettime(CLOCK_REALTIME, &record->time);
+        capture_args(record, format, ap);
+        atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    }
+    va_end(ap);
+    errno = error;
+}
+
+/**
+ * @brief Da formato a un registro
+ * @return longitud de la linea (termina en '\n')
+ */
+static size_t format_record(struct log_record *record, char *line) {
+    struct tm tm;
+    localtime_r(&record->time.tv_sec, &tm);
+    size_t size = strftime(line, LOG_LINE_MAX, "%Y-%m-%d %H:%M:%S", &tm);
+    size += snprintf(line + size, LOG_LINE_MAX - size, ".%03ld %s ", record->time.tv_nsec / 1000000, levelNames[record->level]);
+
+    int count = 0;
+    const char *strings = record->strings;
+    for (const char *p = record->format; *p != '\0' && size < LOG_LINE_MAX - 1; p++) {
+        if (*p != '%' || p[1] == '%') {
+            line[size++] = *p;
+            if (*p == '%')
+                p++;
+            continue;
+        }
+        //Se rearma la conversion cambiando los '*' por sus valores capturados
+        const char *start = p;
+        int stars, longs;
+        char length;
+        p = parse_spec(p + 1, &stars, &length, &longs);
+        if (*p == '\0')
+            break;
+        char spec[64];
+        size_t specSize = 0;
+        for (const char *q = start; q <= p && specSize < sizeof(spec) - 16; q++) {
+            if (*q == '*')
+                specSize += snprintf(spec + specSize, sizeof(spec) - specSize, "%lld", count < LOG_MAX_ARGS ? record->args[count++] : 0);
+            else if (strchr("hlzjtL", *q) == NULL)
+                spec[specSize++] = *q;
+        }
+        spec[specSize] = '\0';
+
+        size_t room = LOG_LINE_MAX - size;
+        int n = 0;
+        char errorText[128];
+        switch (*p) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c': case 'p': {
+            //Los enteros se imprimen como long long con la misma conversion
+            long long value = count < LOG_MAX_ARGS ? record->args[count++] : 0;
+            if (*p == 'p') {
+                n = snprintf(line + size, room, "%p", (void *)(uintptr_t)value);
+            } else if (*p == 'c') {
+                n = snprintf(line + size, room, spec, (int)value);
+            } else {
+                char wide[80];
+                specSize = strlen(spec);
+                memmove(wide, spec, specSize - 1);
+                snprintf(wide + specSize - 1, sizeof(wide) - specSize + 1, "ll%c", *p);
+                n = snprintf(line + size, room, wide, value);
+            }
+            break;
+        }
+        case 'f': case 'F': case 'g': case 'G': case 'e': case 'E': {
+            double real = 0;
+            if (count < LOG_MAX_ARGS)
+                memcpy(&real, &record->args[count++], sizeof(double));
+            n = snprintf(line + size, room, spec, real);
+            break;
+        }
+        case 's':
+            n = snprintf(line + size, room, spec, strings);
+            strings += strlen(strings) + 1;
+            if (strings >= record->strings + LOG_STRINGS_SIZE)
+                strings = "";
+            break;
+        case 'm':
+            n = snprintf(line + size, room, "%s", strerror_r(record->error, errorText, sizeof(errorText)));
+            break;
+        default:
+            n = snprintf(line + size, room, "%s", spec);
+            break;
+        }
+        if (n > 0)
+            size += (size_t)n < room ? (size_t)n : room - 1;
+    }
+    if (size > LOG_LINE_MAX - 1)
+        size = LOG_LINE_MAX - 1;
+    if (size == 0 || line[size - 1] != '\n')
+        line[size++] = '\n';
+    return size;
+}
+
+/**
+ * @brief Escribe todo el buffer de salida
+ */
+static void flush_output(char *output, size_t *size) {
+    size_t done = 0;
+    while (done < *size) {
+        ssize_t n = write(outputFd, output + done, *size - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    *size = 0;
+}
+
+/**
+ * @brief Hilo de fondo: vacia los anillos, da formato y escribe por bloques
+ */
+static void *log_writer(void *args) {
+    char *output = malloc(LOG_OUTPUT_SIZE);
+    char *line = malloc(LOG_LINE_MAX);
+    size_t size = 0;
+    unsigned long reportedLost = 0;
+    time_t lastReport = time(NULL);
+
+    while (1) {
+        int stop = atomic_load_explicit(&stopping, memory_order_acquire);
+        int drained = 0;
+        //Mezcla por tiempo: cada vez se toma el registro mas antiguo de todos los
+        //anillos, para que las lineas de hilos distintos salgan en orden
+        while (1) {
+            struct log_ring *oldest = NULL;
+            struct log_record *record = NULL;
+            for (struct log_ring *ring = atomic_load_explicit(&rings, memory_order_acquire); ring != NULL; ring = ring->next) {
+                unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+                if (head == atomic_load_explicit(&ring->tail, memory_order_acquire))
+                    continue;
+                struct log_record *candidate = &ring->records[head & (LOG_RING_SIZE - 1)];
+                if (record == NULL || candidate->time.tv_sec < record->time.tv_sec
+                        || (candidate->time.tv_sec == record->time.tv_sec && candidate->time.tv_nsec < record->time.tv_nsec)) {
+                    oldest = ring;
+                    record = candidate;
+                }
+            }
+            if (oldest == NULL)
+                break;
+            size_t length = format_record(record, line);
+            atomic_fetch_add_explicit(&oldest->head, 1, memory_order_release);
+            if (size + length > LOG_OUTPUT_SIZE)
+                flush_output(output, &size);
+            memcpy(output + size, line, length);
+            size += length;
+            drained++;
+        }
+        atomic_fetch_add_explicit(&written, drained, memory_order_relaxed);
+
+        //Informamos los registros perdidos, sin pasar por los anillos
+        time_t now = time(NULL);
+        if (now - lastReport >= LOG_REPORT_SECONDS || stop) {
+            struct log_stats stats;
+            log_get_stats(&stats);
+            if (stats.sampled + stats.dropped > reportedLost) {
+                int n = snprintf(line, LOG_LINE_MAX, "log: %lu records sampled out and %lu dropped under pressure\n", stats.sampled, stats.dropped);
+                if (size + n > LOG_OUTPUT_SIZE)
+                    flush_output(output, &size);
+                memcpy(output + size, line, n);
+                size += n;
+                reportedLost = stats.sampled + stats.dropped;
+            }
+            lastReport = now;
+        }
+
+        if (drained == 0) {
+            flush_output(output, &size);
+            if (stop)
+                break;
+            struct timespec idle = { 0, LOG_IDLE_NS };
+            nanosleep(&idle, NULL);
+        }
+    }
+    free(output);
+    free(line);
+    return NULL;
+}
+
+int log_start(log_level minLevel, int fd) {
+    minimumLevel = minLevel;
+    outputFd = fd;
+    atomic_store(&stopping, 0);
+    if (pthread_create(&writer, NULL, log_writer, NULL) != 0)
+        return -1;
+    atomic_store_explicit(&running, 1, memory_order_release);
+    return 0;
+}
+
+void log_stop(void) {
+    if (!atomic_exchange(&running, 0))
+        return;
+    atomic_store_explicit(&stopping, 1, memory_order_release);
+    pthread_join(writer, NULL);
+}
+
+void log_get_stats(struct log_stats *stats) {
+    stats->written = atomic_load(&written);
+    stats->sampled = 0;
+    stats->dropped = 0;
+    for (struct log_ring *ring = atomic_load_explicit(&rings, memory_order_acquire); ring != NULL; ring = ring->next) {
+        stats->sampled += atomic_load_explicit(&ring->sampled, memory_order_relaxed);
+        stats->dropped += atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+    }
+}
+
+int log_parse_level(const char *name) {
+    for (int level = LOG_LEVEL_DEBUG; level <= LOG_LEVEL_ERROR; level++) {
+        if (strcasecmp(name, levelOptions[level]) == 0)
+            return level;
+    }
+    return -1;
+}
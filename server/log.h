@@ -0,0 +1,99 @@
+/**
+ * @file
+ * @brief Bitacora asincrona del servidor: los hilos dejan registros en un anillo
+ * propio sin bloquearse ni hacer llamadas al sistema, y un hilo de fondo les da
+ * formato y los escribe
+ * @copyright MIT License
+ */
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdatomic.h>
+#include <time.h>
+
+#define LOG_RING_SIZE 1024     /**< Registros por anillo (potencia de 2) */
+#define LOG_MAX_ARGS 8         /**< Argumentos numericos por registro */
+#define LOG_STRINGS_SIZE 192   /**< Espacio para copiar los argumentos %s de un registro */
+#define LOG_SAMPLE_RATE 8      /**< Bajo presion se guarda 1 de cada LOG_SAMPLE_RATE registros DEBUG/INFO */
+
+/**
+ * @brief Niveles de la bitacora
+ */
+typedef enum {
+    LOG_LEVEL_DEBUG, /**< Detalle para depurar */
+    LOG_LEVEL_INFO,  /**< Solicitudes y eventos normales */
+    LOG_LEVEL_WARN,  /**< Situaciones anormales que el servidor maneja */
+    LOG_LEVEL_ERROR, /**< Errores */
+} log_level;
+
+/**
+ * @brief Registro sin formato: el formato se aplica en el hilo de fondo
+ */
+struct log_record {
+    const char *format;             /**< Formato tipo printf (debe ser una constante) */
+    int level;                      /**< log_level del registro */
+    int error;                      /**< errno al crear el registro, para %m */
+    struct timespec time;           /**< Momento del registro */
+    long long args[LOG_MAX_ARGS];   /**< Argumentos numericos (los double se copian bit a bit) */
+    char strings[LOG_STRINGS_SIZE]; /**< Argumentos %s copiados uno tras otro */
+};
+
+/**
+ * @brief Anillo de un solo productor (el hilo duenio) y un solo consumidor (el hilo de fondo)
+ */
+struct log_ring {
+    struct log_record records[LOG_RING_SIZE]; /**< Registros */
+    atomic_ulong head;                        /**< Siguiente registro a leer (consumidor) */
+    atomic_ulong tail;                        /**< Siguiente registro a escribir (productor) */
+    atomic_ulong sampled;                     /**< Registros descartados por muestreo */
+    atomic_ulong dropped;                     /**< Registros perdidos con el anillo lleno */
+    unsigned long pressure;                   /**< Registros vistos bajo presion, para el muestreo */
+    struct log_ring *next;                    /**< Siguiente anillo registrado */
+};
+
+/**
+ * @brief Contadores de la bitacora
+ */
+struct log_stats {
+    unsigned long written; /**< Registros escritos */
+    unsigned long sampled; /**< Registros descartados por muestreo */
+    unsigned long dropped; /**< Registros perdidos con el anillo lleno */
+};
+
+/**
+ * @brief Arranca el hilo de fondo
+ * @param minLevel nivel minimo que se registra
+ * @param fd descriptor donde se escribe la bitacora
+ * @return 0 si arranco, -1 si hubo error
+ */
+int log_start(log_level minLevel, int fd);
+
+/**
+ * @brief Deja un registro en el anillo del hilo actual. Solo copia los
+ * argumentos; soporta %d %i %u %x %c %s %p %f %g %m con sus modificadores.
+ * Sin log_start escribe directamente con printf
+ * @param level nivel del registro
+ * @param format formato tipo printf, debe ser una cadena constante
+ */
+void log_write(log_level level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief Escribe los registros pendientes y detiene el hilo de fondo
+ */
+void log_stop(void);
+
+/**
+ * @brief Lee los contadores de la bitacora
+ * @param stats contadores
+ */
+void log_get_stats(struct log_stats *stats);
+
+/**
+ * @brief Convierte un nombre de nivel (debug, info, warn, error)
+ * @param name nombre del nivel
+ * @return nivel, -1 si el nombre no es valido
+ */
+int log_parse_level(const char *name);
+
+#endif
@@ -0,0 +1,150 @@
+/**
+ * @file
+ * @brief Contadores e histogramas de latencia del servidor
+ * @copyright MIT License
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+/**
+ * @brief Contadores de un grupo de hilos, alineados para no compartir lineas de cache
+ */
+struct stats_shard {
+    struct stats_operation operations[STATS_OPERATIONS]; /**< Por tipo de solicitud */
+    struct stats_histogram lockWait[STATS_LOCKS];        /**< Espera por los bloqueos del indice */
+    struct stats_histogram lockHold[STATS_LOCKS];        /**< Tiempo con los bloqueos del indice */
+} __attribute__((aligned(64)));
+
+static struct stats_shard shards[STATS_SHARDS];
+static int nextShard = 0;
+static __thread struct stats_shard *threadShard = NULL;
+
+/**
+ * @brief Fragmento del hilo actual: cada hilo toma uno la primera vez
+ */
+static struct stats_shard *current_shard() {
+    if (threadShard == NULL)
+        threadShard = &shards[__atomic_fetch_add(&nextShard, 1, __ATOMIC_RELAXED) % STATS_SHARDS];
+    return threadShard;
+}
+
+/**
+ * @brief Cubeta de un valor: lineal hasta 2^STATS_SUB_BITS, despues la potencia
+ * de dos y los STATS_SUB_BITS bits siguientes al mas alto
+ */
+static int bucket_of(unsigned long long value) {
+    if (value >> (STATS_MAX_EXPONENT + 1))
+        value = (1ULL << (STATS_MAX_EXPONENT + 1)) - 1;
+    if (value < (1ULL << STATS_SUB_BITS))
+        return (int)value;
+    int exponent = 63 - __builtin_clzll(value);
+    return ((exponent - STATS_SUB_BITS + 1) << STATS_SUB_BITS)
+            + (int)((value >> (exponent - STATS_SUB_BITS)) - (1ULL << STATS_SUB_BITS));
+}
+
+/**
+ * @brief Menor valor de una cubeta
+ */
+static unsigned long long bucket_start(int bucket) {
+    int group = bucket >> STATS_SUB_BITS;
+    if (group == 0)
+        return bucket;
+    unsigned long long sub = (1ULL << STATS_SUB_BITS) + (bucket & ((1 << STATS_SUB_BITS) - 1));
+    return sub << (group - 1);
+}
+
+/**
+ * @brief Agrega una muestra; relaxed basta, solo se suman
+ */
+void stats_histogram_record(struct stats_histogram *histogram, unsigned long long value) {
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->buckets[bucket_of(value)], 1, __ATOMIC_RELAXED);
+    unsigned long long max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    while (value > max && !__atomic_compare_exchange_n(&histogram->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void stats_histogram_add(struct stats_histogram *total, const struct stats_histogram *histogram) {
+    total->count += __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+    total->sum += __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED);
+    unsigned long long max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    if (max > total->max)
+        total->max = max;
+    for (int i = 0; i < STATS_BUCKETS; i++)
+        total->buckets[i] += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+}
+
+unsigned long long stats_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void stats_record_request(type_request request, unsigned long long micros, int error,
+        unsigned long long bytesIn, unsigned long long bytesOut) {
+    if ((unsigned)request >= STATS_OPERATIONS)
+        return;
+    struct stats_operation *operation = &current_shard()->operations[request];
+    stats_histogram_record(&operation->latency, micros);
+    if (error)
+        __atomic_fetch_add(&operation->errors, 1, __ATOMIC_RELAXED);
+    if (bytesIn > 0)
+        __atomic_fetch_add(&operation->bytesIn, bytesIn, __ATOMIC_RELAXED);
+    if (bytesOut > 0)
+        __atomic_fetch_add(&operation->bytesOut, bytesOut, __ATOMIC_RELAXED);
+}
+
+void stats_record_lock_wait(enum stats_lock lock, unsigned long long nanos) {
+    stats_histogram_record(&current_shard()->lockWait[lock], nanos / 1000);
+}
+
+void stats_record_lock_hold(enum stats_lock lock, unsigned long long nanos) {
+    stats_histogram_record(&current_shard()->lockHold[lock], nanos / 1000);
+}
+
+void stats_snapshot(struct stats_snapshot *snapshot) {
+    memset(snapshot, 0, sizeof(struct stats_snapshot));
+    for (int s = 0; s < STATS_SHARDS; s++) {
+        struct stats_shard *shard = &shards[s];
+        for (int i = 0; i < STATS_OPERATIONS; i++) {
+            struct stats_operation *total = &snapshot->operations[i];
+            total->errors += __atomic_load_n(&shard->operations[i].errors, __ATOMIC_RELAXED);
+            total->bytesIn += __atomic_load_n(&shard->operations[i].bytesIn, __ATOMIC_RELAXED);
+            total->bytesOut += __atomic_load_n(&shard->operations[i].bytesOut, __ATOMIC_RELAXED);
+            stats_histogram_add(&total->latency, &shard->operations[i].latency);
+        }
+        for (int i = 0; i < STATS_LOCKS; i++) {
+            stats_histogram_add(&snapshot->lockWait[i], &shard->lockWait[i]);
+            stats_histogram_add(&snapshot->lockHold[i], &shard->lockHold[i]);
+        }
+    }
+}
+
+unsigned long long stats_percentile(const struct stats_histogram *histogram, double percentile) {
+    if (histogram->count == 0)
+        return 0;
+    unsigned long rank = (unsigned long)(histogram->count * percentile / 100.0);
+    if (rank >= histogram->count)
+        rank = histogram->count - 1;
+    unsigned long seen = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen > rank) {
+            //El limite de la cubeta nunca pasa de la mayor muestra vista
+            unsigned long long end = i + 1 < STATS_BUCKETS ? bucket_start(i + 1) - 1 : histogram->max;
+            return end < histogram->max ? end : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+void stats_format_histogram(char *line, const char *name, const struct stats_histogram *histogram) {
+    snprintf(line, STATS_LINE_SIZE, "%s count=%lu mean_us=%.1f p50_us=%llu p95_us=%llu p99_us=%llu p999_us=%llu max_us=%llu",
+            name, histogram->count, histogram->count > 0 ? (double)histogram->sum / histogram->count : 0.0,
+            stats_percentile(histogram, 50), stats_percentile(histogram, 95), stats_percentile(histogram, 99),
+            stats_percentile(histogram, 99.9), histogram->max);
+}
@@ -0,0 +1,128 @@
+/**
+ * @file
+ * @brief Contadores e histogramas de latencia del servidor. Cada hilo suma en
+ * su propio fragmento (sin compartir lineas de cache con los demas) y la
+ * solicitud STATS junta los fragmentos al pedir el reporte
+ * @copyright MIT License
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include "../common/protocol.h"
+
+#define STATS_SHARDS 64                /**< Fragmentos: los hilos se reparten entre ellos */
+#define STATS_SUB_BITS 3               /**< 8 cubetas por potencia de dos (error maximo 12.5%) */
+#define STATS_MAX_EXPONENT 40          /**< Mayor potencia de dos medida (en microsegundos, ~25 dias) */
+#define STATS_BUCKETS ((STATS_MAX_EXPONENT - STATS_SUB_BITS + 2) << STATS_SUB_BITS) /**< Cubetas de un histograma */
+#define STATS_OPERATIONS (TRACE + 1)   /**< Tipos de solicitud que se miden (indice: type_request) */
+#define STATS_LINE_SIZE 256            /**< Tamanio maximo de una linea del reporte */
+
+/**
+ * @brief Histograma con cubetas logaritmicas subdivididas (como HDR): el
+ * error relativo es el mismo para microsegundos que para minutos
+ */
+struct stats_histogram {
+    unsigned long count;                   /**< Muestras */
+    unsigned long long sum;                /**< Suma de las muestras (microsegundos) */
+    unsigned long long max;                /**< Mayor muestra */
+    unsigned long buckets[STATS_BUCKETS];  /**< Muestras por cubeta */
+};
+
+/**
+ * @brief Contadores de un tipo de solicitud
+ */
+struct stats_operation {
+    unsigned long errors;           /**< Solicitudes que terminaron en error o por un plazo vencido */
+    unsigned long long bytesIn;     /**< Bytes de archivos recibidos */
+    unsigned long long bytesOut;    /**< Bytes de archivos enviados */
+    struct stats_histogram latency; /**< Duracion de la solicitud */
+};
+
+/**
+ * @brief Bloqueos del indice de versions.db que se miden
+ */
+enum stats_lock {
+    STATS_LOCK_READ,  /**< Bloqueo compartido (consultas) */
+    STATS_LOCK_WRITE, /**< Bloqueo exclusivo (agregar al .db) */
+    STATS_LOCKS,      /**< Numero de bloqueos */
+};
+
+/**
+ * @brief Contadores juntados de todos los fragmentos
+ */
+struct stats_snapshot {
+    struct stats_operation operations[STATS_OPERATIONS]; /**< Por tipo de solicitud */
+    struct stats_histogram lockWait[STATS_LOCKS];        /**< Espera para tomar el bloqueo del indice */
+    struct stats_histogram lockHold[STATS_LOCKS];        /**< Tiempo con el bloqueo tomado */
+};
+
+/**
+ * @brief Registra una solicitud atendida
+ * @param request tipo de solicitud
+ * @param micros duracion en microsegundos
+ * @param error 1 si fallo
+ * @param bytesIn bytes de archivos recibidos
+ * @param bytesOut bytes de archivos enviados
+ */
+void stats_record_request(type_request request, unsigned long long micros, int error,
+        unsigned long long bytesIn, unsigned long long bytesOut);
+
+/**
+ * @brief Registra una espera para tomar un bloqueo del indice
+ * @param lock bloqueo
+ * @param nanos nanosegundos de espera
+ */
+void stats_record_lock_wait(enum stats_lock lock, unsigned long long nanos);
+
+/**
+ * @brief Registra el tiempo que se tuvo un bloqueo del indice
+ * @param lock bloqueo
+ * @param nanos nanosegundos con el bloqueo
+ */
+void stats_record_lock_hold(enum stats_lock lock, unsigned long long nanos);
+
+/**
+ * @brief Agrega una muestra a un histograma; se puede llamar desde varios hilos a la vez
+ * @param histogram histograma
+ * @param value muestra, en la unidad del histograma
+ */
+void stats_histogram_record(struct stats_histogram *histogram, unsigned long long value);
+
+/**
+ * @brief Suma un histograma a otro
+ * @param total histograma donde se suma (no se lee atomicamente)
+ * @param histogram histograma a sumar, puede estar cambiando
+ */
+void stats_histogram_add(struct stats_histogram *total, const struct stats_histogram *histogram);
+
+/**
+ * @brief Suma los fragmentos de todos los hilos. Los contadores se leen sin
+ * detener a los hilos: cada uno es exacto, el conjunto es aproximado
+ * @param snapshot donde dejar la suma
+ */
+void stats_snapshot(struct stats_snapshot *snapshot);
+
+/**
+ * @brief Valor de un percentil
+ * @param histogram histograma
+ * @param percentile percentil entre 0 y 100
+ * @return limite superior de la cubeta del percentil, 0 si no hay muestras
+ */
+unsigned long long stats_percentile(const struct stats_histogram *histogram, double percentile);
+
+/**
+ * @brief Escribe una linea con las muestras, el promedio y los percentiles de un histograma
+ * @param line donde dejar el texto (STATS_LINE_SIZE)
+ * @param name nombre del histograma
+ * @param histogram histograma
+ */
+void stats_format_histogram(char *line, const char *name, const struct stats_histogram *histogram);
+
+/**
+ * @brief Reloj monotonico de las medidas
+ * @return nanosegundos
+ */
+unsigned long long stats_now_ns();
+
+#endif
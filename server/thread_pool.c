@@ -0,0 +1,298 @@
+/**
+ * @file
+ * @brief Pool de hilos de tamanio fijo con robo de trabajo (work stealing)
+ * para atender las solicitudes de los clientes y sus subtareas
+ * @copyright MIT License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "thread_pool.h"
+#include "lock_profile.h"
+
+#define DEQUE_INITIAL_CAPACITY 64 /**< Capacidad inicial del deque de cada trabajador */
+
+static __thread struct thread_pool *currentPool = NULL; /**< Pool del hilo actual, NULL fuera del pool */
+static __thread int currentWorker = -1;                 /**< Indice del trabajador actual */
+
+/**
+ * @brief Argumento de arranque de cada trabajador
+ */
+struct thread_pool_start {
+    struct thread_pool *pool; /**< Pool del trabajador */
+    int index;                /**< Indice del trabajador */
+};
+
+/**
+ * @brief Empila un trabajo por abajo del deque, creciendo el arreglo si esta lleno
+ * @return 0 si se empilo, -1 si no hay memoria
+ */
+static int deque_push(struct thread_pool_deque *deque, struct thread_pool_task *task) {
+    profiled_lock(&deque->mutex, "thread_pool.deque");
+    if (deque->bottom - deque->top == deque->capacity) {
+        size_t capacity = deque->capacity * 2;
+        struct thread_pool_task **tasks = malloc(capacity * sizeof(struct thread_pool_task *));
+        if (tasks == NULL) {
+            profiled_unlock(&deque->mutex);
+            return -1;
+        }
+        for (size_t i = deque->top; i < deque->bottom; i++)
+            tasks[i & (capacity - 1)] = deque->tasks[i & (deque->capacity - 1)];
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+    }
+    deque->tasks[deque->bottom & (deque->capacity - 1)] = task;
+    deque->bottom++;
+    profiled_unlock(&deque->mutex);
+    return 0;
+}
+
+/**
+ * @brief Desempila por abajo (duenio) o roba por arriba (otros trabajadores)
+ * @return trabajo, NULL si el deque esta vacio
+ */
+static struct thread_pool_task *deque_take(struct thread_pool_deque *deque, int steal) {
+    struct thread_pool_task *task = NULL;
+    profiled_lock(&deque->mutex, "thread_pool.deque");
+    if (deque->bottom != deque->top) {
+        if (steal)
+            task = deque->tasks[deque->top++ & (deque->capacity - 1)];
+        else
+            task = deque->tasks[--deque->bottom & (deque->capacity - 1)];
+    }
+    profiled_unlock(&deque->mutex);
+    return task;
+}
+
+/**
+ * @brief Toma una subtarea: primero del deque propio y luego robando a los demas,
+ * empezando por el siguiente trabajador para repartir los robos
+ */
+static struct thread_pool_task *take_subtask(struct thread_pool *pool, int worker) {
+    struct thread_pool_task *task = NULL;
+    if (worker >= 0)
+        task = deque_take(&pool->deques[worker], 0);
+    for (int i = 1; task == NULL && i <= pool->countThreads; i++) {
+        int victim = (worker + i) % pool->countThreads;
+        if (victim != worker)
+            task = deque_take(&pool->deques[victim], 1);
+    }
+    if (task != NULL)
+        __atomic_fetch_sub(&pool->queued, 1, __ATOMIC_RELAXED);
+    return task;
+}
+
+/**
+ * @brief Ejecuta un trabajo y avisa a su grupo si era la ultima subtarea
+ */
+static void run_task(struct thread_pool_task *task) {
+    struct thread_pool_group *group = task->group;
+    task->function(task->arg);
+    free(task);
+    if (group == NULL)
+        return;
+    //Con el mutex tomado: thread_pool_wait lo toma antes de volver, asi el grupo
+    //no se destruye mientras este hilo aun lo usa
+    profiled_lock(&group->mutex, "thread_pool.group");
+    if (__atomic_sub_fetch(&group->pending, 1, __ATOMIC_ACQ_REL) == 0)
+        pthread_cond_broadcast(&group->done);
+    profiled_unlock(&group->mutex);
+}
+
+/**
+ * @brief Ciclo de cada hilo trabajador: subtareas propias, robadas y por ultimo
+ * solicitudes de la cola global, hasta que se detenga el pool
+ * @param args struct thread_pool_start
+ */
+static void *thread_pool_worker(void *args) {
+    struct thread_pool_start *start = (struct thread_pool_start *)args;
+    struct thread_pool *pool = start->pool;
+    currentPool = pool;
+    currentWorker = start->index;
+    free(start);
+
+    while (1) {
+        struct thread_pool_task *task = take_subtask(pool, currentWorker);
+        if (task != NULL) {
+            run_task(task);
+            continue;
+        }
+
+        //Se revisa queued con el mutex tomado: un spawn incrementa queued con el
+        //mutex tomado antes de senalar, asi que no se pierden despertares
+        profiled_lock(&pool->mutex, "thread_pool.queue");
+        if (pool->head != NULL) {
+            task = pool->head;
+            pool->head = task->next;
+            if (pool->head == NULL)
+                pool->tail = NULL;
+            __atomic_fetch_sub(&pool->queued, 1, __ATOMIC_RELAXED);
+        } else if (__atomic_load_n(&pool->queued, __ATOMIC_RELAXED) == 0) {
+            if (pool->stop) {
+                profiled_unlock(&pool->mutex);
+                break;
+            }
+            profiled_cond_wait(&pool->pending, &pool->mutex);
+        }
+        profiled_unlock(&pool->mutex);
+
+        if (task != NULL)
+            run_task(task);
+    }
+    return NULL;
+}
+
+struct thread_pool *thread_pool_create(int countThreads) {
+    struct thread_pool *pool = calloc(1, sizeof(struct thread_pool));
+    if (pool == NULL)
+        return NULL;
+    pool->threads = calloc(countThreads, sizeof(pthread_t));
+    pool->deques = calloc(countThreads, sizeof(struct thread_pool_deque));
+    if (pool->threads == NULL || pool->deques == NULL) {
+        free(pool->threads);
+        free(pool->deques);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->pending, NULL);
+
+    for (int i = 0; i < countThreads; i++) {
+        struct thread_pool_deque *deque = &pool->deques[i];
+        deque->capacity = DEQUE_INITIAL_CAPACITY;
+        deque->tasks = malloc(deque->capacity * sizeof(struct thread_pool_task *));
+        pthread_mutex_init(&deque->mutex, NULL);
+    }
+
+    //Los deques se crean todos antes de arrancar: los trabajadores roban de cualquiera
+    for (int i = 0; i < countThreads; i++) {
+        struct thread_pool_start *start = malloc(sizeof(struct thread_pool_start));
+        if (start == NULL || pool->deques[i].tasks == NULL) {
+            free(start);
+            break;
+        }
+        start->pool = pool;
+        start->index = i;
+        if (pthread_create(&pool->threads[i], NULL, thread_pool_worker, start) != 0) {
+            perror("Error creating the worker thread");
+            free(start);
+            break;
+        }
+        pool->countThreads++;
+    }
+    if (pool->countThreads == 0) {
+        for (int i = 0; i < countThreads; i++) {
+            free(pool->deques[i].tasks);
+            pthread_mutex_destroy(&pool->deques[i].mutex);
+        }
+        pthread_mutex_destroy(&pool->mutex);
+        pthread_cond_destroy(&pool->pending);
+        free(pool->deques);
+        free(pool->threads);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+int thread_pool_submit(struct thread_pool *pool, void (*function)(void *), void *arg) {
+    struct thread_pool_task *task = malloc(sizeof(struct thread_pool_task));
+    if (task == NULL)
+        return -1;
+    task->function = function;
+    task->arg = arg;
+    task->group = NULL;
+    task->next = NULL;
+
+    profiled_lock(&pool->mutex, "thread_pool.queue");
+    if (pool->tail == NULL)
+        pool->head = task;
+    else
+        pool->tail->next = task;
+    pool->tail = task;
+    __atomic_fetch_add(&pool->queued, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&pool->pending);
+    profiled_unlock(&pool->mutex);
+    return 0;
+}
+
+void thread_pool_group_init(struct thread_pool_group *group) {
+    group->pending = 0;
+    pthread_mutex_init(&group->mutex, NULL);
+    pthread_cond_init(&group->done, NULL);
+}
+
+void thread_pool_group_destroy(struct thread_pool_group *group) {
+    pthread_mutex_destroy(&group->mutex);
+    pthread_cond_destroy(&group->done);
+}
+
+void thread_pool_spawn(struct thread_pool *pool, struct thread_pool_group *group, void (*function)(void *), void *arg) {
+    struct thread_pool_task *task = NULL;
+    if (pool != NULL && pool == currentPool)
+        task = malloc(sizeof(struct thread_pool_task));
+    if (task == NULL) {
+        function(arg);
+        return;
+    }
+    task->function = function;
+    task->arg = arg;
+    task->group = group;
+    task->next = NULL;
+
+    __atomic_fetch_add(&group->pending, 1, __ATOMIC_ACQ_REL);
+    if (deque_push(&pool->deques[currentWorker], task) == -1) {
+        free(task);
+        __atomic_fetch_sub(&group->pending, 1, __ATOMIC_ACQ_REL);
+        function(arg);
+        return;
+    }
+
+    //Despertamos a un trabajador dormido para que la robe
+    profiled_lock(&pool->mutex, "thread_pool.queue");
+    __atomic_fetch_add(&pool->queued, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&pool->pending);
+    profiled_unlock(&pool->mutex);
+}
+
+void thread_pool_wait(struct thread_pool *pool, struct thread_pool_group *group) {
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0) {
+        //Solo subtareas: una solicitud de la cola global puede bloquear mucho tiempo
+        struct thread_pool_task *task = NULL;
+        if (pool != NULL && pool == currentPool)
+            task = take_subtask(pool, currentWorker);
+        if (task != NULL) {
+            run_task(task);
+            continue;
+        }
+        profiled_lock(&group->mutex, "thread_pool.group");
+        while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE) > 0)
+            profiled_cond_wait(&group->done, &group->mutex);
+        profiled_unlock(&group->mutex);
+    }
+    //La ultima subtarea pudo dejar pending en 0 y aun no soltar el mutex
+    profiled_lock(&group->mutex, "thread_pool.group");
+    profiled_unlock(&group->mutex);
+}
+
+void thread_pool_destroy(struct thread_pool *pool) {
+    profiled_lock(&pool->mutex, "thread_pool.queue");
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->pending);
+    profiled_unlock(&pool->mutex);
+
+    for (int i = 0; i < pool->countThreads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    for (int i = 0; i < pool->countThreads; i++) {
+        free(pool->deques[i].tasks);
+        pthread_mutex_destroy(&pool->deques[i].mutex);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->pending);
+    free(pool->deques);
+    free(pool->threads);
+    free(pool);
+}
@@ -0,0 +1,113 @@
+/**
+ * @file
+ * @brief Pool de hilos de tamanio fijo con robo de trabajo (work stealing)
+ * para atender las solicitudes de los clientes y sus subtareas
+ * @copyright MIT License
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+
+/**
+ * @brief Trabajo pendiente en el pool
+ */
+struct thread_pool_task {
+    void (*function)(void *);         /**< Funcion a ejecutar */
+    void *arg;                        /**< Argumento de la funcion */
+    struct thread_pool_group *group;  /**< Grupo al que pertenece (subtareas), NULL si no tiene */
+    struct thread_pool_task *next;    /**< Siguiente trabajo en la cola global */
+};
+
+/**
+ * @brief Deque de subtareas de un trabajador. El duenio empila y desempila por
+ * abajo (LIFO, datos calientes en cache), los demas roban por arriba (FIFO)
+ */
+struct thread_pool_deque {
+    struct thread_pool_task **tasks;  /**< Arreglo circular de trabajos */
+    size_t capacity;                  /**< Capacidad del arreglo (potencia de 2) */
+    size_t top;                       /**< Indice por donde roban los demas */
+    size_t bottom;                    /**< Indice por donde empila el duenio */
+    pthread_mutex_t mutex;            /**< Protege el deque */
+};
+
+/**
+ * @brief Grupo de subtareas que se esperan juntas
+ */
+struct thread_pool_group {
+    int pending;                      /**< Subtareas sin terminar */
+    pthread_mutex_t mutex;            /**< Protege la espera */
+    pthread_cond_t done;              /**< Se senala cuando pending llega a 0 */
+};
+
+/**
+ * @brief Pool de hilos: una cola global para las solicitudes que llegan del
+ * reactor y un deque por trabajador para las subtareas
+ */
+struct thread_pool {
+    pthread_t *threads;               /**< Hilos trabajadores */
+    struct thread_pool_deque *deques; /**< Deque de cada trabajador */
+    int countThreads;                 /**< Numero de hilos trabajadores */
+    struct thread_pool_task *head;    /**< Primera solicitud de la cola global */
+    struct thread_pool_task *tail;    /**< Ultima solicitud de la cola global */
+    int queued;                       /**< Trabajos encolados en total (global y deques) */
+    int stop;                         /**< Los trabajadores deben terminar */
+    pthread_mutex_t mutex;            /**< Protege la cola global y el sueno de los trabajadores */
+    pthread_cond_t pending;           /**< Se senala cuando hay trabajos encolados */
+};
+
+/**
+ * @brief Crea el pool y arranca sus hilos
+ * @param countThreads numero de hilos trabajadores
+ * @return pool creado, NULL si hubo error
+ */
+struct thread_pool *thread_pool_create(int countThreads);
+
+/**
+ * @brief Encola una solicitud en la cola global para que la ejecute algun hilo del pool
+ * @param pool pool de hilos
+ * @param function funcion a ejecutar
+ * @param arg argumento de la funcion
+ * @return 0 si se encolo, -1 si hubo error
+ */
+int thread_pool_submit(struct thread_pool *pool, void (*function)(void *), void *arg);
+
+/**
+ * @brief Inicializa un grupo de subtareas vacio
+ * @param group grupo a inicializar
+ */
+void thread_pool_group_init(struct thread_pool_group *group);
+
+/**
+ * @brief Libera los recursos de un grupo (sin subtareas pendientes)
+ * @param group grupo a destruir
+ */
+void thread_pool_group_destroy(struct thread_pool_group *group);
+
+/**
+ * @brief Crea una subtarea en el deque del trabajador actual, de donde la
+ * pueden robar los trabajadores desocupados. Fuera del pool (o sin memoria)
+ * la subtarea se ejecuta inmediatamente en el hilo que llama
+ * @param pool pool de hilos, puede ser NULL
+ * @param group grupo al que pertenece la subtarea
+ * @param function funcion a ejecutar
+ * @param arg argumento de la funcion
+ */
+void thread_pool_spawn(struct thread_pool *pool, struct thread_pool_group *group, void (*function)(void *), void *arg);
+
+/**
+ * @brief Espera a que terminen las subtareas de un grupo. Mientras espera
+ * ejecuta subtareas propias o robadas (nunca solicitudes de la cola global)
+ * @param pool pool de hilos, puede ser NULL
+ * @param group grupo a esperar
+ */
+void thread_pool_wait(struct thread_pool *pool, struct thread_pool_group *group);
+
+/**
+ * @brief Termina los hilos del pool (despues de vaciar las colas) y libera la memoria
+ * @param pool pool de hilos
+ */
+void thread_pool_destroy(struct thread_pool *pool);
+
+#endif
@@ -0,0 +1,137 @@
+/**
+ * @file
+ * @brief Rueda de temporizadores con resolucion de un segundo
+ * @copyright MIT License
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "timer_wheel.h"
+#include "lock_profile.h"
+
+long timer_wheel_now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+int timer_wheel_init(struct timer_wheel *wheel, int slots) {
+    int size = 1;
+    while (size < slots)
+        size *= 2;
+    memset(wheel, 0, sizeof(struct timer_wheel));
+    wheel->slots = malloc(size * sizeof(struct timer_node));
+    if (wheel->slots == NULL)
+        return -1;
+    for (int i = 0; i < size; i++)
+        wheel->slots[i].prev = wheel->slots[i].next = &wheel->slots[i];
+    wheel->mask = size - 1;
+    wheel->current = timer_wheel_now();
+    pthread_mutex_init(&wheel->mutex, NULL);
+    return 0;
+}
+
+/**
+ * @brief Desenlaza un nodo de su ranura, con la rueda bloqueada
+ */
+static void unlink_node(struct timer_wheel *wheel, struct timer_node *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->prev = node->next = NULL;
+    wheel->count--;
+}
+
+/**
+ * @brief Enlaza un nodo al final de su ranura, con la rueda bloqueada
+ */
+static void link_node(struct timer_wheel *wheel, struct timer_node *node, long deadline) {
+    struct timer_node *head = &wheel->slots[deadline & wheel->mask];
+    node->deadline = deadline;
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+    wheel->count++;
+}
+
+void timer_wheel_add(struct timer_wheel *wheel, struct timer_node *node, long deadline) {
+    profiled_lock(&wheel->mutex, "timer_wheel");
+    if (node->next != NULL)
+        unlink_node(wheel, node);
+    link_node(wheel, node, deadline);
+    profiled_unlock(&wheel->mutex);
+}
+
+void timer_wheel_remove(struct timer_wheel *wheel, struct timer_node *node) {
+    profiled_lock(&wheel->mutex, "timer_wheel");
+    if (node->next != NULL)
+        unlink_node(wheel, node);
+    profiled_unlock(&wheel->mutex);
+}
+
+int timer_wheel_advance(struct timer_wheel *wheel, long now, long (*check)(struct timer_node *, void *), void *arg,
+        struct timer_node **expired) {
+    int count = 0;
+    *expired = NULL;
+    profiled_lock(&wheel->mutex, "timer_wheel");
+    //Si pasaron mas segundos que ranuras basta una vuelta: cada ranura se revisa una vez
+    long first = wheel->current + 1;
+    if (now - first > wheel->mask)
+        first = now - wheel->mask;
+    for (long tick = first; tick <= now; tick++) {
+        struct timer_node *head = &wheel->slots[tick & wheel->mask];
+        if (head->next == head)
+            continue;
+        //Se separa la ranura antes de recorrerla: los reprogramados pueden volver a ella
+        struct timer_node *node = head->next;
+        head->prev->next = NULL;
+        head->prev = head->next = head;
+        while (node != NULL) {
+            struct timer_node *next = node->next;
+            wheel->count--;
+            long deadline = node->deadline <= now ? check(node, arg) : node->deadline;
+            if (deadline > now) {
+                link_node(wheel, node, deadline);
+            } else {
+                //Fuera de la rueda next es NULL: la lista de vencidos va por prev
+                node->next = NULL;
+                node->prev = *expired;
+                *expired = node;
+                count++;
+            }
+            node = next;
+        }
+    }
+    if (now > wheel->current)
+        wheel->current = now;
+    profiled_unlock(&wheel->mutex);
+    return count;
+}
+
+void timer_wheel_shorten(struct timer_wheel *wheel, long deadline) {
+    profiled_lock(&wheel->mutex, "timer_wheel");
+    //Se separa cada ranura como en advance y se vuelve a enlazar cada nodo
+    for (int slot = 0; slot <= wheel->mask; slot++) {
+        struct timer_node *head = &wheel->slots[slot];
+        if (head->next == head)
+            continue;
+        struct timer_node *node = head->next;
+        head->prev->next = NULL;
+        head->prev = head->next = head;
+        while (node != NULL) {
+            struct timer_node *next = node->next;
+            wheel->count--;
+            link_node(wheel, node, node->deadline > deadline ? deadline : node->deadline);
+            node = next;
+        }
+    }
+    profiled_unlock(&wheel->mutex);
+}
+
+void timer_wheel_destroy(struct timer_wheel *wheel) {
+    free(wheel->slots);
+    pthread_mutex_destroy(&wheel->mutex);
+    memset(wheel, 0, sizeof(struct timer_wheel));
+}
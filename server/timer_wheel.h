@@ -0,0 +1,94 @@
+/**
+ * @file
+ * @brief Rueda de temporizadores con resolucion de un segundo. Los nodos van
+ * dentro de la estructura que vencen, asi que agregar y quitar son O(1) y no
+ * piden memoria
+ * @copyright MIT License
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <pthread.h>
+
+/**
+ * @brief Nodo de un temporizador, embebido en el objeto que vence
+ */
+struct timer_node {
+    struct timer_node *prev; /**< Anterior en la ranura */
+    struct timer_node *next; /**< Siguiente en la ranura, NULL si no esta en la rueda */
+    long deadline;           /**< Segundo (monotonico) en que vence */
+};
+
+/**
+ * @brief Rueda: cada ranura es una lista circular de los nodos que vencen en
+ * un segundo congruente con ella. Un vencimiento mas lejano que una vuelta se
+ * revisa en cada vuelta y se vuelve a poner en su ranura
+ */
+struct timer_wheel {
+    struct timer_node *slots; /**< Cabeceras de las ranuras */
+    int mask;                 /**< Numero de ranuras - 1 (potencia de dos) */
+    long current;             /**< Ultimo segundo procesado */
+    int count;                /**< Nodos en la rueda */
+    pthread_mutex_t mutex;    /**< Protege la rueda */
+};
+
+/**
+ * @brief Segundos de un reloj monotonico, la unidad de la rueda
+ * @return segundo actual
+ */
+long timer_wheel_now();
+
+/**
+ * @brief Inicializa una rueda vacia
+ * @param wheel rueda a inicializar
+ * @param slots numero de ranuras (se redondea a potencia de dos)
+ * @return 0 si se inicializo, -1 si no hay memoria
+ */
+int timer_wheel_init(struct timer_wheel *wheel, int slots);
+
+/**
+ * @brief Agrega un nodo a la rueda (o lo mueve si ya estaba)
+ * @param wheel rueda
+ * @param node nodo a agregar
+ * @param deadline segundo en que vence
+ */
+void timer_wheel_add(struct timer_wheel *wheel, struct timer_node *node, long deadline);
+
+/**
+ * @brief Quita un nodo de la rueda; no hace nada si no estaba
+ * @param wheel rueda
+ * @param node nodo a quitar
+ */
+void timer_wheel_remove(struct timer_wheel *wheel, struct timer_node *node);
+
+/**
+ * @brief Avanza la rueda hasta now revisando las ranuras que pasaron. Por cada
+ * nodo vencido llama a check con la rueda bloqueada: si devuelve un segundo
+ * posterior a now el nodo se reprograma, si no sale de la rueda y se agrega a
+ * la lista expired (enlazada por prev) para que el llamador lo procese sin el bloqueo
+ * @param wheel rueda
+ * @param now segundo actual
+ * @param check decide el nuevo vencimiento de un nodo
+ * @param arg argumento adicional de check
+ * @param expired lista de los nodos vencidos
+ * @return numero de nodos vencidos
+ */
+int timer_wheel_advance(struct timer_wheel *wheel, long now, long (*check)(struct timer_node *, void *), void *arg,
+        struct timer_node **expired);
+
+/**
+ * @brief Adelanta a deadline todos los nodos que vencen despues, para que el
+ * siguiente advance que pase por deadline los revise
+ * @param wheel rueda
+ * @param deadline segundo maximo de vencimiento
+ */
+void timer_wheel_shorten(struct timer_wheel *wheel, long deadline);
+
+/**
+ * @brief Libera la rueda (no toca los nodos)
+ * @param wheel rueda
+ */
+void timer_wheel_destroy(struct timer_wheel *wheel);
+
+#endif
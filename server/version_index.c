@@ -0,0 +1,337 @@
+/**
+ * @file
+ * @brief Indice de versions.db en memoria compartida
+ * @copyright MIT License
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "version_index.h"
+#include "stats.h"
+#include "../common/trace.h"
+
+static __thread unsigned long long lockedAt = 0; /* Cuando el hilo tomo el bloqueo, para medir cuanto lo tiene*/
+static __thread enum stats_lock lockedKind;      /* Bloqueo que tiene el hilo*/
+static __thread unsigned long long lockedSpan = 0; /* Intervalo del bloqueo tomado, si la solicitud se traza*/
+static __thread struct lock_site *lockedSite = NULL; /* Sitio donde el hilo tomo el bloqueo*/
+static pid_t processId = 0;                       /* getpid() del proceso, se borra en el hijo de un fork*/
+static pthread_once_t processIdOnce = PTHREAD_ONCE_INIT;
+
+static void forget_process_id(void) {
+    processId = 0;
+}
+
+static void watch_forks(void) {
+    pthread_atfork(NULL, NULL, forget_process_id);
+}
+
+/**
+ * @brief Proceso actual sin una llamada al sistema por cada toma del candado
+ */
+static pid_t current_process(void) {
+    if (processId == 0)
+        processId = getpid();
+    return processId;
+}
+
+/**
+ * @brief FNV-1a de 64 bits del nombre y el cliente: los bits bajos eligen la
+ * cubeta y los altos son la clave que se guarda
+ */
+static unsigned long long index_hash(const char *filename, int idClient) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (const char *c = filename; *c; c++)
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ULL;
+    for (unsigned i = 0; i < sizeof(idClient); i++)
+        hash = (hash ^ ((unsigned)idClient >> (8 * i) & 0xff)) * 1099511628211ULL;
+    return hash;
+}
+
+/**
+ * @brief Bytes del indice con capacidad para capacity registros
+ */
+static size_t index_size(unsigned capacity) {
+    return sizeof(struct version_index) + (size_t)capacity * sizeof(struct version_index_record);
+}
+
+struct version_index *version_index_create(int shared, unsigned expected) {
+    unsigned capacity = VERSION_INDEX_MIN_RECORDS;
+    while (capacity < VERSION_INDEX_MAX_RECORDS && capacity < expected + expected / 2ULL)
+        capacity *= 2;
+
+    //Se reserva el espacio de direcciones maximo una sola vez: para crecer basta
+    //agrandar el memfd y ningun proceso tiene que volver a proyectarlo
+    int fd = memfd_create("version_index", MFD_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    struct version_index *index = MAP_FAILED;
+    if (ftruncate(fd, index_size(capacity)) == 0)
+        index = mmap(NULL, index_size(VERSION_INDEX_MAX_RECORDS), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_NORESERVE, fd, 0);
+    if (index == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    index->fd = fd;
+    index->capacity = capacity;
+
+    //Un rwlock no puede ser robusto: el candado es un mutex robusto con el
+    //estado de cada proceso, asi un proceso muerto no detiene a los demas
+    pthread_mutexattr_t mutexAttributes;
+    pthread_condattr_t condAttributes;
+    pthread_mutexattr_init(&mutexAttributes);
+    pthread_condattr_init(&condAttributes);
+    if (shared) {
+        pthread_mutexattr_setpshared(&mutexAttributes, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&mutexAttributes, PTHREAD_MUTEX_ROBUST);
+        pthread_condattr_setpshared(&condAttributes, PTHREAD_PROCESS_SHARED);
+    }
+    pthread_once(&processIdOnce, watch_forks);
+    pthread_mutex_init(&index->mutex, &mutexAttributes);
+    pthread_cond_init(&index->changed, &condAttributes);
+    pthread_mutexattr_destroy(&mutexAttributes);
+    pthread_condattr_destroy(&condAttributes);
+    return index;
+}
+
+/**
+ * @brief Toma el mutex del estado. Si su dueno murio con el tomado, el estado
+ * sigue siendo valido: cada cambio es un contador de su propio proceso, que el
+ * maestro libera con version_index_release_process
+ */
+static void state_lock(struct version_index *index) {
+    if (pthread_mutex_lock(&index->mutex) == EOWNERDEAD)
+        pthread_mutex_consistent(&index->mutex);
+}
+
+/**
+ * @brief Espera un cambio del candado con el mutex del estado tomado
+ */
+static void state_wait(struct version_index *index) {
+    index->sleepers++;
+    if (pthread_cond_wait(&index->changed, &index->mutex) == EOWNERDEAD)
+        pthread_mutex_consistent(&index->mutex);
+    index->sleepers--;
+}
+
+/**
+ * @brief Avisa a los que esperan y suelta el mutex del estado
+ */
+static void state_unlock(struct version_index *index, int changed) {
+    if (changed && index->sleepers > 0)
+        pthread_cond_broadcast(&index->changed);
+    pthread_mutex_unlock(&index->mutex);
+}
+
+/**
+ * @brief Entrada de un proceso en el candado, con el mutex del estado tomado
+ * @param create 1 para ocupar una entrada libre si el proceso no tiene
+ * @return entrada, NULL si no tiene (o no hay libres)
+ */
+static struct version_index_holder *holder_of(struct version_index *index, pid_t pid, int create) {
+    struct version_index_holder *free = NULL;
+    for (int i = 0; i < index->usedHolders; i++) {
+        if (index->holders[i].pid == pid)
+            return &index->holders[i];
+        if (free == NULL && index->holders[i].pid == 0)
+            free = &index->holders[i];
+    }
+    if (!create)
+        return NULL;
+    if (free == NULL && index->usedHolders < VERSION_INDEX_PROCESSES)
+        free = &index->holders[index->usedHolders++];
+    if (free != NULL)
+        *free = (struct version_index_holder){ .pid = pid };
+    return free;
+}
+
+/**
+ * @brief Devuelve la entrada de un proceso si ya no tiene ni espera el candado
+ */
+static void holder_release(struct version_index_holder *holder) {
+    if (holder->readers == 0 && holder->waiting == 0 && !holder->writing)
+        holder->pid = 0;
+}
+
+/**
+ * @brief Indica si hay que esperar el candado: a un escritor lo detienen el
+ * escritor y los lectores; a un lector, el escritor y los escritores en espera
+ */
+static int lock_busy(struct version_index *index, int writer) {
+    for (int i = 0; i < index->usedHolders; i++) {
+        struct version_index_holder *holder = &index->holders[i];
+        if (holder->pid != 0 && (holder->writing || (writer ? holder->readers > 0 : holder->waiting > 0)))
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Toma el candado de lectura
+ * @return 1 si tuvo que esperar, 0 si no
+ */
+static int lock_read(struct version_index *index) {
+    pid_t pid = current_process();
+    int waited = 0;
+    state_lock(index);
+    //Los get leen mucho tiempo: los lectores nuevos esperan a los escritores en espera
+    struct version_index_holder *holder;
+    while (lock_busy(index, 0) || (holder = holder_of(index, pid, 1)) == NULL) {
+        state_wait(index);
+        waited = 1;
+    }
+    holder->readers++;
+    state_unlock(index, 0);
+    return waited;
+}
+
+/**
+ * @brief Toma el candado de escritura
+ * @return 1 si tuvo que esperar, 0 si no
+ */
+static int lock_write(struct version_index *index) {
+    pid_t pid = current_process();
+    int waited = 0;
+    state_lock(index);
+    struct version_index_holder *holder;
+    while ((holder = holder_of(index, pid, 1)) == NULL) {
+        state_wait(index);
+        waited = 1;
+    }
+    holder->waiting++;
+    while (lock_busy(index, 1)) {
+        state_wait(index);
+        waited = 1;
+    }
+    holder->waiting--;
+    holder->writing = 1;
+    state_unlock(index, 0);
+    return waited;
+}
+
+/**
+ * @brief Suelta el candado de lectura o de escritura del hilo
+ */
+static void lock_release(struct version_index *index, enum stats_lock kind) {
+    state_lock(index);
+    struct version_index_holder *holder = holder_of(index, current_process(), 0);
+    if (holder != NULL) {
+        if (kind == STATS_LOCK_READ && holder->readers > 0)
+            holder->readers--;
+        else if (kind == STATS_LOCK_WRITE)
+            holder->writing = 0;
+        holder_release(holder);
+    }
+    state_unlock(index, 1);
+}
+
+void version_index_release_process(struct version_index *index, pid_t pid) {
+    state_lock(index);
+    struct version_index_holder *holder = holder_of(index, pid, 0);
+    if (holder != NULL)
+        holder->pid = 0;
+    state_unlock(index, 1);
+}
+
+void version_index_read_lock_at(struct version_index *index, struct lock_site *site) {
+    unsigned long long start = stats_now_ns();
+    unsigned long long span = trace_begin();
+    int waited = lock_read(index);
+    trace_end("db_lock.read_wait", span);
+    lockedSpan = trace_begin();
+    lockedAt = stats_now_ns();
+    lockedKind = STATS_LOCK_READ;
+    lockedSite = site;
+    stats_record_lock_wait(STATS_LOCK_READ, lockedAt - start);
+    lock_profile_record_acquire(site, waited, lockedAt - start);
+}
+
+void version_index_write_lock_at(struct version_index *index, struct lock_site *site) {
+    unsigned long long start = stats_now_ns();
+    unsigned long long span = trace_begin();
+    int waited = lock_write(index);
+    trace_end("db_lock.write_wait", span);
+    lockedSpan = trace_begin();
+    lockedAt = stats_now_ns();
+    lockedKind = STATS_LOCK_WRITE;
+    lockedSite = site;
+    stats_record_lock_wait(STATS_LOCK_WRITE, lockedAt - start);
+    lock_profile_record_acquire(site, waited, lockedAt - start);
+}
+
+void version_index_unlock(struct version_index *index) {
+    unsigned long long held = stats_now_ns() - lockedAt;
+    stats_record_lock_hold(lockedKind, held);
+    lock_profile_record_hold(lockedSite, held);
+    trace_end(lockedKind == STATS_LOCK_READ ? "db_lock.read_held" : "db_lock.write_held", lockedSpan);
+    lock_release(index, lockedKind);
+}
+
+int version_index_add(struct version_index *index, const char *filename, int idClient) {
+    unsigned record = index->count++;
+    if (index->indexed < record)
+        return -1;
+    if (record == index->capacity) {
+        unsigned capacity = index->capacity < VERSION_INDEX_MAX_RECORDS / 2 ? 2 * index->capacity : VERSION_INDEX_MAX_RECORDS;
+        if (capacity == index->capacity || ftruncate(index->fd, index_size(capacity)) != 0)
+            return -1;
+        index->capacity = capacity;
+    }
+    unsigned long long hash = index_hash(filename, idClient);
+    unsigned bucket = hash & (VERSION_INDEX_BUCKETS - 1);
+    index->records[record].key = hash >> 32;
+    index->records[record].previous = index->heads[bucket];
+    index->heads[bucket] = record + 1;
+    index->indexed++;
+    return 0;
+}
+
+int version_index_complete(struct version_index *index) {
+    return index->indexed == index->count;
+}
+
+unsigned *version_index_find(struct version_index *index, const char *filename, int idClient, int *count) {
+    unsigned long long hash = index_hash(filename, idClient);
+    unsigned bucket = hash & (VERSION_INDEX_BUCKETS - 1);
+    unsigned key = hash >> 32;
+
+    int capacity = 16;
+    unsigned *records = malloc(capacity * sizeof(unsigned));
+    if (records == NULL)
+        return NULL;
+    *count = 0;
+    //La cadena va del mas reciente al mas antiguo
+    for (unsigned next = index->heads[bucket]; next != 0; next = index->records[next - 1].previous) {
+        if (index->records[next - 1].key != key)
+            continue;
+        if (*count == capacity) {
+            unsigned *grown = realloc(records, 2 * capacity * sizeof(unsigned));
+            if (grown == NULL) {
+                free(records);
+                return NULL;
+            }
+            records = grown;
+            capacity *= 2;
+        }
+        records[(*count)++] = next - 1;
+    }
+    for (int i = 0; i < *count / 2; i++) {
+        unsigned swap = records[i];
+        records[i] = records[*count - 1 - i];
+        records[*count - 1 - i] = swap;
+    }
+    return records;
+}
+
+void version_index_destroy(struct version_index *index) {
+    int fd = index->fd;
+    pthread_mutex_destroy(&index->mutex);
+    pthread_cond_destroy(&index->changed);
+    munmap(index, index_size(VERSION_INDEX_MAX_RECORDS));
+    close(fd);
+}
@@ -0,0 +1,150 @@
+/**
+ * @file
+ * @brief Indice de versions.db en memoria compartida: ubica los registros de
+ * un archivo de un cliente sin recorrer la base de datos, y su candado
+ * sincroniza el acceso a versions.db entre hilos y entre procesos
+ * @copyright MIT License
+ */
+
+#ifndef VERSION_INDEX_H
+#define VERSION_INDEX_H
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "lock_profile.h"
+
+#define VERSION_INDEX_MIN_RECORDS (1 << 16)  /**< Capacidad inicial minima del indice */
+#define VERSION_INDEX_MAX_RECORDS (1u << 31) /**< Registros que caben en el espacio de direcciones reservado */
+#define VERSION_INDEX_BUCKETS (1 << 20)      /**< Cubetas de la tabla hash (potencia de dos) */
+#define VERSION_INDEX_PROCESSES 256          /**< Procesos que pueden tener o esperar el candado a la vez */
+
+/**
+ * @brief Parte del candado que tiene un proceso. Si el proceso muere, el
+ * maestro la libera con version_index_release_process
+ */
+struct version_index_holder {
+    pid_t pid;        /**< Proceso, 0 si la entrada esta libre */
+    unsigned readers; /**< Hilos del proceso con el candado de lectura */
+    unsigned waiting; /**< Hilos del proceso esperando el candado de escritura */
+    int writing;      /**< 1 si un hilo del proceso tiene el candado de escritura */
+};
+
+/**
+ * @brief Registro indexado: cadena de su cubeta y clave
+ */
+struct version_index_record {
+    unsigned previous; /**< Registro + 1 anterior de la misma cubeta, 0 si no hay */
+    unsigned key;      /**< Clave del registro, descarta casi todas las colisiones */
+};
+
+/**
+ * @brief Tabla hash encadenada por numero de registro, y el candado de
+ * lectura/escritura que sincroniza versions.db entre hilos y procesos (con
+ * prioridad a los escritores). Vive en un memfd
+ * proyectado compartido: lo heredan los procesos creados despues con fork. La
+ * proyeccion reserva espacio para VERSION_INDEX_MAX_RECORDS y el memfd crece
+ * con ftruncate, asi todos los procesos ven los registros nuevos sin volver a
+ * proyectar. Solo se tocan las paginas de los registros que existen
+ */
+struct version_index {
+    pthread_mutex_t mutex;                 /**< Protege el estado del candado; robusto entre procesos */
+    pthread_cond_t changed;                /**< Se avisa al soltar el candado o liberar un proceso muerto */
+    unsigned sleepers;                     /**< Hilos esperando changed; un proceso muerto solo lo deja alto */
+    int usedHolders;                       /**< Entradas de holders que se han usado (las demas estan libres) */
+    struct version_index_holder holders[VERSION_INDEX_PROCESSES]; /**< Candado de lectura/escritura por proceso */
+    int fd;                                /**< memfd del indice, el mismo numero en todos los procesos */
+    unsigned count;                        /**< Registros de versions.db vistos */
+    unsigned indexed;                      /**< Registros en la tabla; menos que count si el indice no pudo crecer */
+    unsigned capacity;                     /**< Registros que caben en el tamanio actual del memfd */
+    unsigned heads[VERSION_INDEX_BUCKETS]; /**< Registro + 1 mas reciente de cada cubeta, 0 si no hay */
+    struct version_index_record records[]; /**< Un elemento por registro indexado */
+};
+
+/**
+ * @brief Crea un indice vacio
+ * @param shared 1 para compartirlo con los procesos que se creen despues
+ * @param expected registros que se espera indexar (los de versions.db): se
+ * reserva ese tamanio y la mitad mas, y luego crece al doble cuando se llena
+ * @return indice, NULL si no hay memoria
+ */
+struct version_index *version_index_create(int shared, unsigned expected);
+
+/**
+ * @brief Toma el candado para leer versions.db, contandolo en el perfil de
+ * candados en el sitio de la llamada
+ * @param index indice
+ */
+#define version_index_read_lock(index) version_index_read_lock_at((index), LOCK_SITE("version_index.read"))
+
+/**
+ * @brief Toma el candado para agregar a versions.db (tiene prioridad sobre los
+ * lectores), contandolo en el perfil de candados en el sitio de la llamada
+ * @param index indice
+ */
+#define version_index_write_lock(index) version_index_write_lock_at((index), LOCK_SITE("version_index.write"))
+
+/**
+ * @brief Toma el candado para leer versions.db
+ * @param index indice
+ * @param site sitio de la llamada
+ */
+void version_index_read_lock_at(struct version_index *index, struct lock_site *site);
+
+/**
+ * @brief Toma el candado para agregar a versions.db
+ * @param index indice
+ * @param site sitio de la llamada
+ */
+void version_index_write_lock_at(struct version_index *index, struct lock_site *site);
+
+/**
+ * @brief Suelta el candado
+ * @param index indice
+ */
+void version_index_unlock(struct version_index *index);
+
+/**
+ * @brief Libera la parte del candado de un proceso que murio: sus lecturas, su
+ * escritura y sus esperas. Lo llama el maestro al recoger al proceso
+ * @param index indice
+ * @param pid proceso
+ */
+void version_index_release_process(struct version_index *index, pid_t pid);
+
+/**
+ * @brief Indexa el siguiente registro de versions.db, con el candado de escritura
+ * @param index indice
+ * @param filename nombre del archivo del registro
+ * @param idClient cliente del registro
+ * @return 0, -1 si el indice no pudo crecer: el registro se cuenta pero desde el
+ * queda sin indexar (ver version_index_complete)
+ */
+int version_index_add(struct version_index *index, const char *filename, int idClient);
+
+/**
+ * @brief Busca los registros de un archivo de un cliente, con el candado de
+ * lectura. Puede incluir colisiones: el llamador compara el registro
+ * @param index indice
+ * @param filename nombre del archivo
+ * @param idClient cliente
+ * @param count cantidad de registros encontrados
+ * @return numeros de registro del mas antiguo al mas reciente (liberar con free), NULL si no hay memoria
+ */
+unsigned *version_index_find(struct version_index *index, const char *filename, int idClient, int *count);
+
+/**
+ * @brief Indica si todos los registros de versions.db estan en la tabla. Si no,
+ * version_index_find no sirve y hay que recorrer versions.db
+ * @param index indice
+ * @return 1 si esta completo, 0 si no
+ */
+int version_index_complete(struct version_index *index);
+
+/**
+ * @brief Libera el indice
+ * @param index indice creado con version_index_create
+ */
+void version_index_destroy(struct version_index *index);
+
+#endif
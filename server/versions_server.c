@@ -7,7 +7,37 @@
  * @copyright MIT License
 */
 
+#include <poll.h>
+#include <sys/socket.h>
+
 #include "versions_server.h"
+#include "../common/uring.h"
+
+struct version_index *versionIndex = NULL; /**< Indice de versions.db, compartido entre procesos en modo multiproceso. */
+static int writerSocket = -1;              /**< Socket con el proceso escritor, -1 si este proceso escribe el .db. */
+static unsigned writerSequence = 0;        /**< Numero del ultimo lote enviado al escritor. */
+static pthread_mutex_t writerMutex = PTHREAD_MUTEX_INITIALIZER; /**< Un mensaje al escritor a la vez por proceso. */
+
+/**
+ * @brief Mensaje con versiones para el proceso escritor. Un lote grande va en
+ * varios mensajes: el primero descarta lo que haya quedado de un proceso que murio
+ * a mitad de un lote, y con el ultimo se registra todo y se responde.
+ */
+struct writer_message {
+	int first; /**< 1 en el primer mensaje del lote */
+	int last;  /**< 1 en el ultimo mensaje del lote */
+	int count; /**< Versiones en este mensaje (hasta WRITER_MESSAGE_RECORDS) */
+	unsigned sequence; /**< Numero del lote, se devuelve en la respuesta */
+};
+
+/**
+ * @brief Respuesta del proceso escritor a un lote. El numero de lote descarta la
+ * respuesta que no alcanzo a leer un proceso que murio antes de quien lo reemplaza.
+ */
+struct writer_answer {
+	unsigned sequence; /**< Numero del lote */
+	int result;        /**< 1 si se registro, 0 si no */
+};
 
 /**
  * @brief Crea una version en memoria del archivo
@@ -21,28 +51,22 @@
 return_code create_version(char * filename, char * hash, int idClient ,file_version * result);
 
 /**
- * @brief Verifica si existe una version para un archivo
- *
- * @param filename Nombre del archivo
- * @param hash Hash del contenido
- * @param clientId id del cliente
- * @return 1 si la version existe, 0 en caso contrario.
- */
-int version_exists(char * filename, int clientId,char * hash);
-
-/**
-* @brief Almacena un archivo en el repositorio con el hash como nombre
+* @brief Almacena un archivo en el repositorio con el hash como nombre.
+* El contenido se verifica contra el hash mientras se recibe y solo se
+* guarda si coincide.
 *
 * @param file info del archivo a guardar
 * @param hash Hash del archivo: nombre del archivo en el repositorio
 * @param socket socket ha comunicar
-* @param sizeFile tamanio del archivo
+* @param sizeFile tamanio anunciado del archivo
 * @return OK,ERROR_SOCKET,CLIENT_DISCONECT,INVALID_RESPONSE,ERROR,   
 */
-status_operation_socket store_file(char * file, char * hash, int socket, int sizeFile);
+status_operation_socket store_file(char * file, char * hash, int socket, off_t sizeFile);
 
 /**
-* @brief Envia un archivo almacenado en el repositorio
+* @brief Envia un archivo almacenado en el repositorio.
+* A un cliente conectado por socket Unix se le pasa el descriptor del archivo
+* si es suficientemente grande (pass_file_descriptor).
 *
 * @param hash Hash del archivo: nombre del archivo en el repositorio
 * @param socket socket ha comunicar
@@ -63,6 +87,214 @@ status_operation_socket retrieve_file(char * hash, int socket ,int sizeFile);
  */
 int add_new_version(file_version * v);
 
+/**
+ * @brief Adiciona varias versiones en el .db con una sola escritura.
+ * Si la escritura falla se deshace, de modo que se registran todas o ninguna.
+ *
+ * @param versions Versiones a registrar.
+ * @param count Cantidad de versiones.
+ *
+ * @return 1 en caso de exito, 0 en caso de error.
+ */
+int add_new_versions(file_version * versions, int count);
+
+/**
+ * @brief Marca las entradas de un lote cuya version ya existe en el .db.
+ * Busca cada entrada con el indice; si el indice no esta completo recorre la
+ * base de datos una sola vez usando una tabla hash de las entradas.
+ *
+ * @param versions Versiones del lote.
+ * @param count Cantidad de versiones.
+ * @param exists Arreglo de count elementos, queda en 1 si la version ya existe.
+ *
+ * @return 0 en caso de exito, -1 si no hay memoria (exists no es valido).
+ */
+int batch_versions_exist(file_version * versions, int count, char * exists);
+
+/**
+ * @brief Busca con el indice las versiones de un archivo del cliente, con el
+ * candado de lectura tomado.
+ * @param filename Nombre del archivo
+ * @param idClient id del cliente
+ * @param count Cantidad de versiones encontradas
+ * @return Versiones de la mas antigua a la mas reciente (liberar con free), NULL si no hay o hubo error.
+ */
+static file_version * find_file_versions(const char * filename, int idClient, int * count);
+
+/**
+ * @brief Agrega al indice los registros del .db que aun no tiene. Se llama con
+ * el bloqueo de escritura del indice
+ * @param fd descriptor de versions.db
+ * @return 0 si el indice quedo al dia, -1 si fallo la lectura
+ */
+static int index_db_tail(int fd);
+
+/**
+ * @brief Indexa un registro de versions.db, con el bloqueo de escritura del
+ * indice. Si el indice no puede crecer avisa una vez y el registro queda sin indexar
+ * @param r registro
+ */
+static void index_record(const file_version * r);
+
+/**
+ * @brief Busca las versiones de un archivo recorriendo todo versions.db, cuando
+ * el indice no esta completo. Con el candado de lectura tomado
+ * @param filename Nombre del archivo
+ * @param idClient id del cliente
+ * @param count Cantidad de versiones encontradas (en 0 al llamar)
+ * @return Versiones de la mas antigua a la mas reciente (liberar con free), NULL si hubo error.
+ */
+static file_version * scan_file_versions(const char * filename, int idClient, int * count);
+
+/**
+ * @brief Envia versiones al proceso escritor y espera su respuesta.
+ * @return 1 en caso de exito, 0 en caso de error.
+ */
+static int send_to_writer(file_version * versions, int count);
+
+/**
+ * @brief Calcula el hash FNV-1a de un nombre de archivo y un hash de contenido.
+ */
+static unsigned long batch_key(const char * filename, const char * hash);
+
+/**
+ * @brief Archivo solicitado en un get por lotes.
+ */
+struct batch_get_item {
+	char * filename;     /**< Nombre del archivo. */
+	char hash[HASH_SIZE];/**< Hash de la version encontrada. */
+	int version;         /**< Version solicitada (o ultima encontrada). */
+	int seen;            /**< Versiones del archivo vistas al recorrer el .db. */
+	int found;           /**< 1 si la version existe. */
+	int fd;              /**< Blob abierto por adelantado, -1 si no existe. */
+	int next;            /**< Siguiente item con el mismo nombre, -1 si no hay. */
+};
+
+/**
+ * @brief Lista de archivos de un get por lotes con una tabla hash por nombre.
+ */
+struct batch_get_list {
+	struct batch_get_item * items; /**< Archivos solicitados. */
+	int count;                     /**< Cantidad de archivos. */
+	int capacity;                  /**< Capacidad de items. */
+	int * table;                   /**< Indice + 1 del primer item de cada nombre. */
+	size_t tableSize;              /**< Tamanio de la tabla (potencia de 2). */
+};
+
+/**
+ * @brief Busca el primer item con el nombre dado.
+ * @return Indice del item, -1 si no existe.
+ */
+static int batch_get_find(struct batch_get_list * list, const char * filename);
+
+/**
+ * @brief Adiciona un item a la lista, encadenandolo con los de su mismo nombre.
+ * @return Indice del item, -1 si no hay memoria.
+ */
+static int batch_get_append(struct batch_get_list * list, const char * filename, int version);
+
+/**
+ * @brief Libera la memoria de la lista.
+ */
+static void batch_get_free(struct batch_get_list * list);
+
+/**
+ * @brief Busca con el indice las versiones de los items, o en una sola pasada
+ * por el .db si el indice no esta completo o si all es 1: en ese caso se
+ * agregan los archivos del cliente con su ultima version.
+ */
+static void batch_get_resolve(struct batch_get_list * list, int idCliente, int all);
+
+/**
+ * @brief Busca el hash de la ultima version de un archivo del cliente.
+ * @param filename Nombre del archivo
+ * @param idClient id del cliente
+ * @param hash Buffer (HASH_SIZE) para el hash encontrado
+ * @return 1 si existe alguna version, 0 en caso contrario.
+ */
+static int last_version_hash(char * filename, int idClient, char * hash);
+
+/**
+ * @brief Calcula y envia las firmas de los bloques de una version guardada.
+ * Si no hay version previa (hash NULL) envia cero firmas.
+ * @param socket socket ha comunicar
+ * @param hash Hash de la version base, NULL si no existe
+ * @param fileSize Tamanio del archivo nuevo, para elegir el tamanio de bloque
+ * @param header Encabezado enviado
+ * @return OK,ERROR_SOCKET,CLIENT_DISCONECT,INVALID_RESPONSE,ERROR,
+ */
+static status_operation_socket send_base_signatures(int socket, char * hash, size_t fileSize, struct delta_signature_header * header);
+
+/**
+ * @brief Suma a los bytes enviados por el hilo las firmas que se enviaron
+ * @param status resultado de send_delta_signatures
+ * @param header cabecera enviada
+ * @return status
+ */
+static status_operation_socket count_signatures_sent(status_operation_socket status, struct delta_signature_header * header);
+
+/**
+ * @brief Reconstruye una version a partir de la version base y las instrucciones
+ * recibidas, calculando su hash mientras se escribe.
+ * @param socket socket ha comunicar
+ * @param base Descriptor de la version base, -1 si no existe
+ * @param header Encabezado de las firmas enviadas
+ * @param file Descriptor del archivo destino
+ * @param fileSize Tamanio anunciado del archivo nuevo
+ * @param hex Hash calculado (65 bytes)
+ * @return OK,ERROR_SOCKET,CLIENT_DISCONECT,INVALID_RESPONSE,ERROR. Si deja de
+ *         leer antes de DELTA_END marca socketDesynced
+ */
+static status_operation_socket receive_delta(int socket, int base, struct delta_signature_header * header, int file, size_t fileSize, char * hex);
+
+/**
+ * @brief Abre la copia de una version en el repositorio y pide leerla por adelantado.
+ * @return Descriptor del archivo, -1 si no se pudo abrir.
+ */
+static int open_blob_readahead(const char * hash);
+
+/**
+ * @brief Resto de un add con el turno de subida tomado: recibe el archivo y
+ * registra la version.
+ * @param socket socket del usuario.
+ * @param v version a registrar.
+ * @param nameFile nombre del archivo.
+ * @return Resultado de la operacion.
+ */
+static return_code add_transfer(int socket, file_version * v, char * nameFile);
+
+/**
+ * @brief Resto de un add_delta con el turno de subida tomado: envia las firmas,
+ * reconstruye el archivo y registra la version.
+ * @param socket socket del usuario.
+ * @param v version a registrar.
+ * @param nameFile nombre del archivo.
+ * @param idCliente id del cliente.
+ * @return Resultado de la operacion.
+ */
+static return_code add_delta_transfer(int socket, file_version * v, char * nameFile, int idCliente);
+
+/**
+ * @brief Milisegundos transcurridos desde un instante.
+ * @param start instante inicial (CLOCK_MONOTONIC).
+ * @return Milisegundos transcurridos.
+ */
+static double elapsed_ms(struct timespec * start);
+
+/**
+ * @brief Subtarea que abre y lee por adelantado el blob de un item.
+ * @param arg struct batch_get_item *
+ */
+static void batch_get_readahead(void * arg);
+
+/**
+ * @brief Crea las subtareas de lectura adelantada de una ventana de items.
+ * @param list lista de archivos
+ * @param start primer item de la ventana
+ * @param group grupo donde se crean las subtareas
+ */
+static void batch_get_prefetch(struct batch_get_list * list, int start, struct thread_pool_group * group);
+
 
 return_code create_version(char * filename, char * hash, int idClient,file_version * result) {
 	//Estructuras necesarias
@@ -87,45 +319,83 @@ return_code add(int socket, int idCliente) {
 	//1.Resibir la informacion de nombre y hash 
 	size_t size_info = sizeof(struct file_request);
 	struct file_request info_file;
+	unsigned long long span = trace_begin();
 	size_t bytes_read = receive_file_request(socket, &info_file);
+	trace_end("add.receive_request", span);
 
-	if(bytes_read != OK)
+	if(bytes_read != OK){
+		socketDesynced = 1;
 		return VERSION_ERROR;
+	}
 
 	//Crea la nueva version en memoria
 	create_version(info_file.nameFile, info_file.hashFile, idCliente,&v);
 	
 	//2.Validar si existe, y dar respuesta
 
+	span = trace_begin();
 	size_t existVersion = version_exists(info_file.nameFile, idCliente, v.hash);
+	trace_end("add.version_exists", span);
+
+	//2.1 Pedimos turno para la subida: si la cola esta llena el usuario reintenta despues
+	span = trace_begin();
+	int admitted = existVersion || admission_enter(&uploads, idCliente, 1) == 0;
+	trace_end("add.admission", span);
+	if(!admitted){
+		send_retry_after(socket, admission_retry_after(&uploads));
+		return VERSION_RETRY_LATER;
+	}
 
-	//2.1 Notificamos al usuario
+	//2.2 Notificamos al usuario
 
 	return_code response_user = existVersion ?VERSION_ALREADY_EXISTS:VERSION_NOT_EXISTS;
 
-	if(send_status_code(socket, response_user) != OK)
+	if(send_status_code(socket, response_user) != OK){
+		if(!existVersion)
+			admission_exit(&uploads, idCliente, 0);
+		socketDesynced = 1;
 		return VERSION_ERROR;
+	}
 	if(existVersion)
 		return VERSION_ALREADY_EXISTS;
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	return_code result = add_transfer(socket, &v, info_file.nameFile);
+	admission_exit(&uploads, idCliente, elapsed_ms(&start));
+	return result;
+}
+
+static return_code add_transfer(int socket, file_version * v, char * nameFile) {
 	//3.Resibir el tamanio del archivo con el comentario
 	struct file_transfer info_file_transfer;
 	// printf("Se ha intentado recibir el file_transfer\n");
 
-	if( receive_file_transfer(socket, &info_file_transfer) != OK )
+	if( receive_file_transfer(socket, &info_file_transfer) != OK ){
+		socketDesynced = 1;
 		return VERSION_ERROR;
+	}
 
 	//4.Resibir el archivo 
 	
-	strncpy(v.comment, info_file_transfer.comment, sizeof(v.comment) - 1);
-	v.comment[sizeof(v.comment) - 1] = '\0';
+	strncpy(v->comment, info_file_transfer.comment, sizeof(v->comment) - 1);
+	v->comment[sizeof(v->comment) - 1] = '\0';
 
 	//Almacena el archivo en el repositorio.
-	if( store_file(info_file.nameFile, v.hash, socket, info_file_transfer.filseSize) != OK){	
+	unsigned long long span = trace_begin();
+	status_operation_socket stored = store_file(nameFile, v->hash, socket, info_file_transfer.filseSize);
+	trace_end("add.store_file", span);
+	//Puede quedar contenido sin leer en el socket
+	if(stored != OK){	
 		send_status_code(socket, VERSION_ERROR);
+		socketDesynced = 1;
 		return VERSION_ERROR;
 	}
 	//Agrega un nuevo registro al archivo versions.db
-	if(add_new_version(&v) != 1){
+	span = trace_begin();
+	int appended = add_new_version(v);
+	trace_end("add.db_append", span);
+	if(appended != 1){
 		send_status_code(socket, VERSION_ERROR);
 		return VERSION_ERROR;
 	}
@@ -140,26 +410,7 @@ return_code add(int socket, int idCliente) {
 }
 
 int add_new_version(file_version * v) {
-	// Abre el archivo versions.db en modo append 
-	//y verificamos que se haya abierto correctamente
-	pthread_mutex_lock(&mutexDB);
-	FILE * fp;
-	fp = fopen(".versions/versions.db", "ab");
-	
-	if(fp == NULL){
-		pthread_mutex_unlock(&mutexDB);
-		return 0;
-	}
-	// Escribe la estructura v en el archivo, verifica que se haya escrito correctamente
-	// y cierra el archivo 
-	if( fwrite(v, sizeof(file_version), 1, fp) != 1){
-		fclose(fp);
-		pthread_mutex_unlock(&mutexDB);
-		return 0;
-	}
-	fclose(fp);
-	pthread_mutex_unlock(&mutexDB);
-	return 1;
+	return add_new_versions(v, 1);
 }
 
 return_code list(int socket, int idCliente) {
@@ -167,9 +418,13 @@ return_code list(int socket, int idCliente) {
 	struct file_request file;
 	char message[SIZE_ELEMENT_LIST];
 
-	if( receive_file_request(socket, &file) != OK){
+	unsigned long long span = trace_begin();
+	status_operation_socket received = receive_file_request(socket, &file);
+	trace_end("list.receive_request", span);
+	if(received != OK){
 		snprintf(message, SIZE_ELEMENT_LIST, "END");
 		send_element_list(socket, message);
+		socketDesynced = 1;
 		return VERSION_ERROR;
 	}
 	char filename[file.sizeNameFile +1];
@@ -178,21 +433,29 @@ return_code list(int socket, int idCliente) {
 	
 	//2. Responder con la lista de versiones hasta un END
 	//   si no hay simplemente manda el END
-	//	Abre el la base de datos de versiones (versions.db) de manera segura
-	pthread_mutex_lock(&mutexDB);
+	//	El candado solo fija cuantos registros completos tiene el .db: un registro
+	//	no cambia una vez escrito, asi que se leen y envian sin el y un cliente
+	//	que lee despacio no detiene a los add
+	version_index_read_lock(versionIndex);
 	FILE * fp = fopen(".versions/versions.db", "r");
-	file_version  r;
-	if(fp  == NULL ){
-		pthread_mutex_unlock(&mutexDB);
+	struct stat st;
+	if(fp  == NULL || fstat(fileno(fp), &st) != 0){
+		version_index_unlock(versionIndex);
+		if(fp != NULL)
+			fclose(fp);
 		snprintf(message, SIZE_ELEMENT_LIST, "END");
 		send_element_list(socket, message);
 		return VERSION_ERROR;
 	}
+	version_index_unlock(versionIndex);
+	off_t records = st.st_size / sizeof(file_version);
+	file_version  r;
 
-	//Leer hasta el fin del archivo 
+	//Leer hasta el ultimo registro que habia al tomar el candado
 	int cont = 1;
+	unsigned long long scan = trace_begin();
 
-	while(!feof(fp)){
+	for(off_t i = 0; i < records; i++){
 		//Realizar una lectura y retornar
 		if(fread(&r, sizeof(file_version), 1, fp) != 1){
 			break;
@@ -200,63 +463,47 @@ return_code list(int socket, int idCliente) {
 		if(strcmp(filename, "") ==0 && r.idCliente == idCliente){
 			//Si filename es NULL, muestra todos los registros.
 			snprintf(message, SIZE_ELEMENT_LIST, "%d %s %s  %.5s", cont, r.filename, r.comment, r.hash);
-			if( send_element_list(socket, message) != OK)
+			span = trace_begin();
+			received = send_element_list(socket, message);
+			trace_end("list.send", span);
+			if( received != OK)
 				break;
 			cont ++;
 		
 		}else if(EQUALS(r.filename,filename) && r.idCliente == idCliente){
 			snprintf(message, SIZE_ELEMENT_LIST, "%d %s %s  %.5s", cont, r.filename, r.comment, r.hash);
-			if( send_element_list(socket, message) != OK)
+			span = trace_begin();
+			received = send_element_list(socket, message);
+			trace_end("list.send", span);
+			if( received != OK)
 				break;
 			cont++;
 		}
 		//Si el registro corresponde al archivo buscado, imprimir
 		//Muestra los registros cuyo nombre coincide con filename.
 	}	
+	trace_end("list.scan", scan);
 
 	snprintf(message, SIZE_ELEMENT_LIST, "END");
-	send_element_list(socket, message);
+	if(received != OK || send_element_list(socket, message) != OK)
+		socketDesynced = 1;
 	fclose(fp);
-	pthread_mutex_unlock(&mutexDB);
 	return VERSION_ADDED;
 }
 
 int version_exists(char * filename, int idClient,char * hash) {
-	//abre la base de datos de versiones .versions/versions.db
-	pthread_mutex_lock(&mutexDB);
-	FILE * fp = fopen(".versions/versions.db", "rb");
-
-	if( fp == NULL)
-		return 0;
-	
-	file_version * versions;
-
-	// Obtiene el tamaño del archivo	
-	fseek(fp, 0, SEEK_END);
-	long fileSize = ftell(fp);
-	fseek(fp, 0, SEEK_SET);
-
-	// Obtiene la cantidad de registros en la base de datos
-	//Y reserva memoria para almacenarlos
-	int countVersions = fileSize / sizeof(file_version);
-	versions = (file_version *) malloc(fileSize*sizeof(file_version));
-	
-	if(versions == NULL){
-		fclose(fp);
-		pthread_mutex_unlock(&mutexDB);
-		return 0;
-	}
+	//Solo se leen los registros de este archivo del cliente
+	version_index_read_lock(versionIndex);
+	int count = 0;
+	file_version * versions = find_file_versions(filename, idClient, &count);
+	version_index_unlock(versionIndex);
 
-	// Lee los registros de la base de datos
-	fread(versions, sizeof(file_version), countVersions, fp);
-	fclose(fp);
-	pthread_mutex_unlock(&mutexDB);
-	for(int i = 0; i < countVersions; i++)
-		if(strcmp(versions[i].filename, filename) == 0 && strcmp(versions[i].hash, hash) == 0 && versions[i].idCliente == idClient)
-			return 1;
-			
 	// Verifica si en la bd existe un registro que coincide con filename y hash
-	return 0;
+	int exists = 0;
+	for(int i = 0; i < count && !exists; i++)
+		exists = strcmp(versions[i].hash, hash) == 0;
+	free(versions);
+	return exists;
 }
 
 return_code get(int socket, int idCliente) {
@@ -264,8 +511,13 @@ return_code get(int socket, int idCliente) {
 	size_t size_info = sizeof(struct file_request);
 	struct file_request info_file;
 
-	if( receive_file_request(socket, &info_file) != OK)
+	unsigned long long span = trace_begin();
+	status_operation_socket received = receive_file_request(socket, &info_file);
+	trace_end("get.receive_request", span);
+	if(received != OK){
+		socketDesynced = 1;
 		return VERSION_ERROR;
+	}
 	
 	int version = info_file.version;
 
@@ -274,74 +526,1066 @@ return_code get(int socket, int idCliente) {
 	strncpy(filename, info_file.nameFile, PATH_MAX - 1);
 	filename[PATH_MAX - 1] = '\0';
 
-	//abre la base de datos de versiones .versions/versions.db
-	//y validamos que se haya abierto correctamente
-	pthread_mutex_lock(&mutexDB);
-	file_version r;
-	FILE * fp = fopen(".versions/versions.db", "rb");
+	//Buscamos la version con el indice. El candado se suelta antes de enviar:
+	//los blobs no cambian ni se borran, y un cliente lento no debe detener a los add
+	version_index_read_lock(versionIndex);
+	int count = 0;
+	span = trace_begin();
+	file_version * versions = find_file_versions(filename, idCliente, &count);
+	trace_end("get.lookup", span);
+	version_index_unlock(versionIndex);
+	struct file_transfer file_transfer;
+	if(version < 1 || version > count){
+		free(versions);
+		file_transfer.filseSize = 0;
+		send_file_transfer(socket, &file_transfer);
+		return VERSION_NOT_EXISTS;
+	}
+
+	//El registro corresponde al archivo buscado, lo restauramos
+	char hash[HASH_SIZE];
+	strcpy(hash, versions[version - 1].hash);
+	free(versions);
+	char src_filename[PATH_MAX];
+	snprintf(src_filename, PATH_MAX, "%s/%s", VERSIONS_DIR, hash);
+
+	return_code result = VERSION_ADDED;
+	struct stat st;
+	span = trace_begin();
+	int found = stat(src_filename, &st) == 0;
+	trace_end("get.stat", span);
+	//Sin el blob no hay respuesta que el cliente pueda leer
+	if (!found) {
+		socketDesynced = 1;
+		result = VERSION_ERROR;
+	}else{
+		file_transfer.filseSize = st.st_size;
+		span = trace_begin();
+		if( send_file_transfer(socket, &file_transfer) != OK || retrieve_file(hash, socket, st.st_size) != OK){
+			socketDesynced = 1;
+			result = VERSION_ERROR;
+		}
+		trace_end("get.send", span);
+	}
+	return result;
+}
 
-	if( fp == NULL){
-		pthread_mutex_unlock(&mutexDB);
+status_operation_socket store_file(char * file, char * hash, int socket, off_t sizeFile) {
+	char dst_filename[PATH_MAX];
+	snprintf(dst_filename, PATH_MAX, "%s/%s", VERSIONS_DIR, hash);
+	return receive_file_verified(socket, dst_filename, hash, sizeFile);
+}
+
+status_operation_socket retrieve_file(char * hash, int socket,int sizeFile) {
+	char src_filename[PATH_MAX];
+	snprintf(src_filename, PATH_MAX, "%s/%s", VERSIONS_DIR, hash);
+	if(!pass_file_descriptor(socket_is_local(socket), sizeFile))
+		return send_file(socket, src_filename);
+
+	//Cliente local y archivo grande: se le pasa el descriptor en lugar del contenido
+	int fd = open(src_filename, O_RDONLY);
+	if(fd < 0)
+		return ERROR;
+	status_operation_socket status = send_file_descriptor(socket, fd);
+	close(fd);
+	return status;
+}
+
+return_code add_batch(int socket, int idCliente) {
+	//1. Recibir el manifiesto del lote
+	struct batch_header header;
+	if(receive_batch_header(socket, &header) != OK){
+		socketDesynced = 1;
 		return VERSION_ERROR;
 	}
-	
 
-	//Leer hasta el fin del archivo verificando si el registro coincide con filename y version
-	int cont = 1;
-	struct file_transfer file_transfer;
-	while(!feof(fp)){
-		if(fread(&r, sizeof(file_version), 1, fp) != 1)
+	int count = header.count;
+	file_version * versions = calloc(count > 0 ? count : 1, sizeof(file_version));
+	char * exists = calloc(count > 0 ? count : 1, sizeof(char));
+	int * needed = malloc((count > 0 ? count : 1) * sizeof(int));
+	size_t * sizes = malloc((count > 0 ? count : 1) * sizeof(size_t));
+	if(versions == NULL || exists == NULL || needed == NULL || sizes == NULL){
+		free(versions);
+		free(exists);
+		free(needed);
+		free(sizes);
+		socketDesynced = 1;
+		return VERSION_ERROR;
+	}
+
+	//Si se sale antes de leer todo el lote el resto queda en el socket: las
+	//salidas que cortan el flujo marcan socketDesynced para cerrar la conexion
+	return_code result = VERSION_ERROR;
+	struct batch_add_entry entry;
+	char name[PATH_MAX];
+	for(int i = 0; i < count; i++){
+		if(receive_batch_add_entry(socket, &entry, name) != OK){
+			socketDesynced = 1;
+			goto end;
+		}
+		create_version(name, entry.hashFile, idCliente, &versions[i]);
+		sizes[i] = entry.fileSize;
+		strncpy(versions[i].comment, entry.comment, sizeof(versions[i].comment) - 1);
+		versions[i].comment[sizeof(versions[i].comment) - 1] = '\0';
+	}
+
+	//2. Determinar las versiones nuevas y cuales contenidos hacen falta.
+	//   Un contenido no se pide si ya esta en el repositorio o si otra
+	//   entrada del lote con el mismo hash ya lo va a enviar. Sin memoria no se
+	//   sabe que versiones existen: se responde que no hace falta ningun
+	//   contenido y el error, en lugar de registrar versiones repetidas
+	//Tabla hash (direccionamiento abierto) de los contenidos ya pedidos, por hash
+	size_t size = 1;
+	while(size < (size_t)count * 2)
+		size <<= 1;
+	int * requested = calloc(size, sizeof(int));
+	if(requested == NULL || batch_versions_exist(versions, count, exists) != 0){
+		free(requested);
+		if(send_batch_indexes(socket, NULL, 0) == OK)
+			send_status_code(socket, VERSION_ERROR);
+		goto end;
+	}
+
+	int countNeeded = 0;
+	int countNew = 0;
+	for(int i = 0; i < count; i++){
+		if(exists[i])
+			continue;
+		countNew++;
+
+		char blob[PATH_MAX];
+		struct stat st;
+		snprintf(blob, PATH_MAX, "%s/%s", VERSIONS_DIR, versions[i].hash);
+		if(stat(blob, &st) == 0)
+			continue;
+
+		size_t pos = batch_key("", versions[i].hash) & (size - 1);
+		while(requested[pos] != 0 && !EQUALS(versions[requested[pos] - 1].hash, versions[i].hash))
+			pos = (pos + 1) & (size - 1);
+		if(requested[pos] != 0)
+			continue;
+		requested[pos] = i + 1;
+		needed[countNeeded++] = i;
+	}
+	free(requested);
+
+	//3. Pedir turno de subida y responder una sola vez con los indices de los
+	//   contenidos necesarios. Con la cola llena el usuario reintenta despues
+	if(countNeeded > 0 && admission_enter(&uploads, idCliente, 1) != 0){
+		send_batch_retry_after(socket, admission_retry_after(&uploads));
+		result = VERSION_RETRY_LATER;
+		goto end;
+	}
+	if(send_batch_indexes(socket, needed, countNeeded) != OK){
+		if(countNeeded > 0)
+			admission_exit(&uploads, idCliente, 0);
+		socketDesynced = 1;
+		goto end;
+	}
+
+	//4. Recibir los contenidos uno tras otro. El turno se devuelve y se pide de
+	//   nuevo entre archivos, para que un lote grande no deje esperando a los demas
+	for(int i = 0; i < countNeeded; i++){
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		status_operation_socket status = store_file(versions[needed[i]].filename, versions[needed[i]].hash, socket, sizes[needed[i]]);
+		admission_exit(&uploads, idCliente, elapsed_ms(&start));
+		if(status != OK){
+			send_status_code(socket, VERSION_ERROR);
+			socketDesynced = 1;
+			goto end;
+		}
+		if(i + 1 < countNeeded)
+			admission_enter(&uploads, idCliente, 0);
+	}
+
+	//5. Registrar todas las versiones nuevas en una sola escritura
+	int k = 0;
+	for(int i = 0; i < count; i++)
+		if(!exists[i])
+			versions[k++] = versions[i];
+
+	if(countNew > 0 && add_new_versions(versions, countNew) != 1){
+		send_status_code(socket, VERSION_ERROR);
+		goto end;
+	}
+
+	result = countNew > 0 ? VERSION_ADDED : VERSION_ALREADY_EXISTS;
+	send_status_code(socket, result);
+
+end:
+	free(versions);
+	free(exists);
+	free(needed);
+	free(sizes);
+	return result;
+}
+
+int add_new_versions(file_version * versions, int count) {
+	//En modo multiproceso solo el proceso escritor agrega al .db
+	if(writerSocket != -1)
+		return send_to_writer(versions, count);
+	return versions_db_append(versions, count);
+}
+
+int versions_db_append(file_version * versions, int count) {
+	version_index_write_lock(versionIndex);
+	int fd = open(VERSIONS_DB_PATH, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if(fd < 0){
+		version_index_unlock(versionIndex);
+		return 0;
+	}
+
+	//Durante un reinicio el proceso anterior y el nuevo agregan al mismo .db:
+	//el bloqueo del archivo los ordena y el indice se pone al dia antes de agregar
+	struct stat st;
+	if(flock(fd, LOCK_EX) != 0 || index_db_tail(fd) != 0 || fstat(fd, &st) != 0){
+		close(fd);
+		version_index_unlock(versionIndex);
+		return 0;
+	}
+	//Un escritor que murio a mitad de un registro deja un pedazo al final: se
+	//descarta para que los registros nuevos queden alineados
+	if(st.st_size % sizeof(file_version) != 0){
+		st.st_size = (off_t)versionIndex->count * sizeof(file_version);
+		if(ftruncate(fd, st.st_size) != 0){
+			close(fd);
+			version_index_unlock(versionIndex);
+			return 0;
+		}
+	}
+
+	size_t total = (size_t)count * sizeof(file_version);
+	size_t written = 0;
+	while(written < total){
+		ssize_t n = write(fd, (char *)versions + written, total - written);
+		if(n < 0){
+			if(ftruncate(fd, st.st_size) != 0)
+				log_write(LOG_LEVEL_ERROR, "Error restoring versions.db: %m\n");
+			close(fd);
+			version_index_unlock(versionIndex);
+			return 0;
+		}
+		written += n;
+	}
+	close(fd);
+	//Los lectores ven los registros en el indice cuando ya estan en el .db
+	for(int i = 0; i < count; i++)
+		index_record(&versions[i]);
+	version_index_unlock(versionIndex);
+	return 1;
+}
+
+int versions_db_open(int shared) {
+	struct stat st;
+	unsigned expected = stat(VERSIONS_DB_PATH, &st) == 0 ? st.st_size / sizeof(file_version) : 0;
+	versionIndex = version_index_create(shared, expected);
+	if(versionIndex == NULL)
+		return -1;
+	return versions_db_sync() < 0 ? -1 : 0;
+}
+
+int versions_db_sync(void) {
+	int fd = open(VERSIONS_DB_PATH, O_RDONLY);
+	if(fd < 0)
+		return errno == ENOENT ? 0 : -1;
+	version_index_write_lock(versionIndex);
+	unsigned before = versionIndex->count;
+	int result = index_db_tail(fd);
+	unsigned added = versionIndex->count - before;
+	version_index_unlock(versionIndex);
+	close(fd);
+	return result == 0 ? (int)added : -1;
+}
+
+static int index_db_tail(int fd) {
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+		return -1;
+	unsigned total = st.st_size / sizeof(file_version);
+	if(total <= versionIndex->count)
+		return 0;
+	file_version * records = malloc(INDEX_READ_RECORDS * sizeof(file_version));
+	if(records == NULL)
+		return -1;
+	while(versionIndex->count < total){
+		unsigned count = total - versionIndex->count;
+		if(count > INDEX_READ_RECORDS)
+			count = INDEX_READ_RECORDS;
+		ssize_t n = pread(fd, records, count * sizeof(file_version), (off_t)versionIndex->count * sizeof(file_version));
+		if(n < (ssize_t)sizeof(file_version))
+			break;
+		for(unsigned i = 0; i < n / sizeof(file_version); i++)
+			index_record(&records[i]);
+	}
+	free(records);
+	return versionIndex->count < total ? -1 : 0;
+}
+
+static void index_record(const file_version * r) {
+	if(version_index_add(versionIndex, r->filename, r->idCliente) == 0)
+		return;
+	if(versionIndex->indexed + 1 == versionIndex->count)
+		log_write(LOG_LEVEL_WARN, "The index of versions.db cannot grow past %u records: lookups will read the whole file\n",
+				versionIndex->indexed);
+}
+
+static file_version * scan_file_versions(const char * filename, int idClient, int * count) {
+	FILE * fp = fopen(VERSIONS_DB_PATH, "rb");
+	if(fp == NULL)
+		return NULL;
+	int capacity = 16;
+	file_version * versions = malloc(capacity * sizeof(file_version));
+	file_version r;
+	while(versions != NULL && fread(&r, sizeof(file_version), 1, fp) == 1){
+		if(r.idCliente != idClient || !EQUALS(r.filename, filename))
+			continue;
+		if(*count == capacity){
+			file_version * grown = realloc(versions, 2 * capacity * sizeof(file_version));
+			if(grown == NULL){
+				free(versions);
+				versions = NULL;
+				break;
+			}
+			versions = grown;
+			capacity *= 2;
+		}
+		versions[(*count)++] = r;
+	}
+	fclose(fp);
+	if(versions == NULL)
+		*count = 0;
+	return versions;
+}
+
+int blob_store_usage(unsigned long * count, unsigned long long * bytes) {
+	*count = 0;
+	*bytes = 0;
+	DIR * dir = opendir(VERSIONS_DIR);
+	if(dir == NULL)
+		return -1;
+	//Los blobs se llaman como el hash de su contenido; el .db y los temporales no cuentan
+	struct dirent * entry;
+	struct stat st;
+	while((entry = readdir(dir)) != NULL){
+		if(strlen(entry->d_name) != BLOB_NAME_SIZE || strspn(entry->d_name, "0123456789abcdef") != BLOB_NAME_SIZE)
+			continue;
+		if(fstatat(dirfd(dir), entry->d_name, &st, 0) == 0){
+			(*count)++;
+			*bytes += st.st_size;
+		}
+	}
+	closedir(dir);
+	return 0;
+}
+
+static file_version * find_file_versions(const char * filename, int idClient, int * count) {
+	*count = 0;
+	if(!version_index_complete(versionIndex))
+		return scan_file_versions(filename, idClient, count);
+	int candidates = 0;
+	unsigned * records = version_index_find(versionIndex, filename, idClient, &candidates);
+	if(records == NULL || candidates == 0){
+		free(records);
+		return NULL;
+	}
+	file_version * versions = malloc(candidates * sizeof(file_version));
+	int fd = open(VERSIONS_DB_PATH, O_RDONLY);
+	if(versions == NULL || fd < 0){
+		if(fd >= 0)
+			close(fd);
+		free(versions);
+		free(records);
+		return NULL;
+	}
+	//El indice puede traer colisiones: se compara cada registro leido
+	for(int i = 0; i < candidates; i++){
+		file_version * r = &versions[*count];
+		if(pread(fd, r, sizeof(file_version), (off_t)records[i] * sizeof(file_version)) == sizeof(file_version)
+				&& r->idCliente == idClient && EQUALS(r->filename, filename))
+			(*count)++;
+	}
+	close(fd);
+	free(records);
+	return versions;
+}
+
+void versions_db_set_writer(int socket) {
+	writerSocket = socket;
+	//Un proceso que reemplaza a otro no confunde los lotes de ambos
+	writerSequence = (unsigned)getpid() << 16;
+}
+
+static int send_to_writer(file_version * versions, int count) {
+	size_t capacity = sizeof(struct writer_message) + WRITER_MESSAGE_RECORDS * sizeof(file_version);
+	char * buffer = malloc(capacity);
+	if(buffer == NULL)
+		return 0;
+	struct writer_message * message = (struct writer_message *)buffer;
+	struct writer_answer answer = {0};
+
+	profiled_lock(&writerMutex, "writer");
+	writerSequence++;
+	for(int sent = 0; sent < count; sent += message->count){
+		message->sequence = writerSequence;
+		message->first = sent == 0;
+		message->count = count - sent < WRITER_MESSAGE_RECORDS ? count - sent : WRITER_MESSAGE_RECORDS;
+		message->last = sent + message->count == count;
+		memcpy(buffer + sizeof(struct writer_message), versions + sent, message->count * sizeof(file_version));
+		size_t size = sizeof(struct writer_message) + message->count * sizeof(file_version);
+		if(send(writerSocket, buffer, size, MSG_NOSIGNAL) != (ssize_t)size){
+			log_write(LOG_LEVEL_ERROR, "Error sending the versions to the writer process: %m\n");
+			profiled_unlock(&writerMutex);
+			free(buffer);
+			return 0;
+		}
+	}
+	do{
+		if(recv(writerSocket, &answer, sizeof(answer), 0) != sizeof(answer)){
+			log_write(LOG_LEVEL_ERROR, "Error receiving the answer of the writer process: %m\n");
+			answer.result = 0;
 			break;
-		//Si el registro corresponde al archivo buscado, lo restauramos
-		if(EQUALS(r.filename,filename) && r.idCliente == idCliente){
-			if(cont != version){
-				cont++;
+		}
+	}while(answer.sequence != writerSequence);
+	profiled_unlock(&writerMutex);
+	free(buffer);
+	return answer.result;
+}
+
+void versions_db_serve(int * sockets, int count) {
+	size_t capacity = sizeof(struct writer_message) + WRITER_MESSAGE_RECORDS * sizeof(file_version);
+	struct pollfd * polls = calloc(count, sizeof(struct pollfd));
+	file_version ** pending = calloc(count, sizeof(file_version *));
+	int * pendingCount = calloc(count, sizeof(int));
+	unsigned * sequences = calloc(count, sizeof(unsigned));
+	int * ready = calloc(count, sizeof(int));
+	char * buffer = malloc(capacity);
+	if(polls == NULL || pending == NULL || pendingCount == NULL || sequences == NULL || ready == NULL || buffer == NULL){
+		log_write(LOG_LEVEL_ERROR, "Error starting the writer process: %m\n");
+		exit(EXIT_FAILURE);
+	}
+	for(int i = 0; i < count; i++){
+		polls[i].fd = sockets[i];
+		polls[i].events = POLLIN;
+	}
+
+	struct writer_message * message = (struct writer_message *)buffer;
+	file_version * merged = NULL;
+	int mergedCapacity = 0;
+	while(1){
+		if(poll(polls, count, -1) < 0)
+			continue;
+		int countReady = 0;
+		int total = 0;
+		for(int i = 0; i < count; i++){
+			if(!(polls[i].revents & POLLIN))
 				continue;
+			//SOCK_SEQPACKET: cada recv trae un mensaje completo. Se leen los que ya
+			//llegaron hasta terminar el lote; el proceso no envia otro sin la respuesta
+			ssize_t size;
+			while((size = recv(polls[i].fd, buffer, capacity, MSG_DONTWAIT)) > 0){
+				if(size < (ssize_t)sizeof(struct writer_message) || message->count < 0 || message->count > WRITER_MESSAGE_RECORDS
+						|| size != (ssize_t)(sizeof(struct writer_message) + message->count * sizeof(file_version)))
+					continue;
+				if(message->first)
+					pendingCount[i] = 0;
+				file_version * grown = realloc(pending[i], (pendingCount[i] + message->count) * sizeof(file_version));
+				if(grown == NULL){
+					pendingCount[i] = 0;
+					continue;
+				}
+				pending[i] = grown;
+				memcpy(pending[i] + pendingCount[i], buffer + sizeof(struct writer_message), message->count * sizeof(file_version));
+				pendingCount[i] += message->count;
+				if(message->last){
+					sequences[i] = message->sequence;
+					ready[countReady++] = i;
+					total += pendingCount[i];
+					break;
+				}
 			}
+		}
+		if(countReady == 0)
+			continue;
 
-			char src_filename[PATH_MAX];
-			snprintf(src_filename, PATH_MAX, "%s/%s", VERSIONS_DIR, r.hash);
+		//Los lotes completos de todos los procesos se registran en una sola escritura
+		int result = 1;
+		if(total > mergedCapacity){
+			file_version * grown = realloc(merged, total * sizeof(file_version));
+			if(grown != NULL){
+				merged = grown;
+				mergedCapacity = total;
+			}else{
+				result = 0;
+			}
+		}
+		if(result){
+			int k = 0;
+			for(int j = 0; j < countReady; j++){
+				memcpy(merged + k, pending[ready[j]], pendingCount[ready[j]] * sizeof(file_version));
+				k += pendingCount[ready[j]];
+			}
+			result = versions_db_append(merged, total);
+		}
+		for(int j = 0; j < countReady; j++){
+			struct writer_answer answer = { sequences[ready[j]], result };
+			pendingCount[ready[j]] = 0;
+			send(polls[ready[j]].fd, &answer, sizeof(answer), MSG_NOSIGNAL);
+		}
+	}
+}
+
+static unsigned long batch_key(const char * filename, const char * hash) {
+	unsigned long key = 14695981039346656037UL;
+	for(const char * c = filename; *c; c++)
+		key = (key ^ (unsigned char)*c) * 1099511628211UL;
+	key = (key ^ '/') * 1099511628211UL;
+	for(const char * c = hash; *c; c++)
+		key = (key ^ (unsigned char)*c) * 1099511628211UL;
+	return key;
+}
+
+int batch_versions_exist(file_version * versions, int count, char * exists) {
+	if(count == 0)
+		return 0;
+
+	//Tabla hash (direccionamiento abierto) con los indices + 1 de las entradas
+	size_t size = 1;
+	while(size < (size_t)count * 2)
+		size <<= 1;
+	int * table = calloc(size, sizeof(int));
+	if(table == NULL)
+		return -1;
+
+	for(int i = 0; i < count; i++){
+		size_t pos = batch_key(versions[i].filename, versions[i].hash) & (size - 1);
+		while(table[pos] != 0){
+			file_version * other = &versions[table[pos] - 1];
+			//Una entrada repetida en el mismo lote solo se registra una vez
+			if(EQUALS(other->filename, versions[i].filename) && EQUALS(other->hash, versions[i].hash)){
+				exists[i] = 1;
+				break;
+			}
+			pos = (pos + 1) & (size - 1);
+		}
+		if(!exists[i])
+			table[pos] = i + 1;
+	}
+
+	//Con el indice completo se leen solo los registros de los nombres del lote
+	version_index_read_lock(versionIndex);
+	if(version_index_complete(versionIndex)){
+		for(int i = 0; i < count; i++){
+			if(exists[i])
+				continue;
+			int found = 0;
+			file_version * stored = find_file_versions(versions[i].filename, versions[i].idCliente, &found);
+			for(int j = 0; j < found && !exists[i]; j++)
+				exists[i] = EQUALS(stored[j].hash, versions[i].hash);
+			free(stored);
+		}
+		version_index_unlock(versionIndex);
+		free(table);
+		return 0;
+	}
 
+	//Si no, recorrer la base de datos una sola vez
+	FILE * fp = fopen(VERSIONS_DB_PATH, "rb");
+	if(fp != NULL){
+		file_version r;
+		while(fread(&r, sizeof(file_version), 1, fp) == 1){
+			if(r.idCliente != versions[0].idCliente)
+				continue;
+			size_t pos = batch_key(r.filename, r.hash) & (size - 1);
+			while(table[pos] != 0){
+				file_version * v = &versions[table[pos] - 1];
+				if(EQUALS(v->filename, r.filename) && EQUALS(v->hash, r.hash)){
+					exists[table[pos] - 1] = 1;
+					break;
+				}
+				pos = (pos + 1) & (size - 1);
+			}
+		}
+		fclose(fp);
+	}
+	version_index_unlock(versionIndex);
+	free(table);
+	return 0;
+}
+
+return_code get_batch(int socket, int idCliente) {
+	//1. Recibir la lista de archivos, vacia para todos los archivos del cliente
+	struct batch_header header;
+	if(receive_batch_header(socket, &header) != OK){
+		socketDesynced = 1;
+		return VERSION_ERROR;
+	}
+
+	struct batch_get_list list = {0};
+	struct batch_get_entry entry;
+	char name[PATH_MAX];
+	for(int i = 0; i < header.count; i++){
+		if(receive_batch_get_entry(socket, &entry, name) != OK || batch_get_append(&list, name, entry.version) < 0){
+			batch_get_free(&list);
+			socketDesynced = 1;
+			return VERSION_ERROR;
+		}
+	}
+
+	//2. Resolver los hashes con el indice (o una sola lectura del .db), sin
+	//   mantener el mutex mientras se envian los archivos
+	batch_get_resolve(&list, idCliente, header.count == 0);
+
+	//3. Enviar un flujo continuo. Mientras se envia una ventana de archivos la
+	//   siguiente se abre y se lee por adelantado en subtareas del pool,
+	//   que otros trabajadores desocupados pueden robar
+	struct thread_pool_group windows[2];
+	thread_pool_group_init(&windows[0]);
+	thread_pool_group_init(&windows[1]);
+	batch_get_prefetch(&list, 0, &windows[0]);
+
+	return_code result = VERSION_ADDED;
+	status_operation_socket status = OK;
+	int local = socket_is_local(socket);
+	int sent = 0;
+	for(int start = 0; start < list.count; start += BATCH_READAHEAD){
+		int window = (start / BATCH_READAHEAD) % 2;
+		int end = start + BATCH_READAHEAD < list.count ? start + BATCH_READAHEAD : list.count;
+		thread_pool_wait(workerPool, &windows[window]);
+		batch_get_prefetch(&list, end, &windows[1 - window]);
+
+		for(int i = start; i < end; i++){
+			struct batch_get_item * item = &list.items[i];
+			struct batch_file_header fileHeader;
 			struct stat st;
-			if (stat(src_filename, &st) != 0) {
-				pthread_mutex_unlock(&mutexDB);
-				return VERSION_ERROR;
+
+			fileHeader.version = item->version;
+			fileHeader.fileSize = 0;
+			fileHeader.status = VERSION_NOT_EXISTS;
+			if(item->fd >= 0 && fstat(item->fd, &st) == 0){
+				fileHeader.fileSize = st.st_size;
+				fileHeader.status = VERSION_ADDED;
+			}
+
+			if(status == OK)
+				status = send_batch_file_header(socket, &fileHeader, item->filename);
+			if(status == OK && fileHeader.status == VERSION_ADDED){
+				status = pass_file_descriptor(local, fileHeader.fileSize) ? send_file_descriptor(socket, item->fd) : send_file_data(socket, item->fd, fileHeader.fileSize);
+				sent++;
 			}
+			//Tras un error se siguen cerrando los blobs ya abiertos
+			if(item->fd >= 0)
+				close(item->fd);
+			item->fd = -1;
+		}
+		if(status != OK){
+			thread_pool_wait(workerPool, &windows[1 - window]);
+			for(int i = end; i < end + BATCH_READAHEAD && i < list.count; i++)
+				if(list.items[i].fd >= 0)
+					close(list.items[i].fd);
+			break;
+		}
+	}
+	thread_pool_group_destroy(&windows[0]);
+	thread_pool_group_destroy(&windows[1]);
+	if(status != OK){
+		batch_get_free(&list);
+		socketDesynced = 1;
+		return VERSION_ERROR;
+	}
+
+	//4. Fin del flujo
+	struct batch_file_header end = {0};
+	if(send_batch_file_header(socket, &end, NULL) != OK){
+		socketDesynced = 1;
+		result = VERSION_ERROR;
+	}
+	else if(sent == 0)
+		result = VERSION_NOT_EXISTS;
 
-			file_transfer.filseSize = st.st_size;
-			
-			if( send_file_transfer(socket, &file_transfer) != OK){
-				pthread_mutex_unlock(&mutexDB);
-				return VERSION_ERROR;
-			}			
+	batch_get_free(&list);
+	return result;
+}
+
+static void batch_get_readahead(void * arg) {
+	struct batch_get_item * item = (struct batch_get_item *)arg;
+	item->fd = item->found ? open_blob_readahead(item->hash) : -1;
+}
+
+static void batch_get_prefetch(struct batch_get_list * list, int start, struct thread_pool_group * group) {
+	for(int i = start; i < start + BATCH_READAHEAD && i < list->count; i++)
+		thread_pool_spawn(workerPool, group, batch_get_readahead, &list->items[i]);
+}
+
+static double elapsed_ms(struct timespec * start) {
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000.0 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+static int open_blob_readahead(const char * hash) {
+	char blob[PATH_MAX];
+	snprintf(blob, PATH_MAX, "%s/%s", VERSIONS_DIR, hash);
+	int fd = open(blob, O_RDONLY);
+	if(fd >= 0)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	return fd;
+}
+
+static unsigned long name_key(const char * filename) {
+	unsigned long key = 14695981039346656037UL;
+	for(const char * c = filename; *c; c++)
+		key = (key ^ (unsigned char)*c) * 1099511628211UL;
+	return key;
+}
+
+static int batch_get_find(struct batch_get_list * list, const char * filename) {
+	if(list->tableSize == 0)
+		return -1;
+	size_t pos = name_key(filename) & (list->tableSize - 1);
+	while(list->table[pos] != 0){
+		if(EQUALS(list->items[list->table[pos] - 1].filename, filename))
+			return list->table[pos] - 1;
+		pos = (pos + 1) & (list->tableSize - 1);
+	}
+	return -1;
+}
+
+static int batch_get_append(struct batch_get_list * list, const char * filename, int version) {
+	//Crecer la tabla para mantenerla a lo sumo medio llena
+	if((size_t)(list->count + 1) * 2 > list->tableSize){
+		size_t size = list->tableSize ? list->tableSize * 2 : 64;
+		int * table = calloc(size, sizeof(int));
+		if(table == NULL)
+			return -1;
+		for(int i = 0; i < list->count; i++){
+			if(list->items[i].seen < 0)
+				continue;
+			size_t pos = name_key(list->items[i].filename) & (size - 1);
+			while(table[pos] != 0)
+				pos = (pos + 1) & (size - 1);
+			table[pos] = i + 1;
+		}
+		free(list->table);
+		list->table = table;
+		list->tableSize = size;
+	}
+	if(list->count == list->capacity){
+		int capacity = list->capacity ? list->capacity * 2 : 64;
+		struct batch_get_item * items = realloc(list->items, capacity * sizeof(struct batch_get_item));
+		if(items == NULL)
+			return -1;
+		list->items = items;
+		list->capacity = capacity;
+	}
+
+	int index = list->count;
+	struct batch_get_item * item = &list->items[index];
+	item->filename = strdup(filename);
+	if(item->filename == NULL)
+		return -1;
+	item->version = version;
+	item->seen = 0;
+	item->found = 0;
+	item->next = -1;
+	list->count++;
+
+	//Los items con el mismo nombre se encadenan al primero, que es el unico en la tabla
+	int first = batch_get_find(list, filename);
+	if(first >= 0 && first != index){
+		item->seen = -1;
+		item->next = list->items[first].next;
+		list->items[first].next = index;
+		return index;
+	}
+	size_t pos = name_key(filename) & (list->tableSize - 1);
+	while(list->table[pos] != 0)
+		pos = (pos + 1) & (list->tableSize - 1);
+	list->table[pos] = index + 1;
+	return index;
+}
+
+static void batch_get_free(struct batch_get_list * list) {
+	for(int i = 0; i < list->count; i++)
+		free(list->items[i].filename);
+	free(list->items);
+	free(list->table);
+}
 
-			if( retrieve_file(r.hash, socket, st.st_size) != OK){
-				pthread_mutex_unlock(&mutexDB);
-				return VERSION_ERROR;
+static void batch_get_resolve(struct batch_get_list * list, int idCliente, int all) {
+	version_index_read_lock(versionIndex);
+	//Con el indice completo se busca cada nombre pedido una vez, con todos los
+	//items encadenados a el. get-all no conoce los nombres: recorre el .db
+	if(!all && version_index_complete(versionIndex)){
+		for(int first = 0; first < list->count; first++){
+			if(list->items[first].seen < 0)
+				continue;
+			int count = 0;
+			file_version * versions = find_file_versions(list->items[first].filename, idCliente, &count);
+			for(int i = first; i >= 0; i = list->items[i].next){
+				int version = list->items[i].version;
+				if(version >= 1 && version <= count){
+					strncpy(list->items[i].hash, versions[version - 1].hash, HASH_SIZE);
+					list->items[i].found = 1;
+				}
 			}
+			free(versions);
+		}
+		version_index_unlock(versionIndex);
+		return;
+	}
 
-			fclose(fp);
-			pthread_mutex_unlock(&mutexDB);
-			return VERSION_ADDED;	
+	FILE * fp = fopen(VERSIONS_DB_PATH, "rb");
+	if(fp == NULL){
+		version_index_unlock(versionIndex);
+		return;
+	}
+
+	file_version r;
+	while(fread(&r, sizeof(file_version), 1, fp) == 1){
+		if(r.idCliente != idCliente)
+			continue;
+		int first = batch_get_find(list, r.filename);
+		if(first < 0 && all)
+			first = batch_get_append(list, r.filename, 0);
+		if(first < 0)
+			continue;
+
+		//La version de un registro es su posicion entre los del mismo archivo
+		int version = ++list->items[first].seen;
+		if(all){
+			strncpy(list->items[first].hash, r.hash, HASH_SIZE);
+			list->items[first].version = version;
+			list->items[first].found = 1;
+			continue;
+		}
+		for(int i = first; i >= 0; i = list->items[i].next){
+			if(list->items[i].version == version){
+				strncpy(list->items[i].hash, r.hash, HASH_SIZE);
+				list->items[i].found = 1;
+			}
 		}
 	}
-	file_transfer.filseSize = 0;
-	send_file_transfer(socket, &file_transfer);
 	fclose(fp);
-	pthread_mutex_unlock(&mutexDB);
-	return VERSION_NOT_EXISTS;
+	version_index_unlock(versionIndex);
+}
+
+return_code add_delta(int socket, int idCliente) {
+	file_version v;
+
+	//1. Recibir nombre y hash, y responder si la version ya existe
+	struct file_request info_file;
+	if(receive_file_request(socket, &info_file) != OK){
+		socketDesynced = 1;
+		return VERSION_ERROR;
+	}
+	info_file.nameFile[PATH_MAX - 1] = '\0';
+	info_file.hashFile[HASH_SIZE - 1] = '\0';
+	create_version(info_file.nameFile, info_file.hashFile, idCliente, &v);
+
+	int existVersion = version_exists(info_file.nameFile, idCliente, v.hash);
+	if(existVersion)
+		return send_status_code(socket, VERSION_ALREADY_EXISTS) == OK ? VERSION_ALREADY_EXISTS : VERSION_ERROR;
 
+	//La reconstruccion escribe un archivo completo: usa un turno de subida como add
+	if(admission_enter(&uploads, idCliente, 1) != 0){
+		send_retry_after(socket, admission_retry_after(&uploads));
+		return VERSION_RETRY_LATER;
+	}
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	return_code result = VERSION_ERROR;
+	if(send_status_code(socket, VERSION_NOT_EXISTS) == OK)
+		result = add_delta_transfer(socket, &v, info_file.nameFile, idCliente);
+	else
+		socketDesynced = 1;
+	admission_exit(&uploads, idCliente, elapsed_ms(&start));
+	return result;
 }
 
-status_operation_socket store_file(char * file, char * hash, int socket, int sizeFile) {
+static return_code add_delta_transfer(int socket, file_version * v, char * nameFile, int idCliente) {
+	//2. Recibir el tamanio y comentario, y enviar las firmas de la ultima version
+	struct file_transfer info_file_transfer;
+	if(receive_file_transfer(socket, &info_file_transfer) != OK){
+		socketDesynced = 1;
+		return VERSION_ERROR;
+	}
+	strncpy(v->comment, info_file_transfer.comment, sizeof(v->comment) - 1);
+	v->comment[sizeof(v->comment) - 1] = '\0';
+
+	char baseHash[HASH_SIZE];
+	int hasBase = last_version_hash(nameFile, idCliente, baseHash);
+	struct delta_signature_header header;
+	if(send_base_signatures(socket, hasBase ? baseHash : NULL, info_file_transfer.filseSize, &header) != OK){
+		socketDesynced = 1;
+		return VERSION_ERROR;
+	}
+
+	//3. Reconstruir la nueva version en un archivo temporal
+	char base_filename[PATH_MAX];
+	char tmp_filename[PATH_MAX];
+	snprintf(base_filename, PATH_MAX, "%s/%s", VERSIONS_DIR, baseHash);
+	snprintf(tmp_filename, PATH_MAX, "%s/.delta-XXXXXX", VERSIONS_DIR);
+	int base = header.blockCount > 0 ? open(base_filename, O_RDONLY) : -1;
+	int file = mkstemp(tmp_filename);
+	//El cliente ya esta enviando las instrucciones: no se leen, se responde
+	//el error y se cierra la conexion
+	if(file < 0 || (header.blockCount > 0 && base < 0)){
+		if(file >= 0){
+			close(file);
+			unlink(tmp_filename);
+		}
+		if(base >= 0)
+			close(base);
+		send_status_code(socket, VERSION_ERROR);
+		socketDesynced = 1;
+		return VERSION_ERROR;
+	}
+
+	char hex[65];
+	status_operation_socket status = receive_delta(socket, base, &header, file, info_file_transfer.filseSize, hex);
+	if(base >= 0)
+		close(base);
+	close(file);
+
+	//4. Guardar la version solo si el contenido coincide con el hash anunciado
 	char dst_filename[PATH_MAX];
-	snprintf(dst_filename, PATH_MAX, "%s/%s", VERSIONS_DIR, hash);
-	return receive_file(socket, dst_filename);
+	snprintf(dst_filename, PATH_MAX, "%s/%s", VERSIONS_DIR, hex);
+	//El cliente siempre espera un estado; si receive_delta corto el flujo
+	//ademas marco socketDesynced para cerrar la conexion
+	if(status != OK || !EQUALS(hex, v->hash) || rename(tmp_filename, dst_filename) != 0){
+		unlink(tmp_filename);
+		send_status_code(socket, VERSION_ERROR);
+		return VERSION_ERROR;
+	}
+
+	if(add_new_version(v) != 1){
+		send_status_code(socket, VERSION_ERROR);
+		return VERSION_ERROR;
+	}
+	send_status_code(socket, VERSION_ADDED);
+	return VERSION_ADDED;
 }
 
-status_operation_socket retrieve_file(char * hash, int socket,int sizeFile) {
-	char src_filename[PATH_MAX];
-	snprintf(src_filename, PATH_MAX, "%s/%s", VERSIONS_DIR, hash);
-	return send_file(socket, src_filename);
+static int last_version_hash(char * filename, int idClient, char * hash) {
+	version_index_read_lock(versionIndex);
+	int count = 0;
+	file_version * versions = find_file_versions(filename, idClient, &count);
+	version_index_unlock(versionIndex);
+	if(count > 0)
+		strncpy(hash, versions[count - 1].hash, HASH_SIZE);
+	free(versions);
+	return count > 0;
 }
 
+static status_operation_socket send_base_signatures(int socket, char * hash, size_t fileSize, struct delta_signature_header * header) {
+	header->blockSize = delta_block_size(fileSize);
+	header->blockCount = 0;
+
+	int fd = -1;
+	struct stat st;
+	if(hash != NULL){
+		char base_filename[PATH_MAX];
+		snprintf(base_filename, PATH_MAX, "%s/%s", VERSIONS_DIR, hash);
+		fd = open(base_filename, O_RDONLY);
+	}
+	//Sin version base (o si es demasiado grande) el cliente envia todo como contenido nuevo
+	if(fd < 0 || fstat(fd, &st) != 0 || (st.st_size + header->blockSize - 1) / header->blockSize > MAX_DELTA_BLOCKS){
+		if(fd >= 0)
+			close(fd);
+		return count_signatures_sent(send_delta_signatures(socket, header, NULL), header);
+	}
+
+	int count = (st.st_size + header->blockSize - 1) / header->blockSize;
+	struct block_signature * signatures = malloc((count > 0 ? count : 1) * sizeof(struct block_signature));
+	uint8_t * block = malloc(header->blockSize);
+	if(signatures == NULL || block == NULL){
+		free(signatures);
+		free(block);
+		close(fd);
+		return ERROR;
+	}
+
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	for(int i = 0; i < count; i++){
+		size_t size = 0;
+		ssize_t n = 1;
+		while(size < header->blockSize && (n = read(fd, block + size, header->blockSize - size)) > 0)
+			size += n;
+		if(n < 0 || size == 0)
+			break;
+		delta_block_signature(block, size, &signatures[i]);
+		header->blockCount++;
+	}
+	close(fd);
+	free(block);
+
+	status_operation_socket status = count_signatures_sent(send_delta_signatures(socket, header, signatures), header);
+	free(signatures);
+	return status;
+}
+
+static status_operation_socket count_signatures_sent(status_operation_socket status, struct delta_signature_header * header) {
+	if(status == OK){
+		size_t bytes = sizeof(struct delta_signature_header) + (size_t)header->blockCount * sizeof(struct block_signature);
+		threadTransferBytes += bytes;
+		threadSentBytes += bytes;
+	}
+	return status;
+}
+
+static status_operation_socket receive_delta(int socket, int base, struct delta_signature_header * header, int file, size_t fileSize, char * hex) {
+	char buffer[64 * 1024];
+	struct sha256_buff sha;
+	struct delta_op op;
+	size_t total = 0;
+	status_operation_socket status;
+
+	sha256_init(&sha);
+	while((status = receive_delta_op(socket, &op)) == OK && op.type != DELTA_END){
+		status = INVALID_RESPONSE;
+		if(op.length > fileSize - total)
+			goto broken;
+
+		off_t offset = (off_t)op.block * header->blockSize;
+		if(op.type == DELTA_COPY && (op.block < 0 || op.block >= header->blockCount))
+			goto broken;
+
+		size_t done = 0;
+		while(done < op.length){
+			size_t size = op.length - done < sizeof(buffer) ? op.length - done : sizeof(buffer);
+			if(op.type == DELTA_COPY){
+				ssize_t n = pread(base, buffer, size, offset + done);
+				if(n <= 0)
+					goto broken;
+				size = n;
+			}else if((status = receive_all(socket, buffer, size)) != OK){
+				goto broken;
+			}else{
+				//Solo el contenido nuevo viaja por el socket: es lo que cuenta en las estadisticas
+				threadTransferBytes += size;
+			}
+			sha256_update(&sha, buffer, size);
+			if(write(file, buffer, size) != (ssize_t)size){
+				status = ERROR;
+				goto broken;
+			}
+			done += size;
+		}
+		total += op.length;
+	}
+	if(status != OK)
+		goto broken;
+	if(total != fileSize)
+		return INVALID_RESPONSE;
+
+	sha256_finalize(&sha);
+	sha256_read_hex(&sha, hex);
+	hex[64] = '\0';
+	return OK;
+
+broken:
+	//Se dejo de leer antes de DELTA_END: el resto de las instrucciones queda en el socket
+	socketDesynced = 1;
+	return status;
+}
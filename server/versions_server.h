@@ -18,15 +18,29 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/file.h>
+#include <errno.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "../common/sha256.h"
 #include "../common/protocol.h"
+#include "../common/delta.h"
+#include "../common/trace.h"
+#include "thread_pool.h"
+#include "admission.h"
+#include "log.h"
+#include "version_index.h"
+#include "lock_profile.h"
 
 #define VERSIONS_DB "versions.db" /**< Nombre de la base de datos de versiones. */
 #define VERSIONS_DIR ".versions" /**< Directorio del repositorio. */
 #define VERSIONS_DB_PATH VERSIONS_DIR "/" VERSIONS_DB /**< Ruta completa de la base de datos.*/
+#define BATCH_READAHEAD 8 /**< Archivos por ventana de lectura adelantada en un get por lotes. */
+#define WRITER_MESSAGE_RECORDS 16 /**< Registros por mensaje al proceso escritor (cabe en un SOCK_SEQPACKET). */
+#define INDEX_READ_RECORDS 256 /**< Registros por lectura al cargar el indice. */
+#define BLOB_NAME_SIZE 64 /**< Largo del nombre de un blob: el sha256 de su contenido en hexadecimal. */
 
 #define EQUALS(s1, s2) (strcmp(s1, s2) == 0) /**< Verdadero si dos cadenas son iguales.*/
 
@@ -44,7 +58,9 @@ typedef  struct __attribute__((aligned(512))) {
 	int  idCliente; 			/**< id del cliente que subio la version */
 }file_version;
 
-extern pthread_mutex_t mutexDB; /**< Mutex para proteger el acceso a la base de datos. */
+extern struct version_index *versionIndex; /**< Indice de la base de datos; su candado protege el acceso a ella. */
+extern struct thread_pool *workerPool; /**< Pool de trabajadores donde se crean las subtareas, NULL si no hay. */
+extern struct admission uploads; /**< Control de admision de las subidas de archivos. */
 
 /**
  * @brief Adiciona un archivo al repositorio.
@@ -71,4 +87,95 @@ return_code list(int socket, int idCliente);
  */
 return_code get(int socket, int idCLiente);
 
+/**
+ * @brief Adiciona varios archivos al repositorio en una sola solicitud.
+ * Recibe el manifiesto (nombre, hash, tamanio, comentario), responde una sola vez
+ * con los indices de los archivos cuyo contenido necesita, recibe esos contenidos
+ * uno tras otro y registra todas las versiones nuevas en una sola escritura.
+ * @param socket socket ha comunicar
+ * @param idCliente id del cliente
+ * @return Resultado de la operacion VERSION_ERROR,VERSION_ADDED,VERSION_ALREADY_EXISTS.
+ */
+return_code add_batch(int socket, int idCliente);
+
+/**
+ * @brief Envia varias versiones en un solo flujo continuo.
+ * Recibe una lista de pares (version, archivo), o una lista vacia para pedir la
+ * ultima version de todos los archivos del cliente, y responde cada archivo con
+ * su encabezado y contenido, leyendo por adelantado los siguientes del repositorio.
+ * @param socket socket ha comunicar
+ * @param idCliente id del cliente
+ * @return Resultado de la operacion VERSION_ERROR,VERSION_ADDED,VERSION_NOT_EXISTS.
+ */
+return_code get_batch(int socket, int idCliente);
+
+/**
+ * @brief Adiciona un archivo recibiendo solo sus cambios respecto a la ultima version.
+ * Envia las firmas de los bloques de la ultima version del archivo, reconstruye la
+ * nueva version con las instrucciones de copia y el contenido nuevo que envia el
+ * cliente y la guarda solo si su SHA-256 coincide con el hash anunciado.
+ * @param socket socket ha comunicar
+ * @param idCliente id del cliente
+ * @return Resultado de la operacion VERSION_ERROR,VERSION_ADDED,VERSION_ALREADY_EXISTS.
+ */
+return_code add_delta(int socket, int idCliente);
+
+/**
+ * @brief Crea el indice de la base de datos y lo carga con los registros existentes.
+ * @param shared 1 para compartirlo con los procesos que se creen despues (modo multiproceso).
+ * @return 0 en caso de exito, -1 en caso de error.
+ */
+int versions_db_open(int shared);
+
+/**
+ * @brief Verifica si existe una version para un archivo (consulta el indice).
+ *
+ * @param filename Nombre del archivo
+ * @param hash Hash del contenido
+ * @param clientId id del cliente
+ * @return 1 si la version existe, 0 en caso contrario.
+ */
+int version_exists(char * filename, int clientId,char * hash);
+
+/**
+ * @brief Agrega al indice los registros que otro proceso agrego al .db (por
+ * ejemplo el proceso anterior a un reinicio mientras terminaba sus solicitudes).
+ * @return registros agregados, -1 en caso de error.
+ */
+int versions_db_sync(void);
+
+/**
+ * @brief Cuenta los blobs del repositorio y los bytes que ocupan (recorre el directorio).
+ * @param count donde dejar el numero de blobs
+ * @param bytes donde dejar la suma de sus tamanios
+ * @return 0 en caso de exito, -1 si no se pudo abrir el directorio.
+ */
+int blob_store_usage(unsigned long * count, unsigned long long * bytes);
+
+/**
+ * @brief Agrega versiones al .db y al indice con una sola escritura, en este proceso.
+ * Si la escritura falla se deshace, de modo que se registran todas o ninguna.
+ *
+ * @param versions Versiones a registrar.
+ * @param count Cantidad de versiones.
+ *
+ * @return 1 en caso de exito, 0 en caso de error.
+ */
+int versions_db_append(file_version * versions, int count);
+
+/**
+ * @brief Hace que las versiones nuevas de este proceso las registre el proceso escritor.
+ * @param socket socket (SOCK_SEQPACKET) conectado con el proceso escritor.
+ */
+void versions_db_set_writer(int socket);
+
+/**
+ * @brief Ciclo del proceso escritor: recibe versiones de los demas procesos,
+ * junta los lotes que estan completos en un mismo despertar, los registra con
+ * una sola llamada a versions_db_append y responde el resultado a cada uno. No retorna.
+ * @param sockets sockets conectados con cada proceso.
+ * @param count cantidad de sockets.
+ */
+void versions_db_serve(int * sockets, int count);
+
 #endif